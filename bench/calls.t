@@ -0,0 +1,166 @@
+// NOTE: every call doubles the work of the one below it, f22 makes 2^22 calls in total.
+// Exercises call overhead and integer arithmetic without depending on control flow
+
+f0 :: () -> i64
+{
+    return 1;
+}
+
+f1 :: () -> i64
+{
+    a : i64 = f0();
+    b : i64 = f0();
+    return a + b;
+}
+
+f2 :: () -> i64
+{
+    a : i64 = f1();
+    b : i64 = f1();
+    return a + b;
+}
+
+f3 :: () -> i64
+{
+    a : i64 = f2();
+    b : i64 = f2();
+    return a + b;
+}
+
+f4 :: () -> i64
+{
+    a : i64 = f3();
+    b : i64 = f3();
+    return a + b;
+}
+
+f5 :: () -> i64
+{
+    a : i64 = f4();
+    b : i64 = f4();
+    return a + b;
+}
+
+f6 :: () -> i64
+{
+    a : i64 = f5();
+    b : i64 = f5();
+    return a + b;
+}
+
+f7 :: () -> i64
+{
+    a : i64 = f6();
+    b : i64 = f6();
+    return a + b;
+}
+
+f8 :: () -> i64
+{
+    a : i64 = f7();
+    b : i64 = f7();
+    return a + b;
+}
+
+f9 :: () -> i64
+{
+    a : i64 = f8();
+    b : i64 = f8();
+    return a + b;
+}
+
+f10 :: () -> i64
+{
+    a : i64 = f9();
+    b : i64 = f9();
+    return a + b;
+}
+
+f11 :: () -> i64
+{
+    a : i64 = f10();
+    b : i64 = f10();
+    return a + b;
+}
+
+f12 :: () -> i64
+{
+    a : i64 = f11();
+    b : i64 = f11();
+    return a + b;
+}
+
+f13 :: () -> i64
+{
+    a : i64 = f12();
+    b : i64 = f12();
+    return a + b;
+}
+
+f14 :: () -> i64
+{
+    a : i64 = f13();
+    b : i64 = f13();
+    return a + b;
+}
+
+f15 :: () -> i64
+{
+    a : i64 = f14();
+    b : i64 = f14();
+    return a + b;
+}
+
+f16 :: () -> i64
+{
+    a : i64 = f15();
+    b : i64 = f15();
+    return a + b;
+}
+
+f17 :: () -> i64
+{
+    a : i64 = f16();
+    b : i64 = f16();
+    return a + b;
+}
+
+f18 :: () -> i64
+{
+    a : i64 = f17();
+    b : i64 = f17();
+    return a + b;
+}
+
+f19 :: () -> i64
+{
+    a : i64 = f18();
+    b : i64 = f18();
+    return a + b;
+}
+
+f20 :: () -> i64
+{
+    a : i64 = f19();
+    b : i64 = f19();
+    return a + b;
+}
+
+f21 :: () -> i64
+{
+    a : i64 = f20();
+    b : i64 = f20();
+    return a + b;
+}
+
+f22 :: () -> i64
+{
+    a : i64 = f21();
+    b : i64 = f21();
+    return a + b;
+}
+
+main :: () -> i64
+{
+    return f22() / 4194304;
+}
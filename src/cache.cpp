@@ -0,0 +1,379 @@
+#include "cache.h"
+#include "core.h"
+#include "file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <link.h>
+#include <unistd.h>
+#endif
+
+// NOTE(jesper): bump CACHE_ENTRY_VERSION whenever the layout of the entry files changes
+constexpr u32 CACHE_ENTRY_MAGIC   = 0x63726974; // "tirc"
+constexpr u32 CACHE_ENTRY_VERSION = 2;
+
+#define CACHE_ENTRY_EXT ".tirc"
+#define CACHE_STATS_LOCK_TIMEOUT_NS 1000000000ull
+
+struct CacheEntryHeader {
+    u32 magic;
+    u32 version;
+
+    i32 has_main;
+    i32 main_prim;
+    i32 main_size;
+    i32 uses_runtime;
+
+    i32 object_count;
+    // i32 object_sizes[object_count]
+    // u8 object_data[]
+};
+
+String default_cache_dir(Allocator mem)
+{
+    if (char *dir = getenv("TIR_CACHE_DIR"); dir && dir[0]) return string(dir, mem);
+
+#if defined(_WIN32)
+    if (char *dir = getenv("LOCALAPPDATA"); dir && dir[0]) return stringf(mem, "%s\\tir\\cache", dir);
+#elif defined(__linux__)
+    if (char *dir = getenv("XDG_CACHE_HOME"); dir && dir[0]) return stringf(mem, "%s/tir", dir);
+    if (char *dir = getenv("HOME"); dir && dir[0]) return stringf(mem, "%s/.cache/tir", dir);
+#endif
+
+    return {};
+}
+
+bool init_object_cache(ObjectCache *cache, String dir, u64 max_size)
+{
+    if (!dir.length) return false;
+    if (!create_directory(dir)) return false;
+
+    cache->dir = dir;
+    cache->max_size = max_size;
+    return true;
+}
+
+void cache_key_begin(llvm_blake3_hasher *hasher)
+{
+    llvm_blake3_hasher_init(hasher);
+}
+
+void cache_key_add(llvm_blake3_hasher *hasher, String data)
+{
+    // NOTE(jesper): the length is hashed along with the data so that the boundaries between
+    // the key's parts are unambiguous
+    i32 length = data.length;
+    llvm_blake3_hasher_update(hasher, &length, sizeof length);
+    llvm_blake3_hasher_update(hasher, data.data, data.length);
+}
+
+#if defined(__linux__)
+static i32 module_identity_callback(dl_phdr_info *info, size_t /*size*/, void *user_data)
+{
+    auto *hasher = (llvm_blake3_hasher*)user_data;
+
+    // NOTE(jesper): the vdso is provided by the kernel and doesn't have a file
+    if (info->dlpi_name && strstr(info->dlpi_name, "linux-vdso")) return 0;
+
+    for (i32 i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_NOTE) continue;
+
+        char *note = (char*)(info->dlpi_addr + phdr->p_vaddr);
+        char *end = note + phdr->p_memsz;
+        while (note + sizeof(ElfW(Nhdr)) <= end) {
+            auto *nhdr = (ElfW(Nhdr)*)note;
+            char *name = note + sizeof *nhdr;
+            char *desc = name + ((nhdr->n_namesz + 3) & ~3u);
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+                cache_key_add(hasher, String{ desc, (i32)nhdr->n_descsz });
+                return 0;
+            }
+
+            note = desc + ((nhdr->n_descsz + 3) & ~3u);
+        }
+    }
+
+    // NOTE(jesper): without a build-id the module is identified by its contents. The main
+    // executable doesn't have a name here, but it's always /proc/self/exe
+    SArena scratch = tl_scratch_arena();
+    char *path = info->dlpi_name && info->dlpi_name[0] ? (char*)info->dlpi_name : (char*)"/proc/self/exe";
+    FileInfo f = read_file(string(path), scratch);
+    cache_key_add(hasher, String{ (char*)f.data, f.size });
+    return 0;
+}
+#endif
+
+// NOTE(jesper): adds the code tir is running to the key: the build-ids, or the contents when they
+// don't have one, of its executable and every library loaded with it, which includes LLVM's
+void cache_key_add_compiler(llvm_blake3_hasher *hasher)
+{
+#if defined(_WIN32)
+    // TODO(jesper): enumerate the loaded modules. LLVM-C is the only library tir loads code
+    // from that isn't part of the system, so that's all that's identified besides the executable
+    HMODULE modules[] = { nullptr, GetModuleHandleA("LLVM-C.dll") };
+    for (HMODULE module : modules) {
+        char path[1024];
+        DWORD length = GetModuleFileNameA(module, path, sizeof path);
+        if (length == 0 || length == sizeof path) continue;
+
+        SArena scratch = tl_scratch_arena();
+        FileInfo f = read_file(String{ path, (i32)length }, scratch);
+        cache_key_add(hasher, String{ (char*)f.data, f.size });
+    }
+#elif defined(__linux__)
+    dl_iterate_phdr(module_identity_callback, hasher);
+#endif
+}
+
+CacheKey cache_key_end(llvm_blake3_hasher *hasher)
+{
+    CacheKey key;
+    llvm_blake3_hasher_finalize(hasher, key.hash, sizeof key.hash);
+    return key;
+}
+
+static String cache_entry_path(ObjectCache *cache, CacheKey key, Allocator mem)
+{
+    char hex[2*sizeof key.hash + 1];
+    for (i32 i = 0; i < (i32)sizeof key.hash; i++) snprintf(&hex[2*i], 3, "%02x", key.hash[i]);
+    return stringf(mem, "%.*s/%s%s", STRFMT(cache->dir), hex, CACHE_ENTRY_EXT);
+}
+
+static String cache_stats_path(ObjectCache *cache, Allocator mem)
+{
+    return stringf(mem, "%.*s/stats", STRFMT(cache->dir));
+}
+
+CacheStats read_cache_stats(ObjectCache *cache)
+{
+    SArena scratch = tl_scratch_arena();
+
+    CacheStats stats{};
+
+    String path = cache_stats_path(cache, scratch);
+    if (!file_exists(path)) return stats;
+
+    FileInfo f = read_file(path, scratch);
+    if (f.data && f.size == sizeof stats) memcpy(&stats, f.data, sizeof stats);
+    return stats;
+}
+
+static void update_cache_stats(ObjectCache *cache, u64 hits, u64 misses, u64 evictions)
+{
+    SArena scratch = tl_scratch_arena();
+
+    // NOTE(jesper): the read-modify-write is serialised between concurrent tir processes by
+    // exclusively creating a lock file, and the updated counts are written to a temporary file and
+    // renamed into place so that a reader never observes a partially written file. A lock that's
+    // still held after the timeout is assumed to belong to a process that died while holding it
+    String path = cache_stats_path(cache, scratch);
+    String lock_path = stringf(scratch, "%.*s.lock", STRFMT(path));
+    String tmp_path = stringf(scratch, "%.*s.%llx.tmp", STRFMT(path), (unsigned long long)wall_timestamp());
+    char *sz_lock_path = sz_string(lock_path, scratch);
+
+    FILE *lock = nullptr;
+    u64 deadline = wall_timestamp() + CACHE_STATS_LOCK_TIMEOUT_NS;
+    while (!(lock = fopen(sz_lock_path, "wx")) && wall_timestamp() < deadline) {
+#if defined(_WIN32)
+        Sleep(1);
+#elif defined(__linux__)
+        usleep(1000);
+#endif
+    }
+
+    if (!lock) {
+        remove_file(lock_path);
+        if (!(lock = fopen(sz_lock_path, "wx"))) {
+            LOG_ERROR("unable to lock the object cache stats file '%.*s'", STRFMT(path));
+            return;
+        }
+    }
+    fclose(lock);
+
+    CacheStats stats = read_cache_stats(cache);
+    stats.hits += hits;
+    stats.misses += misses;
+    stats.evictions += evictions;
+
+    write_file(tmp_path, &stats, sizeof stats);
+    if (rename(sz_string(tmp_path, scratch), sz_string(path, scratch)) != 0) {
+        // NOTE(jesper): rename doesn't replace an existing file on windows, the lock still keeps
+        // the counts consistent when they're written in place
+        remove_file(tmp_path);
+        write_file(path, &stats, sizeof stats);
+    }
+
+    remove_file(lock_path);
+}
+
+static bool parse_cache_entry(FileInfo f, CacheEntry *entry)
+{
+    CacheEntryHeader header;
+    if (f.size < (i32)sizeof header) return false;
+    memcpy(&header, f.data, sizeof header);
+
+    if (header.magic != CACHE_ENTRY_MAGIC ||
+        header.version != CACHE_ENTRY_VERSION ||
+        header.object_count <= 0)
+    {
+        return false;
+    }
+
+    i32 offset = sizeof header + header.object_count*sizeof(i32);
+    if (offset > f.size) return false;
+
+    i32 *sizes = (i32*)(f.data + sizeof header);
+    for (i32 i = 0; i < header.object_count; i++) {
+        if (sizes[i] < 0 || sizes[i] > f.size - offset) return false;
+
+        array_add(&entry->objects, String{ (char*)f.data + offset, sizes[i] });
+        offset += sizes[i];
+    }
+
+    entry->has_main = header.has_main;
+    entry->main_prim = header.main_prim;
+    entry->main_size = header.main_size;
+    entry->uses_runtime = header.uses_runtime;
+    return true;
+}
+
+bool cache_lookup(ObjectCache *cache, CacheKey key, CacheEntry *entry, Allocator mem)
+{
+    SArena scratch = tl_scratch_arena(mem);
+
+    String path = cache_entry_path(cache, key, scratch);
+    if (!file_exists(path)) {
+        update_cache_stats(cache, 0, 1, 0);
+        return false;
+    }
+
+    FileInfo f = read_file(path, mem);
+    if (!f.data || !parse_cache_entry(f, entry)) {
+        LOG_ERROR("invalid cache entry '%.*s', removing", STRFMT(path));
+        entry->objects.count = 0;
+        remove_file(path);
+        update_cache_stats(cache, 0, 1, 0);
+        return false;
+    }
+
+    // NOTE(jesper): the modified timestamp of an entry doubles as its last use for the purpose
+    // of LRU eviction
+    touch_file(path);
+    update_cache_stats(cache, 1, 0, 0);
+    return true;
+}
+
+static u64 evict_cache_entries(ObjectCache *cache)
+{
+    SArena scratch = tl_scratch_arena();
+
+    DynamicArray<String> files = list_files(cache->dir, scratch);
+
+    DynamicArray<String> entries{ .alloc = scratch };
+    DynamicArray<u64> timestamps{ .alloc = scratch };
+    DynamicArray<u64> sizes{ .alloc = scratch };
+
+    u64 total_size = 0;
+    for (String file : files) {
+        if (!ends_with(file, CACHE_ENTRY_EXT)) continue;
+
+        array_add(&entries, file);
+        array_add(&timestamps, file_modified_timestamp(file));
+        array_add(&sizes, file_size(file));
+        total_size += sizes[sizes.count-1];
+    }
+
+    if (total_size <= cache->max_size) return 0;
+
+    // NOTE(jesper): least recently used first
+    quick_sort_asc(timestamps, entries, sizes);
+
+    u64 evicted = 0;
+    for (i32 i = 0; i < entries.count && total_size > cache->max_size; i++) {
+        remove_file(entries[i]);
+        total_size -= sizes[i];
+        evicted++;
+    }
+
+    return evicted;
+}
+
+void cache_store(ObjectCache *cache, CacheKey key, CacheEntry *entry)
+{
+    SArena scratch = tl_scratch_arena();
+
+    CacheEntryHeader header{
+        .magic = CACHE_ENTRY_MAGIC,
+        .version = CACHE_ENTRY_VERSION,
+        .has_main = entry->has_main,
+        .main_prim = entry->main_prim,
+        .main_size = entry->main_size,
+        .uses_runtime = entry->uses_runtime,
+        .object_count = entry->objects.count,
+    };
+
+    i32 size = sizeof header + entry->objects.count*sizeof(i32);
+    for (String obj : entry->objects) size += obj.length;
+
+    if ((u64)size > cache->max_size) return;
+
+    u8 *data = (u8*)ALLOC(*scratch, size);
+    u8 *ptr = data;
+
+    memcpy(ptr, &header, sizeof header);
+    ptr += sizeof header;
+
+    for (String obj : entry->objects) {
+        memcpy(ptr, &obj.length, sizeof(i32));
+        ptr += sizeof(i32);
+    }
+
+    for (String obj : entry->objects) {
+        memcpy(ptr, obj.data, obj.length);
+        ptr += obj.length;
+    }
+
+    // NOTE(jesper): written to a temporary file first and then renamed into place so that a
+    // concurrent tir process never observes a partially written entry
+    String path = cache_entry_path(cache, key, scratch);
+    String tmp_path = stringf(scratch, "%.*s.%llx.tmp", STRFMT(path), (unsigned long long)wall_timestamp());
+
+    write_file(tmp_path, data, size);
+    if (rename(sz_string(tmp_path, scratch), sz_string(path, scratch)) != 0) {
+        remove_file(tmp_path);
+        return;
+    }
+
+    u64 evicted = evict_cache_entries(cache);
+    if (evicted > 0) update_cache_stats(cache, 0, 0, evicted);
+}
+
+void print_cache_stats(ObjectCache *cache)
+{
+    SArena scratch = tl_scratch_arena();
+
+    CacheStats stats = read_cache_stats(cache);
+
+    i32 entries = 0;
+    u64 total_size = 0;
+    for (String file : list_files(cache->dir, scratch)) {
+        if (!ends_with(file, CACHE_ENTRY_EXT)) continue;
+        entries++;
+        total_size += file_size(file);
+    }
+
+    u64 lookups = stats.hits + stats.misses;
+    f32 hit_rate = lookups > 0 ? 100.0f * stats.hits / lookups : 0.0f;
+
+    printf("cache directory:  %.*s\n", STRFMT(cache->dir));
+    printf("cache size:       %.2f / %.2f MiB\n", (f64)total_size / MiB, (f64)cache->max_size / MiB);
+    printf("entries:          %d\n", entries);
+    printf("hits:             %llu\n", (unsigned long long)stats.hits);
+    printf("misses:           %llu\n", (unsigned long long)stats.misses);
+    printf("hit rate:         %.1f%%\n", hit_rate);
+    printf("evictions:        %llu\n", (unsigned long long)stats.evictions);
+}
@@ -0,0 +1,52 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "string.h"
+#include "array.h"
+
+#include <llvm-c/blake3.h>
+
+struct CacheKey {
+    u8 hash[LLVM_BLAKE3_OUT_LEN];
+};
+
+struct CacheStats {
+    u64 hits;
+    u64 misses;
+    u64 evictions;
+};
+
+struct CacheEntry {
+    // NOTE(jesper): whether the module has a main procedure, and its return type, so that
+    // run mode can call it without having the AST
+    i32 has_main;
+    i32 main_prim;
+    i32 main_size;
+
+    // NOTE(jesper): whether the objects call into the runtime library, which the executable has
+    // to be linked against
+    i32 uses_runtime;
+
+    DynamicArray<String> objects;
+};
+
+struct ObjectCache {
+    String dir;
+    u64 max_size;
+};
+
+String default_cache_dir(Allocator mem);
+bool init_object_cache(ObjectCache *cache, String dir, u64 max_size);
+
+void cache_key_begin(llvm_blake3_hasher *hasher);
+void cache_key_add(llvm_blake3_hasher *hasher, String data);
+void cache_key_add_compiler(llvm_blake3_hasher *hasher);
+CacheKey cache_key_end(llvm_blake3_hasher *hasher);
+
+bool cache_lookup(ObjectCache *cache, CacheKey key, CacheEntry *entry, Allocator mem);
+void cache_store(ObjectCache *cache, CacheKey key, CacheEntry *entry);
+
+CacheStats read_cache_stats(ObjectCache *cache);
+void print_cache_stats(ObjectCache *cache);
+
+#endif // CACHE_H
@@ -95,6 +95,42 @@ enum ElfSectionFlags {
     ELF_SHF_EXCLUDE          = 0x80000000,
 };
 
+enum ElfSectionIndex {
+    ELF_SHN_UNDEF  = 0x0000,
+    ELF_SHN_ABS    = 0xfff1,
+    ELF_SHN_COMMON = 0xfff2,
+};
+
+enum ElfSymbolBinding {
+    ELF_STB_LOCAL  = 0,
+    ELF_STB_GLOBAL = 1,
+    ELF_STB_WEAK   = 2,
+};
+
+enum ElfSymbolType {
+    ELF_STT_NOTYPE  = 0,
+    ELF_STT_OBJECT  = 1,
+    ELF_STT_FUNC    = 2,
+    ELF_STT_SECTION = 3,
+    ELF_STT_FILE    = 4,
+};
+
+enum ElfRelocationX64 {
+    ELF_R_X86_64_NONE          = 0,
+    ELF_R_X86_64_64            = 1,
+    ELF_R_X86_64_PC32          = 2,
+    ELF_R_X86_64_PLT32         = 4,
+    ELF_R_X86_64_GOTPCREL      = 9,
+    ELF_R_X86_64_32            = 10,
+    ELF_R_X86_64_32S           = 11,
+    ELF_R_X86_64_PC64          = 24,
+    ELF_R_X86_64_GOTPCRELX     = 41,
+    ELF_R_X86_64_REX_GOTPCRELX = 42,
+};
+
+// NOTE(jesper): section type of .eh_frame as emitted by LLVM for x86-64
+#define ELF_SHT_X86_64_UNWIND 0x70000001
+
 struct ElfHeader {
     u8  magic[4] = { 0x7f, 'E', 'L', 'F' };
     u8  bitness = ELF_64;
@@ -142,6 +178,29 @@ struct ElfSectionHeader {
     u64 entsize;
 };
 
+struct ElfSymbol {
+    u32 name;
+    u8  info;
+    u8  other;
+    u16 shndx;
+    u64 value;
+    u64 size;
+};
+
+inline u8 elf_symbol_binding(u8 info) { return info >> 4; }
+inline u8 elf_symbol_type(u8 info) { return info & 0xf; }
+inline u8 elf_symbol_info(u8 binding, u8 type) { return (binding << 4) | (type & 0xf); }
+
+struct ElfRela {
+    u64 offset;
+    u64 info;
+    i64 addend;
+};
+
+inline u32 elf_rela_symbol(u64 info) { return info >> 32; }
+inline u32 elf_rela_type(u64 info) { return info & 0xffffffff; }
+inline u64 elf_rela_info(u32 symbol, u32 type) { return ((u64)symbol << 32) | type; }
+
 struct Elf64 {
     ElfHeader header;
     ElfProgramHeader *program_headers;
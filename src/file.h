@@ -80,6 +80,7 @@ void write_file(String path, void *data, i32 bytes);
 void write_file(String path, StringBuilder *sb);
 
 bool is_directory(String path);
+bool create_directory(String path);
 bool file_exists_sz(const char *path);
 bool file_exists(String path);
 
@@ -90,6 +91,9 @@ String get_working_dir(Allocator mem);
 void set_working_dir(String path);
 
 u64 file_modified_timestamp(String path);
+u64 file_size(String path);
+void touch_file(String path);
+bool set_file_executable(String path);
 
 String select_folder_dialog(Allocator mem);
 
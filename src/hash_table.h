@@ -176,6 +176,35 @@ V* map_find_emplace(HashTable<K, V> *table, K key, V emp_value)
     return &table->slots[slot].value;
 }
 
+template<typename K, typename V>
+void map_clear(HashTable<K, V> *table)
+{
+    for (i32 i = 0; i < table->capacity; i++) table->slots[i].occupied = false;
+    table->count = 0;
+}
+
+template<typename K, typename V>
+void map_remove(HashTable<K, V> *table, K key)
+{
+    i32 i = find_slot(table, key);
+    if (i == -1 || !table->slots[i].occupied) return;
+
+    // NOTE(jesper): shift the rest of the probe sequence back into the hole instead of leaving
+    // a tombstone, so that find_slot can keep stopping at the first unoccupied slot
+    table->slots[i].occupied = false;
+    table->count--;
+
+    for (i32 j = (i+1) % table->capacity; table->slots[j].occupied; j = (j+1) % table->capacity) {
+        i32 k = hash32(table->slots[j].key) % table->capacity;
+        bool in_place = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+        if (in_place) continue;
+
+        table->slots[i] = table->slots[j];
+        table->slots[j].occupied = false;
+        i = j;
+    }
+}
+
 template<typename K, typename V>
 void map_destroy(HashTable<K, V> *table)
 {
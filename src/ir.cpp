@@ -0,0 +1,2401 @@
+#include "ir.h"
+#include "string.h"
+
+#include <stdio.h>
+
+// NOTE(jesper): a variable declared in the current scope, with the local it shadows, or
+// IR_NONE if it didn't shadow any
+struct IrScopedLocal {
+    String name;
+    i32 shadowed;
+};
+
+struct IrBuilder {
+    IrModule *module;
+    IrProc *proc;
+    i32 block;
+
+    HashTable<String, i32> locals;
+    DynamicArray<IrScopedLocal> scope;
+    i32 parallel_count;
+};
+
+static i32 ir_reg(IrProc *proc, TypeExpr type)
+{
+    return array_add(&proc->regs, type);
+}
+
+static i32 ir_emit(IrBuilder *b, IrInst inst)
+{
+    array_add(&b->proc->blocks[b->block].insts, inst);
+    return inst.dst;
+}
+
+static i32 ir_block(IrBuilder *b)
+{
+    return array_add(&b->proc->blocks, IrBlock{ .insts = { .alloc = b->module->mem } });
+}
+
+static bool ir_terminated(IrBuilder *b)
+{
+    DynamicArray<IrInst> &insts = b->proc->blocks[b->block].insts;
+    return insts.count > 0 && ir_is_terminator(insts[insts.count-1].op);
+}
+
+static void ir_jump(IrBuilder *b, i32 target)
+{
+    IrInst inst{ .op = IR_JUMP, .dst = IR_NONE, .a = IR_NONE, .b = IR_NONE };
+    inst.target = target;
+    ir_emit(b, inst);
+}
+
+static void ir_branch(IrBuilder *b, i32 cond, i32 target, i32 target_else)
+{
+    IrInst inst{ .op = IR_BRANCH, .dst = IR_NONE, .a = cond, .b = IR_NONE };
+    inst.target = target;
+    inst.target_else = target_else;
+    ir_emit(b, inst);
+}
+
+// NOTE(jesper): widens reg to size if it's a scalar integer, other types are returned as they are
+static i32 ir_extend(IrBuilder *b, i32 reg, i32 size)
+{
+    TypeExpr type = b->proc->regs[reg];
+    if ((type != T_SIGNED && type != T_UNSIGNED) || type.lanes > 0 || type.elems != 0 || type.pointers != 0)
+        return reg;
+
+    type.size = size;
+    return ir_emit(b, { .op = IR_EXTEND, .dst = ir_reg(b->proc, type), .a = reg, .b = IR_NONE });
+}
+
+static i32 ir_lower_expr(IrBuilder *b, AST *ast);
+static i32 ir_zero(IrBuilder *b, TypeExpr type);
+
+static bool ir_lower_call(IrBuilder *b, AST *ast, i32 *dst)
+{
+    SArena scratch = tl_scratch_arena(b->module->mem);
+
+    i32 *callee = map_find(&b->module->proc_indices, ast->proc_call.identifier.str);
+    if (!callee) {
+        TERROR(ast->proc_call.identifier, "unknown procedure '%.*s'", STRFMT(ast->proc_call.identifier.str));
+        return false;
+    }
+
+    // NOTE(jesper): the arguments are lowered before they're added to the argument list, so
+    // that the registers of calls nested in them don't end up interleaved with these
+    DynamicArray<i32> args{ .alloc = scratch };
+    for (AST *arg = ast->proc_call.args; arg; arg = arg->next) {
+        i32 reg = ir_lower_expr(b, arg);
+        if (reg == IR_NONE) return false;
+        array_add(&args, reg);
+    }
+
+    TypeExpr ret_type = b->module->procs[*callee].ret_type;
+    IrInst inst{
+        .op = IR_CALL,
+        .dst = ret_type == T_VOID ? IR_NONE : ir_reg(b->proc, ret_type),
+        .a = IR_NONE, .b = IR_NONE,
+    };
+    inst.proc = *callee;
+    inst.args = b->proc->args.count;
+    inst.arg_count = args.count;
+
+    array_add(&b->proc->args, args.data, args.count);
+    *dst = ir_emit(b, inst);
+    return true;
+}
+
+// NOTE(jesper): atomic stores and fences don't produce a value, dst is IR_NONE for them
+static bool ir_lower_atomic(IrBuilder *b, AST *ast, i32 *dst)
+{
+    i32 operands[3] = { IR_NONE, IR_NONE, IR_NONE };
+    i32 count = 0;
+    for (AST *arg = ast->atomic.args; arg; arg = arg->next) {
+        if ((operands[count++] = ir_lower_expr(b, arg)) == IR_NONE) return false;
+    }
+
+    IrInst inst{ .dst = IR_NONE, .a = operands[0], .b = operands[1] };
+    inst.desired = operands[2];
+    inst.atomic_op = ast->atomic.op;
+    inst.order = ast->atomic.order;
+
+    switch (ast->atomic.op) {
+    case ATOMIC_LOAD:  inst.op = IR_ATOMIC_LOAD; break;
+    case ATOMIC_STORE: inst.op = IR_ATOMIC_STORE; break;
+    case ATOMIC_CAS:   inst.op = IR_ATOMIC_CAS; break;
+    case ATOMIC_FENCE: inst.op = IR_FENCE; break;
+    default:           inst.op = IR_ATOMIC_RMW; break;
+    }
+
+    if (inst.op != IR_ATOMIC_STORE && inst.op != IR_FENCE) inst.dst = ir_reg(b->proc, ast->atomic.type);
+    *dst = ir_emit(b, inst);
+    return true;
+}
+
+static bool ir_lower_intrinsic(IrBuilder *b, AST *ast, i32 *dst)
+{
+    i32 operands[2] = { IR_NONE, IR_NONE };
+    i32 count = 0;
+    for (AST *arg = ast->intrinsic.args; arg; arg = arg->next) {
+        if ((operands[count++] = ir_lower_expr(b, arg)) == IR_NONE) return false;
+    }
+
+    IrInst inst{ .dst = IR_NONE, .a = operands[0], .b = operands[1] };
+    switch (ast->intrinsic.op) {
+    case INTRINSIC_LIKELY:   inst.op = IR_EXPECT; inst.ival = 1; break;
+    case INTRINSIC_UNLIKELY: inst.op = IR_EXPECT; inst.ival = 0; break;
+    case INTRINSIC_PREFETCH: inst.op = IR_PREFETCH; break;
+    case INTRINSIC_POPCOUNT: inst.op = IR_POPCOUNT; break;
+    case INTRINSIC_CLZ:      inst.op = IR_CLZ; break;
+    case INTRINSIC_CTZ:      inst.op = IR_CTZ; break;
+    case INTRINSIC_BSWAP:    inst.op = IR_BSWAP; break;
+    case INTRINSIC_ROTL:     inst.op = IR_ROTL; break;
+    case INTRINSIC_ROTR:     inst.op = IR_ROTR; break;
+    }
+
+    if (inst.op != IR_PREFETCH) inst.dst = ir_reg(b->proc, ast->intrinsic.type);
+    *dst = ir_emit(b, inst);
+    return true;
+}
+
+static bool ir_lower_index(IrBuilder *b, AST *ast, i32 *slice, i32 *index)
+{
+    *slice = ir_lower_expr(b, ast->index.expr);
+    *index = ir_lower_expr(b, ast->index.index);
+    if (*slice == IR_NONE || *index == IR_NONE) return false;
+
+    if (b->proc->regs[*index].size < 8) *index = ir_extend(b, *index, 8);
+
+    // NOTE(jesper): the count of what a pointer points to isn't known
+    if (b->module->bounds_checks && b->proc->regs[*slice].elems == TYPE_SLICE) {
+        ir_emit(b, { .op = IR_BOUNDS_CHECK, .dst = IR_NONE, .a = *index, .b = *slice });
+    }
+
+    return true;
+}
+
+static i32 ir_lower_expr(IrBuilder *b, AST *ast)
+{
+    IrProc *proc = b->proc;
+
+    switch (ast->type) {
+    case AST_LITERAL: {
+        IrInst inst{ .op = IR_CONST, .dst = ir_reg(proc, ast->literal.type), .a = IR_NONE, .b = IR_NONE };
+        switch (ast->literal.type.prim) {
+        case T_FLOAT: inst.fval = ast->literal.type.size == 8 ? ast->literal.dval : ast->literal.fval; break;
+        case T_BOOL:  inst.ival = ast->literal.bval; break;
+        default:      inst.ival = ast->literal.ival; break;
+        }
+
+        return ir_emit(b, inst);
+        }
+    case AST_VAR_LOAD: {
+        i32 *local = map_find(&b->locals, ast->var_load.identifier.str);
+        if (!local) {
+            TERROR(ast->var_load.identifier, "unknown variable");
+            return IR_NONE;
+        }
+
+        // NOTE(jesper): fixed arrays are never loaded as a whole, they're used through a slice
+        TypeExpr type = proc->locals[*local].type;
+        if (type.elems > 0) {
+            type.elems = TYPE_SLICE;
+            return ir_emit(b, { .op = IR_SLICE, .dst = ir_reg(proc, type), .a = IR_NONE, .b = IR_NONE, .local = *local });
+        }
+
+        return ir_emit(b, { .op = IR_LOAD, .dst = ir_reg(proc, type), .a = IR_NONE, .b = IR_NONE, .local = *local });
+        }
+    case AST_GLOBAL: {
+        TypeExpr type = ast->global.type;
+        type.elems = TYPE_SLICE;
+        return ir_emit(b, { .op = IR_GLOBAL, .dst = ir_reg(proc, type), .a = IR_NONE, .b = IR_NONE, .global = ast->global.index });
+        }
+    case AST_PROC_CALL: {
+        i32 dst;
+        if (!ir_lower_call(b, ast, &dst)) return IR_NONE;
+        return dst;
+        }
+    case AST_RUN:
+        // NOTE(jesper): #run directives are replaced by their results before the module is
+        // lowered, the only ones left are nested in a directive being evaluated
+        return ir_lower_expr(b, ast->run.expr);
+    case AST_BINARY_OP: {
+        i32 lhs = ir_lower_expr(b, ast->binary_op.lhs);
+        i32 rhs = ir_lower_expr(b, ast->binary_op.rhs);
+        if (lhs == IR_NONE || rhs == IR_NONE) return IR_NONE;
+
+        // NOTE(jesper): the sizecheck only lets the operands differ in size when one of them is
+        // an array count, the narrower one is widened to it
+        if (proc->regs[lhs].size < proc->regs[rhs].size) lhs = ir_extend(b, lhs, proc->regs[rhs].size);
+        if (proc->regs[rhs].size < proc->regs[lhs].size) rhs = ir_extend(b, rhs, proc->regs[lhs].size);
+
+        IrOp op;
+        switch (ast->binary_op.op.type) {
+        case '+': op = IR_ADD; break;
+        case '-': op = IR_SUB; break;
+        case '*': op = IR_MUL; break;
+        case '/': op = IR_DIV; break;
+        case '<': op = IR_LT; break;
+        case '>': op = IR_GT; break;
+        case TOKEN_LE: op = IR_LE; break;
+        case TOKEN_GE: op = IR_GE; break;
+        case TOKEN_EQ: op = IR_EQ; break;
+        case TOKEN_NE: op = IR_NE; break;
+        default:
+            TERROR(ast->binary_op.op, "invalid binary op '%.*s'", STRFMT(ast->binary_op.op.str));
+            return IR_NONE;
+        }
+
+        TypeExpr type = ir_is_comparison(op) ? TypeExpr{ T_BOOL, 1 } : proc->regs[lhs];
+        return ir_emit(b, { .op = op, .dst = ir_reg(proc, type), .a = lhs, .b = rhs });
+        }
+    case AST_VECTOR: {
+        SArena scratch = tl_scratch_arena(b->module->mem);
+
+        DynamicArray<i32> elems{ .alloc = scratch };
+        for (AST *elem = ast->vector.elems; elem; elem = elem->next) {
+            i32 reg = ir_lower_expr(b, elem);
+            if (reg == IR_NONE) return IR_NONE;
+            array_add(&elems, reg);
+        }
+
+        IrInst inst{ .op = IR_VECTOR, .dst = ir_reg(proc, ast->vector.type), .a = IR_NONE, .b = IR_NONE };
+        inst.args = proc->args.count;
+        inst.arg_count = elems.count;
+
+        array_add(&proc->args, elems.data, elems.count);
+        return ir_emit(b, inst);
+        }
+    case AST_SWIZZLE: {
+        i32 src = ir_lower_expr(b, ast->swizzle.expr);
+        if (src == IR_NONE) return IR_NONE;
+
+        IrInst inst{ .dst = ir_reg(proc, ast->swizzle.type), .a = src, .b = IR_NONE };
+        if (ast->swizzle.count == 1) {
+            inst.op = IR_EXTRACT;
+            inst.lane = ast->swizzle.lanes[0];
+        } else {
+            inst.op = IR_SHUFFLE;
+            for (i32 i = 0; i < ast->swizzle.count; i++) inst.mask[i] = ast->swizzle.lanes[i];
+        }
+
+        return ir_emit(b, inst);
+        }
+    case AST_REDUCE: {
+        i32 src = ir_lower_expr(b, ast->reduce.expr);
+        if (src == IR_NONE) return IR_NONE;
+
+        IrOp op;
+        switch (ast->reduce.op) {
+        case REDUCE_ADD: op = IR_REDUCE_ADD; break;
+        case REDUCE_MUL: op = IR_REDUCE_MUL; break;
+        case REDUCE_MIN: op = IR_REDUCE_MIN; break;
+        case REDUCE_MAX: op = IR_REDUCE_MAX; break;
+        }
+
+        return ir_emit(b, { .op = op, .dst = ir_reg(proc, ast->reduce.type), .a = src, .b = IR_NONE });
+        }
+    case AST_INDEX: {
+        i32 slice, index;
+        if (!ir_lower_index(b, ast, &slice, &index)) return IR_NONE;
+
+        IrInst inst{ .op = IR_INDEX, .dst = ir_reg(proc, ast->index.type), .a = slice, .b = index };
+        inst.field = IR_NONE;
+        return ir_emit(b, inst);
+        }
+    case AST_FIELD: {
+        // NOTE(jesper): only the field is loaded from array elements
+        if (AST *expr = ast->field.expr; expr->type == AST_INDEX) {
+            i32 slice, index;
+            if (!ir_lower_index(b, expr, &slice, &index)) return IR_NONE;
+
+            IrInst inst{ .op = IR_INDEX, .dst = ir_reg(proc, ast->field.type), .a = slice, .b = index };
+            inst.field = ast->field.index;
+            return ir_emit(b, inst);
+        }
+
+        i32 src = ir_lower_expr(b, ast->field.expr);
+        if (src == IR_NONE) return IR_NONE;
+
+        IrInst inst{ .op = IR_FIELD, .dst = ir_reg(proc, ast->field.type), .a = src, .b = IR_NONE };
+        inst.field = ast->field.index;
+        return ir_emit(b, inst);
+        }
+    case AST_COUNT: {
+        // NOTE(jesper): the count of a fixed array is known up front
+        if (AST *expr = ast->count.expr; expr->type == AST_GLOBAL) {
+            IrInst inst{ .op = IR_CONST, .dst = ir_reg(proc, { T_SIGNED, 8 }), .a = IR_NONE, .b = IR_NONE };
+            inst.ival = expr->global.type.elems;
+            return ir_emit(b, inst);
+        }
+
+        if (AST *expr = ast->count.expr; expr->type == AST_VAR_LOAD) {
+            i32 *local = map_find(&b->locals, expr->var_load.identifier.str);
+            if (local && proc->locals[*local].type.elems > 0) {
+                IrInst inst{ .op = IR_CONST, .dst = ir_reg(proc, { T_SIGNED, 8 }), .a = IR_NONE, .b = IR_NONE };
+                inst.ival = proc->locals[*local].type.elems;
+                return ir_emit(b, inst);
+            }
+        }
+
+        i32 slice = ir_lower_expr(b, ast->count.expr);
+        if (slice == IR_NONE) return IR_NONE;
+        return ir_emit(b, { .op = IR_COUNT, .dst = ir_reg(proc, { T_SIGNED, 8 }), .a = slice, .b = IR_NONE });
+        }
+    case AST_ADDRESS_OF: {
+        AST *expr = ast->unary.expr;
+        if (expr->type == AST_FIELD && expr->field.expr->type == AST_INDEX) {
+            i32 slice, index;
+            if (!ir_lower_index(b, expr->field.expr, &slice, &index)) return IR_NONE;
+
+            IrInst inst{ .op = IR_INDEX_ADDR, .dst = ir_reg(proc, ast->unary.type), .a = slice, .b = index };
+            inst.field = expr->field.index;
+            return ir_emit(b, inst);
+        }
+
+        // NOTE(jesper): fields of struct variables are addressed as the only element of a pointer
+        // to the variable.
+        // TODO(jesper): stores to fields of the variable itself still replace the whole struct,
+        // so the fields of one that's shared with other threads have to be stored through the
+        // pointer
+        if (expr->type == AST_FIELD) {
+            AST *var = expr->field.expr;
+            i32 *local = map_find(&b->locals, var->var_load.identifier.str);
+            if (!local) {
+                TERROR(var->var_load.identifier, "unknown variable");
+                return IR_NONE;
+            }
+
+            TypeExpr ptr_type = proc->locals[*local].type;
+            ptr_type.pointers++;
+
+            i32 ptr = ir_emit(b, { .op = IR_ADDR, .dst = ir_reg(proc, ptr_type), .a = IR_NONE, .b = IR_NONE, .local = *local });
+            i32 zero = ir_zero(b, { T_SIGNED, 8 });
+
+            IrInst inst{ .op = IR_INDEX_ADDR, .dst = ir_reg(proc, ast->unary.type), .a = ptr, .b = zero };
+            inst.field = expr->field.index;
+            return ir_emit(b, inst);
+        }
+
+        if (expr->type == AST_INDEX) {
+            i32 slice, index;
+            if (!ir_lower_index(b, expr, &slice, &index)) return IR_NONE;
+
+            IrInst inst{ .op = IR_INDEX_ADDR, .dst = ir_reg(proc, ast->unary.type), .a = slice, .b = index };
+            inst.field = IR_NONE;
+            return ir_emit(b, inst);
+        }
+
+        i32 *local = map_find(&b->locals, expr->var_load.identifier.str);
+        if (!local) {
+            TERROR(expr->var_load.identifier, "unknown variable");
+            return IR_NONE;
+        }
+
+        return ir_emit(b, { .op = IR_ADDR, .dst = ir_reg(proc, ast->unary.type), .a = IR_NONE, .b = IR_NONE, .local = *local });
+        }
+    case AST_DEREF: {
+        i32 ptr = ir_lower_expr(b, ast->unary.expr);
+        if (ptr == IR_NONE) return IR_NONE;
+        return ir_emit(b, { .op = IR_PTR_LOAD, .dst = ir_reg(proc, ast->unary.type), .a = ptr, .b = IR_NONE });
+        }
+    case AST_ATOMIC: {
+        i32 dst;
+        if (!ir_lower_atomic(b, ast, &dst)) return IR_NONE;
+        return dst;
+        }
+    case AST_INTRINSIC: {
+        i32 dst;
+        if (!ir_lower_intrinsic(b, ast, &dst)) return IR_NONE;
+        return dst;
+        }
+    default:
+        LOG_ERROR("invalid expression type '%s'", sz_from_enum(ast->type));
+        return IR_NONE;
+    }
+}
+
+static i32 ir_zero(IrBuilder *b, TypeExpr type)
+{
+    IrInst inst{ .op = IR_CONST, .dst = ir_reg(b->proc, type), .a = IR_NONE, .b = IR_NONE };
+    if (type == T_FLOAT) inst.fval = 0;
+    else inst.ival = 0;
+    return ir_emit(b, inst);
+}
+
+// NOTE(jesper): the same thresholds LLVM's own switch lowering uses for jump tables, at least 4
+// cases covering at least 40% of the values between the smallest and largest of them
+constexpr i32 IR_SWITCH_MIN_CASES = 4;
+constexpr i32 IR_SWITCH_MIN_DENSITY = 40;
+
+// NOTE(jesper): with this many cases or fewer they're compared one at a time, which takes as many
+// comparisons as splitting them in half would
+constexpr i32 IR_SWITCH_LINEAR_CASES = 3;
+
+// NOTE(jesper): lowers the comparisons of the switch value against the sorted case values,
+// jumping to the target of the one that's equal, or target_else if none are. A dense set of
+// values becomes an IR_SWITCH, otherwise they're split in half by a comparison against the middle
+// value, until the halves are either dense or few enough to compare one by one
+static void ir_lower_switch_cases(
+    IrBuilder *b,
+    i32 value,
+    Array<i64> values,
+    Array<i32> targets,
+    i32 target_else)
+{
+    IrProc *proc = b->proc;
+    TypeExpr type = proc->regs[value];
+
+    if (values.count == 0) {
+        ir_jump(b, target_else);
+        return;
+    }
+
+    u64 span = (u64)values[values.count-1] - (u64)values[0];
+    if (values.count >= IR_SWITCH_MIN_CASES && span < (u64)values.count*100 / IR_SWITCH_MIN_DENSITY) {
+        IrInst inst{ .op = IR_SWITCH, .dst = IR_NONE, .a = value, .b = IR_NONE };
+        inst.target = IR_NONE;
+        inst.target_else = target_else;
+        inst.cases = proc->switch_cases.count;
+        inst.case_count = values.count;
+
+        for (i32 i = 0; i < values.count; i++) {
+            array_add(&proc->switch_cases, IrSwitchCase{ .value = values[i], .target = targets[i] });
+        }
+
+        ir_emit(b, inst);
+        return;
+    }
+
+    auto compare = [&](IrOp op, i64 ival) -> i32
+    {
+        IrInst inst{ .op = IR_CONST, .dst = ir_reg(proc, type), .a = IR_NONE, .b = IR_NONE };
+        inst.ival = ival;
+        i32 rhs = ir_emit(b, inst);
+        return ir_emit(b, { .op = op, .dst = ir_reg(proc, { T_BOOL, 1 }), .a = value, .b = rhs });
+    };
+
+    if (values.count <= IR_SWITCH_LINEAR_CASES) {
+        for (i32 i = 0; i < values.count; i++) {
+            i32 next = i < values.count-1 ? ir_block(b) : target_else;
+            ir_branch(b, compare(IR_EQ, values[i]), targets[i], next);
+            b->block = next;
+        }
+        return;
+    }
+
+    i32 mid = values.count / 2;
+    i32 lower = ir_block(b);
+    i32 upper = ir_block(b);
+    ir_branch(b, compare(IR_LT, values[mid]), lower, upper);
+
+    b->block = lower;
+    ir_lower_switch_cases(b, value, slice(values, 0, mid), slice(targets, 0, mid), target_else);
+
+    b->block = upper;
+    ir_lower_switch_cases(b, value, slice(values, mid), slice(targets, mid), target_else);
+}
+
+static bool ir_lower_stmts(IrBuilder *b, AST *stmts);
+static bool ir_lower_stmt(IrBuilder *b, AST *stmt);
+
+// NOTE(jesper): the variables of the enclosing procedure that a parallel loop's body refers to,
+// which are passed to its outlined procedure by value. Assigning to them or taking their
+// address would be a race between the iterations, so only the elements of arrays and what
+// pointers point to can be written to
+struct IrCaptures {
+    DynamicArray<String> names;
+    DynamicArray<String> declared;  // in the body, including its induction variable
+};
+
+static bool ir_capture(IrBuilder *b, IrCaptures *captures, Token identifier, bool write)
+{
+    if (array_contains(captures->declared, identifier.str)) return true;
+    if (!map_find(&b->locals, identifier.str)) return true;
+
+    if (write) {
+        TERROR(identifier,
+               "cannot assign to or take the address of '%.*s' in a parallel loop, it's shared by every iteration",
+               STRFMT(identifier.str));
+        return false;
+    }
+
+    if (!array_contains(captures->names, identifier.str)) array_add(&captures->names, identifier.str);
+    return true;
+}
+
+static bool ir_collect_captures(IrBuilder *b, AST *ast, IrCaptures *captures)
+{
+    for (; ast; ast = ast->next) {
+        bool ok = true;
+        switch (ast->type) {
+        case AST_VAR_LOAD:
+            ok = ir_capture(b, captures, ast->var_load.identifier, false);
+            break;
+        case AST_VAR_DECL:
+            ok = ir_collect_captures(b, ast->var_decl.init, captures);
+            array_add(&captures->declared, ast->var_decl.identifier.str);
+            break;
+        case AST_VAR_STORE:
+            ok = ir_capture(b, captures, ast->var_store.identifier, true) &&
+                ir_collect_captures(b, ast->var_store.rhs, captures);
+            break;
+        case AST_PROC_CALL:
+            ok = ir_collect_captures(b, ast->proc_call.args, captures);
+            break;
+        case AST_RETURN:
+            TERROR(ast->ret.token, "cannot return from inside a parallel loop");
+            return false;
+        case AST_BINARY_OP:
+            ok = ir_collect_captures(b, ast->binary_op.lhs, captures) &&
+                ir_collect_captures(b, ast->binary_op.rhs, captures);
+            break;
+        case AST_RUN:
+            ok = ir_collect_captures(b, ast->run.expr, captures);
+            break;
+        case AST_LOOP:
+            ok = ir_collect_captures(b, ast->loop.init, captures) &&
+                ir_collect_captures(b, ast->loop.cond, captures) &&
+                ir_collect_captures(b, ast->loop.step, captures) &&
+                ir_collect_captures(b, ast->loop.body, captures);
+            break;
+        case AST_SWITCH:
+            ok = ir_collect_captures(b, ast->switch_stmt.expr, captures);
+            for (AST *it = ast->switch_stmt.cases; it && ok; it = it->next) {
+                ok = ir_collect_captures(b, it->switch_case.body, captures);
+            }
+            break;
+        case AST_VECTOR:
+            ok = ir_collect_captures(b, ast->vector.elems, captures);
+            break;
+        case AST_SWIZZLE:
+            ok = ir_collect_captures(b, ast->swizzle.expr, captures);
+            break;
+        case AST_REDUCE:
+            ok = ir_collect_captures(b, ast->reduce.expr, captures);
+            break;
+        case AST_INDEX:
+            ok = ir_collect_captures(b, ast->index.expr, captures) &&
+                ir_collect_captures(b, ast->index.index, captures);
+            break;
+        case AST_INDEX_STORE:
+            ok = ir_collect_captures(b, ast->index_store.lhs, captures) &&
+                ir_collect_captures(b, ast->index_store.rhs, captures);
+            break;
+        case AST_COUNT:
+            ok = ir_collect_captures(b, ast->count.expr, captures);
+            break;
+        case AST_FIELD:
+            ok = ir_collect_captures(b, ast->field.expr, captures);
+            break;
+        case AST_FIELD_STORE:
+            // NOTE(jesper): fields of struct variables are stored by replacing the whole value
+            if (AST *expr = ast->field_store.lhs->field.expr; expr->type == AST_VAR_LOAD) {
+                ok = ir_capture(b, captures, expr->var_load.identifier, true);
+            } else {
+                ok = ir_collect_captures(b, ast->field_store.lhs, captures);
+            }
+
+            ok = ok && ir_collect_captures(b, ast->field_store.rhs, captures);
+            break;
+        case AST_ADDRESS_OF: {
+            AST *expr = ast->unary.expr;
+            if (expr->type == AST_FIELD && expr->field.expr->type == AST_VAR_LOAD) expr = expr->field.expr;
+
+            if (expr->type == AST_VAR_LOAD) ok = ir_capture(b, captures, expr->var_load.identifier, true);
+            else ok = ir_collect_captures(b, expr, captures);
+            } break;
+        case AST_DEREF:
+            ok = ir_collect_captures(b, ast->unary.expr, captures);
+            break;
+        case AST_DEREF_STORE:
+            ok = ir_collect_captures(b, ast->deref_store.lhs, captures) &&
+                ir_collect_captures(b, ast->deref_store.rhs, captures);
+            break;
+        case AST_ATOMIC:
+            ok = ir_collect_captures(b, ast->atomic.args, captures);
+            break;
+        case AST_INTRINSIC:
+            ok = ir_collect_captures(b, ast->intrinsic.args, captures);
+            break;
+        default:
+            break;
+        }
+
+        if (!ok) return false;
+    }
+
+    return true;
+}
+
+static i32 ir_count_parallel_loops(AST *stmts)
+{
+    i32 count = 0;
+    for (AST *stmt = stmts; stmt; stmt = stmt->next) {
+        if (stmt->type == AST_SWITCH) {
+            for (AST *it = stmt->switch_stmt.cases; it; it = it->next) {
+                count += ir_count_parallel_loops(it->switch_case.body);
+            }
+        }
+
+        if (stmt->type != AST_LOOP) continue;
+        count += stmt->loop.parallel + ir_count_parallel_loops(stmt->loop.body);
+    }
+
+    return count;
+}
+
+// NOTE(jesper): the body is outlined into a procedure that runs the iterations in [start, end)
+// it's given, with the captured variables as its leading parameters. Fixed arrays are captured
+// as slices of the enclosing procedure's array, so stores to their elements are seen once the
+// loop is done
+static bool ir_lower_parallel_for(IrBuilder *b, AST *stmt)
+{
+    SArena scratch = tl_scratch_arena(b->module->mem);
+    IrModule *ir = b->module;
+    IrProc *proc = b->proc;
+
+    AST *init = stmt->loop.init;
+    i32 start = ir_lower_expr(b, init->var_decl.init);
+    i32 end = ir_lower_expr(b, stmt->loop.cond->binary_op.rhs);
+    if (start == IR_NONE || end == IR_NONE) return false;
+
+    IrCaptures captures{ .names = { .alloc = scratch }, .declared = { .alloc = scratch } };
+    array_add(&captures.declared, init->var_decl.identifier.str);
+    if (!ir_collect_captures(b, stmt->loop.body, &captures)) return false;
+
+    TypeExpr index_type = init->var_decl.type;
+    Array<TypeExpr> params = array_create<TypeExpr>(captures.names.count + 2, ir->mem);
+    Array<bool> noalias = array_create<bool>(params.count, ir->mem);
+    for (bool &it : noalias) it = false;
+
+    DynamicArray<i32> args{ .alloc = scratch };
+    for (i32 i = 0; i < captures.names.count; i++) {
+        i32 local = *map_find(&b->locals, captures.names[i]);
+        TypeExpr type = proc->locals[local].type;
+
+        IrOp op = IR_LOAD;
+        if (type.elems > 0) {
+            type.elems = TYPE_SLICE;
+            op = IR_SLICE;
+        }
+
+        params[i] = type;
+        array_add(&args, ir_emit(b, { .op = op, .dst = ir_reg(proc, type), .a = IR_NONE, .b = IR_NONE, .local = local }));
+    }
+
+    params[captures.names.count] = index_type;
+    params[captures.names.count+1] = index_type;
+
+    // NOTE(jesper): the module's procedures are reserved up front for every parallel loop, so
+    // adding one doesn't move the procedure being lowered
+    PANIC_IF(ir->procs.count == ir->procs.capacity, "procedures of parallel loops weren't reserved");
+    i32 body_proc = array_add(&ir->procs, IrProc{
+        .name = stringf(ir->mem, "%.*s.parallel.%d", STRFMT(proc->name), b->parallel_count++),
+        .ret_type = { T_VOID },
+        .params = params,
+        .noalias = noalias,
+        .defined = true,
+        .regs = { .alloc = ir->mem },
+        .args = { .alloc = ir->mem },
+        .switch_cases = { .alloc = ir->mem },
+        .phi_incoming = { .alloc = ir->mem },
+        .locals = { .alloc = ir->mem },
+        .blocks = { .alloc = ir->mem },
+        .loops = { .alloc = ir->mem },
+    });
+
+    IrInst inst{ .op = IR_PARALLEL_FOR, .dst = IR_NONE, .a = start, .b = end };
+    inst.proc = body_proc;
+    inst.args = proc->args.count;
+    inst.arg_count = args.count;
+    inst.grain_size = stmt->loop.hints.grain_size;
+
+    array_add(&proc->args, args.data, args.count);
+    ir_emit(b, inst);
+    ir->uses_runtime = true;
+
+    IrBuilder body{
+        .module = ir,
+        .proc = &ir->procs[body_proc],
+        .locals = { .alloc = scratch },
+        .scope = { .alloc = scratch },
+    };
+    body.block = ir_block(&body);
+
+    auto param = [&body](i32 index, TypeExpr type) -> i32
+    {
+        IrInst inst{ .op = IR_PARAM, .dst = ir_reg(body.proc, type), .a = IR_NONE, .b = IR_NONE };
+        inst.param = index;
+        return ir_emit(&body, inst);
+    };
+
+    for (i32 i = 0; i < captures.names.count; i++) {
+        i32 local = array_add(&body.proc->locals, IrLocal{ .name = captures.names[i], .type = params[i] });
+        map_set(&body.locals, captures.names[i], local);
+        ir_emit(&body, { .op = IR_STORE, .dst = IR_NONE, .a = param(i, params[i]), .b = IR_NONE, .local = local });
+    }
+
+    i32 index = array_add(&body.proc->locals, IrLocal{ .name = init->var_decl.identifier.str, .type = index_type });
+    map_set(&body.locals, init->var_decl.identifier.str, index);
+    ir_emit(&body, { .op = IR_STORE, .dst = IR_NONE, .a = param(captures.names.count, index_type), .b = IR_NONE, .local = index });
+    i32 body_end = param(captures.names.count+1, index_type);
+
+    i32 header = ir_block(&body);
+    i32 loop_body = ir_block(&body);
+    i32 exit = ir_block(&body);
+    ir_jump(&body, header);
+
+    body.block = header;
+    i32 current = ir_emit(&body, { .op = IR_LOAD, .dst = ir_reg(body.proc, index_type), .a = IR_NONE, .b = IR_NONE, .local = index });
+    i32 cond = ir_emit(&body, { .op = IR_LT, .dst = ir_reg(body.proc, { T_BOOL, 1 }), .a = current, .b = body_end });
+    ir_branch(&body, cond, loop_body, exit);
+
+    body.block = loop_body;
+    if (!ir_lower_stmts(&body, stmt->loop.body)) return false;
+    if (!ir_lower_stmt(&body, stmt->loop.step)) return false;
+
+    array_add(&body.proc->loops, IrLoop{ .header = header, .latch = body.block, .hints = stmt->loop.hints });
+    ir_jump(&body, header);
+
+    body.block = exit;
+    ir_emit(&body, { .op = IR_RET, .dst = IR_NONE, .a = IR_NONE, .b = IR_NONE });
+    return true;
+}
+
+static void ir_declare_local(IrBuilder *b, String name, i32 local)
+{
+    i32 *shadowed = map_find(&b->locals, name);
+    array_add(&b->scope, { .name = name, .shadowed = shadowed ? *shadowed : IR_NONE });
+    map_set(&b->locals, name, local);
+}
+
+static void ir_pop_scope(IrBuilder *b, i32 scope)
+{
+    for (i32 i = b->scope.count-1; i >= scope; i--) {
+        IrScopedLocal scoped = b->scope[i];
+        if (scoped.shadowed != IR_NONE) map_set(&b->locals, scoped.name, scoped.shadowed);
+        else map_remove(&b->locals, scoped.name);
+    }
+
+    b->scope.count = scope;
+}
+
+static bool ir_lower_stmt(IrBuilder *b, AST *stmt)
+{
+    IrProc *proc = b->proc;
+
+    switch (stmt->type) {
+    case AST_VAR_DECL: {
+        i32 local = array_add(&proc->locals, IrLocal{
+            .name = stmt->var_decl.identifier.str,
+            .type = stmt->var_decl.type,
+        });
+        ir_declare_local(b, stmt->var_decl.identifier.str, local);
+
+        // NOTE(jesper): variables declared without an initialiser are zero initialised
+        i32 value = stmt->var_decl.init
+            ? ir_lower_expr(b, stmt->var_decl.init)
+            : ir_zero(b, stmt->var_decl.type);
+        if (value == IR_NONE) return false;
+
+        ir_emit(b, { .op = IR_STORE, .dst = IR_NONE, .a = value, .b = IR_NONE, .local = local });
+        } break;
+    case AST_VAR_STORE: {
+        i32 *local = map_find(&b->locals, stmt->var_store.identifier.str);
+        if (!local) {
+            TERROR(stmt->var_store.identifier, "unknown variable");
+            return false;
+        }
+
+        i32 value = ir_lower_expr(b, stmt->var_store.rhs);
+        if (value == IR_NONE) return false;
+
+        ir_emit(b, { .op = IR_STORE, .dst = IR_NONE, .a = value, .b = IR_NONE, .local = *local });
+        } break;
+    case AST_PROC_CALL: {
+        i32 dst;
+        if (!ir_lower_call(b, stmt, &dst)) return false;
+        } break;
+    case AST_ATOMIC: {
+        i32 dst;
+        if (!ir_lower_atomic(b, stmt, &dst)) return false;
+        } break;
+    case AST_INTRINSIC: {
+        i32 dst;
+        if (!ir_lower_intrinsic(b, stmt, &dst)) return false;
+        } break;
+    case AST_INDEX_STORE: {
+        i32 slice, index;
+        if (!ir_lower_index(b, stmt->index_store.lhs, &slice, &index)) return false;
+
+        i32 value = ir_lower_expr(b, stmt->index_store.rhs);
+        if (value == IR_NONE) return false;
+
+        IrInst inst{ .op = IR_INDEX_STORE, .dst = IR_NONE, .a = slice, .b = index };
+        inst.value = value;
+        inst.field = IR_NONE;
+        ir_emit(b, inst);
+        } break;
+    case AST_FIELD_STORE: {
+        AST *field = stmt->field_store.lhs;
+        AST *expr = field->field.expr;
+
+        if (expr->type == AST_INDEX) {
+            i32 slice, index;
+            if (!ir_lower_index(b, expr, &slice, &index)) return false;
+
+            i32 value = ir_lower_expr(b, stmt->field_store.rhs);
+            if (value == IR_NONE) return false;
+
+            IrInst inst{ .op = IR_INDEX_STORE, .dst = IR_NONE, .a = slice, .b = index };
+            inst.value = value;
+            inst.field = field->field.index;
+            ir_emit(b, inst);
+            break;
+        }
+
+        // NOTE(jesper): fields of struct variables are stored by replacing the whole value,
+        // which mem2reg and the backends turn back into a store of only the field
+        i32 *local = map_find(&b->locals, expr->var_load.identifier.str);
+        if (!local) {
+            TERROR(expr->var_load.identifier, "unknown variable");
+            return false;
+        }
+
+        TypeExpr type = proc->locals[*local].type;
+        i32 src = ir_emit(b, { .op = IR_LOAD, .dst = ir_reg(proc, type), .a = IR_NONE, .b = IR_NONE, .local = *local });
+
+        i32 value = ir_lower_expr(b, stmt->field_store.rhs);
+        if (value == IR_NONE) return false;
+
+        IrInst inst{ .op = IR_INSERT_FIELD, .dst = ir_reg(proc, type), .a = src, .b = value };
+        inst.field = field->field.index;
+        ir_emit(b, { .op = IR_STORE, .dst = IR_NONE, .a = ir_emit(b, inst), .b = IR_NONE, .local = *local });
+        } break;
+    case AST_DEREF_STORE: {
+        i32 ptr = ir_lower_expr(b, stmt->deref_store.lhs->unary.expr);
+        if (ptr == IR_NONE) return false;
+
+        i32 value = ir_lower_expr(b, stmt->deref_store.rhs);
+        if (value == IR_NONE) return false;
+
+        ir_emit(b, { .op = IR_PTR_STORE, .dst = IR_NONE, .a = ptr, .b = value });
+        } break;
+    case AST_RETURN: {
+        i32 value = IR_NONE;
+        if (stmt->ret.expr && (value = ir_lower_expr(b, stmt->ret.expr)) == IR_NONE) return false;
+
+        ir_emit(b, { .op = IR_RET, .dst = IR_NONE, .a = value, .b = IR_NONE });
+        } break;
+    case AST_LOOP: {
+        if (stmt->loop.parallel) return ir_lower_parallel_for(b, stmt);
+
+        // NOTE(jesper): the condition is evaluated in its own header block, which the body
+        // jumps back to after the step statement. Once the condition is false the loop exits
+        // to a new block that the statements following the loop are lowered into. The variables
+        // declared by its init and body go out of scope once it exits
+        i32 scope = b->scope.count;
+        if (stmt->loop.init && !ir_lower_stmt(b, stmt->loop.init)) return false;
+
+        i32 header = ir_block(b);
+        i32 body = ir_block(b);
+        i32 exit = ir_block(b);
+        ir_jump(b, header);
+
+        b->block = header;
+        i32 cond = ir_lower_expr(b, stmt->loop.cond);
+        if (cond == IR_NONE) return false;
+        ir_branch(b, cond, body, exit);
+
+        b->block = body;
+        if (!ir_lower_stmts(b, stmt->loop.body)) return false;
+
+        // NOTE(jesper): a body that always returns never loops back
+        if (!ir_terminated(b)) {
+            if (stmt->loop.step && !ir_lower_stmt(b, stmt->loop.step)) return false;
+
+            array_add(&proc->loops, IrLoop{ .header = header, .latch = b->block, .hints = stmt->loop.hints });
+            ir_jump(b, header);
+        }
+
+        ir_pop_scope(b, scope);
+        b->block = exit;
+        } break;
+    case AST_SWITCH: {
+        SArena scratch = tl_scratch_arena(b->module->mem);
+
+        i32 value = ir_lower_expr(b, stmt->switch_stmt.expr);
+        if (value == IR_NONE) return false;
+
+        // NOTE(jesper): every case is lowered into a block of its own, which continues with the
+        // statements following the switch. The exit block comes after the cases so that the
+        // jumps to it are forward
+        i32 value_count = 0;
+        for (AST *it = stmt->switch_stmt.cases; it; it = it->next) {
+            for (AST *v = it->switch_case.values; v; v = v->next) value_count++;
+        }
+
+        Array<i64> values = array_create<i64>(value_count, scratch);
+        Array<i32> targets = array_create<i32>(value_count, scratch);
+        DynamicArray<i32> case_blocks{ .alloc = scratch };
+
+        value_count = 0;
+        i32 else_block = IR_NONE;
+        for (AST *it = stmt->switch_stmt.cases; it; it = it->next) {
+            i32 block = ir_block(b);
+            array_add(&case_blocks, block);
+            if (!it->switch_case.values) else_block = block;
+
+            for (AST *v = it->switch_case.values; v; v = v->next, value_count++) {
+                values[value_count] = v->literal.ival;
+                targets[value_count] = block;
+            }
+        }
+
+        i32 exit = ir_block(b);
+        quick_sort_asc(values, targets);
+        ir_lower_switch_cases(b, value, values, targets, else_block != IR_NONE ? else_block : exit);
+
+        i32 index = 0;
+        for (AST *it = stmt->switch_stmt.cases; it; it = it->next) {
+            b->block = case_blocks[index++];
+
+            i32 scope = b->scope.count;
+            if (!ir_lower_stmts(b, it->switch_case.body)) return false;
+            if (!ir_terminated(b)) ir_jump(b, exit);
+            ir_pop_scope(b, scope);
+        }
+
+        b->block = exit;
+        } break;
+    default:
+        LOG_ERROR("invalid statement type '%s'", sz_from_enum(stmt->type));
+        return false;
+    }
+
+    return true;
+}
+
+static bool ir_lower_stmts(IrBuilder *b, AST *stmts)
+{
+    for (AST *stmt = stmts; stmt; stmt = stmt->next) {
+        // NOTE(jesper): everything following a return in the same statement list is unreachable
+        if (ir_terminated(b)) break;
+        if (!ir_lower_stmt(b, stmt)) return false;
+    }
+
+    return true;
+}
+
+static bool ir_lower_proc(IrBuilder *b, AST *ast)
+{
+    IrProc *proc = b->proc;
+
+    // NOTE(jesper): the variable names are owned by the source file, so the table is
+    // cleared instead of destroyed
+    map_clear(&b->locals);
+    b->scope.count = 0;
+    b->parallel_count = 0;
+
+    b->block = ir_block(b);
+
+    // NOTE(jesper): parameters are stored to locals on entry, like any other variable, and
+    // promoted back to registers by mem2reg unless they're assigned to elsewhere
+    i32 param_index = 0;
+    for (AST *param = ast->proc_decl.params; param; param = param->next, param_index++) {
+        i32 local = array_add(&proc->locals, IrLocal{
+            .name = param->var_decl.identifier.str,
+            .type = param->var_decl.type,
+        });
+        map_set(&b->locals, param->var_decl.identifier.str, local);
+
+        IrInst inst{ .op = IR_PARAM, .dst = ir_reg(proc, param->var_decl.type), .a = IR_NONE, .b = IR_NONE };
+        inst.param = param_index;
+        ir_emit(b, { .op = IR_STORE, .dst = IR_NONE, .a = ir_emit(b, inst), .b = IR_NONE, .local = local });
+    }
+
+    if (!ir_lower_stmts(b, ast->proc_decl.body)) return false;
+
+    if (!ir_terminated(b)) {
+        i32 value = proc->ret_type == T_VOID ? IR_NONE : ir_zero(b, proc->ret_type);
+        ir_emit(b, { .op = IR_RET, .dst = IR_NONE, .a = value, .b = IR_NONE });
+    }
+
+    return true;
+}
+
+bool ir_lower_module(IrModule *ir, Module *module, Allocator mem, bool bounds_checks /*= true */)
+{
+    SArena scratch = tl_scratch_arena(mem);
+
+    *ir = {
+        .mem = mem,
+        .bounds_checks = bounds_checks,
+        .procs = { .alloc = mem },
+        .proc_indices = { .alloc = mem },
+    };
+
+    i32 proc_count = 0;
+    for (AST *it = module->ast; it; it = it->next) {
+        if (it->type != AST_PROC_DECL) continue;
+        proc_count += 1 + ir_count_parallel_loops(it->proc_decl.body);
+    }
+    array_reserve(&ir->procs, proc_count);
+
+    for (AST *it = module->ast; it; it = it->next) {
+        if (it->type != AST_PROC_DECL) continue;
+
+        i32 *index = map_find(&ir->proc_indices, it->proc_decl.identifier.str);
+        if (index) {
+            ir->procs[*index].defined |= it->proc_decl.body != nullptr;
+            ir->procs[*index].exported |= it->proc_decl.flags.exported || it == module->entry;
+            continue;
+        }
+
+        TypeExpr ret_type = it->proc_decl.ret_type;
+        if (ret_type == T_UNKNOWN) ret_type = { T_VOID };
+
+        i32 param_count = 0;
+        for (AST *param = it->proc_decl.params; param; param = param->next) param_count++;
+
+        Array<TypeExpr> params = array_create<TypeExpr>(param_count, mem);
+        Array<bool> noalias = array_create<bool>(param_count, mem);
+        param_count = 0;
+        for (AST *param = it->proc_decl.params; param; param = param->next, param_count++) {
+            params[param_count] = param->var_decl.type;
+            noalias[param_count] = param->var_decl.noalias;
+        }
+
+        i32 i = array_add(&ir->procs, IrProc{
+            .name = it->proc_decl.identifier.str,
+            .ret_type = ret_type,
+            .params = params,
+            .noalias = noalias,
+            .defined = it->proc_decl.body != nullptr,
+            .exported = it->proc_decl.flags.exported || it == module->entry,
+            .cold = it->proc_decl.flags.cold != 0,
+            .hot = it->proc_decl.flags.hot != 0,
+            .regs = { .alloc = mem },
+            .args = { .alloc = mem },
+            .switch_cases = { .alloc = mem },
+            .phi_incoming = { .alloc = mem },
+            .locals = { .alloc = mem },
+            .blocks = { .alloc = mem },
+            .loops = { .alloc = mem },
+        });
+        map_set(&ir->proc_indices, it->proc_decl.identifier.str, i);
+    }
+
+    ir->globals = array_create<IrGlobal>(module->globals.count, mem);
+    for (i32 i = 0; i < module->globals.count; i++) {
+        GlobalConstant &global = module->globals[i];
+
+        Array<IrConstant> values = array_create<IrConstant>(global.type.elems, mem);
+        i32 count = 0;
+        for (AST *elem = global.elems; elem; elem = elem->next, count++) {
+            switch (elem->literal.type.prim) {
+            case T_FLOAT: values[count].fval = elem->literal.type.size == 8 ? elem->literal.dval : elem->literal.fval; break;
+            case T_BOOL:  values[count].ival = elem->literal.bval; break;
+            default:      values[count].ival = elem->literal.ival; break;
+            }
+        }
+
+        ir->globals[i] = { .name = global.identifier.str, .type = global.type, .values = values };
+    }
+
+    IrBuilder b{ .module = ir, .locals = { .alloc = scratch }, .scope = { .alloc = scratch } };
+    for (AST *it = module->ast; it; it = it->next) {
+        if (it->type != AST_PROC_DECL || !it->proc_decl.body) continue;
+
+        b.proc = &ir->procs[*map_find(&ir->proc_indices, it->proc_decl.identifier.str)];
+        if (b.proc->blocks.count > 0) {
+            TERROR(it->proc_decl.identifier, "duplicate definition of '%.*s'", STRFMT(b.proc->name));
+            return false;
+        }
+
+        if (!ir_lower_proc(&b, it)) return false;
+    }
+
+    return true;
+}
+
+void ir_mem2reg(IrProc *proc)
+{
+    SArena scratch = tl_scratch_arena();
+
+    // NOTE(jesper): a local is promoted when all of its accesses are in a single block and
+    // the first of them is a store, in which case every load can be replaced by the value
+    // last stored without needing any phi nodes
+    enum { UNSEEN = -1, NOT_PROMOTABLE = -2 };
+    Array<i32> local_block = array_create<i32>(proc->locals.count, scratch);
+    for (i32 &it : local_block) it = UNSEEN;
+
+    for (i32 bi = 0; bi < proc->blocks.count; bi++) {
+        for (IrInst &inst : proc->blocks[bi].insts) {
+            // NOTE(jesper): the elements of a sliced array are accessed through its address, and
+            // so is any local whose address is taken
+            if (inst.op == IR_SLICE || inst.op == IR_ADDR) local_block[inst.local] = NOT_PROMOTABLE;
+            if (inst.op != IR_LOAD && inst.op != IR_STORE) continue;
+
+            i32 &state = local_block[inst.local];
+            if (state == UNSEEN) state = inst.op == IR_STORE ? bi : NOT_PROMOTABLE;
+            else if (state != bi) state = NOT_PROMOTABLE;
+        }
+    }
+
+    Array<i32> current = array_create<i32>(proc->locals.count, scratch);
+    for (IrBlock &block : proc->blocks) {
+        for (i32 &it : current) it = IR_NONE;
+
+        for (IrInst &inst : block.insts) {
+            if (inst.op != IR_LOAD && inst.op != IR_STORE) continue;
+            if (local_block[inst.local] < 0) continue;
+
+            if (inst.op == IR_STORE) {
+                current[inst.local] = inst.a;
+                inst = { .op = IR_NOP, .dst = IR_NONE, .a = IR_NONE, .b = IR_NONE };
+            } else {
+                inst = { .op = IR_COPY, .dst = inst.dst, .a = current[inst.local], .b = IR_NONE };
+            }
+        }
+    }
+}
+
+Array<i32> ir_reverse_postorder(IrProc *proc, Allocator mem, i32 *reachable /*= nullptr */)
+{
+    SArena scratch = tl_scratch_arena(mem);
+
+    Array<i32> order = array_create<i32>(proc->blocks.count, mem);
+    Array<bool> visited = array_create<bool>(proc->blocks.count, scratch);
+    for (bool &it : visited) it = false;
+
+    struct Frame { i32 block, next; };
+    DynamicArray<Frame> stack{ .alloc = scratch };
+    DynamicArray<i32> postorder{ .alloc = scratch };
+
+    visited[0] = true;
+    array_add(&stack, Frame{ 0, 0 });
+    while (stack.count > 0) {
+        Frame &top = stack[stack.count-1];
+        i32 succ = ir_successor(proc, top.block, top.next++);
+        if (succ == IR_NONE) {
+            array_add(&postorder, top.block);
+            stack.count--;
+        } else if (!visited[succ]) {
+            visited[succ] = true;
+            array_add(&stack, Frame{ succ, 0 });
+        }
+    }
+
+    i32 count = 0;
+    for (i32 i = postorder.count-1; i >= 0; i--) order[count++] = postorder[i];
+    for (i32 i = 0; i < proc->blocks.count; i++) {
+        if (!visited[i]) order[count++] = i;
+    }
+
+    if (reachable) *reachable = postorder.count;
+    return order;
+}
+
+// NOTE(jesper): promotes the locals whose address is never taken, and that mem2reg left because
+// they're accessed in more than one block, to registers. It's the classic construction: phis are
+// placed on the iterated dominance frontiers of the blocks storing to a local, and the loads are
+// then renamed to the value reaching them by walking the dominator tree. Loads that no store
+// reaches get the zero value, which is what locals are initialised to anyway
+void ir_construct_ssa(IrProc *proc)
+{
+    SArena scratch = tl_scratch_arena();
+
+    i32 block_count = proc->blocks.count;
+    i32 local_count = proc->locals.count;
+    if (block_count == 0 || local_count == 0) return;
+
+    Array<bool> promote = array_create<bool>(local_count, scratch);
+    for (bool &it : promote) it = false;
+
+    for (IrBlock &block : proc->blocks) {
+        for (IrInst &inst : block.insts) {
+            if (inst.op == IR_LOAD || inst.op == IR_STORE) promote[inst.local] = true;
+        }
+    }
+
+    for (IrBlock &block : proc->blocks) {
+        for (IrInst &inst : block.insts) {
+            if (inst.op == IR_SLICE || inst.op == IR_ADDR) promote[inst.local] = false;
+        }
+    }
+
+    bool any = false;
+    for (bool it : promote) any = any || it;
+    if (!any) return;
+
+    i32 reachable;
+    Array<i32> order = ir_reverse_postorder(proc, scratch, &reachable);
+
+    Array<i32> rpo_index = array_create<i32>(block_count, scratch);
+    for (i32 &it : rpo_index) it = IR_NONE;
+    for (i32 i = 0; i < reachable; i++) rpo_index[order[i]] = i;
+
+    // NOTE(jesper): one entry for each edge, a block branching to the same successor more than once
+    // is its predecessor that many times
+    Array<DynamicArray<i32>> preds = array_create<DynamicArray<i32>>(block_count, scratch);
+    for (DynamicArray<i32> &it : preds) it = { .alloc = scratch };
+    for (i32 bi = 0; bi < block_count; bi++) {
+        for (i32 i = 0, succ; (succ = ir_successor(proc, bi, i)) != IR_NONE; i++) array_add(&preds[succ], bi);
+    }
+
+    // NOTE(jesper): Cooper, Harvey and Kennedy's iterative dominator algorithm
+    Array<i32> idom = array_create<i32>(block_count, scratch);
+    for (i32 &it : idom) it = IR_NONE;
+    idom[order[0]] = order[0];
+
+    auto intersect = [&](i32 a, i32 b) -> i32
+    {
+        while (a != b) {
+            while (rpo_index[a] > rpo_index[b]) a = idom[a];
+            while (rpo_index[b] > rpo_index[a]) b = idom[b];
+        }
+        return a;
+    };
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (i32 i = 1; i < reachable; i++) {
+            i32 block = order[i];
+
+            i32 new_idom = IR_NONE;
+            for (i32 pred : preds[block]) {
+                if (idom[pred] == IR_NONE) continue;
+                new_idom = new_idom == IR_NONE ? pred : intersect(pred, new_idom);
+            }
+
+            if (idom[block] != new_idom) {
+                idom[block] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    Array<DynamicArray<i32>> frontier = array_create<DynamicArray<i32>>(block_count, scratch);
+    Array<DynamicArray<i32>> children = array_create<DynamicArray<i32>>(block_count, scratch);
+    for (DynamicArray<i32> &it : frontier) it = { .alloc = scratch };
+    for (DynamicArray<i32> &it : children) it = { .alloc = scratch };
+
+    for (i32 i = 0; i < reachable; i++) {
+        i32 block = order[i];
+        if (i > 0) array_add(&children[idom[block]], block);
+        if (preds[block].count < 2) continue;
+
+        for (i32 pred : preds[block]) {
+            if (rpo_index[pred] == IR_NONE) continue;
+
+            for (i32 runner = pred; runner != idom[block]; runner = idom[runner]) {
+                DynamicArray<i32> &df = frontier[runner];
+                if (df.count == 0 || df[df.count-1] != block) array_add(&df, block);
+            }
+        }
+    }
+
+    // NOTE(jesper): the locals each block has a phi for, in the same order as the phis at its start
+    Array<DynamicArray<i32>> phi_locals = array_create<DynamicArray<i32>>(block_count, scratch);
+    for (DynamicArray<i32> &it : phi_locals) it = { .alloc = scratch };
+
+    Array<i32> has_phi = array_create<i32>(block_count, scratch);
+    Array<i32> queued = array_create<i32>(block_count, scratch);
+    for (i32 &it : has_phi) it = IR_NONE;
+    for (i32 &it : queued) it = IR_NONE;
+
+    DynamicArray<i32> worklist{ .alloc = scratch };
+    for (i32 local = 0; local < local_count; local++) {
+        if (!promote[local]) continue;
+
+        for (i32 i = 0; i < reachable; i++) {
+            for (IrInst &inst : proc->blocks[order[i]].insts) {
+                if (inst.op != IR_STORE || inst.local != local) continue;
+                queued[order[i]] = local;
+                array_add(&worklist, order[i]);
+                break;
+            }
+        }
+
+        while (worklist.count > 0) {
+            i32 block = array_pop(&worklist);
+            for (i32 df : frontier[block]) {
+                if (has_phi[df] == local) continue;
+                has_phi[df] = local;
+                array_add(&phi_locals[df], local);
+
+                if (queued[df] != local) {
+                    queued[df] = local;
+                    array_add(&worklist, df);
+                }
+            }
+        }
+    }
+
+    Array<i32> zero = array_create<i32>(local_count, scratch);
+    {
+        DynamicArray<IrInst> &entry = proc->blocks[order[0]].insts;
+        DynamicArray<IrInst> insts{ .alloc = entry.alloc };
+        for (i32 local = 0; local < local_count; local++) {
+            zero[local] = IR_NONE;
+            if (!promote[local]) continue;
+
+            zero[local] = ir_reg(proc, proc->locals[local].type);
+            array_add(&insts, IrInst{ .op = IR_CONST, .dst = zero[local], .a = IR_NONE, .b = IR_NONE, .ival = 0 });
+        }
+
+        array_add(&insts, entry.data, entry.count);
+        entry = insts;
+    }
+
+    for (i32 bi = 0; bi < block_count; bi++) {
+        if (phi_locals[bi].count == 0) continue;
+
+        DynamicArray<IrInst> &block = proc->blocks[bi].insts;
+        DynamicArray<IrInst> insts{ .alloc = block.alloc };
+        for (i32 local : phi_locals[bi]) {
+            TypeExpr type = proc->locals[local].type;
+
+            IrInst phi{ .op = IR_PHI, .dst = ir_reg(proc, type), .a = IR_NONE, .b = IR_NONE };
+            phi.incoming = proc->phi_incoming.count;
+            phi.incoming_count = preds[bi].count;
+            phi.shadow = ir_reg(proc, type);
+            array_add(&insts, phi);
+
+            for (i32 pred : preds[bi]) array_add(&proc->phi_incoming, IrPhiIncoming{ pred, IR_NONE });
+        }
+
+        array_add(&insts, block.data, block.count);
+        block = insts;
+    }
+
+    Array<i32> current = array_create<i32>(local_count, scratch);
+    for (i32 i = 0; i < local_count; i++) current[i] = zero[i];
+
+    struct Undo { i32 local, value; };
+    struct Frame { i32 block, child, undo; };
+    DynamicArray<Undo> undo{ .alloc = scratch };
+    DynamicArray<Frame> stack{ .alloc = scratch };
+
+    auto rename = [&](i32 block)
+    {
+        DynamicArray<IrInst> &insts = proc->blocks[block].insts;
+        for (i32 i = 0; i < phi_locals[block].count; i++) {
+            i32 local = phi_locals[block][i];
+            array_add(&undo, Undo{ local, current[local] });
+            current[local] = insts[i].dst;
+        }
+
+        for (IrInst &inst : insts) {
+            if ((inst.op != IR_LOAD && inst.op != IR_STORE) || !promote[inst.local]) continue;
+
+            if (inst.op == IR_STORE) {
+                array_add(&undo, Undo{ inst.local, current[inst.local] });
+                current[inst.local] = inst.a;
+                inst = { .op = IR_NOP, .dst = IR_NONE, .a = IR_NONE, .b = IR_NONE };
+            } else {
+                inst = { .op = IR_COPY, .dst = inst.dst, .a = current[inst.local], .b = IR_NONE };
+            }
+        }
+
+        for (i32 i = 0, succ; (succ = ir_successor(proc, block, i)) != IR_NONE; i++) {
+            for (i32 j = 0; j < phi_locals[succ].count; j++) {
+                IrInst &phi = proc->blocks[succ].insts[j];
+                for (i32 k = 0; k < phi.incoming_count; k++) {
+                    IrPhiIncoming &it = proc->phi_incoming[phi.incoming + k];
+                    if (it.block == block) it.value = current[phi_locals[succ][j]];
+                }
+            }
+        }
+    };
+
+    rename(order[0]);
+    array_add(&stack, Frame{ order[0], 0, 0 });
+    while (stack.count > 0) {
+        Frame &top = stack[stack.count-1];
+        if (top.child < children[top.block].count) {
+            i32 child = children[top.block][top.child++];
+            i32 undo_start = undo.count;
+            rename(child);
+            array_add(&stack, Frame{ child, 0, undo_start });
+            continue;
+        }
+
+        while (undo.count > top.undo) {
+            Undo it = array_pop(&undo);
+            current[it.local] = it.value;
+        }
+        stack.count--;
+    }
+
+    // NOTE(jesper): unreachable predecessors are never renamed, their entries only exist because
+    // LLVM wants one for every predecessor
+    for (i32 bi = 0; bi < block_count; bi++) {
+        for (i32 j = 0; j < phi_locals[bi].count; j++) {
+            IrInst &phi = proc->blocks[bi].insts[j];
+            for (i32 k = 0; k < phi.incoming_count; k++) {
+                IrPhiIncoming &it = proc->phi_incoming[phi.incoming + k];
+                if (it.value == IR_NONE) it.value = zero[phi_locals[bi][j]];
+            }
+        }
+    }
+
+    // NOTE(jesper): phis whose entries are all the same value, or the phi itself, are replaced by a
+    // copy of that value. Removing one can make others trivial, so it's repeated until none are
+    Array<i32> repl = array_create<i32>(proc->regs.count, scratch);
+    for (i32 i = 0; i < repl.count; i++) repl[i] = i;
+
+    auto resolve = [&repl](i32 reg) -> i32
+    {
+        while (repl[reg] != reg) reg = repl[reg];
+        return reg;
+    };
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (i32 bi = 0; bi < block_count; bi++) {
+            for (i32 j = 0; j < phi_locals[bi].count; j++) {
+                IrInst &phi = proc->blocks[bi].insts[j];
+                if (phi.op != IR_PHI) continue;
+
+                i32 value = IR_NONE;
+                bool trivial = true;
+                for (i32 k = 0; k < phi.incoming_count && trivial; k++) {
+                    i32 reg = resolve(proc->phi_incoming[phi.incoming + k].value);
+                    if (reg == phi.dst || reg == value) continue;
+                    trivial = value == IR_NONE;
+                    value = reg;
+                }
+                if (!trivial) continue;
+
+                if (value == IR_NONE) value = zero[phi_locals[bi][j]];
+                repl[phi.dst] = value;
+                phi = { .op = IR_COPY, .dst = phi.dst, .a = value, .b = IR_NONE };
+                changed = true;
+            }
+        }
+    }
+
+    // NOTE(jesper): the copies are moved after the remaining phis, so that those stay at the start
+    // of their block
+    for (i32 bi = 0; bi < block_count; bi++) {
+        i32 count = phi_locals[bi].count;
+        if (count == 0) continue;
+
+        DynamicArray<IrInst> &insts = proc->blocks[bi].insts;
+        Array<IrInst> head = array_create<IrInst>(count, scratch);
+        i32 phis = 0;
+        for (i32 i = 0; i < count; i++) {
+            if (insts[i].op == IR_PHI) head[phis++] = insts[i];
+        }
+        for (i32 i = 0, copies = phis; i < count; i++) {
+            if (insts[i].op != IR_PHI) head[copies++] = insts[i];
+        }
+        for (i32 i = 0; i < count; i++) insts[i] = head[i];
+    }
+}
+
+void ir_copy_propagation(IrProc *proc)
+{
+    SArena scratch = tl_scratch_arena();
+
+    Array<i32> repl = array_create<i32>(proc->regs.count, scratch);
+    for (i32 i = 0; i < repl.count; i++) repl[i] = i;
+
+    for (IrBlock &block : proc->blocks) {
+        for (IrInst &inst : block.insts) {
+            if (inst.op == IR_COPY) repl[inst.dst] = inst.a;
+        }
+    }
+
+    // NOTE(jesper): registers are only assigned once, so chains of copies can be resolved
+    // independently of the order they appear in
+    auto resolve = [&repl](i32 reg) -> i32
+    {
+        if (reg == IR_NONE) return reg;
+        while (repl[reg] != reg) reg = repl[reg];
+        return reg;
+    };
+
+    for (IrBlock &block : proc->blocks) {
+        for (IrInst &inst : block.insts) {
+            inst.a = resolve(inst.a);
+            inst.b = resolve(inst.b);
+            if (inst.op == IR_INDEX_STORE) inst.value = resolve(inst.value);
+            if (inst.op == IR_ATOMIC_CAS) inst.desired = resolve(inst.desired);
+        }
+    }
+
+    for (i32 &arg : proc->args) arg = resolve(arg);
+    for (IrPhiIncoming &it : proc->phi_incoming) it.value = resolve(it.value);
+}
+
+static bool ir_uses_local(IrOp op)
+{
+    return op == IR_LOAD || op == IR_STORE || op == IR_SLICE || op == IR_ADDR;
+}
+
+static bool ir_has_side_effects(IrInst &inst)
+{
+    switch (inst.op) {
+    case IR_STORE:
+    case IR_CALL:
+    case IR_RET:
+    case IR_JUMP:
+    case IR_BRANCH:
+    case IR_SWITCH:
+    case IR_INDEX_STORE:
+    case IR_PTR_STORE:
+    case IR_BOUNDS_CHECK:
+    case IR_ATOMIC_LOAD:
+    case IR_ATOMIC_STORE:
+    case IR_ATOMIC_RMW:
+    case IR_ATOMIC_CAS:
+    case IR_FENCE:
+    case IR_PARALLEL_FOR:
+    case IR_PREFETCH:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void ir_dead_code_elimination(IrProc *proc)
+{
+    SArena scratch = tl_scratch_arena();
+
+    struct InstRef { i32 block, index; };
+    Array<InstRef> defs = array_create<InstRef>(proc->regs.count, scratch);
+    Array<bool> live = array_create<bool>(proc->regs.count, scratch);
+    for (bool &it : live) it = false;
+
+    DynamicArray<i32> worklist{ .alloc = scratch };
+
+    auto mark = [&](i32 reg)
+    {
+        if (reg == IR_NONE || live[reg]) return;
+        live[reg] = true;
+        array_add(&worklist, reg);
+    };
+
+    for (i32 bi = 0; bi < proc->blocks.count; bi++) {
+        DynamicArray<IrInst> &insts = proc->blocks[bi].insts;
+        for (i32 i = 0; i < insts.count; i++) {
+            if (insts[i].dst != IR_NONE) defs[insts[i].dst] = { bi, i };
+            if (ir_has_side_effects(insts[i])) {
+                mark(insts[i].a);
+                mark(insts[i].b);
+            }
+
+            if (insts[i].op == IR_CALL || insts[i].op == IR_PARALLEL_FOR) {
+                for (i32 j = 0; j < insts[i].arg_count; j++) mark(proc->args[insts[i].args + j]);
+            }
+
+            if (insts[i].op == IR_INDEX_STORE) mark(insts[i].value);
+            if (insts[i].op == IR_ATOMIC_CAS) mark(insts[i].desired);
+        }
+    }
+
+    while (worklist.count > 0) {
+        InstRef def = defs[array_pop(&worklist)];
+        IrInst &inst = proc->blocks[def.block].insts[def.index];
+        mark(inst.a);
+        mark(inst.b);
+
+        if (inst.op == IR_VECTOR) {
+            for (i32 j = 0; j < inst.arg_count; j++) mark(proc->args[inst.args + j]);
+        }
+
+        if (inst.op == IR_PHI) {
+            for (i32 j = 0; j < inst.incoming_count; j++) mark(proc->phi_incoming[inst.incoming + j].value);
+        }
+    }
+
+    Array<bool> local_used = array_create<bool>(proc->locals.count, scratch);
+    for (bool &it : local_used) it = false;
+
+    for (IrBlock &block : proc->blocks) {
+        i32 count = 0;
+        for (IrInst &inst : block.insts) {
+            if (inst.op == IR_NOP) continue;
+            if (!ir_has_side_effects(inst) && (inst.dst == IR_NONE || !live[inst.dst])) continue;
+
+            if (ir_uses_local(inst.op)) local_used[inst.local] = true;
+            block.insts[count++] = inst;
+        }
+
+        block.insts.count = count;
+    }
+
+    // NOTE(jesper): locals that are no longer accessed, typically because mem2reg promoted
+    // them, are removed so that the backends don't reserve stack space for them
+    Array<i32> local_remap = array_create<i32>(proc->locals.count, scratch);
+    i32 local_count = 0;
+    for (i32 i = 0; i < proc->locals.count; i++) {
+        local_remap[i] = local_used[i] ? local_count : IR_NONE;
+        if (local_used[i]) proc->locals[local_count++] = proc->locals[i];
+    }
+    proc->locals.count = local_count;
+
+    for (IrBlock &block : proc->blocks) {
+        for (IrInst &inst : block.insts) {
+            if (ir_uses_local(inst.op)) inst.local = local_remap[inst.local];
+        }
+    }
+}
+
+// NOTE(jesper): a bounds check is removed when the range of the index can be shown to be within
+// the count of the slice. Ranges are derived from constants and the arithmetic on them, and from
+// the condition of a loop that the index is an induction variable of. Locals whose address is
+// taken can be changed through pointers, so only the others are known to be changed by nothing
+// but the stores to them
+struct IrInstRef {
+    i32 block;
+    i32 index;
+};
+
+struct IrRange {
+    i64 lo, hi;
+};
+
+struct IrBoundsContext {
+    IrModule *module;
+    IrProc *proc;
+    Allocator mem;
+
+    Array<IrInstRef> defs;
+    Array<i32> store_count;
+    Array<IrInstRef> last_store;
+    Array<bool> address_taken;
+    Array<DynamicArray<i32>> preds;
+    Array<Array<bool>> loop_blocks;
+};
+
+static IrInst* ir_def(IrBoundsContext *ctx, i32 reg)
+{
+    if (reg == IR_NONE || ctx->defs[reg].block == IR_NONE) return nullptr;
+    return &ctx->proc->blocks[ctx->defs[reg].block].insts[ctx->defs[reg].index];
+}
+
+static bool ir_type_range(TypeExpr type, IrRange *range)
+{
+    if (type.lanes != 0 || type.elems != 0 || type.pointers != 0) return false;
+
+    // NOTE(jesper): u64 values that don't fit in an i64 are never known
+    i32 bits = type.size*8;
+    if (type == T_SIGNED) {
+        *range = bits == 64 ? IrRange{ i64_MIN, i64_MAX } : IrRange{ -(1ll << (bits-1)), (1ll << (bits-1)) - 1 };
+        return true;
+    } else if (type == T_UNSIGNED) {
+        *range = { 0, bits == 64 ? i64_MAX : (1ll << bits) - 1 };
+        return true;
+    }
+
+    return false;
+}
+
+// NOTE(jesper): the natural loop, the header and every block that can reach the latch without
+// going through the header
+static Array<bool> ir_loop_blocks(IrBoundsContext *ctx, i32 loop_index)
+{
+    Array<bool> &blocks = ctx->loop_blocks[loop_index];
+    if (blocks.count > 0) return blocks;
+
+    IrLoop &loop = ctx->proc->loops[loop_index];
+    blocks = array_create<bool>(ctx->proc->blocks.count, ctx->mem);
+    for (bool &it : blocks) it = false;
+    blocks[loop.header] = true;
+
+    DynamicArray<i32> worklist{ .alloc = ctx->mem };
+    array_add(&worklist, loop.latch);
+    while (worklist.count > 0) {
+        i32 block = array_pop(&worklist);
+        if (blocks[block]) continue;
+
+        blocks[block] = true;
+        array_add(&worklist, ctx->preds[block].data, ctx->preds[block].count);
+    }
+
+    return blocks;
+}
+
+static bool ir_loads_local(IrBoundsContext *ctx, i32 reg, i32 local, i32 block)
+{
+    IrInst *def = ir_def(ctx, reg);
+    return def && def->op == IR_LOAD && def->local == local && ctx->defs[reg].block == block;
+}
+
+static bool ir_reg_range(IrBoundsContext *ctx, i32 reg, IrRange *range, i32 depth, bool *induction);
+
+// NOTE(jesper): the range of a local in the loop that it's an induction variable of. The local
+// has to be compared against the bound in the loop header, incremented by a non-negative amount
+// in the latch and nowhere else in the loop, and assigned right before entering the loop. Its
+// value is then in [init, bound) wherever it's loaded in the loop before being incremented.
+// With a slice count as the bound, bound_slice is set instead of the upper end of the range
+static bool ir_induction_range(
+    IrBoundsContext *ctx,
+    IrInstRef load,
+    IrRange *range,
+    i32 *bound_slice,
+    i32 depth,
+    bool *induction)
+{
+    IrProc *proc = ctx->proc;
+    i32 local = proc->blocks[load.block].insts[load.index].local;
+
+    IrRange type_range;
+    if (ctx->address_taken[local] || !ir_type_range(proc->locals[local].type, &type_range)) return false;
+
+    for (i32 li = 0; li < proc->loops.count; li++) {
+        IrLoop &loop = proc->loops[li];
+        Array<bool> blocks = ir_loop_blocks(ctx, li);
+        if (!blocks[load.block] || load.block == loop.header) continue;
+
+        DynamicArray<IrInst> &header = proc->blocks[loop.header].insts;
+        IrInst &branch = header[header.count-1];
+        if (branch.op != IR_BRANCH || !blocks[branch.target] || blocks[branch.target_else]) continue;
+
+        IrInst *cond = ir_def(ctx, branch.a);
+        if (!cond) continue;
+
+        i32 bound;
+        bool inclusive;
+        if ((cond->op == IR_LT || cond->op == IR_LE) && ir_loads_local(ctx, cond->a, local, loop.header)) {
+            bound = cond->b;
+            inclusive = cond->op == IR_LE;
+        } else if ((cond->op == IR_GT || cond->op == IR_GE) && ir_loads_local(ctx, cond->b, local, loop.header)) {
+            bound = cond->a;
+            inclusive = cond->op == IR_GE;
+        } else {
+            continue;
+        }
+
+        bool valid = true;
+        i64 step_max = 0;
+        for (i32 bi = 0; bi < blocks.count && valid; bi++) {
+            if (!blocks[bi]) continue;
+
+            DynamicArray<IrInst> &insts = proc->blocks[bi].insts;
+            for (i32 i = 0; i < insts.count && valid; i++) {
+                if (insts[i].op != IR_STORE || insts[i].local != local) continue;
+                if (bi != loop.latch || (bi == load.block && i < load.index)) {
+                    valid = false;
+                    break;
+                }
+
+                IrInst *add = ir_def(ctx, insts[i].a);
+                if (!add || add->op != IR_ADD) {
+                    valid = false;
+                    break;
+                }
+
+                i32 step = ir_loads_local(ctx, add->a, local, ctx->defs[add->a].block) ? add->b
+                    : ir_loads_local(ctx, add->b, local, ctx->defs[add->b].block) ? add->a
+                    : IR_NONE;
+
+                IrRange step_range;
+                valid = step != IR_NONE &&
+                    ir_reg_range(ctx, step, &step_range, depth+1, induction) &&
+                    step_range.lo >= 0 &&
+                    !__builtin_add_overflow(step_max, step_range.hi, &step_max);
+            }
+        }
+        if (!valid) continue;
+
+        DynamicArray<i32> &preds = ctx->preds[loop.header];
+        if (preds.count != 2) continue;
+
+        i32 entry = preds[0] == loop.latch ? preds[1] : preds[0];
+        if (blocks[entry]) continue;
+
+        i32 init = IR_NONE;
+        DynamicArray<IrInst> &entry_insts = proc->blocks[entry].insts;
+        for (i32 i = entry_insts.count-1; i >= 0 && init == IR_NONE; i--) {
+            if (entry_insts[i].op == IR_STORE && entry_insts[i].local == local) init = entry_insts[i].a;
+        }
+
+        IrRange init_range;
+        if (init == IR_NONE || !ir_reg_range(ctx, init, &init_range, depth+1, induction)) continue;
+
+        // NOTE(jesper): the increments can't wrap around once the local reaches the bound. Slice
+        // counts are assumed to leave enough room below the maximum of a 64 bit local
+        IrInst *bound_def = ir_def(ctx, bound);
+        if (bound_def && bound_def->op == IR_COUNT && !inclusive) {
+            if (proc->locals[local].type.size != 8 || step_max > u32_MAX) continue;
+
+            *range = { init_range.lo, i64_MAX };
+            *bound_slice = bound_def->a;
+            return true;
+        }
+
+        IrRange bound_range;
+        if (!ir_reg_range(ctx, bound, &bound_range, depth+1, induction)) continue;
+
+        i64 hi = inclusive ? bound_range.hi : bound_range.hi - 1;
+        if (hi > type_range.hi - step_max) continue;
+
+        *range = { init_range.lo, hi };
+        *bound_slice = IR_NONE;
+        return true;
+    }
+
+    return false;
+}
+
+static bool ir_reg_range(IrBoundsContext *ctx, i32 reg, IrRange *range, i32 depth, bool *induction)
+{
+    if (depth > 8) return false;
+
+    IrRange type_range;
+    if (!ir_type_range(ctx->proc->regs[reg], &type_range)) return false;
+
+    IrInst *inst = ir_def(ctx, reg);
+    if (!inst) return false;
+
+    IrRange a, b;
+    switch (inst->op) {
+    case IR_CONST:
+        if (inst->ival < type_range.lo || inst->ival > type_range.hi) return false;
+        *range = { inst->ival, inst->ival };
+        break;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+        if (!ir_reg_range(ctx, inst->a, &a, depth+1, induction) ||
+            !ir_reg_range(ctx, inst->b, &b, depth+1, induction))
+        {
+            return false;
+        }
+
+        if (inst->op == IR_ADD) {
+            if (__builtin_add_overflow(a.lo, b.lo, &range->lo) ||
+                __builtin_add_overflow(a.hi, b.hi, &range->hi))
+            {
+                return false;
+            }
+        } else if (inst->op == IR_SUB) {
+            if (__builtin_sub_overflow(a.lo, b.hi, &range->lo) ||
+                __builtin_sub_overflow(a.hi, b.lo, &range->hi))
+            {
+                return false;
+            }
+        } else {
+            i64 products[4];
+            if (__builtin_mul_overflow(a.lo, b.lo, &products[0]) ||
+                __builtin_mul_overflow(a.lo, b.hi, &products[1]) ||
+                __builtin_mul_overflow(a.hi, b.lo, &products[2]) ||
+                __builtin_mul_overflow(a.hi, b.hi, &products[3]))
+            {
+                return false;
+            }
+
+            *range = { products[0], products[0] };
+            for (i64 p : products) {
+                range->lo = MIN(range->lo, p);
+                range->hi = MAX(range->hi, p);
+            }
+        }
+        break;
+    case IR_EXTEND:
+        if (!ir_reg_range(ctx, inst->a, range, depth+1, induction)) return false;
+        break;
+    case IR_LOAD: {
+        i32 bound_slice;
+        if (!ir_induction_range(ctx, ctx->defs[reg], range, &bound_slice, depth+1, induction) ||
+            bound_slice != IR_NONE)
+        {
+            return false;
+        }
+
+        *induction = true;
+        } break;
+    default:
+        return false;
+    }
+
+    // NOTE(jesper): arithmetic that might wrap around in the type of the register can't be
+    // reasoned about
+    return range->lo >= type_range.lo && range->hi <= type_range.hi;
+}
+
+// NOTE(jesper): slices loaded from a local that's only assigned once are the same slice wherever
+// they're loaded
+static i32 ir_slice_key(IrBoundsContext *ctx, i32 reg)
+{
+    IrInst *def = ir_def(ctx, reg);
+    if (!def) return reg;
+
+    if (def->op == IR_LOAD && ctx->store_count[def->local] == 1 && !ctx->address_taken[def->local]) {
+        return ctx->proc->regs.count + def->local;
+    }
+
+    if (def->op == IR_SLICE) return ctx->proc->regs.count + ctx->proc->locals.count + def->local;
+    if (def->op == IR_GLOBAL) return ctx->proc->regs.count + 2*ctx->proc->locals.count + def->global;
+    return reg;
+}
+
+static bool ir_slice_count(IrBoundsContext *ctx, i32 reg, i64 *count, i32 depth)
+{
+    IrInst *def = ir_def(ctx, reg);
+    if (!def || depth > 8) return false;
+
+    switch (def->op) {
+    case IR_SLICE:
+        *count = ctx->proc->locals[def->local].type.elems;
+        return true;
+    case IR_GLOBAL:
+        *count = ctx->module->globals[def->global].type.elems;
+        return true;
+    case IR_CONST:
+        *count = 0;
+        return true;
+    case IR_LOAD:
+        if (ctx->store_count[def->local] != 1 || ctx->address_taken[def->local]) return false;
+        {
+            IrInstRef store = ctx->last_store[def->local];
+            return ir_slice_count(ctx, ctx->proc->blocks[store.block].insts[store.index].a, count, depth+1);
+        }
+    default:
+        return false;
+    }
+}
+
+void ir_bounds_check_elimination(IrModule *ir, IrProc *proc, IrBoundsCheckStats *stats)
+{
+    SArena scratch = tl_scratch_arena();
+
+    IrBoundsContext ctx{
+        .module = ir,
+        .proc = proc,
+        .mem = scratch,
+        .defs = array_create<IrInstRef>(proc->regs.count, scratch),
+        .store_count = array_create<i32>(proc->locals.count, scratch),
+        .last_store = array_create<IrInstRef>(proc->locals.count, scratch),
+        .address_taken = array_create<bool>(proc->locals.count, scratch),
+        .preds = array_create<DynamicArray<i32>>(proc->blocks.count, scratch),
+        .loop_blocks = array_create<Array<bool>>(proc->loops.count, scratch),
+    };
+
+    for (IrInstRef &it : ctx.defs) it = { IR_NONE, IR_NONE };
+    for (i32 &it : ctx.store_count) it = 0;
+    for (bool &it : ctx.address_taken) it = false;
+    for (DynamicArray<i32> &it : ctx.preds) it = { .alloc = scratch };
+    for (Array<bool> &it : ctx.loop_blocks) it = {};
+
+    for (i32 bi = 0; bi < proc->blocks.count; bi++) {
+        DynamicArray<IrInst> &insts = proc->blocks[bi].insts;
+        for (i32 i = 0; i < insts.count; i++) {
+            IrInst &inst = insts[i];
+            if (inst.dst != IR_NONE) ctx.defs[inst.dst] = { bi, i };
+
+            if (inst.op == IR_STORE) {
+                ctx.store_count[inst.local]++;
+                ctx.last_store[inst.local] = { bi, i };
+            }
+
+            if (inst.op == IR_ADDR) ctx.address_taken[inst.local] = true;
+
+            if (inst.op == IR_JUMP) array_add(&ctx.preds[inst.target], bi);
+            if (inst.op == IR_BRANCH) {
+                array_add(&ctx.preds[inst.target], bi);
+                array_add(&ctx.preds[inst.target_else], bi);
+            }
+
+            if (inst.op == IR_SWITCH) {
+                for (i32 c = 0; c < inst.case_count; c++) {
+                    array_add(&ctx.preds[proc->switch_cases[inst.cases + c].target], bi);
+                }
+                array_add(&ctx.preds[inst.target_else], bi);
+            }
+        }
+    }
+
+    for (IrBlock &block : proc->blocks) {
+        for (IrInst &inst : block.insts) {
+            if (inst.op != IR_BOUNDS_CHECK) continue;
+            stats->checks++;
+
+            bool induction = false;
+            IrRange index;
+            i64 count;
+            if (ir_slice_count(&ctx, inst.b, &count, 0) &&
+                ir_reg_range(&ctx, inst.a, &index, 0, &induction) &&
+                index.lo >= 0 && index.hi < count)
+            {
+                if (induction) stats->removed_induction++;
+                else stats->removed_constant++;
+                inst = { .op = IR_NOP, .dst = IR_NONE, .a = IR_NONE, .b = IR_NONE };
+                continue;
+            }
+
+            // NOTE(jesper): loops over the count of the slice they're indexing
+            IrInst *def = ir_def(&ctx, inst.a);
+            i32 bound_slice;
+            if (def && def->op == IR_LOAD &&
+                ir_induction_range(&ctx, ctx.defs[inst.a], &index, &bound_slice, 0, &induction) &&
+                bound_slice != IR_NONE && index.lo >= 0 &&
+                ir_slice_key(&ctx, bound_slice) == ir_slice_key(&ctx, inst.b))
+            {
+                stats->removed_induction++;
+                inst = { .op = IR_NOP, .dst = IR_NONE, .a = IR_NONE, .b = IR_NONE };
+            }
+        }
+    }
+}
+
+void ir_optimize(IrModule *ir)
+{
+    IrBoundsCheckStats bounds{};
+    for (IrProc &proc : ir->procs) {
+        if (!proc.defined) continue;
+
+        ir_mem2reg(&proc);
+        ir_copy_propagation(&proc);
+
+        // NOTE(jesper): the bounds checks are eliminated before the rest of the locals are
+        // promoted, its induction variable analysis works on their loads and stores
+        ir_bounds_check_elimination(ir, &proc, &bounds);
+        ir_construct_ssa(&proc);
+        ir_copy_propagation(&proc);
+        ir_dead_code_elimination(&proc);
+    }
+
+    if (bounds.checks > 0) {
+        LOG_INFO("ir: removed %d of %d bounds checks, %d by constant ranges and %d by loop induction",
+                 bounds.removed_constant + bounds.removed_induction, bounds.checks,
+                 bounds.removed_constant, bounds.removed_induction);
+    }
+}
+
+Array<i32> ir_profile_counters(IrProc *proc, Allocator mem, i32 *count)
+{
+    Array<i32> first = array_create<i32>(proc->blocks.count, mem);
+
+    *count = 1;
+    for (i32 bi = 0; bi < proc->blocks.count; bi++) {
+        DynamicArray<IrInst> &insts = proc->blocks[bi].insts;
+        IrOp op = insts.count > 0 ? insts[insts.count-1].op : IR_NOP;
+
+        first[bi] = IR_NONE;
+        if (op != IR_BRANCH && op != IR_SWITCH) continue;
+
+        first[bi] = *count;
+        for (i32 i = 0; ir_successor(proc, bi, i) != IR_NONE; i++) (*count)++;
+    }
+
+    return first;
+}
+
+u32 ir_profile_checksum(IrProc *proc)
+{
+    u32 checksum = hash32(proc->blocks.count);
+    for (i32 bi = 0; bi < proc->blocks.count; bi++) {
+        DynamicArray<IrInst> &insts = proc->blocks[bi].insts;
+        checksum = hash32((i32)(insts.count > 0 ? insts[insts.count-1].op : IR_NOP), checksum);
+
+        for (i32 i = 0, succ; (succ = ir_successor(proc, bi, i)) != IR_NONE; i++) {
+            checksum = hash32(succ, checksum);
+        }
+    }
+
+    return checksum;
+}
+
+static String ir_profile_token(String *profile)
+{
+    i32 start = 0;
+    while (start < profile->length && is_whitespace(profile->data[start])) start++;
+
+    i32 end = start;
+    while (end < profile->length && !is_whitespace(profile->data[end])) end++;
+
+    String token = slice(*profile, start, end);
+    *profile = slice(*profile, end);
+    return token;
+}
+
+static bool ir_profile_u64(String *profile, u64 *dst)
+{
+    String token = ir_profile_token(profile);
+    if (token.length == 0) return false;
+
+    u64 value = 0;
+    for (i32 i = 0; i < token.length; i++) {
+        if (!is_number(token.data[i])) return false;
+        value = value*10 + (u64)(token.data[i] - '0');
+    }
+
+    *dst = value;
+    return true;
+}
+
+bool ir_apply_profile(IrModule *ir, String profile)
+{
+    SArena scratch = tl_scratch_arena();
+
+    if (ir_profile_token(&profile) != "tir-profile" || ir_profile_token(&profile) != "1") {
+        LOG_ERROR("not a tir profile, or one written by a different version of tir");
+        return false;
+    }
+
+    // NOTE(jesper): the procedures of parallel loop bodies aren't in proc_indices
+    HashTable<String, i32> procs{ .alloc = scratch };
+    for (i32 i = 0; i < ir->procs.count; i++) {
+        if (ir->procs[i].defined) map_set(&procs, ir->procs[i].name, i);
+    }
+
+    i32 applied = 0, stale = 0;
+    for (;;) {
+        String name = ir_profile_token(&profile);
+        if (name.length == 0) break;
+
+        u64 checksum, counter_count;
+        if (!ir_profile_u64(&profile, &checksum) || !ir_profile_u64(&profile, &counter_count) ||
+            counter_count > (u64)profile.length)
+        {
+            LOG_ERROR("malformed profile entry of '%.*s'", STRFMT(name));
+            return false;
+        }
+
+        Array<u64> counters = array_create<u64>((i32)counter_count, ir->mem);
+        for (u64 &counter : counters) {
+            if (!ir_profile_u64(&profile, &counter)) {
+                LOG_ERROR("malformed profile entry of '%.*s'", STRFMT(name));
+                return false;
+            }
+        }
+
+        i32 *index = map_find(&procs, name);
+        if (!index) {
+            stale++;
+            continue;
+        }
+
+        IrProc *proc = &ir->procs[*index];
+
+        i32 count;
+        ir_profile_counters(proc, scratch, &count);
+        if (checksum != ir_profile_checksum(proc) || counter_count != (u64)count) {
+            stale++;
+            continue;
+        }
+
+        proc->profile = counters;
+        applied++;
+    }
+
+    LOG_INFO("ir: applied the profile of %d procedures", applied);
+    if (stale > 0) {
+        LOG_INFO("ir: ignored the profile of %d procedures that have changed since it was generated", stale);
+    }
+
+    return true;
+}
+
+i32 ir_inst_count(IrProc *proc)
+{
+    i32 count = 0;
+    for (IrBlock &block : proc->blocks) count += block.insts.count;
+    return count;
+}
+
+static const char* sz_type_name(TypeExpr type, char *buffer, i32 size)
+{
+    i32 length = 0;
+    if (type.elems > 0) length = snprintf(buffer, size, "[%d]", type.elems);
+    else if (type.elems == TYPE_SLICE) length = snprintf(buffer, size, "[]");
+    for (i32 i = 0; i < type.pointers; i++) length += snprintf(buffer+length, size-length, "*");
+
+    switch (type.prim) {
+    case T_VOID:     return "void";
+    case T_BOOL:     length += snprintf(buffer+length, size-length, "bool"); break;
+    case T_SIGNED:   length += snprintf(buffer+length, size-length, "i%d", type.size*8); break;
+    case T_UNSIGNED: length += snprintf(buffer+length, size-length, "u%d", type.size*8); break;
+    case T_FLOAT:    length += snprintf(buffer+length, size-length, "f%d", type.size*8); break;
+    case T_STRUCT:
+        snprintf(buffer+length, size-length, "%.*s", STRFMT(type.struct_type->identifier.str));
+        return buffer;
+    default:         return sz_from_enum(type.prim);
+    }
+
+    if (type.lanes > 0) snprintf(buffer+length, size-length, "x%d", type.lanes);
+    return buffer;
+}
+
+void ir_print(IrModule *ir)
+{
+    SArena scratch = tl_scratch_arena();
+    StringBuilder sb{ .alloc = scratch };
+
+    char type_buffer[32];
+    for (IrGlobal &global : ir->globals) {
+        append_stringf(&sb, "global @%.*s: %s = (",
+                       STRFMT(global.name),
+                       sz_type_name(global.type, type_buffer, sizeof type_buffer));
+        for (i32 i = 0; i < global.values.count; i++) {
+            if (global.type == T_FLOAT) append_stringf(&sb, "%s%g", i > 0 ? ", " : "", global.values[i].fval);
+            else append_stringf(&sb, "%s%lld", i > 0 ? ", " : "", (long long)global.values[i].ival);
+        }
+        append_string(&sb, ")\n");
+    }
+
+    for (IrProc &proc : ir->procs) {
+        append_stringf(&sb, "%s%s%s %.*s(",
+                       proc.exported ? "export " : "",
+                       proc.cold ? "#cold " : proc.hot ? "#hot " : "",
+                       proc.defined ? "proc" : "foreign",
+                       STRFMT(proc.name));
+        for (i32 i = 0; i < proc.params.count; i++) {
+            append_stringf(&sb, "%s%s%s",
+                           i > 0 ? ", " : "",
+                           proc.noalias[i] ? "#restrict " : "",
+                           sz_type_name(proc.params[i], type_buffer, sizeof type_buffer));
+        }
+        append_stringf(&sb, ") -> %s\n", sz_type_name(proc.ret_type, type_buffer, sizeof type_buffer));
+        if (!proc.defined) continue;
+
+        if (proc.profile.count > 0) append_stringf(&sb, "  profile: entered %llu times\n", (unsigned long long)proc.profile[0]);
+
+        for (i32 i = 0; i < proc.locals.count; i++) {
+            append_stringf(&sb, "  local %%%d %.*s: %s\n",
+                           i, STRFMT(proc.locals[i].name),
+                           sz_type_name(proc.locals[i].type, type_buffer, sizeof type_buffer));
+        }
+
+        for (IrLoop &loop : proc.loops) {
+            append_stringf(&sb, "  loop bb%d, latch bb%d", loop.header, loop.latch);
+            if (loop.hints.vectorize_width) append_stringf(&sb, " vectorize(%d)", loop.hints.vectorize_width);
+            if (loop.hints.unroll_count) append_stringf(&sb, " unroll(%d)", loop.hints.unroll_count);
+            if (loop.hints.no_vectorize) append_string(&sb, " no_vectorize");
+            if (loop.hints.no_unroll) append_string(&sb, " no_unroll");
+            append_string(&sb, "\n");
+        }
+
+        for (i32 bi = 0; bi < proc.blocks.count; bi++) {
+            append_stringf(&sb, "bb%d:\n", bi);
+
+            for (IrInst &inst : proc.blocks[bi].insts) {
+                append_string(&sb, "    ");
+                if (inst.dst != IR_NONE) {
+                    append_stringf(&sb, "r%d: %s = ", inst.dst,
+                                   sz_type_name(proc.regs[inst.dst], type_buffer, sizeof type_buffer));
+                }
+
+                append_string(&sb, string(sz_from_enum(inst.op)));
+
+                switch (inst.op) {
+                case IR_CONST:
+                    if (proc.regs[inst.dst] == T_FLOAT) append_stringf(&sb, " %f", inst.fval);
+                    else append_stringf(&sb, " %lld", (long long)inst.ival);
+                    break;
+                case IR_LOAD:
+                    append_stringf(&sb, " %%%d", inst.local);
+                    break;
+                case IR_STORE:
+                    append_stringf(&sb, " %%%d, r%d", inst.local, inst.a);
+                    break;
+                case IR_PARAM:
+                    append_stringf(&sb, " %d", inst.param);
+                    break;
+                case IR_CALL:
+                    append_stringf(&sb, " %.*s(", STRFMT(ir->procs[inst.proc].name));
+                    for (i32 i = 0; i < inst.arg_count; i++) {
+                        append_stringf(&sb, "%sr%d", i > 0 ? ", " : "", proc.args[inst.args + i]);
+                    }
+                    append_string(&sb, ")");
+                    break;
+                case IR_PARALLEL_FOR:
+                    append_stringf(&sb, " r%d..r%d %.*s(", inst.a, inst.b, STRFMT(ir->procs[inst.proc].name));
+                    for (i32 i = 0; i < inst.arg_count; i++) {
+                        append_stringf(&sb, "%sr%d", i > 0 ? ", " : "", proc.args[inst.args + i]);
+                    }
+                    append_string(&sb, ")");
+                    if (inst.grain_size) append_stringf(&sb, " grain(%d)", inst.grain_size);
+                    break;
+                case IR_VECTOR:
+                    for (i32 i = 0; i < inst.arg_count; i++) {
+                        append_stringf(&sb, "%sr%d", i > 0 ? ", " : " ", proc.args[inst.args + i]);
+                    }
+                    break;
+                case IR_EXTRACT:
+                    append_stringf(&sb, " r%d[%d]", inst.a, inst.lane);
+                    break;
+                case IR_SLICE:
+                case IR_ADDR:
+                    append_stringf(&sb, " %%%d", inst.local);
+                    break;
+                case IR_GLOBAL:
+                    append_stringf(&sb, " @%.*s", STRFMT(ir->globals[inst.global].name));
+                    break;
+                case IR_INDEX:
+                case IR_INDEX_ADDR:
+                    append_stringf(&sb, " r%d[r%d]", inst.a, inst.b);
+                    if (inst.field != IR_NONE) append_stringf(&sb, ".%d", inst.field);
+                    break;
+                case IR_INDEX_STORE:
+                    append_stringf(&sb, " r%d[r%d]", inst.a, inst.b);
+                    if (inst.field != IR_NONE) append_stringf(&sb, ".%d", inst.field);
+                    append_stringf(&sb, ", r%d", inst.value);
+                    break;
+                case IR_FIELD:
+                    append_stringf(&sb, " r%d.%d", inst.a, inst.field);
+                    break;
+                case IR_INSERT_FIELD:
+                    append_stringf(&sb, " r%d.%d, r%d", inst.a, inst.field, inst.b);
+                    break;
+                case IR_ATOMIC_LOAD:
+                case IR_ATOMIC_STORE:
+                case IR_ATOMIC_RMW:
+                case IR_ATOMIC_CAS:
+                case IR_FENCE:
+                    if (inst.op == IR_ATOMIC_RMW) append_stringf(&sb, ".%s", sz_from_enum(inst.atomic_op));
+                    if (inst.a != IR_NONE) append_stringf(&sb, " r%d", inst.a);
+                    if (inst.b != IR_NONE) append_stringf(&sb, ", r%d", inst.b);
+                    if (inst.op == IR_ATOMIC_CAS) append_stringf(&sb, ", r%d", inst.desired);
+                    append_stringf(&sb, " %s", sz_from_enum(inst.order));
+                    break;
+                case IR_EXPECT:
+                    append_stringf(&sb, " r%d, %s", inst.a, inst.ival ? "true" : "false");
+                    break;
+                case IR_SHUFFLE:
+                    append_stringf(&sb, " r%d, <", inst.a);
+                    for (i32 i = 0; i < proc.regs[inst.dst].lanes; i++) {
+                        append_stringf(&sb, "%s%d", i > 0 ? ", " : "", inst.mask[i]);
+                    }
+                    append_string(&sb, ">");
+                    break;
+                case IR_JUMP:
+                    append_stringf(&sb, " bb%d", inst.target);
+                    break;
+                case IR_BRANCH:
+                    append_stringf(&sb, " r%d, bb%d, bb%d", inst.a, inst.target, inst.target_else);
+                    break;
+                case IR_PHI:
+                    for (i32 i = 0; i < inst.incoming_count; i++) {
+                        IrPhiIncoming &it = proc.phi_incoming[inst.incoming + i];
+                        append_stringf(&sb, "%s[bb%d: r%d]", i > 0 ? ", " : " ", it.block, it.value);
+                    }
+                    break;
+                case IR_SWITCH:
+                    append_stringf(&sb, " r%d, bb%d [", inst.a, inst.target_else);
+                    for (i32 c = 0; c < inst.case_count; c++) {
+                        IrSwitchCase &it = proc.switch_cases[inst.cases + c];
+                        append_stringf(&sb, "%s%lld: bb%d", c > 0 ? ", " : "", it.value, it.target);
+                    }
+                    append_string(&sb, "]");
+                    break;
+                default:
+                    if (inst.a != IR_NONE) append_stringf(&sb, " r%d", inst.a);
+                    if (inst.b != IR_NONE) append_stringf(&sb, ", r%d", inst.b);
+                    break;
+                }
+
+                append_string(&sb, "\n");
+            }
+        }
+    }
+
+    LOG_INFO("Generated tir IR:\n%s", sz_string(&sb, scratch));
+}
@@ -0,0 +1,417 @@
+#ifndef IR_H
+#define IR_H
+
+#include "tir.h"
+
+// NOTE(jesper): the mid-level IR sits between the typed AST and the backends. A procedure is
+// a list of basic blocks, each a flat array of instructions operating on typed virtual
+// registers that are assigned exactly once, and ending in a jump, branch or return. Locals live
+// in stack slots accessed through explicit loads and stores until they're promoted to registers:
+// mem2reg promotes the ones only accessed in a single block, and ir_construct_ssa the others
+// whose address is never taken, joined by phis where their values meet across blocks.
+// Everything is allocated from the module's arena, so the IR is released as a whole.
+
+#define IR_NONE -1
+
+enum IrOp : u8 {
+    IR_NOP = 0,
+
+    IR_CONST,
+    IR_COPY,
+    IR_PARAM,
+
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+
+    // NOTE(jesper): comparisons produce a bool, signed, unsigned or ordered float comparison is
+    // selected by the type of the operands
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_LE,
+    IR_GT,
+    IR_GE,
+
+    IR_LOAD,
+    IR_STORE,
+
+    IR_CALL,
+    IR_RET,
+    IR_JUMP,
+    IR_BRANCH,
+
+    // NOTE(jesper): jumps to the target of the case equal to a, or target_else if none are. It's
+    // only emitted for dense sets of cases, which the backends can turn into a jump table, the
+    // others are lowered to a tree of comparisons instead
+    IR_SWITCH,
+
+    // NOTE(jesper): takes the value of the incoming entry for the predecessor control came from.
+    // Phis are always at the start of their block
+    IR_PHI,
+
+    // NOTE(jesper): SIMD vector operations, the element-wise arithmetic is done by the regular
+    // ops with vector typed registers
+    IR_VECTOR,
+    IR_EXTRACT,
+    IR_SHUFFLE,
+    IR_REDUCE_ADD,
+    IR_REDUCE_MUL,
+    IR_REDUCE_MIN,
+    IR_REDUCE_MAX,
+
+    // NOTE(jesper): arrays are accessed through slices, a fixed array local is turned into one
+    // by IR_SLICE and a constant array by IR_GLOBAL. IR_BOUNDS_CHECK traps unless index a is less
+    // than the count of slice b
+    IR_SLICE,
+    IR_GLOBAL,
+    IR_COUNT,
+    IR_INDEX,
+    IR_INDEX_STORE,
+    IR_BOUNDS_CHECK,
+
+    // NOTE(jesper): struct values in registers, IR_INSERT_FIELD produces a copy of struct a with
+    // the field replaced by b. Fields of array elements are accessed directly by IR_INDEX and
+    // IR_INDEX_STORE instead of going through the whole element
+    IR_FIELD,
+    IR_INSERT_FIELD,
+
+    // NOTE(jesper): IR_ADDR of a local, which keeps it from being promoted to a register, and
+    // IR_INDEX_ADDR of element b of slice or pointer a. IR_INDEX and IR_INDEX_STORE index pointers
+    // the same way, without a bounds check. IR_PTR_STORE stores b to pointer a
+    IR_ADDR,
+    IR_INDEX_ADDR,
+    IR_PTR_LOAD,
+    IR_PTR_STORE,
+
+    // NOTE(jesper): atomic accesses of pointer a, IR_ATOMIC_STORE and IR_ATOMIC_RMW of value b,
+    // and IR_ATOMIC_CAS from b to desired. IR_ATOMIC_RMW and IR_ATOMIC_CAS produce the previous
+    // value
+    IR_ATOMIC_LOAD,
+    IR_ATOMIC_STORE,
+    IR_ATOMIC_RMW,
+    IR_ATOMIC_CAS,
+    IR_FENCE,
+
+    // NOTE(jesper): runs the outlined body of a parallel loop over the iterations [a, b), split
+    // across the threads of the runtime's pool. It returns once every iteration is done
+    IR_PARALLEL_FOR,
+
+    // NOTE(jesper): IR_EXPECT produces a, a bool, which is expected to be ival. IR_PREFETCH
+    // hints that the memory pointer a points to is about to be read. The bit operations are on
+    // scalar integers, with IR_ROTL and IR_ROTR rotating a by b bits
+    IR_EXPECT,
+    IR_PREFETCH,
+    IR_POPCOUNT,
+    IR_CLZ,
+    IR_CTZ,
+    IR_BSWAP,
+    IR_ROTL,
+    IR_ROTR,
+
+    // NOTE(jesper): widens a, a scalar integer, to the larger integer type of dst. It's sign
+    // extended if a is signed, and zero extended otherwise
+    IR_EXTEND,
+};
+
+inline const char* sz_from_enum(IrOp op)
+{
+    switch (op) {
+    case IR_NOP:   return "nop";
+    case IR_CONST: return "const";
+    case IR_COPY:  return "copy";
+    case IR_PARAM: return "param";
+    case IR_ADD:   return "add";
+    case IR_SUB:   return "sub";
+    case IR_MUL:   return "mul";
+    case IR_DIV:   return "div";
+    case IR_EQ:    return "eq";
+    case IR_NE:    return "ne";
+    case IR_LT:    return "lt";
+    case IR_LE:    return "le";
+    case IR_GT:    return "gt";
+    case IR_GE:    return "ge";
+    case IR_LOAD:  return "load";
+    case IR_STORE: return "store";
+    case IR_CALL:  return "call";
+    case IR_RET:   return "ret";
+    case IR_JUMP:  return "jump";
+    case IR_BRANCH: return "branch";
+    case IR_SWITCH: return "switch";
+    case IR_PHI:    return "phi";
+    case IR_VECTOR:  return "vector";
+    case IR_EXTRACT: return "extract";
+    case IR_SHUFFLE: return "shuffle";
+    case IR_REDUCE_ADD: return "reduce_add";
+    case IR_REDUCE_MUL: return "reduce_mul";
+    case IR_REDUCE_MIN: return "reduce_min";
+    case IR_REDUCE_MAX: return "reduce_max";
+    case IR_SLICE:   return "slice";
+    case IR_GLOBAL:  return "global";
+    case IR_COUNT:   return "count";
+    case IR_INDEX:   return "index";
+    case IR_INDEX_STORE: return "index_store";
+    case IR_BOUNDS_CHECK: return "bounds_check";
+    case IR_FIELD:   return "field";
+    case IR_INSERT_FIELD: return "insert_field";
+    case IR_ADDR:    return "addr";
+    case IR_INDEX_ADDR: return "index_addr";
+    case IR_PTR_LOAD: return "ptr_load";
+    case IR_PTR_STORE: return "ptr_store";
+    case IR_ATOMIC_LOAD: return "atomic_load";
+    case IR_ATOMIC_STORE: return "atomic_store";
+    case IR_ATOMIC_RMW: return "atomic_rmw";
+    case IR_ATOMIC_CAS: return "atomic_cas";
+    case IR_FENCE:   return "fence";
+    case IR_PARALLEL_FOR: return "parallel_for";
+    case IR_EXPECT:  return "expect";
+    case IR_PREFETCH: return "prefetch";
+    case IR_POPCOUNT: return "popcount";
+    case IR_CLZ:     return "clz";
+    case IR_CTZ:     return "ctz";
+    case IR_BSWAP:   return "bswap";
+    case IR_ROTL:    return "rotl";
+    case IR_ROTR:    return "rotr";
+    case IR_EXTEND:  return "extend";
+    }
+
+    return "invalid";
+}
+
+inline bool ir_is_terminator(IrOp op)
+{
+    return op == IR_RET || op == IR_JUMP || op == IR_BRANCH || op == IR_SWITCH;
+}
+
+inline bool ir_is_comparison(IrOp op)
+{
+    return op >= IR_EQ && op <= IR_GE;
+}
+
+struct IrInst {
+    IrOp op;
+
+    i32 dst;        // register written by the instruction, or IR_NONE
+    i32 a;          // operand registers, or IR_NONE
+    i32 b;
+
+    union {
+        i64 ival;   // IR_CONST, splat to every lane of vector types, and IR_EXPECT
+        f64 fval;   // IR_CONST of float type
+        i32 local;  // IR_LOAD, IR_STORE, IR_SLICE, IR_ADDR
+        i32 global; // IR_GLOBAL, index into IrModule::globals
+        i32 param;  // IR_PARAM, index into IrProc::params
+        i32 lane;   // IR_EXTRACT
+
+        // NOTE(jesper): IR_SHUFFLE selects mask[i] of a for each lane of dst
+        u8 mask[4];
+
+        // NOTE(jesper): IR_CALL of proc, an index into IrModule::procs, with arg_count argument
+        // registers starting at args in IrProc::args. IR_VECTOR uses the same argument list for
+        // its elements, a single element is splat to every lane. IR_PARALLEL_FOR passes the
+        // captured variables as the arguments, which proc takes followed by the bounds of the
+        // iterations it's handed, and gives the runtime the loop's grain_size
+        struct {
+            i32 proc;
+            i32 args;
+            i32 arg_count;
+            i32 grain_size;
+        };
+
+        // NOTE(jesper): IR_INDEX of element b of slice a, and IR_INDEX_STORE of value to it. The
+        // whole element is accessed when field is IR_NONE, otherwise only that field of it, an
+        // index into StructType::fields. IR_FIELD and IR_INSERT_FIELD only use the field
+        struct {
+            i32 value;
+            i32 field;
+        };
+
+        // NOTE(jesper): IR_ATOMIC_* and IR_FENCE, with atomic_op only used by IR_ATOMIC_RMW and
+        // desired by IR_ATOMIC_CAS
+        struct {
+            i32 desired;
+            AtomicOp atomic_op;
+            AtomicOrder order;
+        };
+
+        // NOTE(jesper): IR_JUMP to target, IR_BRANCH to target if a is true and target_else
+        // otherwise, indices into IrProc::blocks. IR_SWITCH has case_count cases starting at
+        // cases in IrProc::switch_cases, sorted by value, and only uses target_else
+        struct {
+            i32 target;
+            i32 target_else;
+            i32 cases;
+            i32 case_count;
+        };
+
+        // NOTE(jesper): IR_PHI has incoming_count entries starting at incoming in
+        // IrProc::phi_incoming, one for each edge into its block. See ir_for_each_phi_copy for
+        // the shadow register
+        struct {
+            i32 incoming;
+            i32 incoming_count;
+            i32 shadow;
+        };
+    };
+};
+
+struct IrBlock {
+    DynamicArray<IrInst> insts;
+};
+
+struct IrSwitchCase {
+    i64 value;
+    i32 target;
+};
+
+struct IrPhiIncoming {
+    i32 block;
+    i32 value;
+};
+
+struct IrLocal {
+    String name;
+    TypeExpr type;
+};
+
+union IrConstant {
+    i64 ival;
+    f64 fval;
+};
+
+// NOTE(jesper): read-only array of type.elems constants, which the backends place in read-only
+// data
+struct IrGlobal {
+    String name;
+    TypeExpr type;
+    Array<IrConstant> values;
+};
+
+// NOTE(jesper): the latch is the block that jumps back to the header, the backends attach the
+// loop's hints to that jump
+struct IrLoop {
+    i32 header;
+    i32 latch;
+    LoopHints hints;
+};
+
+struct IrProc {
+    String name;
+    TypeExpr ret_type;
+    Array<TypeExpr> params;
+    Array<bool> noalias;    // #restrict parameters
+    bool defined;
+
+    // NOTE(jesper): referenced from outside of the module, by #export or being the entry point.
+    // The backends are free to change the calling convention and linkage of the others
+    bool exported;
+
+    // NOTE(jesper): #cold procedures are rarely called, which makes the paths leading to calls
+    // of them unlikely, and are optimised for size. #hot procedures are the opposite
+    bool cold;
+    bool hot;
+
+    // NOTE(jesper): the counters of the procedure in the -fprofile-use profile, laid out as
+    // described by ir_profile_counters. Empty when the profile doesn't cover it
+    Array<u64> profile;
+
+    DynamicArray<TypeExpr> regs;
+    DynamicArray<i32> args;
+    DynamicArray<IrSwitchCase> switch_cases;
+    DynamicArray<IrPhiIncoming> phi_incoming;
+    DynamicArray<IrLocal> locals;
+    DynamicArray<IrBlock> blocks;
+    DynamicArray<IrLoop> loops;
+};
+
+struct IrModule {
+    Allocator mem;
+    bool bounds_checks;
+    bool uses_runtime;  // calls into libtir_runtime, which it has to be linked against
+
+    DynamicArray<IrProc> procs;
+    HashTable<String, i32> proc_indices;
+    Array<IrGlobal> globals;
+};
+
+bool ir_lower_module(IrModule *ir, Module *module, Allocator mem, bool bounds_checks = true);
+
+// NOTE(jesper): the counters of a procedure instrumented by -fprofile-generate. The first counts
+// entries into the procedure, followed by one for each successor of every IR_BRANCH and IR_SWITCH
+// in block order. Returns the index of the first counter of each block's successors, or IR_NONE
+// for blocks that don't end in a branch or switch, with the number of counters in count
+Array<i32> ir_profile_counters(IrProc *proc, Allocator mem, i32 *count);
+
+// NOTE(jesper): covers the shape of the procedure's control flow, the counters of a procedure
+// whose checksum doesn't match the one in the profile no longer line up with its branches
+u32 ir_profile_checksum(IrProc *proc);
+
+// NOTE(jesper): reads the counters of a profile written by an instrumented program into
+// IrProc::profile, ignoring procedures that have changed since. Returns false if it isn't a
+// profile
+bool ir_apply_profile(IrModule *ir, String profile);
+
+// NOTE(jesper): the i-th successor of a block, or IR_NONE once there are no more
+inline i32 ir_successor(IrProc *proc, i32 block, i32 i)
+{
+    DynamicArray<IrInst> &insts = proc->blocks[block].insts;
+    if (insts.count == 0) return IR_NONE;
+
+    IrInst &terminator = insts[insts.count-1];
+    switch (terminator.op) {
+    case IR_JUMP:
+        return i == 0 ? terminator.target : IR_NONE;
+    case IR_BRANCH:
+        return i == 0 ? terminator.target : i == 1 ? terminator.target_else : IR_NONE;
+    case IR_SWITCH:
+        if (i < terminator.case_count) return proc->switch_cases[terminator.cases + i].target;
+        return i == terminator.case_count ? terminator.target_else : IR_NONE;
+    default:
+        return IR_NONE;
+    }
+}
+
+// NOTE(jesper): for backends without phi nodes. The value a phi takes from a predecessor is copied
+// to the phi's shadow register at the end of the predecessor, right before its terminator, and
+// the phi copies its shadow to its result. Only the phi reads its shadow, so the copies can't
+// clobber each other even when one phi's incoming value is the result of another
+template<typename F>
+void ir_for_each_phi_copy(IrProc *proc, i32 block, F &&copy)
+{
+    for (i32 i = 0, succ; (succ = ir_successor(proc, block, i)) != IR_NONE; i++) {
+        for (IrInst &phi : proc->blocks[succ].insts) {
+            if (phi.op != IR_PHI) break;
+
+            for (i32 j = 0; j < phi.incoming_count; j++) {
+                IrPhiIncoming &it = proc->phi_incoming[phi.incoming + j];
+                if (it.block == block) {
+                    copy(phi.shadow, it.value);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// NOTE(jesper): the blocks reachable from the entry in reverse postorder, where every block comes
+// after its dominators, followed by the unreachable ones
+Array<i32> ir_reverse_postorder(IrProc *proc, Allocator mem, i32 *reachable = nullptr);
+
+struct IrBoundsCheckStats {
+    i32 checks;
+    i32 removed_constant;   // proven by the constant ranges of the index and array count
+    i32 removed_induction;  // proven by the condition of a loop the index is an induction variable of
+};
+
+void ir_mem2reg(IrProc *proc);
+void ir_copy_propagation(IrProc *proc);
+void ir_bounds_check_elimination(IrModule *ir, IrProc *proc, IrBoundsCheckStats *stats);
+void ir_construct_ssa(IrProc *proc);
+void ir_dead_code_elimination(IrProc *proc);
+void ir_optimize(IrModule *ir);
+
+i32 ir_inst_count(IrProc *proc);
+void ir_print(IrModule *ir);
+
+#endif // IR_H
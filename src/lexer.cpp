@@ -55,6 +55,8 @@ Token next_token(Lexer *lexer, u32 flags) EXPORT
 
             while (lexer->ptr < lexer->end) {
                 if (t.type == TOKEN_INTEGER && *lexer->ptr == '.') {
+                    // NOTE(jesper): the '..' of a range that starts with an integer
+                    if (lexer->ptr+1 < lexer->end && lexer->ptr[1] == '.') break;
                     t.type = TOKEN_NUMBER;
                 } else if (*lexer->ptr > '9' || *lexer->ptr < '0') break;
                 lexer->ptr++;
@@ -87,6 +89,21 @@ Token next_token(Lexer *lexer, u32 flags) EXPORT
 
             t.str.length = (i32)(lexer->ptr - t.str.data);
             return t;
+        } else if (lexer->ptr+1 < lexer->end && lexer->ptr[1] == '=' &&
+                   (lexer->ptr[0] == '=' || lexer->ptr[0] == '!' ||
+                    lexer->ptr[0] == '<' || lexer->ptr[0] == '>'))
+        {
+            switch (lexer->ptr[0]) {
+            case '=': t.type = TOKEN_EQ; break;
+            case '!': t.type = TOKEN_NE; break;
+            case '<': t.type = TOKEN_LE; break;
+            case '>': t.type = TOKEN_GE; break;
+            }
+
+            t.str = { lexer->ptr, 2 };
+            lexer->ptr += 2;
+            lexer->col += 2;
+            return t;
         } else {
             t.type = (TokenType)*lexer->ptr;
             t.str = { lexer->ptr, 1 };
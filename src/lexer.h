@@ -18,6 +18,8 @@ enum TokenType : u16 {
     TOKEN_SUB = '-',
     TOKEN_MUL = '*',
     TOKEN_DIV = '/',
+    TOKEN_LT  = '<',
+    TOKEN_GT  = '>',
 
     TOKEN_START = 255, // NOTE(jesper): 0-255 reserved for ascii token values
 
@@ -25,6 +27,11 @@ enum TokenType : u16 {
     TOKEN_INTEGER,
     TOKEN_NUMBER,
 
+    TOKEN_EQ,         // ==
+    TOKEN_NE,         // !=
+    TOKEN_LE,         // <=
+    TOKEN_GE,         // >=
+
     TOKEN_WHITESPACE, // automatically eaten unless LEXER_WHITESPACE
     TOKEN_NEWLINE,    // automatically eaten unless LEXER_NEWLINE
     TOKEN_COMMENT,    // automatically eaten unless LEXER_COMMENT
@@ -84,6 +91,10 @@ inline const char* sz_from_enum(TokenType type)
     case TOKEN_IDENTIFIER: return "IDENTIFIER";
     case TOKEN_INTEGER:    return "INTEGER";
     case TOKEN_NUMBER:     return "NUMBER";
+    case TOKEN_EQ:         return "==";
+    case TOKEN_NE:         return "!=";
+    case TOKEN_LE:         return "<=";
+    case TOKEN_GE:         return ">=";
     case TOKEN_WHITESPACE: return "WHITESPACE";
     case TOKEN_NEWLINE:    return "NEWLINE";
     case TOKEN_EOF:        return "EOF";
@@ -0,0 +1,411 @@
+#include "linker.h"
+#include "core.h"
+#include "file.h"
+#include "hash_table.h"
+#include "elf.h"
+
+#include <string.h>
+
+constexpr u64 LINK_BASE_ADDRESS = 0x400000;
+constexpr u64 LINK_PAGE_SIZE    = 0x1000;
+
+enum LinkSegment : i32 {
+    SEGMENT_TEXT,
+    SEGMENT_RODATA,
+    SEGMENT_DATA,
+    SEGMENT_COUNT,
+};
+
+struct LinkSection {
+    ElfSectionHeader *shdr;
+    u8 *data;
+
+    LinkSegment segment;
+    u64 offset; // file offset in the output, not valid for NOBITS
+    u64 addr;
+};
+
+struct LinkObject {
+    u8 *data;
+    i32 size;
+
+    ElfSectionHeader *shdrs;
+    i32 shnum;
+
+    ElfSymbol *symbols;
+    i32 symbol_count;
+    char *strtab;
+
+    // NOTE(jesper): indexed by the object's section index, nullptr for sections that aren't
+    // part of the output image
+    LinkSection **sections;
+};
+
+// NOTE(jesper): _start: xor ebp, ebp; call main; mov edi, eax; mov eax, 60; syscall
+static const u8 start_stub[] = {
+    0x31, 0xed,
+    0xe8, 0x00, 0x00, 0x00, 0x00,
+    0x89, 0xc7,
+    0xb8, 0x3c, 0x00, 0x00, 0x00,
+    0x0f, 0x05,
+};
+constexpr i32 START_STUB_CALL_OFFSET = 3;
+
+static bool parse_link_object(LinkObject *obj, String data, Allocator mem)
+{
+    obj->data = (u8*)data.data;
+    obj->size = data.length;
+
+    if (data.length < (i32)sizeof(ElfHeader)) return false;
+    ElfHeader *header = (ElfHeader*)obj->data;
+
+    if (memcmp(header->magic, "\x7f" "ELF", 4) != 0 ||
+        header->bitness != ELF_64 ||
+        header->endian != ELF_LE ||
+        header->type != ELF_TYPE_REL ||
+        header->machine != ELF_MACHINE_X86_64)
+    {
+        LOG_ERROR("unsupported object file, expected an x86-64 ELF relocatable object");
+        return false;
+    }
+
+    if (header->shoff + (u64)header->shnum*sizeof(ElfSectionHeader) > (u64)data.length) return false;
+
+    obj->shdrs = (ElfSectionHeader*)(obj->data + header->shoff);
+    obj->shnum = header->shnum;
+    obj->sections = ALLOC_ARR(mem, LinkSection*, obj->shnum);
+    memset(obj->sections, 0, obj->shnum*sizeof *obj->sections);
+
+    for (i32 i = 0; i < obj->shnum; i++) {
+        ElfSectionHeader *shdr = &obj->shdrs[i];
+        if (shdr->type != ELF_SHT_SYMTAB) continue;
+
+        obj->symbols = (ElfSymbol*)(obj->data + shdr->offset);
+        obj->symbol_count = shdr->size / sizeof(ElfSymbol);
+        obj->strtab = (char*)obj->data + obj->shdrs[shdr->link].offset;
+    }
+
+    return true;
+}
+
+static u64 align_up(u64 value, u64 alignment)
+{
+    if (alignment <= 1) return value;
+    return (value + alignment-1) & ~(alignment-1);
+}
+
+static bool link_symbol_address(
+    LinkObject *obj,
+    u32 index,
+    HashTable<String, u64> *globals,
+    u64 *addr)
+{
+    if (index >= (u32)obj->symbol_count) return false;
+
+    ElfSymbol *sym = &obj->symbols[index];
+    u8 binding = elf_symbol_binding(sym->info);
+
+    switch (sym->shndx) {
+    case ELF_SHN_UNDEF: {
+            String name = string(obj->strtab + sym->name);
+            if (u64 *global = map_find(globals, name); global) {
+                *addr = *global;
+                return true;
+            }
+
+            if (binding == ELF_STB_WEAK) {
+                *addr = 0;
+                return true;
+            }
+
+            LOG_INFO("builtin linker: undefined symbol '%.*s'", STRFMT(name));
+            return false;
+        }
+    case ELF_SHN_ABS:
+        *addr = sym->value;
+        return true;
+    case ELF_SHN_COMMON:
+        LOG_INFO("builtin linker: common symbols are not supported");
+        return false;
+    }
+
+    if (sym->shndx >= obj->shnum || !obj->sections[sym->shndx]) {
+        LOG_INFO("builtin linker: symbol refers to a section that isn't part of the image");
+        return false;
+    }
+
+    *addr = obj->sections[sym->shndx]->addr + sym->value;
+    return true;
+}
+
+static bool is_got_relocation(u32 type)
+{
+    return type == ELF_R_X86_64_GOTPCREL ||
+        type == ELF_R_X86_64_GOTPCRELX ||
+        type == ELF_R_X86_64_REX_GOTPCRELX;
+}
+
+bool link_static_executable(String exe_path, Array<String> objects, const char *entry)
+{
+    SArena scratch = tl_scratch_arena();
+
+    Array<LinkObject> objs = array_create<LinkObject>(objects.count, scratch);
+    for (i32 i = 0; i < objects.count; i++) {
+        if (!parse_link_object(&objs[i], objects[i], scratch)) return false;
+    }
+
+    DynamicArray<LinkSection*> sections{ .alloc = scratch };
+    i32 got_count = 0;
+
+    for (LinkObject &obj : objs) {
+        for (i32 i = 0; i < obj.shnum; i++) {
+            ElfSectionHeader *shdr = &obj.shdrs[i];
+
+            if (shdr->type == ELF_SHT_RELA) {
+                ElfRela *relas = (ElfRela*)(obj.data + shdr->offset);
+                i32 count = shdr->size / sizeof(ElfRela);
+                for (i32 j = 0; j < count; j++) {
+                    if (is_got_relocation(elf_rela_type(relas[j].info))) got_count++;
+                }
+                continue;
+            }
+
+            if (!(shdr->flags & ELF_SHF_ALLOC) || shdr->size == 0) continue;
+
+            switch (shdr->type) {
+            case ELF_SHT_PROGBITS:
+            case ELF_SHT_NOBITS:
+            case ELF_SHT_X86_64_UNWIND:
+                break;
+            default:
+                // NOTE(jesper): init/fini arrays and the like need the C runtime to run them
+                LOG_INFO("builtin linker: unsupported section type 0x%x", shdr->type);
+                return false;
+            }
+
+            if (shdr->flags & ELF_SHF_TLS) {
+                LOG_INFO("builtin linker: thread local storage is not supported");
+                return false;
+            }
+
+            LinkSection *section = ALLOC_T(*scratch, LinkSection) {
+                .shdr = shdr,
+                .data = obj.data + shdr->offset,
+                .segment = shdr->flags & ELF_SHF_EXECINSTR ? SEGMENT_TEXT
+                    : shdr->flags & ELF_SHF_WRITE ? SEGMENT_DATA
+                    : SEGMENT_RODATA,
+            };
+
+            obj.sections[i] = section;
+            array_add(&sections, section);
+        }
+    }
+
+    // NOTE(jesper): one segment per permission set, each starting on its own page so the file
+    // offsets and virtual addresses stay congruent. The ELF and program headers are mapped
+    // with the text segment, followed by the _start stub
+    constexpr i32 headers_size = sizeof(ElfHeader) + SEGMENT_COUNT*sizeof(ElfProgramHeader);
+
+    u64 segment_offset[SEGMENT_COUNT];
+    u64 segment_filesz[SEGMENT_COUNT];
+    u64 segment_memsz[SEGMENT_COUNT];
+
+    u64 start_offset = align_up(headers_size, 16);
+    u64 got_offset = 0;
+
+    u64 offset = 0;
+    for (i32 seg = 0; seg < SEGMENT_COUNT; seg++) {
+        offset = align_up(offset, LINK_PAGE_SIZE);
+        segment_offset[seg] = offset;
+
+        if (seg == SEGMENT_TEXT) offset = start_offset + sizeof start_stub;
+
+        if (seg == SEGMENT_RODATA && got_count > 0) {
+            got_offset = align_up(offset, 8);
+            offset = got_offset + got_count*8;
+        }
+
+        for (LinkSection *section : sections) {
+            if (section->segment != seg || section->shdr->type == ELF_SHT_NOBITS) continue;
+
+            offset = align_up(offset, section->shdr->addralign);
+            section->offset = offset;
+            section->addr = LINK_BASE_ADDRESS + offset;
+            offset += section->shdr->size;
+        }
+
+        segment_filesz[seg] = offset - segment_offset[seg];
+
+        u64 memend = offset;
+        for (LinkSection *section : sections) {
+            if (section->segment != seg || section->shdr->type != ELF_SHT_NOBITS) continue;
+
+            memend = align_up(memend, section->shdr->addralign);
+            section->addr = LINK_BASE_ADDRESS + memend;
+            memend += section->shdr->size;
+        }
+
+        segment_memsz[seg] = memend - segment_offset[seg];
+
+        // NOTE(jesper): the next segment can't share a page with this one's bss
+        offset = memend;
+    }
+
+    u64 file_size = segment_offset[SEGMENT_DATA] + segment_filesz[SEGMENT_DATA];
+    u8 *image = (u8*)ALLOC(*scratch, file_size);
+    memset(image, 0, file_size);
+
+    for (LinkSection *section : sections) {
+        if (section->shdr->type == ELF_SHT_NOBITS) continue;
+        memcpy(image + section->offset, section->data, section->shdr->size);
+    }
+
+    HashTable<String, u64> globals{ .alloc = scratch };
+    for (LinkObject &obj : objs) {
+        for (i32 i = 0; i < obj.symbol_count; i++) {
+            ElfSymbol *sym = &obj.symbols[i];
+            u8 binding = elf_symbol_binding(sym->info);
+
+            if (binding == ELF_STB_LOCAL || sym->shndx == ELF_SHN_UNDEF) continue;
+
+            u64 addr;
+            if (!link_symbol_address(&obj, i, &globals, &addr)) return false;
+
+            String name = string(obj.strtab + sym->name);
+            if (u64 *existing = map_find(&globals, name); existing) {
+                if (binding == ELF_STB_WEAK) continue;
+
+                LOG_INFO("builtin linker: duplicate symbol '%.*s'", STRFMT(name));
+                return false;
+            }
+
+            map_set(&globals, name, addr);
+        }
+    }
+
+    i32 got_index = 0;
+    for (LinkObject &obj : objs) {
+        for (i32 i = 0; i < obj.shnum; i++) {
+            ElfSectionHeader *shdr = &obj.shdrs[i];
+            if (shdr->type != ELF_SHT_RELA) continue;
+
+            LinkSection *target = shdr->info < (u32)obj.shnum ? obj.sections[shdr->info] : nullptr;
+            if (!target) continue;
+
+            ElfRela *relas = (ElfRela*)(obj.data + shdr->offset);
+            i32 count = shdr->size / sizeof(ElfRela);
+
+            for (i32 j = 0; j < count; j++) {
+                ElfRela *rela = &relas[j];
+                u32 type = elf_rela_type(rela->info);
+
+                u64 S;
+                if (!link_symbol_address(&obj, elf_rela_symbol(rela->info), &globals, &S))
+                    return false;
+
+                i64 A = rela->addend;
+                u64 P = target->addr + rela->offset;
+                u8 *loc = image + target->offset + rela->offset;
+
+                // NOTE(jesper): there's no dynamic linking so every GOT entry is resolved at
+                // link time to the symbol's final address
+                if (is_got_relocation(type)) {
+                    u64 got_entry = got_offset + 8*got_index++;
+                    memcpy(image + got_entry, &S, sizeof S);
+                    S = LINK_BASE_ADDRESS + got_entry;
+                }
+
+                switch (type) {
+                case ELF_R_X86_64_NONE:
+                    break;
+                case ELF_R_X86_64_64: {
+                        u64 value = S + A;
+                        memcpy(loc, &value, sizeof value);
+                    } break;
+                case ELF_R_X86_64_PC64: {
+                        i64 value = S + A - P;
+                        memcpy(loc, &value, sizeof value);
+                    } break;
+                case ELF_R_X86_64_PC32:
+                case ELF_R_X86_64_PLT32:
+                case ELF_R_X86_64_GOTPCREL:
+                case ELF_R_X86_64_GOTPCRELX:
+                case ELF_R_X86_64_REX_GOTPCRELX: {
+                        i64 value = S + A - P;
+                        if (value < i32_MIN || value > i32_MAX) {
+                            LOG_ERROR("builtin linker: relocation out of range");
+                            return false;
+                        }
+
+                        i32 value32 = (i32)value;
+                        memcpy(loc, &value32, sizeof value32);
+                    } break;
+                case ELF_R_X86_64_32:
+                case ELF_R_X86_64_32S: {
+                        i64 value = S + A;
+                        if ((type == ELF_R_X86_64_32 && (value < 0 || value > u32_MAX)) ||
+                            (type == ELF_R_X86_64_32S && (value < i32_MIN || value > i32_MAX)))
+                        {
+                            LOG_ERROR("builtin linker: relocation out of range");
+                            return false;
+                        }
+
+                        u32 value32 = (u32)value;
+                        memcpy(loc, &value32, sizeof value32);
+                    } break;
+                default:
+                    LOG_INFO("builtin linker: unsupported relocation type %d", type);
+                    return false;
+                }
+            }
+        }
+    }
+
+    u64 *entry_addr = map_find(&globals, string(entry));
+    if (!entry_addr) {
+        LOG_ERROR("builtin linker: undefined entry point '%s'", entry);
+        return false;
+    }
+
+    u64 start_addr = LINK_BASE_ADDRESS + start_offset;
+    memcpy(image + start_offset, start_stub, sizeof start_stub);
+
+    i32 call_rel = (i32)(*entry_addr - (start_addr + START_STUB_CALL_OFFSET + 4));
+    memcpy(image + start_offset + START_STUB_CALL_OFFSET, &call_rel, sizeof call_rel);
+
+    ElfHeader header{
+        .endian = ELF_LE,
+        .abi = ELF_ABI_SYSV,
+        .type = ELF_TYPE_EXEC,
+        .machine = ELF_MACHINE_X86_64,
+        .entry = start_addr,
+        .phoff = sizeof(ElfHeader),
+        .ehsize = sizeof(ElfHeader),
+        .phentsize = sizeof(ElfProgramHeader),
+        .phnum = SEGMENT_COUNT,
+    };
+    memcpy(image, &header, sizeof header);
+
+    u32 segment_flags[SEGMENT_COUNT];
+    segment_flags[SEGMENT_TEXT]   = ELF_PF_R | ELF_PF_X;
+    segment_flags[SEGMENT_RODATA] = ELF_PF_R;
+    segment_flags[SEGMENT_DATA]   = ELF_PF_R | ELF_PF_W;
+
+    ElfProgramHeader *phdrs = (ElfProgramHeader*)(image + sizeof header);
+    for (i32 seg = 0; seg < SEGMENT_COUNT; seg++) {
+        phdrs[seg] = {
+            .type = ELF_PT_LOAD,
+            .flags = segment_flags[seg],
+            .offset = segment_offset[seg],
+            .vaddr = LINK_BASE_ADDRESS + segment_offset[seg],
+            .paddr = LINK_BASE_ADDRESS + segment_offset[seg],
+            .filesz = segment_filesz[seg],
+            .memsz = segment_memsz[seg],
+            .align = LINK_PAGE_SIZE,
+        };
+    }
+
+    PANIC_IF(file_size > i32_MAX, "executable too large");
+    write_file(exe_path, image, (i32)file_size);
+    return set_file_executable(exe_path);
+}
@@ -0,0 +1,12 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include "string.h"
+#include "array.h"
+
+// NOTE(jesper): minimal static linker for x86-64 ELF relocatable objects. It only handles
+// self-contained programs; anything that needs the C runtime, shared libraries or a dynamic
+// loader makes it return false, and the caller is expected to fall back to the system linker
+bool link_static_executable(String exe_path, Array<String> objects, const char *entry);
+
+#endif // LINKER_H
@@ -61,6 +61,8 @@ FileInfo read_file(String path, Allocator mem, i32 /*retry_count*/)
     PANIC_IF(st.st_size > i32_MAX, "file size is too large");
     fi.size = (i32)st.st_size;
 
+    close(fd);
+
     return fi;
 }
 
@@ -173,6 +175,22 @@ void write_file(String path, StringBuilder *sb)
     close(fd);
 }
 
+void write_file(String path, void *data, i32 bytes)
+{
+    SArena scratch = tl_scratch_arena();
+    char *sz_path = sz_string(path, scratch);
+    i32 fd = open(sz_path, O_TRUNC | O_CREAT | O_WRONLY, S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH);
+    if (fd < 0) {
+        LOG_ERROR("unable to open file descriptor for file: '%s' - '%s'", sz_path, strerror(errno));
+        return;
+    }
+
+    ssize_t res = write(fd, data, bytes);
+    if (res == -1) LOG_ERROR("unhandled write error %d: '%s'", errno, strerror(errno));
+
+    close(fd);
+}
+
 void remove_file(String path)
 {
     SArena scratch = tl_scratch_arena();
@@ -216,6 +234,31 @@ bool is_directory(String path)
 	return st.st_mode & S_IFDIR;
 }
 
+bool create_directory(String path)
+{
+    SArena scratch = tl_scratch_arena();
+    char *sz_path = sz_string(path, scratch);
+
+    // NOTE(jesper): create each missing parent directory in turn, like mkdir -p
+    for (char *p = sz_path+1; *p; p++) {
+        if (*p != '/') continue;
+
+        *p = '\0';
+        if (mkdir(sz_path, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH) != 0 && errno != EEXIST) {
+            LOG_ERROR("failed to create directory: '%s', errno: %d", sz_path, errno);
+            return false;
+        }
+        *p = '/';
+    }
+
+    if (mkdir(sz_path, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH) != 0 && errno != EEXIST) {
+        LOG_ERROR("failed to create directory: '%s', errno: %d", sz_path, errno);
+        return false;
+    }
+
+    return true;
+}
+
 String get_exe_folder(Allocator mem)
 {
     return duplicate_string(exe_path, mem);
@@ -451,3 +494,40 @@ u64 file_modified_timestamp(String path)
 
     return st.st_mtim.tv_sec;
 }
+
+u64 file_size(String path)
+{
+    SArena scratch = tl_scratch_arena();
+    char *sz_path = sz_string(path, scratch);
+
+    struct stat st;
+    if (stat(sz_path, &st) != 0) {
+        LOG_ERROR("couldn't stat file: %s", sz_path);
+        return 0;
+    }
+
+    return st.st_size;
+}
+
+void touch_file(String path)
+{
+    SArena scratch = tl_scratch_arena();
+    char *sz_path = sz_string(path, scratch);
+
+    if (utimensat(AT_FDCWD, sz_path, nullptr, 0) != 0) {
+        LOG_ERROR("failed to update timestamp of file: '%s', errno: %d", sz_path, errno);
+    }
+}
+
+bool set_file_executable(String path)
+{
+    SArena scratch = tl_scratch_arena();
+    char *sz_path = sz_string(path, scratch);
+
+    if (chmod(sz_path, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH) != 0) {
+        LOG_ERROR("failed to make file executable: '%s', errno: %d", sz_path, errno);
+        return false;
+    }
+
+    return true;
+}
@@ -3,6 +3,7 @@
 
 #include <spawn.h>
 #include <errno.h>
+#include <dlfcn.h>
 
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -82,3 +83,15 @@ bool get_exit_code(Process */*process*/, int * /*exit_code*/)
 	LOG_ERROR("unimplemented");
 	return false;
 }
+
+void* load_library(const char *path)
+{
+    void *library = dlopen(path, RTLD_NOW | RTLD_GLOBAL);
+    if (!library) LOG_ERROR("failed to load library '%s': %s", path, dlerror());
+    return library;
+}
+
+void* find_library_symbol(void *library, const char *name)
+{
+    return dlsym(library ? library : RTLD_DEFAULT, name);
+}
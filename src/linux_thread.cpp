@@ -2,6 +2,8 @@
 #include "core.h"
 
 #include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
 #include <errno.h>
 
 struct Thread {
@@ -36,6 +38,33 @@ void unlock_mutex(Mutex *m)
 	PANIC_IF(r != 0, "failed to lock mutex, errno: %d", errno);
 }
 
+Semaphore* create_semaphore(i32 initial_count)
+{
+    extern Allocator mem_sys;
+
+	sem_t *sem = ALLOC_T(mem_sys, sem_t);
+
+	int r = sem_init(sem, 0, initial_count);
+	PANIC_IF(r != 0, "failed to create semaphore, errno: %d", errno);
+
+	return (Semaphore*)sem;
+}
+
+void signal_semaphore(Semaphore *s)
+{
+	sem_t *sem = (sem_t*)s;
+	int r = sem_post(sem);
+	PANIC_IF(r != 0, "failed to signal semaphore, errno: %d", errno);
+}
+
+void wait_semaphore(Semaphore *s)
+{
+	sem_t *sem = (sem_t*)s;
+	while (sem_wait(sem) != 0) {
+		PANIC_IF(errno != EINTR, "failed to wait on semaphore, errno: %d", errno);
+	}
+}
+
 Thread* create_thread(ThreadProc proc, void *user_data)
 {
     extern Allocator mem_sys;
@@ -62,3 +91,19 @@ Thread* create_thread(ThreadProc proc, void *user_data)
 	PANIC_IF(result != 0, "failed creating thread");
 	return thread;
 }
+
+void wait_for_thread(Thread *thread)
+{
+    extern Allocator mem_sys;
+
+	int result = pthread_join(thread->handle, nullptr);
+	PANIC_IF(result != 0, "failed joining thread, errno: %d", result);
+
+	FREE(mem_sys, thread);
+}
+
+i32 get_hardware_thread_count()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (i32)count : 1;
+}
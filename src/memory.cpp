@@ -92,7 +92,9 @@ void* tl_linear_alloc(void *v_state, M_Proc cmd, void *old_ptr, i64 old_size, i6
         return ptr;
         }
     case M_FREE:
-        LOG_ERROR("free called on linear allocator, unsupported");
+        // NOTE(jesper): individual allocations can't be released, the memory is reclaimed when
+        // the allocator or arena is reset. Containers that grow, like hash tables, free their
+        // old storage, so this isn't treated as an error
         return nullptr;
     case M_REALLOC: {
         if (size == 0) return nullptr;
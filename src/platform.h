@@ -75,6 +75,10 @@ constexpr f32 f32_PI = (f32)f64_PI;
 #define f32_MAX 3.402823466e+38F
 #define f32_INF ((f32)(1e+300*1e+300))
 
+#define i64_MAX (i64)0x7FFFFFFFFFFFFFFF
+#define i64_MIN (i64)0x8000000000000000
+#define u64_MAX (u64)0xFFFFFFFFFFFFFFFF
+
 #define i32_MAX (i32)0x7FFFFFFF
 #define i32_MIN (i32)0x80000000
 #define u32_MAX (u32)0xFFFFFFFF
@@ -21,6 +21,12 @@ void release_process(Process *process);
 bool wait_for_process(Process *process, int *exit_code = nullptr);
 bool get_exit_code(Process *process, int *exit_code = nullptr);
 
+// dynamic libraries
+void* load_library(const char *path);
+
+// NOTE(jesper): a null library searches the symbols already loaded into the process
+void* find_library_symbol(void *library, const char *name);
+
 
 // initializer_list utils
 inline Process* create_process(String exe, std::initializer_list<String> args, ProcessOpts opts = {})
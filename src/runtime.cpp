@@ -0,0 +1,292 @@
+#include "runtime.h"
+#include "core.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// NOTE(jesper): this is linked into the programs tir compiles, so it can't use anything that
+// needs the rest of the compiler's platform layer or the C++ runtime. No allocations through
+// operator new, and no statics that need constructors
+
+constexpr i32 RT_MAX_THREADS    = 256;
+constexpr i32 RT_DEQUE_CAPACITY = 64;
+
+// NOTE(jesper): the grain size picked when a loop doesn't give one, enough ranges per thread to
+// even out iterations of uneven cost without splitting them up so far that it's all overhead
+constexpr i64 RT_RANGES_PER_THREAD = 8;
+
+struct RtRange {
+    i64 start;
+    i64 end;
+};
+
+// NOTE(jesper): a thread splits the ranges it takes in half until they're down to the grain size,
+// pushing the upper halves to the tail of its own deque and running what's left. Once done it pops
+// the most recently pushed range back off the tail, while threads without any work left steal the
+// oldest, and largest, range from the head of another's. Splitting in half keeps the deques
+// shallow, and they're only touched when a range is split or stolen, so a spin lock is enough
+struct alignas(64) RtDeque {
+    u32 lock;
+    i32 head;
+    i32 tail;
+    RtRange ranges[RT_DEQUE_CAPACITY];
+};
+
+struct RtPool {
+    i32 thread_count;
+    RtDeque *deques;    // indexed by thread, the thread starting a loop is 0
+
+    // NOTE(jesper): the loop being run. Set before its range is pushed, and read by the threads
+    // after they've taken a range of it
+    ParallelTask task;
+    void *ctx;
+    i64 grain_size;
+
+    i64 remaining;      // iterations not done yet
+    i32 active;         // worker threads looking for ranges of the loop
+    u64 generation;     // incremented for every loop, guarded by rt_wake_mutex
+};
+
+static RtPool rt_pool;
+
+static pthread_once_t rt_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t rt_loop_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t rt_wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rt_wake = PTHREAD_COND_INITIALIZER;
+
+// NOTE(jesper): the index of the thread's deque while it's running a loop, -1 otherwise, which
+// is what runs nested loops serially
+static __thread i32 rt_thread_index = -1;
+
+static void rt_lock(RtDeque *deque)
+{
+    while (__atomic_exchange_n(&deque->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&deque->lock, __ATOMIC_RELAXED)) {}
+    }
+}
+
+static void rt_unlock(RtDeque *deque)
+{
+    __atomic_store_n(&deque->lock, 0, __ATOMIC_RELEASE);
+}
+
+static bool rt_push(RtDeque *deque, RtRange range)
+{
+    rt_lock(deque);
+
+    bool pushed = deque->tail < RT_DEQUE_CAPACITY;
+    if (pushed) deque->ranges[deque->tail++] = range;
+
+    rt_unlock(deque);
+    return pushed;
+}
+
+static bool rt_pop(RtDeque *deque, RtRange *range)
+{
+    rt_lock(deque);
+
+    bool popped = deque->head < deque->tail;
+    if (popped) *range = deque->ranges[--deque->tail];
+    if (deque->head == deque->tail) deque->head = deque->tail = 0;
+
+    rt_unlock(deque);
+    return popped;
+}
+
+static bool rt_steal(RtDeque *deque, RtRange *range)
+{
+    // NOTE(jesper): checked without the lock first, so that idle threads don't keep the lock of
+    // an empty deque from its owner
+    if (__atomic_load_n(&deque->head, __ATOMIC_RELAXED) >= __atomic_load_n(&deque->tail, __ATOMIC_RELAXED))
+        return false;
+
+    rt_lock(deque);
+
+    bool stolen = deque->head < deque->tail;
+    if (stolen) *range = deque->ranges[deque->head++];
+    if (deque->head == deque->tail) deque->head = deque->tail = 0;
+
+    rt_unlock(deque);
+    return stolen;
+}
+
+static void rt_run_range(i32 index, RtRange range)
+{
+    RtDeque *deque = &rt_pool.deques[index];
+    while (range.end - range.start > rt_pool.grain_size) {
+        i64 mid = range.start + (range.end - range.start) / 2;
+        if (!rt_push(deque, { mid, range.end })) break;
+        range.end = mid;
+    }
+
+    rt_pool.task(rt_pool.ctx, range.start, range.end);
+    __atomic_sub_fetch(&rt_pool.remaining, range.end - range.start, __ATOMIC_ACQ_REL);
+}
+
+static void rt_run_loop(i32 index)
+{
+    while (__atomic_load_n(&rt_pool.remaining, __ATOMIC_ACQUIRE) > 0) {
+        RtRange range;
+        bool found = rt_pop(&rt_pool.deques[index], &range);
+
+        for (i32 i = 1; i < rt_pool.thread_count && !found; i++) {
+            found = rt_steal(&rt_pool.deques[(index + i) % rt_pool.thread_count], &range);
+        }
+
+        if (found) rt_run_range(index, range);
+        else sched_yield();
+    }
+}
+
+static void* rt_worker_proc(void *data)
+{
+    i32 index = (i32)(i64)data;
+    u64 generation = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&rt_wake_mutex);
+        while (rt_pool.generation == generation) pthread_cond_wait(&rt_wake, &rt_wake_mutex);
+        generation = rt_pool.generation;
+        __atomic_add_fetch(&rt_pool.active, 1, __ATOMIC_ACQ_REL);
+        pthread_mutex_unlock(&rt_wake_mutex);
+
+        rt_thread_index = index;
+        rt_run_loop(index);
+        rt_thread_index = -1;
+
+        __atomic_sub_fetch(&rt_pool.active, 1, __ATOMIC_ACQ_REL);
+    }
+
+    return nullptr;
+}
+
+static void rt_init()
+{
+    i32 count = (i32)sysconf(_SC_NPROCESSORS_ONLN);
+    if (char *env = getenv("TIR_NUM_THREADS"); env && atoi(env) > 0) count = atoi(env);
+    count = CLAMP(count, 1, RT_MAX_THREADS);
+
+    rt_pool.deques = (RtDeque*)aligned_alloc(alignof(RtDeque), count*sizeof(RtDeque));
+    if (!rt_pool.deques) count = 0;
+    else memset(rt_pool.deques, 0, count*sizeof(RtDeque));
+
+    // NOTE(jesper): the thread starting a loop takes part in it, so it's one fewer workers. If any
+    // of them fail to start the loops are spread over the ones that did
+    rt_pool.thread_count = MIN(count, 1);
+    for (i32 i = 1; i < count; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, rt_worker_proc, (void*)(i64)i) != 0) break;
+
+        pthread_detach(thread);
+        rt_pool.thread_count++;
+    }
+}
+
+extern "C" void tir_parallel_for(ParallelTask task, void *ctx, i64 start, i64 end, i64 grain_size)
+{
+    if (end <= start) return;
+    pthread_once(&rt_once, rt_init);
+
+    i64 count = end - start;
+    if (rt_pool.thread_count > 1 && grain_size <= 0) {
+        grain_size = MAX(count / (rt_pool.thread_count*RT_RANGES_PER_THREAD), 1);
+    }
+
+    if (rt_pool.thread_count <= 1 || rt_thread_index >= 0 || count <= grain_size) {
+        task(ctx, start, end);
+        return;
+    }
+
+    // NOTE(jesper): loops started from different threads of the program take turns
+    pthread_mutex_lock(&rt_loop_mutex);
+
+    rt_pool.task = task;
+    rt_pool.ctx = ctx;
+    rt_pool.grain_size = grain_size;
+    __atomic_store_n(&rt_pool.remaining, count, __ATOMIC_RELEASE);
+    rt_push(&rt_pool.deques[0], { start, end });
+
+    pthread_mutex_lock(&rt_wake_mutex);
+    rt_pool.generation++;
+    pthread_cond_broadcast(&rt_wake);
+    pthread_mutex_unlock(&rt_wake_mutex);
+
+    rt_thread_index = 0;
+    rt_run_loop(0);
+    rt_thread_index = -1;
+
+    // NOTE(jesper): the workers may still be looking at the pool, which has to stay untouched
+    // until they've all seen that the loop is done
+    while (__atomic_load_n(&rt_pool.active, __ATOMIC_ACQUIRE) > 0) sched_yield();
+
+    pthread_mutex_unlock(&rt_loop_mutex);
+}
+
+// NOTE(jesper): one registration per codegen unit, which is at most one per hardware thread
+constexpr i32 RT_MAX_PROFILE_UNITS = 1024;
+
+struct RtProfileUnit {
+    const TirProfileProc *procs;
+    i64 count;
+};
+
+static const char *rt_profile_path;
+static RtProfileUnit rt_profile_units[RT_MAX_PROFILE_UNITS];
+static i32 rt_profile_unit_count;
+static bool rt_profile_atexit;
+static pthread_mutex_t rt_profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+extern "C" void tir_profile_register(const char *path, const TirProfileProc *procs, i64 count)
+{
+    pthread_mutex_lock(&rt_profile_mutex);
+
+    if (rt_profile_unit_count == 0) {
+        if (!rt_profile_atexit) rt_profile_atexit = atexit(tir_profile_dump) == 0;
+
+        rt_profile_path = path;
+        if (char *env = getenv("TIR_PROFILE_FILE"); env && env[0]) rt_profile_path = env;
+    }
+
+    if (rt_profile_unit_count < RT_MAX_PROFILE_UNITS) {
+        rt_profile_units[rt_profile_unit_count++] = { procs, count };
+    }
+
+    pthread_mutex_unlock(&rt_profile_mutex);
+}
+
+extern "C" void tir_profile_dump()
+{
+    pthread_mutex_lock(&rt_profile_mutex);
+    if (rt_profile_unit_count == 0) {
+        pthread_mutex_unlock(&rt_profile_mutex);
+        return;
+    }
+
+    // NOTE(jesper): the format is read back by ir_apply_profile, a header line followed by a
+    // line per procedure of its name, checksum, counter count and counters
+    FILE *f = fopen(rt_profile_path, "w");
+    if (!f) {
+        fprintf(stderr, "tir: failed to write profile '%s': %s\n", rt_profile_path, strerror(errno));
+    } else {
+        fprintf(f, "tir-profile 1\n");
+        for (i32 i = 0; i < rt_profile_unit_count; i++) {
+            for (i64 j = 0; j < rt_profile_units[i].count; j++) {
+                const TirProfileProc *proc = &rt_profile_units[i].procs[j];
+                fprintf(f, "%s %u %lld", proc->name, proc->checksum, (long long)proc->counter_count);
+                for (i64 k = 0; k < proc->counter_count; k++) {
+                    fprintf(f, " %llu", (unsigned long long)__atomic_load_n(&proc->counters[k], __ATOMIC_RELAXED));
+                }
+                fprintf(f, "\n");
+            }
+        }
+        fclose(f);
+    }
+
+    rt_profile_unit_count = 0;
+    pthread_mutex_unlock(&rt_profile_mutex);
+}
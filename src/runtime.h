@@ -0,0 +1,40 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include "platform.h"
+
+// NOTE(jesper): the runtime library that programs using parallel loops or built with
+// -fprofile-generate are linked against, as
+// libtir_runtime. It only depends on libc and pthreads. The compiler links it in as well, so
+// that programs run in-process can be resolved against its copy
+
+#define TIR_RUNTIME_LIBRARY "tir_runtime"
+
+typedef void (*ParallelTask)(void *ctx, i64 start, i64 end);
+
+// NOTE(jesper): calls task for every iteration in [start, end), split into ranges of at least
+// grain_size iterations, or a size picked by the runtime when zero, that are spread over its
+// thread pool. It returns once every iteration is done. Loops nested in a task run serially on
+// the thread running it.
+// The number of threads is the number of hardware threads, or $TIR_NUM_THREADS if set
+extern "C" void tir_parallel_for(ParallelTask task, void *ctx, i64 start, i64 end, i64 grain_size);
+
+// NOTE(jesper): the counters of a procedure instrumented by -fprofile-generate, laid out as
+// described by ir_profile_counter_count. checksum is the procedure's ir_profile_checksum
+struct TirProfileProc {
+    const char *name;
+    u64 *counters;
+    i64 counter_count;
+    u32 checksum;
+};
+
+// NOTE(jesper): called by the constructor of every instrumented codegen unit with the procedures
+// it defines. The counters are written to path when the program exits, or to $TIR_PROFILE_FILE
+// if set, replacing any profile already there
+extern "C" void tir_profile_register(const char *path, const TirProfileProc *procs, i64 count);
+
+// NOTE(jesper): writes the profile of the registered units and unregisters them, so it's only
+// written once. Programs run in-process call it before their code is unloaded
+extern "C" void tir_profile_dump();
+
+#endif // RUNTIME_H
@@ -925,7 +925,7 @@ void reset_string_builder(StringBuilder *sb) EXPORT
 String string(StringBuilder *sb, Allocator mem) EXPORT
 {
     i32 length = 0;
-    for (auto it = sb->current; it; it = it->next) {
+    for (auto it = &sb->head; it; it = it->next) {
         if (it->written == 0) break;
         length += it->written;
     }
@@ -935,9 +935,10 @@ String string(StringBuilder *sb, Allocator mem) EXPORT
     str.length = length;
 
     char *ptr = str.data;
-    for (auto it = sb->current; it; it = it->next) {
+    for (auto it = &sb->head; it; it = it->next) {
         if (it->written == 0) break;
         memcpy(ptr, it->data, it->written);
+        ptr += it->written;
     }
 
     return str;
@@ -946,16 +947,17 @@ String string(StringBuilder *sb, Allocator mem) EXPORT
 char* sz_string(StringBuilder *sb, Allocator mem) EXPORT
 {
     i32 length = 0;
-    for (auto it = sb->current; it; it = it->next) {
+    for (auto it = &sb->head; it; it = it->next) {
         if (it->written == 0) break;
         length += it->written;
     }
 
     char *str = (char*)ALLOC(mem, length+1);
     char *ptr = str;
-    for (auto it = sb->current; it; it = it->next) {
+    for (auto it = &sb->head; it; it = it->next) {
         if (it->written == 0) break;
         memcpy(ptr, it->data, it->written);
+        ptr += it->written;
     }
 
     str[length] = '\0';
@@ -997,10 +999,10 @@ void append_stringf(StringBuilder *sb, const char *fmt, ...)
     va_start(args, fmt);
 
     i32 available = sizeof sb->current->data - sb->current->written;
-    i32 length = vsnprintf(sb->current->data + sb->current->written, available-1, fmt, args);
+    i32 length = vsnprintf(sb->current->data + sb->current->written, available, fmt, args);
     va_end(args);
 
-    if (length > available-1) {
+    if (length >= available) {
         SArena scratch = tl_scratch_arena(sb->alloc);
         char *buffer = (char*)ALLOC(*scratch, length+1);
 
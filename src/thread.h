@@ -6,6 +6,7 @@
 #define GUARD_MUTEX(mutex) for (i32 i_##__LINE__ = (lock_mutex(mutex), 0); i_##__LINE__ == 0; i_##__LINE__ = (unlock_mutex(mutex), 1))
 
 struct Mutex;
+struct Semaphore;
 struct Thread;
 
 typedef i32 (*ThreadProc)(void *user_data);
@@ -14,6 +15,24 @@ Mutex* create_mutex();
 void lock_mutex(Mutex*);
 void unlock_mutex(Mutex*);
 
+Semaphore* create_semaphore(i32 initial_count = 0);
+void signal_semaphore(Semaphore*);
+void wait_semaphore(Semaphore*);
+
 Thread* create_thread(ThreadProc proc, void *user_data = nullptr);
+void wait_for_thread(Thread *thread);
+
+i32 get_hardware_thread_count();
+
+// NOTE(jesper): loads acquire and stores release, which is all the data we hand between
+// threads need. Both compilers we care about support the __atomic builtins
+template<typename T>
+T atomic_load(T *ptr) { return __atomic_load_n(ptr, __ATOMIC_ACQUIRE); }
+
+template<typename T>
+void atomic_store(T *ptr, T value) { __atomic_store_n(ptr, value, __ATOMIC_RELEASE); }
+
+template<typename T>
+T atomic_add(T *ptr, T value) { return __atomic_add_fetch(ptr, value, __ATOMIC_ACQ_REL); }
 
 #endif // THREAD_H
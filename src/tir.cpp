@@ -4,6 +4,14 @@
 #include "lexer.h"
 #include "process.h"
 #include "hash_table.h"
+#include "thread.h"
+#include "cache.h"
+#include "linker.h"
+#include "tir.h"
+#include "ir.h"
+#include "x64.h"
+#include "vm.h"
+#include "runtime.h"
 
 #include "string.h"
 
@@ -12,242 +20,181 @@
 #include <string.h>
 
 #include <llvm-c/Core.h>
+#include <llvm-c/DebugInfo.h>
 #include <llvm-c/Target.h>
 #include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+#include <llvm-c/LLJIT.h>
 
 #ifdef _WIN32
 #define strdup _strdup
 #endif
 
+#define TIR_VERSION "0.1.0"
+
 enum Keyword : i32 {
     KW_INVALID = 0,
     KW_RETURN,
+    KW_WHILE,
+    KW_FOR,
+    KW_PARALLEL,
+    KW_SWITCH,
 };
 
-enum ASTType : i32 {
-    AST_INVALID = 0,
-
-    AST_VAR_DECL,
-    AST_VAR_LOAD,
-    AST_VAR_STORE,
+LLVMTypeRef llvm_type_from_type_expr(LLVMContextRef context, TypeExpr type);
 
-    AST_PROC_DECL,
-    AST_PROC_CALL,
+// NOTE(jesper): the fields are already in layout order, and LLVM pads them the same way the
+// layout was computed. Alignment beyond the natural alignment of the fields is padded explicitly
+// at the end, the allocas are aligned separately. Fixed arrays of #soa structs are a struct of
+// one array per field
+LLVMTypeRef llvm_struct_type(LLVMContextRef context, StructType *st, i32 soa_count = 0)
+{
+    SArena scratch = tl_scratch_arena();
 
-    AST_RETURN,
-    AST_LITERAL,
-    AST_BINARY_OP,
-};
+    DynamicArray<LLVMTypeRef> fields{ .alloc = scratch };
+    i32 natural_alignment = 1;
+    for (StructField &field : st->fields) {
+        LLVMTypeRef type = llvm_type_from_type_expr(context, field.type);
+        array_add(&fields, soa_count > 0 ? LLVMArrayType(type, soa_count) : type);
+        natural_alignment = MAX(natural_alignment, type_size(field.type));
+    }
 
-const char* sz_from_enum(ASTType type)
-{
-    switch (type) {
-    case AST_INVALID:   return "invalid";
-    case AST_VAR_LOAD:  return "var_load";
-    case AST_VAR_DECL:  return "var_decl";
-    case AST_VAR_STORE: return "var_store";
-    case AST_PROC_DECL: return "proc_decl";
-    case AST_PROC_CALL: return "proc_call";
-    case AST_RETURN:    return "return";
-    case AST_LITERAL:   return "literal";
-    case AST_BINARY_OP: return "binary_op";
+    if (soa_count == 0 && (st->packed || st->alignment > natural_alignment)) {
+        StructField &last = st->fields[st->fields.count-1];
+        if (i32 padding = st->size - (last.offset + type_size(last.type)); padding > 0) {
+            array_add(&fields, LLVMArrayType(LLVMInt8TypeInContext(context), padding));
+        }
     }
 
-    return "invalid";
+    return LLVMStructTypeInContext(context, fields.data, fields.count, soa_count == 0 && st->packed);
 }
 
-enum UnaryOp : i8 {
-    UOP_INVALID = 0,
-
-    // UOP_NEG,
-};
-
-const char* sz_from_enum(UnaryOp op)
+LLVMTypeRef llvm_type_from_type_expr(LLVMContextRef context, TypeExpr type)
 {
-    switch (op) {
-    case UOP_INVALID: return "invalid";
+    // NOTE(jesper): slices are passed around as a pointer to their first element and a count
+    if (type.elems == TYPE_SLICE) {
+        LLVMTypeRef fields[] = { LLVMPointerTypeInContext(context, 0), LLVMInt64TypeInContext(context) };
+        return LLVMStructTypeInContext(context, fields, ARRAY_COUNT(fields), false);
+    } else if (type.elems > 0) {
+        if (type == T_STRUCT && type.struct_type->soa) return llvm_struct_type(context, type.struct_type, type.elems);
+
+        TypeExpr elem_type = type;
+        elem_type.elems = 0;
+        return LLVMArrayType(llvm_type_from_type_expr(context, elem_type), type.elems);
     }
-}
 
-enum PrimitiveType : i32 {
-    T_INVALID = -1,
-    T_UNKNOWN = 0,
-    T_VOID,
-    T_INTEGER,
-    T_UNSIGNED,
-    T_SIGNED,
-    T_FLOAT,
-    T_BOOL,
-};
+    if (type.pointers > 0) return LLVMPointerTypeInContext(context, 0);
 
-const char* sz_from_enum(PrimitiveType type)
-{
-    switch (type) {
-    case T_UNKNOWN:  return "unknown";
-    case T_VOID:     return "void";
-    case T_INTEGER:  return "INT";
-    case T_SIGNED:   return "SINT";
-    case T_UNSIGNED: return "UINT";
-    case T_FLOAT:    return "FLOAT";
-    case T_BOOL:     return "BOOL";
-    case T_INVALID:  break;
+    if (type.lanes > 0) {
+        TypeExpr lane_type = type;
+        lane_type.lanes = 0;
+        return LLVMVectorType(llvm_type_from_type_expr(context, lane_type), type.lanes);
     }
 
-    return "invalid";
-}
-
-struct TypeExpr {
-    PrimitiveType prim;
-    i32           size;
-
-    explicit operator bool() { return prim != T_UNKNOWN && size != 0; }
-    bool operator==(const TypeExpr &rhs) const = default;
-    bool operator==(const PrimitiveType &rhs) const { return prim == rhs; }
-};
-
-LLVMTypeRef llvm_type_from_type_expr(LLVMContextRef context, TypeExpr type)
-{
     switch (type.prim) {
     case T_INVALID: break;
     case T_UNKNOWN: break;
+    case T_GENERIC: break;
     case T_VOID:
-        return LLVMVoidType();
+        return LLVMVoidTypeInContext(context);
     case T_INTEGER:
         PANIC("undetermined signage of integer");
         return nullptr;
     case T_SIGNED:
         switch (type.size) {
-        case 1: return LLVMInt8Type();
-        case 2: return LLVMInt16Type();
-        case 4: return LLVMInt32Type();
-        case 8: return LLVMInt64Type();
+        case 1: return LLVMInt8TypeInContext(context);
+        case 2: return LLVMInt16TypeInContext(context);
+        case 4: return LLVMInt32TypeInContext(context);
+        case 8: return LLVMInt64TypeInContext(context);
         default: PANIC("Invalid integer size %d", type.size);
         }
         break;
     case T_UNSIGNED:
         // TODO(jesper): how does LLVM distinguish between signed and unsigned types?
         switch (type.size) {
-        case 1: return LLVMInt8Type();
-        case 2: return LLVMInt16Type();
-        case 4: return LLVMInt32Type();
-        case 8: return LLVMInt64Type();
+        case 1: return LLVMInt8TypeInContext(context);
+        case 2: return LLVMInt16TypeInContext(context);
+        case 4: return LLVMInt32TypeInContext(context);
+        case 8: return LLVMInt64TypeInContext(context);
         default: PANIC("Invalid unsignd integer size %d", type.size);
         }
         break;
     case T_FLOAT:
         switch (type.size) {
-        case 4: return LLVMFloatType();
-        case 8: return LLVMDoubleType();
+        case 4: return LLVMFloatTypeInContext(context);
+        case 8: return LLVMDoubleTypeInContext(context);
         default: PANIC("invalid float size: %d", type.size);
         }
         break;
     case T_BOOL:
         switch (type.size) {
-        case 1: return LLVMInt1Type();
+        case 1: return LLVMInt1TypeInContext(context);
         default: PANIC("invalid bool size: %d", type.size);
         }
         break;
+    case T_STRUCT:
+        return llvm_struct_type(context, type.struct_type);
     }
 
     return nullptr;
 }
 
-struct AST {
-    AST *next;
-
-    ASTType type;
-    union {
-        struct {
-            Token identifier;
-            TypeExpr ret_type;
-            struct {
-                u32 foreign : 1;
-                u32 unused  : 31;
-            } flags;
-            AST *body;
-        } proc_decl;
-        struct {
-            Token identifier;
-        } proc_call;
-        struct {
-            Token identifier;
-            TypeExpr type;
-            AST *init;
-        } var_decl;
-        struct {
-            Token identifier;
-            AST *rhs;
-        } var_store;
-        struct {
-            Token identifier;
-        } var_load;
-        struct {
-            Token op;
-            AST *lhs;
-            AST *rhs;
-        } binary_op;
-        struct {
-            Token token;
-            TypeExpr type;
-            union {
-                i64 ival;
-                f32 fval;
-                bool bval;
-            };
-        } literal;
-        struct {
-            Token token;
-            AST *expr;
-        } ret;
-    };
+struct LLVMProc {
+    LLVMValueRef func;
+    LLVMTypeRef  func_t;
 };
 
-enum SymbolType {
-    SYM_VARIABLE,
-    SYM_PROC,
+// NOTE(jesper): relaxations of IEEE-754 semantics the float operations may be optimised under,
+// each maps to the LLVM function attribute of the same meaning
+enum FpMathFlags : u32 {
+    FP_UNSAFE_MATH      = 1 << 0,   // reassociation, reciprocals and contraction into fma
+    FP_NO_NANS          = 1 << 1,
+    FP_NO_INFS          = 1 << 2,
+    FP_NO_SIGNED_ZEROS  = 1 << 3,
+    FP_APPROX_FUNC      = 1 << 4,
+
+    FP_FAST_MATH = FP_UNSAFE_MATH | FP_NO_NANS | FP_NO_INFS | FP_NO_SIGNED_ZEROS | FP_APPROX_FUNC,
 };
 
-struct Symbol {
-    SymbolType type;
-    union {
-        struct {
-            TypeExpr type;
-        } variable;
-        struct {
-            AST *ast;
-        } proc;
-    };
+// NOTE(jesper): procedures that aren't exported can't be called from outside of the module,
+// which lets LLVM change their signature and drop them once they've been inlined everywhere
+enum ProcLinkage : u8 {
+    LINKAGE_EXTERNAL,   // C calling convention, default visibility
+    LINKAGE_HIDDEN,     // called from other codegen units; fastcc, hidden visibility
+    LINKAGE_INTERNAL,   // only called from within its codegen unit; fastcc, internal linkage
 };
 
-struct Module {
-    AST *ast;
-    AST *entry;
+struct LLVMIR {
+    LLVMContextRef context;
+    LLVMBuilderRef ir;
+    LLVMModuleRef module;
 
-    DynamicArray<AST*> procedures;
-    HashTable<String, Symbol> symbols;
-};
+    IrModule *source;
 
+    // NOTE(jesper): indexed the same as IrModule::procs
+    Array<LLVMProc> procedures;
 
-struct Scope {
-    LLVMBasicBlockRef entry;
-    HashTable<String, LLVMValueRef> variables;
-};
+    // NOTE(jesper): indexed the same as IrModule::globals
+    Array<LLVMValueRef> globals;
 
-struct LLVMProc {
-    LLVMValueRef func;
-    LLVMTypeRef  func_t;
+    // NOTE(jesper): indexed the same as IrModule::procs, every procedure is external when empty
+    Array<ProcLinkage> linkage;
 
-    LLVMBasicBlockRef entry;
-};
+    const char *target_cpu;
+    const char *target_features;
+    u32 fp_math;
 
-struct LLVMIR {
-    LLVMContextRef context;
-    LLVMBuilderRef ir;
-    LLVMModuleRef module;
+    // NOTE(jesper): the file an instrumented program writes its profile to, nullptr unless built
+    // with -fprofile-generate. The counters are indexed the same as IrModule::procs, and are only
+    // set for the procedures defined in the unit
+    const char *profile_path;
+    Array<LLVMValueRef> profile_counters;
 
-    HashTable<String, LLVMProc> procedures;
+    // NOTE(jesper): procedures the -fprofile-use profile entered at least this many times are
+    // hot, zero when none are. See llvm_profile_summary
+    u64 profile_hot_count;
 
-    Scope scope;
+    LLVMTargetDataRef data_layout;
 };
 
 
@@ -256,6 +203,10 @@ struct LLVMIR {
 Keyword keyword_from_string(String str)
 {
     if (str == "return") return KW_RETURN;
+    if (str == "while") return KW_WHILE;
+    if (str == "for") return KW_FOR;
+    if (str == "parallel") return KW_PARALLEL;
+    if (str == "switch") return KW_SWITCH;
     return KW_INVALID;
 }
 
@@ -293,6 +244,13 @@ void debug_print_ast(AST *ast, i32 depth = 0)
                      sz_from_enum(ast->literal.type.prim),
                      ast->literal.type.size);
             break;
+        case AST_GLOBAL:
+            LOG_INFO("%.*sglobal %.*s [%s:%d]",
+                     depth, indent,
+                     STRFMT(ast->global.token.str),
+                     sz_from_enum(ast->global.type.prim),
+                     ast->global.type.size);
+            break;
         case AST_BINARY_OP:
             LOG_INFO("%.*sbinary op %.*s", depth, indent, STRFMT(ast->binary_op.op.str));
             debug_print_ast(ast->binary_op.lhs, depth+1);
@@ -305,12 +263,138 @@ void debug_print_ast(AST *ast, i32 depth = 0)
                      sz_from_enum(ast->proc_decl.ret_type.prim),
                      ast->proc_decl.ret_type.size);
 
+            if (ast->proc_decl.params) {
+                LOG_INFO("%.*sparams", depth, indent);
+                debug_print_ast(ast->proc_decl.params, depth+1);
+            }
+
             if (ast->proc_decl.body) debug_print_ast(ast->proc_decl.body, depth+1);
             break;
         case AST_RETURN:
             LOG_INFO("%.*sreturn", depth, indent);
             if (ast->ret.expr) debug_print_ast(ast->ret.expr, depth+1);
             break;
+        case AST_RUN:
+            LOG_INFO("%.*s#run [%s:%d]", depth, indent, sz_from_enum(ast->run.type.prim), ast->run.type.size);
+            debug_print_ast(ast->run.expr, depth+1);
+            break;
+        case AST_LOOP:
+            LOG_INFO("%.*s%.*s", depth, indent, STRFMT(ast->loop.token.str));
+            if (ast->loop.init) {
+                LOG_INFO("%.*sinit", depth, indent);
+                debug_print_ast(ast->loop.init, depth+1);
+            }
+
+            LOG_INFO("%.*scond", depth, indent);
+            debug_print_ast(ast->loop.cond, depth+1);
+
+            if (ast->loop.step) {
+                LOG_INFO("%.*sstep", depth, indent);
+                debug_print_ast(ast->loop.step, depth+1);
+            }
+
+            LOG_INFO("%.*sbody", depth, indent);
+            debug_print_ast(ast->loop.body, depth+1);
+            break;
+        case AST_SWITCH:
+            LOG_INFO("%.*sswitch [%s:%d]",
+                     depth, indent,
+                     sz_from_enum(ast->switch_stmt.type.prim),
+                     ast->switch_stmt.type.size);
+            debug_print_ast(ast->switch_stmt.expr, depth+1);
+            debug_print_ast(ast->switch_stmt.cases, depth+1);
+            break;
+        case AST_SWITCH_CASE:
+            LOG_INFO("%.*scase", depth, indent);
+            if (ast->switch_case.values) debug_print_ast(ast->switch_case.values, depth+1);
+            LOG_INFO("%.*sbody", depth, indent);
+            if (ast->switch_case.body) debug_print_ast(ast->switch_case.body, depth+1);
+            break;
+        case AST_VECTOR:
+            LOG_INFO("%.*svector %.*s [%s:%d]",
+                     depth, indent,
+                     STRFMT(ast->vector.token.str),
+                     sz_from_enum(ast->vector.type.prim),
+                     ast->vector.type.size);
+            debug_print_ast(ast->vector.elems, depth+1);
+            break;
+        case AST_SWIZZLE:
+            LOG_INFO("%.*sswizzle %d lanes [%s:%d]",
+                     depth, indent,
+                     ast->swizzle.count,
+                     sz_from_enum(ast->swizzle.type.prim),
+                     ast->swizzle.type.size);
+            debug_print_ast(ast->swizzle.expr, depth+1);
+            break;
+        case AST_REDUCE:
+            LOG_INFO("%.*s%.*s [%s:%d]",
+                     depth, indent,
+                     STRFMT(ast->reduce.token.str),
+                     sz_from_enum(ast->reduce.type.prim),
+                     ast->reduce.type.size);
+            debug_print_ast(ast->reduce.expr, depth+1);
+            break;
+        case AST_INDEX:
+            LOG_INFO("%.*sindex [%s:%d]",
+                     depth, indent,
+                     sz_from_enum(ast->index.type.prim),
+                     ast->index.type.size);
+            debug_print_ast(ast->index.expr, depth+1);
+            debug_print_ast(ast->index.index, depth+1);
+            break;
+        case AST_INDEX_STORE:
+            LOG_INFO("%.*sindex store", depth, indent);
+            debug_print_ast(ast->index_store.lhs, depth+1);
+            debug_print_ast(ast->index_store.rhs, depth+1);
+            break;
+        case AST_COUNT:
+            LOG_INFO("%.*scount", depth, indent);
+            debug_print_ast(ast->count.expr, depth+1);
+            break;
+        case AST_FIELD:
+            LOG_INFO("%.*sfield %.*s [%s:%d]",
+                     depth, indent,
+                     STRFMT(ast->field.token.str),
+                     sz_from_enum(ast->field.type.prim),
+                     ast->field.type.size);
+            debug_print_ast(ast->field.expr, depth+1);
+            break;
+        case AST_FIELD_STORE:
+            LOG_INFO("%.*sfield store", depth, indent);
+            debug_print_ast(ast->field_store.lhs, depth+1);
+            debug_print_ast(ast->field_store.rhs, depth+1);
+            break;
+        case AST_ADDRESS_OF:
+        case AST_DEREF:
+            LOG_INFO("%.*s%s [%s:%d]",
+                     depth, indent,
+                     sz_from_enum(ast->type),
+                     sz_from_enum(ast->unary.type.prim),
+                     ast->unary.type.size);
+            debug_print_ast(ast->unary.expr, depth+1);
+            break;
+        case AST_DEREF_STORE:
+            LOG_INFO("%.*sderef store", depth, indent);
+            debug_print_ast(ast->deref_store.lhs, depth+1);
+            debug_print_ast(ast->deref_store.rhs, depth+1);
+            break;
+        case AST_ATOMIC:
+            LOG_INFO("%.*s%.*s %s [%s:%d]",
+                     depth, indent,
+                     STRFMT(ast->atomic.token.str),
+                     sz_from_enum(ast->atomic.order),
+                     sz_from_enum(ast->atomic.type.prim),
+                     ast->atomic.type.size);
+            debug_print_ast(ast->atomic.args, depth+1);
+            break;
+        case AST_INTRINSIC:
+            LOG_INFO("%.*s%.*s [%s:%d]",
+                     depth, indent,
+                     STRFMT(ast->intrinsic.token.str),
+                     sz_from_enum(ast->intrinsic.type.prim),
+                     ast->intrinsic.type.size);
+            debug_print_ast(ast->intrinsic.args, depth+1);
+            break;
         case AST_INVALID: break;
         }
     }
@@ -324,6 +408,13 @@ UnaryOp optional_parse_unary_op(Lexer *)
 i32 operator_precedence(Token op)
 {
     switch (op.type) {
+    case '<':
+    case '>':
+    case TOKEN_LE:
+    case TOKEN_GE:
+    case TOKEN_EQ:
+    case TOKEN_NE:
+        return 5;
     case '+':
     case '-':
         return 10;
@@ -335,6 +426,21 @@ i32 operator_precedence(Token op)
     }
 }
 
+bool is_comparison_op(Token t)
+{
+    switch (t.type) {
+    case '<':
+    case '>':
+    case TOKEN_LE:
+    case TOKEN_GE:
+    case TOKEN_EQ:
+    case TOKEN_NE:
+        return true;
+    default:
+        return false;
+    }
+}
+
 bool is_binary_op(Token t)
 {
     switch (t.type) {
@@ -344,11 +450,141 @@ bool is_binary_op(Token t)
     case '/':
         return true;
     default:
+        return is_comparison_op(t);
+    }
+}
+
+bool parse_args(Lexer *lexer, Allocator mem, AST **dst)
+{
+    if (optional_token(lexer, ')')) return true;
+
+    do {
+        if (!(*dst = parse_expression(lexer, mem))) {
+            PARSE_ERROR(lexer, "expected argument expression");
+            return false;
+        }
+        dst = &(*dst)->next;
+    } while (optional_token(lexer, ','));
+
+    if (!require_next_token(lexer, ')')) {
+        PARSE_ERROR(lexer, "expected ')' after arguments");
         return false;
     }
+
+    return true;
+}
+
+bool reduce_op_from_string(String str, ReduceOp *op)
+{
+    if (str == "reduce_add") { *op = REDUCE_ADD; return true; }
+    if (str == "reduce_mul") { *op = REDUCE_MUL; return true; }
+    if (str == "reduce_min") { *op = REDUCE_MIN; return true; }
+    if (str == "reduce_max") { *op = REDUCE_MAX; return true; }
+    return false;
+}
+
+bool atomic_op_from_string(String str, AtomicOp *op)
+{
+    if (str == "atomic_load")  { *op = ATOMIC_LOAD; return true; }
+    if (str == "atomic_store") { *op = ATOMIC_STORE; return true; }
+    if (str == "atomic_xchg")  { *op = ATOMIC_XCHG; return true; }
+    if (str == "atomic_add")   { *op = ATOMIC_ADD; return true; }
+    if (str == "atomic_sub")   { *op = ATOMIC_SUB; return true; }
+    if (str == "atomic_and")   { *op = ATOMIC_AND; return true; }
+    if (str == "atomic_or")    { *op = ATOMIC_OR; return true; }
+    if (str == "atomic_xor")   { *op = ATOMIC_XOR; return true; }
+    if (str == "atomic_min")   { *op = ATOMIC_MIN; return true; }
+    if (str == "atomic_max")   { *op = ATOMIC_MAX; return true; }
+    if (str == "atomic_cas")   { *op = ATOMIC_CAS; return true; }
+    if (str == "atomic_fence") { *op = ATOMIC_FENCE; return true; }
+    return false;
+}
+
+bool atomic_order_from_string(String str, AtomicOrder *order)
+{
+    if (str == "relaxed") { *order = ORDER_RELAXED; return true; }
+    if (str == "acquire") { *order = ORDER_ACQUIRE; return true; }
+    if (str == "release") { *order = ORDER_RELEASE; return true; }
+    if (str == "acq_rel") { *order = ORDER_ACQ_REL; return true; }
+    if (str == "seq_cst") { *order = ORDER_SEQ_CST; return true; }
+    return false;
+}
+
+bool intrinsic_op_from_string(String str, IntrinsicOp *op)
+{
+    if (str == "prefetch") { *op = INTRINSIC_PREFETCH; return true; }
+    if (str == "popcount") { *op = INTRINSIC_POPCOUNT; return true; }
+    if (str == "clz")      { *op = INTRINSIC_CLZ; return true; }
+    if (str == "ctz")      { *op = INTRINSIC_CTZ; return true; }
+    if (str == "bswap")    { *op = INTRINSIC_BSWAP; return true; }
+    if (str == "rotl")     { *op = INTRINSIC_ROTL; return true; }
+    if (str == "rotr")     { *op = INTRINSIC_ROTR; return true; }
+    return false;
+}
+
+i32 intrinsic_operand_count(IntrinsicOp op)
+{
+    return op == INTRINSIC_ROTL || op == INTRINSIC_ROTR ? 2 : 1;
+}
+
+// NOTE(jesper): the number of arguments before the memory order, including the pointer
+i32 atomic_operand_count(AtomicOp op)
+{
+    switch (op) {
+    case ATOMIC_FENCE: return 0;
+    case ATOMIC_LOAD:  return 1;
+    case ATOMIC_CAS:   return 3;
+    default:           return 2;
+    }
+}
+
+AST* parse_postfix(Lexer *lexer, AST *expr, Allocator mem)
+{
+    while (*lexer) {
+        Token t = peek_token(lexer);
+        if (t != '[' && t != '.') break;
+
+        // NOTE(jesper): the end of the expression before the '..' of a range
+        if (t == '.' && peek_nth_token(lexer, 2) == '.') break;
+        next_token(lexer);
+
+        if (t == '[') {
+            AST *index = ALLOC_T(mem, AST) {
+                .type = AST_INDEX,
+                .index.token = t,
+                .index.expr = expr,
+            };
+
+            if (!(index->index.index = parse_expression(lexer, mem))) {
+                PARSE_ERROR(lexer, "expected index expression");
+                return nullptr;
+            }
+
+            if (!require_next_token(lexer, ']')) {
+                PARSE_ERROR(lexer, "expected ']' after index");
+                return nullptr;
+            }
+
+            expr = index;
+        } else {
+            if (!require_next_token(lexer, TOKEN_IDENTIFIER)) {
+                PARSE_ERROR(lexer, "expected field or swizzle after '.'");
+                return nullptr;
+            }
+
+            if (expr->type == AST_INDEX) expr->index.field_access = true;
+            expr = ALLOC_T(mem, AST) {
+                .type = AST_FIELD,
+                .field.token = lexer->t,
+                .field.expr = expr,
+            };
+        }
+    }
+
+    return expr;
 }
 
-AST* parse_expression(Lexer *lexer, Allocator mem, i32 min_prec = 0)
+AST* parse_expression(Lexer *lexer, Allocator mem, i32 min_prec /*= 0 */) INTERNAL
 {
     AST *expr = nullptr;
     if (optional_token(lexer, TOKEN_INTEGER)) {
@@ -389,19 +625,148 @@ AST* parse_expression(Lexer *lexer, Allocator mem, i32 min_prec = 0)
             TERROR(lexer->t, "invalid boolean literal");
             return nullptr;
         }
+    } else if (optional_token(lexer, '#')) {
+        Token directive;
+        if (!optional_identifier(lexer, "run", &directive) &&
+            !optional_identifier(lexer, "likely", &directive) &&
+            !optional_identifier(lexer, "unlikely", &directive))
+        {
+            PARSE_ERROR(lexer, "unknown expression directive: %.*s", STRFMT(peek_token(lexer).str));
+            return nullptr;
+        }
+
+        // NOTE(jesper): the directive applies to the whole expression that follows it
+        AST *directive_expr = parse_expression(lexer, mem);
+        if (!directive_expr) {
+            PARSE_ERROR(lexer, "expected expression after '#%.*s'", STRFMT(directive.str));
+            return nullptr;
+        }
+
+        if (directive == "run") {
+            expr = ALLOC_T(mem, AST) {
+                .type = AST_RUN,
+                .run.token = directive,
+                .run.expr = directive_expr,
+            };
+        } else {
+            expr = ALLOC_T(mem, AST) {
+                .type = AST_INTRINSIC,
+                .intrinsic.token = directive,
+                .intrinsic.op = directive == "likely" ? INTRINSIC_LIKELY : INTRINSIC_UNLIKELY,
+                .intrinsic.args = directive_expr,
+            };
+        }
+    } else if (optional_token(lexer, '*') || optional_token(lexer, '&')) {
+        // NOTE(jesper): the prefix operators bind tighter than any binary operator but not the
+        // postfix ones, so `*p[i]` dereferences the element and `&a[i]` takes its address
+        Token op = lexer->t;
+
+        AST *operand = parse_expression(lexer, mem, i32_MAX);
+        if (!operand) {
+            PARSE_ERROR(lexer, "expected expression after '%.*s'", STRFMT(op.str));
+            return nullptr;
+        }
+
+        expr = ALLOC_T(mem, AST) {
+            .type = op == '*' ? AST_DEREF : AST_ADDRESS_OF,
+            .unary.token = op,
+            .unary.expr = operand,
+        };
     } else if (optional_token(lexer, TOKEN_IDENTIFIER)) {
         Token identifier = lexer->t;
-        if (optional_token(lexer, '(')) {
+
+        TypeExpr vector_type;
+        ReduceOp reduce_op;
+        AtomicOp atomic_op;
+        IntrinsicOp intrinsic_op;
+        if (peek_token(lexer) == '(' &&
+            (vector_type = type_from_string(identifier.str)).lanes > 0)
+        {
+            next_token(lexer);
+            expr = ALLOC_T(mem, AST) {
+                .type = AST_VECTOR,
+                .vector.token = identifier,
+                .vector.type = vector_type,
+            };
+
+            if (!parse_args(lexer, mem, &expr->vector.elems)) return nullptr;
+        } else if (peek_token(lexer) == '(' &&
+                   reduce_op_from_string(identifier.str, &reduce_op))
+        {
+            next_token(lexer);
+            expr = ALLOC_T(mem, AST) {
+                .type = AST_REDUCE,
+                .reduce.token = identifier,
+                .reduce.op = reduce_op,
+            };
+
+            if (!(expr->reduce.expr = parse_expression(lexer, mem))) {
+                PARSE_ERROR(lexer, "expected vector expression");
+                return nullptr;
+            }
+
+            if (!require_next_token(lexer, ')')) {
+                PARSE_ERROR(lexer, "expected ')' after vector expression");
+                return nullptr;
+            }
+        } else if (peek_token(lexer) == '(' &&
+                   atomic_op_from_string(identifier.str, &atomic_op))
+        {
+            next_token(lexer);
+            expr = ALLOC_T(mem, AST) {
+                .type = AST_ATOMIC,
+                .atomic.token = identifier,
+                .atomic.op = atomic_op,
+            };
+
+            // NOTE(jesper): the memory order is always the last argument
+            i32 count = atomic_operand_count(atomic_op);
+            AST **arg = &expr->atomic.args;
+            for (i32 i = 0; i < count; i++, arg = &(*arg)->next) {
+                if (!(*arg = parse_expression(lexer, mem)) || !require_next_token(lexer, ',')) {
+                    PARSE_ERROR(lexer, "'%.*s' takes %d arguments followed by the memory order",
+                                STRFMT(identifier.str), count);
+                    return nullptr;
+                }
+            }
+
+            if (!require_next_token(lexer, TOKEN_IDENTIFIER) ||
+                !atomic_order_from_string(lexer->t.str, &expr->atomic.order))
+            {
+                PARSE_ERROR(lexer, "expected memory order, one of relaxed, acquire, release, acq_rel or seq_cst");
+                return nullptr;
+            }
+
             if (!require_next_token(lexer, ')')) {
-                PARSE_ERROR(lexer, "expected ')'");
+                PARSE_ERROR(lexer, "expected ')' after memory order");
                 return nullptr;
             }
+        } else if (peek_token(lexer) == '(' &&
+                   intrinsic_op_from_string(identifier.str, &intrinsic_op))
+        {
+            next_token(lexer);
+            expr = ALLOC_T(mem, AST) {
+                .type = AST_INTRINSIC,
+                .intrinsic.token = identifier,
+                .intrinsic.op = intrinsic_op,
+            };
 
+            if (!parse_args(lexer, mem, &expr->intrinsic.args)) return nullptr;
+
+            i32 count = 0;
+            for (AST *arg = expr->intrinsic.args; arg; arg = arg->next) count++;
+            if (count != intrinsic_operand_count(intrinsic_op)) {
+                TERROR(identifier, "'%.*s' takes %d arguments, called with %d",
+                       STRFMT(identifier.str), intrinsic_operand_count(intrinsic_op), count);
+                return nullptr;
+            }
+        } else if (optional_token(lexer, '(')) {
             expr = ALLOC_T(mem, AST) {
                 .type = AST_PROC_CALL,
                 .proc_call.identifier = identifier,
             };
 
+            if (!parse_args(lexer, mem, &expr->proc_call.args)) return nullptr;
         } else {
             expr = ALLOC_T(mem, AST) {
                 .type = AST_VAR_LOAD,
@@ -410,6 +775,8 @@ AST* parse_expression(Lexer *lexer, Allocator mem, i32 min_prec = 0)
         }
     }
 
+    if (expr && !(expr = parse_postfix(lexer, expr, mem))) return nullptr;
+
     while (*lexer) {
         Token op = peek_token(lexer);
         if (!is_binary_op(op)) break;
@@ -432,98 +799,548 @@ AST* parse_expression(Lexer *lexer, Allocator mem, i32 min_prec = 0)
     return expr;
 }
 
-TypeExpr parse_type_expression(Lexer *lexer)
+TypeExpr type_from_string(String str) INTERNAL
 {
-    if (optional_token(lexer, TOKEN_IDENTIFIER)) {
-        if (lexer->t == "void") return { T_VOID, 0 };
+    if (str == "void") return { T_VOID, 0 };
 
-        if (lexer->t == "i8")  return { T_SIGNED,  1 };
-        if (lexer->t == "i16") return { T_SIGNED,  2 };
-        if (lexer->t == "i32") return { T_SIGNED,  4 };
-        if (lexer->t == "i64") return { T_SIGNED,  8 };
+    if (str == "i8")  return { T_SIGNED,  1 };
+    if (str == "i16") return { T_SIGNED,  2 };
+    if (str == "i32") return { T_SIGNED,  4 };
+    if (str == "i64") return { T_SIGNED,  8 };
 
-        if (lexer->t == "u8")  return { T_UNSIGNED, 1 };
-        if (lexer->t == "u16") return { T_UNSIGNED, 2 };
-        if (lexer->t == "u32") return { T_UNSIGNED, 4 };
-        if (lexer->t == "u64") return { T_UNSIGNED, 8 };
+    if (str == "u8")  return { T_UNSIGNED, 1 };
+    if (str == "u16") return { T_UNSIGNED, 2 };
+    if (str == "u32") return { T_UNSIGNED, 4 };
+    if (str == "u64") return { T_UNSIGNED, 8 };
 
-        if (lexer->t == "f32") return { T_FLOAT, 4 };
-        if (lexer->t == "f64") return { T_FLOAT, 8 };
+    if (str == "f32") return { T_FLOAT, 4 };
+    if (str == "f64") return { T_FLOAT, 8 };
 
-        if (lexer->t == "bool") return { T_BOOL, 1 };
-        return { T_INVALID };
+    if (str == "bool") return { T_BOOL, 1 };
+
+    // NOTE(jesper): SIMD vectors are named by their lane type and count, like f32x4 or i32x8.
+    // Lane indices are packed in 4 bits in the IR, which limits them to 16 lanes
+    if (i32 x = last_of(str, 'x'); x > 0) {
+        TypeExpr type = type_from_string(slice(str, 0, x));
+
+        i32 lanes;
+        if ((type == T_SIGNED || type == T_UNSIGNED || type == T_FLOAT) && type.lanes == 0 &&
+            i32_from_string(slice(str, x+1), &lanes) &&
+            (lanes == 2 || lanes == 4 || lanes == 8 || lanes == 16))
+        {
+            type.lanes = lanes;
+            return type;
+        }
     }
 
-    return { T_UNKNOWN };
+    return { T_INVALID };
 }
 
-AST* parse_statement(Lexer *lexer, Allocator mem) INTERNAL
+TypeExpr type_from_name(String name, Module *module)
 {
-    if (optional_token(lexer, '{')) {
-        AST *stmt = parse_statement(lexer, mem);
-        if (!stmt) return nullptr;
-
-        AST *ptr = stmt;
-        while (*lexer && peek_token(lexer) != '}') {
-            ptr->next = parse_statement(lexer, mem);
-            ptr = ptr->next;
-        }
+    for (TypeBinding binding : module->type_bindings) {
+        if (binding.name == name) return binding.type;
+    }
 
-        if (!require_next_token(lexer, '}')) {
-            PARSE_ERROR(lexer, "unclosed statement list");
-            return nullptr;
-        }
+    TypeExpr type = type_from_string(name);
 
-        return stmt;
-    } else if (Token t = peek_token(lexer); t == TOKEN_IDENTIFIER) {
-        Token identifier = t;
-        if (i32 kw = keyword_from_string(t.str); kw != KW_INVALID) {
-            next_token(lexer);
+    // NOTE(jesper): structs have to be declared before they're used
+    if (Symbol *sym = map_find(&module->symbols, name);
+        type == T_INVALID && sym && sym->type == SYM_STRUCT)
+    {
+        StructType *st = sym->struct_decl.type;
+        type = { T_STRUCT, st->size, 0, 0, st };
+    }
 
-            AST *ast = nullptr;
-            switch (kw) {
-            case KW_RETURN:
-                ast = ALLOC_T(mem, AST) {
-                    .type = AST_RETURN,
-                    .ret.expr = parse_expression(lexer, mem)
-                };
+    return type;
+}
 
-                if (!require_next_token(lexer, ';')) {
-                    PARSE_ERROR(lexer, "expected ';' after return statement");
-                    return nullptr;
-                }
-                break;
-            }
+// NOTE(jesper): the name of the type as it's written in source, which is what the names of
+// generic procedure instantiations are made of
+String string_from_type(TypeExpr type, Allocator mem)
+{
+    String name;
+    switch (type.prim) {
+    case T_VOID:     name = "void"; break;
+    case T_BOOL:     name = "bool"; break;
+    case T_SIGNED:   name = stringf(mem, "i%d", type.size*8); break;
+    case T_UNSIGNED: name = stringf(mem, "u%d", type.size*8); break;
+    case T_FLOAT:    name = stringf(mem, "f%d", type.size*8); break;
+    case T_STRUCT:   name = type.struct_type->identifier.str; break;
+    default:         name = string(sz_from_enum(type.prim)); break;
+    }
 
-            return ast;
-        } else if (peek_nth_token(lexer, 2) == ':') {
-            t = next_nth_token(lexer, 2);
+    if (type.lanes > 0) name = stringf(mem, "%.*sx%d", STRFMT(name), type.lanes);
+    for (i32 i = 0; i < type.pointers; i++) name = stringf(mem, "*%.*s", STRFMT(name));
 
-            AST *decl = ALLOC_T(mem, AST) {
-                .type = AST_VAR_DECL,
-                .var_decl.identifier = identifier,
-                .var_decl.type = parse_type_expression(lexer),
-            };
+    if (type.elems == TYPE_SLICE) name = stringf(mem, "[]%.*s", STRFMT(name));
+    else if (type.elems > 0) name = stringf(mem, "[%d]%.*s", type.elems, STRFMT(name));
+    return name;
+}
 
-            if (optional_token(lexer, '=')) {
-                decl->var_decl.init = parse_expression(lexer, mem);
+TypeExpr parse_type_expression(Lexer *lexer, Module *module)
+{
+    if (optional_token(lexer, '[')) {
+        i32 elems = TYPE_SLICE;
+        if (optional_token(lexer, TOKEN_INTEGER)) {
+            if (!i32_from_string(lexer->t.str, &elems) || elems <= 0) {
+                PARSE_ERROR(lexer, "invalid array size '%.*s'", STRFMT(lexer->t.str));
+                return { T_INVALID };
             }
-
-            if (!require_next_token(lexer, ';')) {
-                PARSE_ERROR(lexer, "expected ';' after declaration, got: '%.*s'", STRFMT(lexer->t.str));
-                return nullptr;
+        } else if (optional_token(lexer, TOKEN_IDENTIFIER)) {
+            // NOTE(jesper): constants are folded when they're declared, so one declared before
+            // the array can be used as its size
+            Symbol *sym = map_find(&module->symbols, lexer->t.str);
+            if (!sym || sym->type != SYM_CONSTANT) {
+                PARSE_ERROR(lexer, "array size '%.*s' is not a constant declared before it", STRFMT(lexer->t.str));
+                return { T_INVALID };
             }
 
-            return decl;
-        } else {
-            AST *expr = parse_expression(lexer, mem);
-            if (!expr) {
-                PARSE_ERROR(lexer, "invalid statement, expected an expression");
-                return nullptr;
+            AST *value = sym->constant.value;
+            if (value->type != AST_LITERAL ||
+                (value->literal.type != T_INTEGER && value->literal.type != T_SIGNED && value->literal.type != T_UNSIGNED) ||
+                value->literal.ival <= 0 || value->literal.ival > i32_MAX)
+            {
+                PARSE_ERROR(lexer, "invalid array size '%.*s', it has to be a positive integer constant", STRFMT(lexer->t.str));
+                return { T_INVALID };
             }
 
-            if (!require_next_token(lexer, ';')) {
-                PARSE_ERROR(lexer, "expected ';' after expression, got: '%.*s'", STRFMT(lexer->t.str));
+            elems = (i32)value->literal.ival;
+        }
+
+        if (!require_next_token(lexer, ']')) {
+            PARSE_ERROR(lexer, "expected ']' after array size");
+            return { T_INVALID };
+        }
+
+        // TODO(jesper): multi-dimensional arrays
+        TypeExpr type = parse_type_expression(lexer, module);
+        if (type == T_INVALID || type == T_UNKNOWN || type == T_VOID || type.elems != 0) {
+            PARSE_ERROR(lexer, "invalid array element type");
+            return { T_INVALID };
+        }
+
+        type.elems = elems;
+        return type;
+    }
+
+    if (optional_token(lexer, '*')) {
+        // TODO(jesper): pointers to arrays, for now they're passed around as slices
+        TypeExpr type = parse_type_expression(lexer, module);
+        if (type == T_INVALID || type == T_UNKNOWN || type == T_VOID || type.elems != 0) {
+            PARSE_ERROR(lexer, "invalid pointer type, expected '*<type>' of a scalar, vector, struct or pointer");
+            return { T_INVALID };
+        }
+
+        type.pointers++;
+        return type;
+    }
+
+    if (optional_token(lexer, TOKEN_IDENTIFIER)) return type_from_name(lexer->t.str, module);
+    return { T_UNKNOWN };
+}
+
+AST* parse_assignment(Lexer *lexer, Allocator mem)
+{
+    Token identifier;
+    if (!require_next_token(lexer, TOKEN_IDENTIFIER, &identifier) || !require_next_token(lexer, '=')) {
+        PARSE_ERROR(lexer, "expected assignment");
+        return nullptr;
+    }
+
+    AST *rhs = parse_expression(lexer, mem);
+    if (!rhs) {
+        PARSE_ERROR(lexer, "expected expression after '='");
+        return nullptr;
+    }
+
+    return ALLOC_T(mem, AST) {
+        .type = AST_VAR_STORE,
+        .var_store.identifier = identifier,
+        .var_store.rhs = rhs,
+    };
+}
+
+bool parse_directive_count(Lexer *lexer, i32 *count)
+{
+    if (!require_next_token(lexer, '(') ||
+        !require_next_token(lexer, TOKEN_INTEGER) ||
+        !i32_from_string(lexer->t.str, count) || *count <= 0)
+    {
+        PARSE_ERROR(lexer, "expected positive integer argument to directive");
+        return false;
+    }
+
+    if (!require_next_token(lexer, ')')) {
+        PARSE_ERROR(lexer, "expected ')' after directive argument");
+        return false;
+    }
+
+    return true;
+}
+
+// NOTE(jesper): parses the statements of a block up to and including its closing '}', which can
+// be none at all. The statements are appended to the list, including those of nested blocks
+bool parse_statement_list(Lexer *lexer, Module *module, Allocator mem, AST **stmts) INTERNAL
+{
+    AST **tail = stmts;
+    while (*lexer && peek_token(lexer) != '}') {
+        if (optional_token(lexer, '{')) {
+            if (!parse_statement_list(lexer, module, mem, tail)) return false;
+        } else if (!(*tail = parse_statement(lexer, module, mem))) {
+            return false;
+        }
+
+        while (*tail) tail = &(*tail)->next;
+    }
+
+    if (!require_next_token(lexer, '}')) {
+        PARSE_ERROR(lexer, "unclosed statement list");
+        return false;
+    }
+
+    return true;
+}
+
+bool parse_loop_body(Lexer *lexer, Module *module, Allocator mem, AST **body) INTERNAL
+{
+    if (optional_token(lexer, '{')) return parse_statement_list(lexer, module, mem, body);
+
+    if (!(*body = parse_statement(lexer, module, mem))) {
+        PARSE_ERROR(lexer, "expected loop body");
+        return false;
+    }
+
+    return true;
+}
+
+AST* parse_statement(Lexer *lexer, Module *module, Allocator mem) INTERNAL
+{
+    if (peek_token(lexer) == '#') {
+        LoopHints hints{};
+        while (optional_token(lexer, '#')) {
+            if (optional_identifier(lexer, "vectorize")) {
+                if (!parse_directive_count(lexer, &hints.vectorize_width)) return nullptr;
+            } else if (optional_identifier(lexer, "unroll")) {
+                if (!parse_directive_count(lexer, &hints.unroll_count)) return nullptr;
+            } else if (optional_identifier(lexer, "no_vectorize")) {
+                hints.no_vectorize = true;
+            } else if (optional_identifier(lexer, "no_unroll")) {
+                hints.no_unroll = true;
+            } else if (optional_identifier(lexer, "grain")) {
+                if (!parse_directive_count(lexer, &hints.grain_size)) return nullptr;
+            } else {
+                PARSE_ERROR(lexer, "unknown statement directive: %.*s", STRFMT(peek_token(lexer).str));
+                return nullptr;
+            }
+        }
+
+        if (hints.no_vectorize && hints.vectorize_width > 0) {
+            PARSE_ERROR(lexer, "#no_vectorize and #vectorize can't be combined");
+            return nullptr;
+        }
+
+        if (hints.no_unroll && hints.unroll_count > 0) {
+            PARSE_ERROR(lexer, "#no_unroll and #unroll can't be combined");
+            return nullptr;
+        }
+
+        AST *loop = parse_statement(lexer, module, mem);
+        if (!loop || loop->type != AST_LOOP) {
+            PARSE_ERROR(lexer, "loop directives have to be followed by a loop");
+            return nullptr;
+        }
+
+        if (hints.grain_size > 0 && !loop->loop.parallel) {
+            TERROR(loop->loop.token, "#grain only applies to parallel loops");
+            return nullptr;
+        }
+
+        loop->loop.hints = hints;
+        return loop;
+    } else if (optional_token(lexer, '{')) {
+        // NOTE(jesper): an empty block isn't a statement, the loops that accept one parse their
+        // body with parse_loop_body
+        AST *stmts = nullptr;
+        if (!parse_statement_list(lexer, module, mem, &stmts)) return nullptr;
+        return stmts;
+    } else if (peek_token(lexer) == '*') {
+        AST *lhs = parse_expression(lexer, mem);
+        if (!lhs || lhs->type != AST_DEREF || !optional_token(lexer, '=')) {
+            PARSE_ERROR(lexer, "invalid statement, expected '*<pointer> = <expression>;'");
+            return nullptr;
+        }
+
+        Token token = lexer->t;
+
+        AST *rhs = parse_expression(lexer, mem);
+        if (!rhs) {
+            PARSE_ERROR(lexer, "expected expression after '='");
+            return nullptr;
+        }
+
+        if (!require_next_token(lexer, ';')) {
+            PARSE_ERROR(lexer, "expected ';' after assignment, got: '%.*s'", STRFMT(lexer->t.str));
+            return nullptr;
+        }
+
+        return ALLOC_T(mem, AST) {
+            .type = AST_DEREF_STORE,
+            .deref_store.token = token,
+            .deref_store.lhs = lhs,
+            .deref_store.rhs = rhs,
+        };
+    } else if (Token t = peek_token(lexer); t == TOKEN_IDENTIFIER) {
+        Token identifier = t;
+        if (i32 kw = keyword_from_string(t.str); kw != KW_INVALID) {
+            next_token(lexer);
+
+            AST *ast = nullptr;
+            switch (kw) {
+            case KW_RETURN:
+                ast = ALLOC_T(mem, AST) {
+                    .type = AST_RETURN,
+                    .ret.token = identifier,
+                    .ret.expr = parse_expression(lexer, mem)
+                };
+
+                if (!require_next_token(lexer, ';')) {
+                    PARSE_ERROR(lexer, "expected ';' after return statement");
+                    return nullptr;
+                }
+                break;
+            case KW_WHILE:
+            case KW_FOR: {
+                // NOTE(jesper): `while <cond> <body>` and `for <init>; <cond>; <step> <body>`,
+                // where init is a declaration or assignment and step an assignment
+                ast = ALLOC_T(mem, AST) {
+                    .type = AST_LOOP,
+                    .loop.token = identifier,
+                };
+
+                if (kw == KW_FOR) {
+                    ast->loop.init = parse_statement(lexer, module, mem);
+                    if (!ast->loop.init ||
+                        (ast->loop.init->type != AST_VAR_DECL && ast->loop.init->type != AST_VAR_STORE))
+                    {
+                        PARSE_ERROR(lexer, "expected declaration or assignment in for loop");
+                        return nullptr;
+                    }
+                }
+
+                if (!(ast->loop.cond = parse_expression(lexer, mem))) {
+                    PARSE_ERROR(lexer, "expected loop condition");
+                    return nullptr;
+                }
+
+                if (kw == KW_FOR) {
+                    if (!require_next_token(lexer, ';')) {
+                        PARSE_ERROR(lexer, "expected ';' after for loop condition");
+                        return nullptr;
+                    }
+
+                    if (!(ast->loop.step = parse_assignment(lexer, mem))) return nullptr;
+                }
+
+                if (!parse_loop_body(lexer, module, mem, &ast->loop.body)) return nullptr;
+                } break;
+            case KW_PARALLEL: {
+                // NOTE(jesper): `parallel for <name> in <start>..<end> <body>` is parsed into
+                // `for <name> : i64 = <start>; <name> < <end>; <name> = <name> + 1 <body>`. The
+                // body is outlined into a procedure of its own when lowered, and the bounds are
+                // only evaluated once, before the iterations are split across threads
+                Token name;
+                if (!optional_identifier(lexer, "for") ||
+                    !require_next_token(lexer, TOKEN_IDENTIFIER, &name) ||
+                    !optional_identifier(lexer, "in"))
+                {
+                    PARSE_ERROR(lexer, "expected 'for <name> in <start>..<end>' after 'parallel'");
+                    return nullptr;
+                }
+
+                AST *start = parse_expression(lexer, mem);
+                if (!start || !require_next_token(lexer, '.') || !require_next_token(lexer, '.')) {
+                    PARSE_ERROR(lexer, "expected '<start>..<end>' range of parallel loop");
+                    return nullptr;
+                }
+
+                AST *end = parse_expression(lexer, mem);
+                if (!end) {
+                    PARSE_ERROR(lexer, "expected end of parallel loop range");
+                    return nullptr;
+                }
+
+                Token lt = name, add = name, one = name;
+                lt.type = (TokenType)'<'; lt.str = String{ "<" };
+                add.type = (TokenType)'+'; add.str = String{ "+" };
+                one.type = TOKEN_INTEGER; one.str = String{ "1" };
+
+                AST *step_one = ALLOC_T(mem, AST) {
+                    .type = AST_LITERAL,
+                    .literal.token = one,
+                    .literal.type = { T_INTEGER, 0 },
+                };
+                step_one->literal.ival = 1;
+
+                ast = ALLOC_T(mem, AST) {
+                    .type = AST_LOOP,
+                    .loop.token = identifier,
+                    .loop.init = ALLOC_T(mem, AST) {
+                        .type = AST_VAR_DECL,
+                        .var_decl.identifier = name,
+                        .var_decl.type = { T_SIGNED, 8 },
+                        .var_decl.init = start,
+                    },
+                    .loop.cond = ALLOC_T(mem, AST) {
+                        .type = AST_BINARY_OP,
+                        .binary_op.op = lt,
+                        .binary_op.lhs = ALLOC_T(mem, AST) { .type = AST_VAR_LOAD, .var_load.identifier = name },
+                        .binary_op.rhs = end,
+                    },
+                    .loop.step = ALLOC_T(mem, AST) {
+                        .type = AST_VAR_STORE,
+                        .var_store.identifier = name,
+                        .var_store.rhs = ALLOC_T(mem, AST) {
+                            .type = AST_BINARY_OP,
+                            .binary_op.op = add,
+                            .binary_op.lhs = ALLOC_T(mem, AST) { .type = AST_VAR_LOAD, .var_load.identifier = name },
+                            .binary_op.rhs = step_one,
+                        },
+                    },
+                    .loop.parallel = true,
+                };
+
+                if (!parse_loop_body(lexer, module, mem, &ast->loop.body)) return nullptr;
+                } break;
+            case KW_SWITCH: {
+                // NOTE(jesper): `switch <expr> { case <value>, ...: <statements> case: <statements> }`,
+                // where the case without values is taken when none of the others match
+                ast = ALLOC_T(mem, AST) {
+                    .type = AST_SWITCH,
+                    .switch_stmt.token = identifier,
+                };
+
+                if (!(ast->switch_stmt.expr = parse_expression(lexer, mem))) {
+                    PARSE_ERROR(lexer, "expected switch value");
+                    return nullptr;
+                }
+
+                if (!require_next_token(lexer, '{')) {
+                    PARSE_ERROR(lexer, "expected '{' after switch value");
+                    return nullptr;
+                }
+
+                AST **tail = &ast->switch_stmt.cases;
+                while (!optional_token(lexer, '}')) {
+                    Token token;
+                    if (!*lexer) {
+                        PARSE_ERROR(lexer, "unclosed switch statement");
+                        return nullptr;
+                    }
+
+                    if (!optional_identifier(lexer, "case", &token)) {
+                        PARSE_ERROR(lexer, "expected 'case' in switch, got: '%.*s'", STRFMT(peek_token(lexer).str));
+                        return nullptr;
+                    }
+
+                    AST *switch_case = ALLOC_T(mem, AST) {
+                        .type = AST_SWITCH_CASE,
+                        .switch_case.token = token,
+                    };
+
+                    AST **value = &switch_case->switch_case.values;
+                    while (peek_token(lexer) != ':') {
+                        if (!(*value = parse_expression(lexer, mem))) {
+                            PARSE_ERROR(lexer, "expected case value");
+                            return nullptr;
+                        }
+
+                        value = &(*value)->next;
+                        if (!optional_token(lexer, ',')) break;
+                    }
+
+                    if (!require_next_token(lexer, ':')) {
+                        PARSE_ERROR(lexer, "expected ':' after case values");
+                        return nullptr;
+                    }
+
+                    AST **stmt_tail = &switch_case->switch_case.body;
+                    while (*lexer && peek_token(lexer) != '}' && peek_token(lexer) != "case") {
+                        if (!(*stmt_tail = parse_statement(lexer, module, mem))) return nullptr;
+                        while (*stmt_tail) stmt_tail = &(*stmt_tail)->next;
+                    }
+
+                    *tail = switch_case;
+                    tail = &switch_case->next;
+                }
+                } break;
+            }
+
+            return ast;
+        } else if (peek_nth_token(lexer, 2) == ':') {
+            t = next_nth_token(lexer, 2);
+
+            AST *decl = ALLOC_T(mem, AST) {
+                .type = AST_VAR_DECL,
+                .var_decl.identifier = identifier,
+                .var_decl.type = parse_type_expression(lexer, module),
+            };
+
+            if (optional_token(lexer, '=')) {
+                decl->var_decl.init = parse_expression(lexer, mem);
+            }
+
+            if (!require_next_token(lexer, ';')) {
+                PARSE_ERROR(lexer, "expected ';' after declaration, got: '%.*s'", STRFMT(lexer->t.str));
+                return nullptr;
+            }
+
+            return decl;
+        } else if (peek_nth_token(lexer, 2) == '=') {
+            AST *assign = parse_assignment(lexer, mem);
+            if (!assign) return nullptr;
+
+            if (!require_next_token(lexer, ';')) {
+                PARSE_ERROR(lexer, "expected ';' after assignment, got: '%.*s'", STRFMT(lexer->t.str));
+                return nullptr;
+            }
+
+            return assign;
+        } else {
+            AST *expr = parse_expression(lexer, mem);
+            if (!expr) {
+                PARSE_ERROR(lexer, "invalid statement, expected an expression");
+                return nullptr;
+            }
+
+            if ((expr->type == AST_INDEX || expr->type == AST_FIELD) && optional_token(lexer, '=')) {
+                Token token = lexer->t;
+
+                AST *rhs = parse_expression(lexer, mem);
+                if (!rhs) {
+                    PARSE_ERROR(lexer, "expected expression after '='");
+                    return nullptr;
+                }
+
+                if (expr->type == AST_INDEX) {
+                    expr = ALLOC_T(mem, AST) {
+                        .type = AST_INDEX_STORE,
+                        .index_store.token = token,
+                        .index_store.lhs = expr,
+                        .index_store.rhs = rhs,
+                    };
+                } else {
+                    expr = ALLOC_T(mem, AST) {
+                        .type = AST_FIELD_STORE,
+                        .field_store.token = token,
+                        .field_store.lhs = expr,
+                        .field_store.rhs = rhs,
+                    };
+                }
+            }
+
+            if (!require_next_token(lexer, ';')) {
+                PARSE_ERROR(lexer, "expected ';' after expression, got: '%.*s'", STRFMT(lexer->t.str));
                 return nullptr;
             }
 
@@ -539,25 +1356,117 @@ AST* parse_proc_decl(Lexer *lexer, Module *module, Allocator mem) INTERNAL
     Lexer stored = *lexer;
 
     bool foreign = false;
+    bool exported = false;
+
+    bool instantiating = module->type_bindings.count > 0;
+    DynamicArray<Token> type_params{ .alloc = mem };
 
-    if (lexer->t == '#') {
+    bool cold = false;
+    bool hot = false;
+
+    while (lexer->t == '#') {
         if (optional_identifier(lexer, "foreign")) {
             foreign = true;
-            next_token(lexer);
+        } else if (optional_identifier(lexer, "export")) {
+            exported = true;
+        } else if (optional_identifier(lexer, "cold")) {
+            cold = true;
+        } else if (optional_identifier(lexer, "hot")) {
+            hot = true;
         } else {
-            PARSE_ERROR(lexer, "unknown proc directive: %.*s", STRFMT(lexer->t.str));
+            PARSE_ERROR(lexer, "unknown proc directive: %.*s", STRFMT(peek_token(lexer).str));
             return nullptr;
         }
-    } else if (lexer->t.type != TOKEN_IDENTIFIER) return nullptr;
+
+        next_token(lexer);
+    }
+
+    if (lexer->t.type != TOKEN_IDENTIFIER) return nullptr;
+
+    if (cold && hot) {
+        PARSE_ERROR(lexer, "#cold and #hot can't be combined");
+        return nullptr;
+    }
 
     Token identifier = lexer->t;
 
     // TODO(jesper): this meains `main :\s*: ()` is valid syntax, should it be?
     if (optional_token(lexer, ':') && optional_token(lexer, ':')) {
         if (optional_token(lexer, '(')) {
-            if (!require_next_token(lexer, ')')) {
-                PARSE_ERROR(lexer, "expected ')'");
-                return nullptr;
+            AST *params = nullptr;
+            if (!optional_token(lexer, ')')) {
+                AST **param = &params;
+                do {
+                    // NOTE(jesper): `$T : type` parameters make the procedure generic. While its
+                    // declaration is parsed the type parameters are bound to T_GENERIC types, and
+                    // to the type arguments of an instantiation while it's parsed, in which case
+                    // they're left out of its parameters
+                    if (optional_token(lexer, '$')) {
+                        Token name;
+                        if (!require_next_token(lexer, TOKEN_IDENTIFIER, &name) ||
+                            !require_next_token(lexer, ':') ||
+                            !optional_identifier(lexer, "type"))
+                        {
+                            PARSE_ERROR(lexer, "expected type parameter declaration, '$<name> : type'");
+                            return nullptr;
+                        }
+
+                        if (foreign) {
+                            PARSE_ERROR(lexer, "#foreign procedures cannot have type parameters");
+                            return nullptr;
+                        }
+
+                        if (!instantiating) {
+                            array_add(&type_params, name);
+                            array_add(&module->type_bindings, {
+                                name.str,
+                                { T_GENERIC, (i32)module->type_bindings.count+1 }
+                            });
+                        }
+                        continue;
+                    }
+
+                    // NOTE(jesper): #restrict promises that the memory the parameter points to
+                    // isn't accessed through any other pointer or slice while the procedure runs
+                    bool noalias = false;
+                    if (optional_token(lexer, '#')) {
+                        if (!optional_identifier(lexer, "restrict")) {
+                            PARSE_ERROR(lexer, "unknown parameter directive: %.*s", STRFMT(peek_token(lexer).str));
+                            return nullptr;
+                        }
+                        noalias = true;
+                    }
+
+                    Token name;
+                    if (!require_next_token(lexer, TOKEN_IDENTIFIER, &name) || !require_next_token(lexer, ':')) {
+                        PARSE_ERROR(lexer, "expected parameter declaration, '<name> : <type>'");
+                        return nullptr;
+                    }
+
+                    TypeExpr type = parse_type_expression(lexer, module);
+                    if (type == T_UNKNOWN || type == T_INVALID || type == T_VOID) {
+                        PARSE_ERROR(lexer, "invalid type expression for parameter '%.*s'", STRFMT(name.str));
+                        return nullptr;
+                    }
+
+                    if (noalias && type.elems != TYPE_SLICE && (type.elems != 0 || type.pointers == 0)) {
+                        PARSE_ERROR(lexer, "#restrict parameter '%.*s' has to be a pointer or slice", STRFMT(name.str));
+                        return nullptr;
+                    }
+
+                    *param = ALLOC_T(mem, AST) {
+                        .type = AST_VAR_DECL,
+                        .var_decl.identifier = name,
+                        .var_decl.type = type,
+                        .var_decl.noalias = noalias,
+                    };
+                    param = &(*param)->next;
+                } while (optional_token(lexer, ','));
+
+                if (!require_next_token(lexer, ')')) {
+                    PARSE_ERROR(lexer, "expected ')' after parameter list");
+                    return nullptr;
+                }
             }
 
             TypeExpr ret_type { T_UNKNOWN };
@@ -567,7 +1476,7 @@ AST* parse_proc_decl(Lexer *lexer, Module *module, Allocator mem) INTERNAL
                     return nullptr;
                 }
 
-                ret_type = parse_type_expression(lexer);
+                ret_type = parse_type_expression(lexer, module);
                 if (ret_type == T_UNKNOWN) {
                     PARSE_ERROR(lexer, "missing explicit type expression for return type; add appropriate return type or remove the '->' for implicit retun type deduction");
                     return nullptr;
@@ -589,7 +1498,7 @@ AST* parse_proc_decl(Lexer *lexer, Module *module, Allocator mem) INTERNAL
                     return nullptr;
                 }
             } else {
-                body = parse_statement(lexer, mem);
+                body = parse_statement(lexer, module, mem);
 
                 if (!body && !require_next_token(lexer, ';')) {
                     PARSE_ERROR(lexer, "expected procedure body after decl");
@@ -602,13 +1511,37 @@ AST* parse_proc_decl(Lexer *lexer, Module *module, Allocator mem) INTERNAL
                 .proc_decl.identifier = identifier,
                 .proc_decl.ret_type = ret_type,
                 .proc_decl.flags.foreign = foreign,
+                .proc_decl.flags.exported = exported,
+                .proc_decl.flags.generic = type_params.count > 0,
+                .proc_decl.flags.cold = cold,
+                .proc_decl.flags.hot = hot,
+                .proc_decl.params = params,
                 .proc_decl.body = body,
             };
 
-            map_find_emplace(&module->symbols, identifier.str, {
-                .type = SYM_PROC,
-                .proc = { proc },
-            });
+            // NOTE(jesper): instantiations are added to the symbols under their own name once
+            // they've been parsed
+            if (instantiating) return proc;
+
+            if (type_params.count > 0) {
+                module->type_bindings.count = 0;
+                map_find_emplace(&module->symbols, identifier.str, {
+                    .type = SYM_GENERIC,
+                    .generic = {
+                        ALLOC_T(mem, GenericProc) {
+                            .decl = proc,
+                            .type_params = type_params,
+                            .lexer = stored,
+                            .mem = mem,
+                        }
+                    },
+                });
+            } else {
+                map_find_emplace(&module->symbols, identifier.str, {
+                    .type = SYM_PROC,
+                    .proc = { proc },
+                });
+            }
 
             return proc;
         }
@@ -618,188 +1551,618 @@ AST* parse_proc_decl(Lexer *lexer, Module *module, Allocator mem) INTERNAL
     return nullptr;
 }
 
-TypeExpr ast_typecheck(AST *ast, TypeExpr parent, Module *module, AST *proc)
+// NOTE(jesper): scalars and SIMD vectors are aligned to their size, which is what LLVM's data
+// layout does for them on every target we support
+void struct_compute_layout(StructType *st, i32 alignment)
 {
-    switch (ast->type) {
-    case AST_VAR_LOAD: {
-        Symbol *sym = map_find(&module->symbols, ast->var_load.identifier.str);
-        if (!sym) {
-            TERROR(ast->var_load.identifier,
-                   "unknown variable '%.*s'",
-                   STRFMT(ast->var_load.identifier.str));
-            return { T_INVALID };
+    if (!st->packed && !st->ordered) {
+        // NOTE(jesper): stable, so fields of the same alignment stay in declaration order
+        for (i32 i = 1; i < st->fields.count; i++) {
+            StructField field = st->fields[i];
+
+            i32 j = i;
+            for (; j > 0 && type_size(st->fields[j-1].type) < type_size(field.type); j--) {
+                st->fields[j] = st->fields[j-1];
+            }
+            st->fields[j] = field;
         }
+    }
 
-        if (sym->type != SYM_VARIABLE) {
-            TERROR(ast->var_load.identifier,
-                   "'%.*s' is not a variable",
-                   STRFMT(ast->var_load.identifier.str));
-            return { T_INVALID };
+    i32 offset = 0, soa_offset = 0;
+    st->alignment = 1;
+    for (StructField &field : st->fields) {
+        i32 size = type_size(field.type);
+        if (!st->packed) {
+            offset = (offset + size-1) / size * size;
+            st->alignment = MAX(st->alignment, size);
         }
 
-        return sym->variable.type;
-        } break;
-    case AST_VAR_STORE: {
-        Symbol *sym = map_find(&module->symbols, ast->var_store.identifier.str);
-        if (!sym) {
-            TERROR(ast->var_load.identifier,
-                   "Unknown variable '%.*s'",
-                   STRFMT(ast->var_load.identifier.str));
-            return { T_INVALID };
-        }
+        field.offset = offset;
+        field.soa_offset = soa_offset;
+        offset += size;
+        soa_offset += size;
+    }
 
-        if (sym->type != SYM_VARIABLE) {
-            TERROR(ast->var_load.identifier,
-                   "symbol '%.*s' is not a variable",
-                   STRFMT(ast->var_load.identifier.str));
-            return { T_INVALID };
-        }
+    st->alignment = MAX(st->alignment, alignment);
+    st->size = (offset + st->alignment-1) / st->alignment * st->alignment;
+}
 
-        TypeExpr lhs = sym->variable.type;
-        TypeExpr rhs = ast_typecheck(ast->var_store.rhs, lhs, module, proc);
-        if (lhs != rhs) {
+// NOTE(jesper): `Name :: struct #packed #ordered #align(n) #soa { field : type; ... }`
+StructType* parse_struct_decl(Lexer *lexer, Module *module, Allocator mem)
+{
+    if (lexer->t.type != TOKEN_IDENTIFIER) return nullptr;
 
-            // TODO(jesper): implicit/explicit conversion rules
-            TERROR(ast->var_store.identifier,
-                   "type mismatch, variable declared as [%s:%d], assignment deduced as [%s:%d]",
-                   sz_from_enum(lhs.prim), lhs.size,
-                   sz_from_enum(rhs.prim), rhs.size);
-            return { T_INVALID };
+    Lexer stored = *lexer;
+    Token identifier = lexer->t;
+
+    if (!optional_token(lexer, ':') || !optional_token(lexer, ':') || !optional_identifier(lexer, "struct")) {
+        *lexer = stored;
+        return nullptr;
+    }
+
+    StructType *st = ALLOC_T(mem, StructType) { .identifier = identifier };
+
+    i32 alignment = 1;
+    while (optional_token(lexer, '#')) {
+        if (optional_identifier(lexer, "packed")) {
+            st->packed = true;
+        } else if (optional_identifier(lexer, "ordered")) {
+            st->ordered = true;
+        } else if (optional_identifier(lexer, "soa")) {
+            st->soa = true;
+        } else if (optional_identifier(lexer, "align")) {
+            if (!parse_directive_count(lexer, &alignment)) return nullptr;
+            if ((alignment & (alignment-1)) != 0 || alignment > 4096) {
+                PARSE_ERROR(lexer, "struct alignment has to be a power of two, no larger than 4096");
+                return nullptr;
+            }
+        } else {
+            PARSE_ERROR(lexer, "unknown struct directive: %.*s", STRFMT(peek_token(lexer).str));
+            return nullptr;
         }
+    }
 
-        return lhs;
-        } break;
-    case AST_VAR_DECL:
-        if (ast->var_decl.init) {
-            TypeExpr init_type = ast_typecheck(ast->var_decl.init, ast->var_decl.type, module, proc);
-            if (ast->var_decl.type == T_UNKNOWN) {
-                ast->var_decl.type = init_type;
-            } else if (init_type.prim != ast->var_decl.type.prim) {
-                // TODO(jesper): check if the type is compatible or implicitly convertible
-                TERROR(ast->var_decl.identifier,
-                       "type mismatch in declaration and assignment of variable, declared as [%s:%d], assignment deduced as [%s:%d]",
-                       sz_from_enum(ast->var_decl.type.prim), ast->var_decl.type.size,
-                       sz_from_enum(init_type.prim), init_type.size);
-                return { T_INVALID };
+    // NOTE(jesper): the field arrays of #soa structs are ordered by alignment so that they can
+    // be laid out back to back for any element count
+    if (st->soa && (st->packed || st->ordered)) {
+        PARSE_ERROR(lexer, "#soa structs cannot be #packed or #ordered, their field arrays are always ordered by alignment");
+        return nullptr;
+    }
+
+    if (!require_next_token(lexer, '{')) {
+        PARSE_ERROR(lexer, "expected '{' after struct declaration");
+        return nullptr;
+    }
+
+    DynamicArray<StructField> fields{ .alloc = mem };
+    while (!optional_token(lexer, '}')) {
+        Token name;
+        if (!require_next_token(lexer, TOKEN_IDENTIFIER, &name) || !require_next_token(lexer, ':')) {
+            PARSE_ERROR(lexer, "expected field declaration, '<name> : <type>;'");
+            return nullptr;
+        }
+
+        // TODO(jesper): nested structs, fixed arrays and pointers in structs
+        TypeExpr type = parse_type_expression(lexer, module);
+        if (type == T_UNKNOWN || type == T_INVALID || type == T_VOID || type == T_STRUCT ||
+            type.elems != 0 || type.pointers != 0)
+        {
+            PARSE_ERROR(lexer, "invalid type of field '%.*s', expected a scalar or SIMD vector type", STRFMT(name.str));
+            return nullptr;
+        }
+
+        for (StructField &it : fields) {
+            if (it.identifier == name.str) {
+                TERROR(name, "duplicate field '%.*s'", STRFMT(name.str));
+                return nullptr;
             }
         }
 
-        if (ast->var_decl.type == T_INTEGER) {
-            TERROR(ast->var_decl.identifier,
-                   "cannot infer signage of integer variable, '%.*s'",
-                   STRFMT(ast->var_decl.identifier.str));
-            return { T_INVALID };
+        array_add(&fields, StructField{ .identifier = name, .type = type });
+
+        if (!require_next_token(lexer, ';')) {
+            PARSE_ERROR(lexer, "expected ';' after field declaration");
+            return nullptr;
         }
+    }
 
-        if (ast->var_decl.type == T_UNKNOWN) {
-            TERROR(ast->var_decl.identifier,
-                   "cannot infer type of '%.*s'",
-                   STRFMT(ast->var_decl.identifier.str));
-            return { T_INVALID };
+    if (fields.count == 0) {
+        TERROR(identifier, "struct '%.*s' has no fields", STRFMT(identifier.str));
+        return nullptr;
+    }
+
+    if (map_find(&module->symbols, identifier.str)) {
+        TERROR(identifier, "redefinition of '%.*s'", STRFMT(identifier.str));
+        return nullptr;
+    }
+
+    st->fields = fields;
+    struct_compute_layout(st, alignment);
+
+    map_set(&module->symbols, identifier.str, {
+        .type = SYM_STRUCT,
+        .struct_decl = { st },
+    });
+
+    return st;
+}
+
+// NOTE(jesper): whether an integer literal's value can be represented by the scalar integer type
+bool literal_fits_type(i64 ival, TypeExpr type)
+{
+    i32 bits = type.size*8;
+    if (type == T_SIGNED) return bits == 64 || (ival >= -(1ll << (bits-1)) && ival < (1ll << (bits-1)));
+    return ival >= 0 && (bits == 64 || ival < (1ll << bits));
+}
+
+// NOTE(jesper): constant initialisers are folded to a literal as they're parsed, so they can
+// only refer to constants declared before them. Integers stay untyped unless they're negative,
+// so that a constant takes its type from where it's used the same as a literal does
+AST* ast_fold_constant(AST *expr, Token decl, Module *module, Allocator mem) INTERNAL
+{
+    switch (expr->type) {
+    case AST_LITERAL:
+        return expr;
+    case AST_VAR_LOAD: {
+        Symbol *sym = map_find(&module->symbols, expr->var_load.identifier.str);
+        if (!sym || sym->type != SYM_CONSTANT) {
+            TERROR(expr->var_load.identifier,
+                   "'%.*s' is not a constant declared before '%.*s'",
+                   STRFMT(expr->var_load.identifier.str), STRFMT(decl.str));
+            return nullptr;
         }
 
-        map_set(&module->symbols, ast->var_decl.identifier.str, {
-            SYM_VARIABLE,
-            .variable = { ast->var_decl.type }
-        });
+        if (sym->constant.value->type == AST_RUN) {
+            TERROR(expr->var_load.identifier,
+                   "'%.*s' isn't known until its #run directive is evaluated, initialise '%.*s' with a #run directive instead",
+                   STRFMT(expr->var_load.identifier.str), STRFMT(decl.str));
+            return nullptr;
+        }
 
-        return ast->var_decl.type;
-    case AST_PROC_DECL:
-        for (AST *stmt = ast->proc_decl.body; stmt; stmt = stmt->next) {
-            if (ast_typecheck(stmt, ast->proc_decl.ret_type, module, ast) == T_INVALID)
-                return { T_INVALID };
+        return sym->constant.value;
         }
+    case AST_BINARY_OP: {
+        AST *lhs = ast_fold_constant(expr->binary_op.lhs, decl, module, mem);
+        if (!lhs) return nullptr;
 
-        // TODO(jesper): proc type expr?
-        return ast->proc_decl.ret_type;
+        AST *rhs = ast_fold_constant(expr->binary_op.rhs, decl, module, mem);
+        if (!rhs) return nullptr;
 
-    case AST_PROC_CALL: {
-        Symbol *sym = map_find(&module->symbols, ast->proc_call.identifier.str);
-        if (!sym || sym->type != SYM_PROC) {
-            TERROR(ast->proc_call.identifier, "procedure not found: '%.*s'", STRFMT(ast->proc_call.identifier.str));
-            return { T_INVALID };
+        Token op = expr->binary_op.op;
+        TypeExpr lhs_t = lhs->literal.type;
+        TypeExpr rhs_t = rhs->literal.type;
+
+        AST *result = ALLOC_T(mem, AST) {
+            .type = AST_LITERAL,
+            .literal.token = op,
+            .literal.type = { T_BOOL, 1 },
+        };
+
+        if (lhs_t == T_BOOL || rhs_t == T_BOOL) {
+            if (lhs_t != rhs_t || (op != TOKEN_EQ && op != TOKEN_NE)) {
+                TERROR(op, "invalid operands of '%.*s' in constant '%.*s'", STRFMT(op.str), STRFMT(decl.str));
+                return nullptr;
+            }
+
+            result->literal.bval = (lhs->literal.bval == rhs->literal.bval) == (op == TOKEN_EQ);
+            return result;
         }
 
-        return sym->proc.ast->proc_decl.ret_type;
-        } break;
+        if ((lhs_t == T_FLOAT) != (rhs_t == T_FLOAT)) {
+            TERROR(op, "mismatched integer and float operands of '%.*s' in constant '%.*s'", STRFMT(op.str), STRFMT(decl.str));
+            return nullptr;
+        }
 
-    case AST_RETURN: {
-        PANIC_IF(!proc || proc->type != AST_PROC_DECL, "expected AST_PROC_DECL");
+        if (lhs_t == T_FLOAT) {
+            f32 a = lhs->literal.fval, b = rhs->literal.fval;
+            switch (op.type) {
+            case '<':      result->literal.bval = a < b; return result;
+            case '>':      result->literal.bval = a > b; return result;
+            case TOKEN_LE: result->literal.bval = a <= b; return result;
+            case TOKEN_GE: result->literal.bval = a >= b; return result;
+            case TOKEN_EQ: result->literal.bval = a == b; return result;
+            case TOKEN_NE: result->literal.bval = a != b; return result;
+            default: break;
+            }
 
-        TypeExpr ret_type = { T_VOID };
-        // TODO(jesper): I don't think this is correct, but I need to add more conversion rules and explicit return type syntax before really testing this further
-        if (ast->ret.expr) ret_type = ast_typecheck(ast->ret.expr, { T_SIGNED }, module, proc);
+            result->literal.type = { T_FLOAT, 4 };
+            switch (op.type) {
+            case '+': result->literal.fval = a + b; break;
+            case '-': result->literal.fval = a - b; break;
+            case '*': result->literal.fval = a * b; break;
+            case '/': result->literal.fval = a / b; break;
+            default: PANIC_UNREACHABLE();
+            }
 
-        if (proc->proc_decl.ret_type == T_UNKNOWN)
-            proc->proc_decl.ret_type = ret_type;
+            return result;
+        }
 
-        if (proc->proc_decl.ret_type.prim != ret_type.prim) {
-            TERROR(ast->ret.token,
-                   "type mismatch in return statement; proc ret type dedeuced to [%s:%d], return expression deduced as [%s:%d]",
-                   sz_from_enum(proc->proc_decl.ret_type.prim), proc->proc_decl.ret_type.size,
-                   sz_from_enum(ret_type.prim), ret_type.size);
+        i64 a = lhs->literal.ival, b = rhs->literal.ival;
+        switch (op.type) {
+        case '<':      result->literal.bval = a < b; return result;
+        case '>':      result->literal.bval = a > b; return result;
+        case TOKEN_LE: result->literal.bval = a <= b; return result;
+        case TOKEN_GE: result->literal.bval = a >= b; return result;
+        case TOKEN_EQ: result->literal.bval = a == b; return result;
+        case TOKEN_NE: result->literal.bval = a != b; return result;
+        default: break;
+        }
 
-            return { T_INVALID };
+        i64 value;
+        bool overflow = false;
+        switch (op.type) {
+        case '+': overflow = __builtin_add_overflow(a, b, &value); break;
+        case '-': overflow = __builtin_sub_overflow(a, b, &value); break;
+        case '*': overflow = __builtin_mul_overflow(a, b, &value); break;
+        case '/':
+            if (b == 0) {
+                TERROR(op, "division by zero in constant '%.*s'", STRFMT(decl.str));
+                return nullptr;
+            }
+
+            overflow = a == i64_MIN && b == -1;
+            value = overflow ? 0 : a / b;
+            break;
+        default: PANIC_UNREACHABLE();
         }
 
-        return ret_type;
-        } break;
-    case AST_LITERAL:
-        if (ast->literal.type == T_INTEGER) {
-            if (parent == T_SIGNED || parent == T_UNSIGNED)
-                ast->literal.type.prim = parent.prim;
-            else if (parent == T_UNKNOWN)
-                ast->literal.type.prim = T_SIGNED;
+        if (overflow) {
+            TERROR(op, "integer overflow in constant '%.*s'", STRFMT(decl.str));
+            return nullptr;
         }
 
-        return ast->literal.type;
-    case AST_BINARY_OP: {
-        TypeExpr lhs = ast_typecheck(ast->binary_op.lhs, parent, module, proc);
-        TypeExpr rhs = ast_typecheck(ast->binary_op.rhs, parent, module, proc);
+        bool is_signed = value < 0 || lhs_t == T_SIGNED || rhs_t == T_SIGNED;
+        result->literal.type = { is_signed ? T_SIGNED : T_INTEGER, 0 };
+        result->literal.ival = value;
+        return result;
+        }
+    case AST_RUN:
+        TERROR(expr->run.token,
+               "#run has to be the whole initialiser of constant '%.*s', it can't be folded with anything else",
+               STRFMT(decl.str));
+        return nullptr;
+    default:
+        TERROR(decl,
+               "'%.*s' is not a constant expression, it can only contain literals, earlier constants and arithmetic or comparisons of them, or be a #run directive",
+               STRFMT(decl.str));
+        return nullptr;
+    }
+}
 
-        if (lhs.prim != rhs.prim) {
-            TERROR(ast->binary_op.op,
-                   "type mismatch in binary operation [%s:%d] %.*s [%s:%d]",
-                   sz_from_enum(lhs.prim), lhs.size,
-                   STRFMT(ast->binary_op.op.str),
-                   sz_from_enum(rhs.prim), rhs.size);
+// NOTE(jesper): `NAME :: expr;` declares a constant scalar, and `NAME :: [N]T(e0, e1, ...);` a
+// constant array of scalars, which is emitted as read-only data instead of being built on the
+// stack of every procedure that uses it
+bool parse_constant_decl(Lexer *lexer, Module *module, Allocator mem) INTERNAL
+{
+    Token identifier = lexer->t;
+    if (!require_next_token(lexer, ':') || !require_next_token(lexer, ':')) {
+        PARSE_ERROR(lexer, "expected '::' after constant name");
+        return false;
+    }
+
+    if (map_find(&module->symbols, identifier.str)) {
+        TERROR(identifier, "redefinition of '%.*s'", STRFMT(identifier.str));
+        return false;
+    }
+
+    if (peek_token(lexer) == '[') {
+        TypeExpr type = parse_type_expression(lexer, module);
+        if (type == T_INVALID) return false;
+
+        if (type.elems <= 0 || type.lanes != 0 || type.pointers != 0 || type == T_STRUCT) {
+            TERROR(identifier, "constant array '%.*s' has to be a fixed array of scalars", STRFMT(identifier.str));
+            return false;
         }
 
-        return lhs;
-    } break;
-    case AST_INVALID:
-        PANIC_UNREACHABLE();
-        break;
+        if (!require_next_token(lexer, '(')) {
+            PARSE_ERROR(lexer, "expected '(' followed by the elements of constant array '%.*s'", STRFMT(identifier.str));
+            return false;
+        }
+
+        AST *elems = nullptr;
+        if (!parse_args(lexer, mem, &elems)) return false;
+
+        TypeExpr elem_t = type;
+        elem_t.elems = 0;
+
+        i32 count = 0;
+        AST **ptr = &elems;
+        for (AST *elem = elems; elem; elem = elem->next, count++) {
+            // NOTE(jesper): checked against the element type when it's typechecked, and replaced
+            // by its literal when it's evaluated with the rest of the #run directives
+            if (elem->type == AST_RUN) {
+                ptr = &elem->next;
+                continue;
+            }
+
+            AST *value = ast_fold_constant(elem, identifier, module, mem);
+            if (!value) return false;
+
+            // NOTE(jesper): copied, the folded literal may be a constant shared with other uses
+            AST *literal = ALLOC_T(mem, AST) { *value };
+            literal->next = elem->next;
+            (*ptr) = literal;
+            ptr = &literal->next;
+            elem = literal;
+
+            TypeExpr value_t = literal->literal.type;
+            bool valid = elem_t == T_FLOAT
+                ? value_t == T_FLOAT
+                : elem_t == T_BOOL
+                ? value_t == T_BOOL
+                : (value_t == T_INTEGER || value_t == T_SIGNED) && literal_fits_type(literal->literal.ival, elem_t);
+
+            if (!valid) {
+                TERROR(literal->literal.token,
+                       "element %d of constant array '%.*s' is not a valid [%s:%d]",
+                       count, STRFMT(identifier.str), sz_from_enum(elem_t.prim), elem_t.size);
+                return false;
+            }
+
+            if (elem_t == T_FLOAT && elem_t.size == 8) literal->literal.dval = literal->literal.fval;
+            literal->literal.type = elem_t;
+        }
+
+        if (count != type.elems) {
+            TERROR(identifier,
+                   "constant array '%.*s' is declared with %d elements, initialised with %d",
+                   STRFMT(identifier.str), type.elems, count);
+            return false;
+        }
+
+        if (!require_next_token(lexer, ';')) {
+            PARSE_ERROR(lexer, "expected ';' after constant declaration");
+            return false;
+        }
+
+        i32 index = array_add(&module->globals, GlobalConstant{
+            .identifier = identifier,
+            .type = type,
+            .elems = elems,
+        });
+
+        map_set(&module->symbols, identifier.str, {
+            .type = SYM_GLOBAL,
+            .global = { index },
+        });
+
+        return true;
     }
 
-    return { T_UNKNOWN };
+    AST *expr = parse_expression(lexer, mem);
+    if (!expr) {
+        PARSE_ERROR(lexer, "expected constant expression");
+        return false;
+    }
+
+    if (!require_next_token(lexer, ';')) {
+        PARSE_ERROR(lexer, "expected ';' after constant declaration");
+        return false;
+    }
+
+    // NOTE(jesper): a constant initialised by #run is only evaluated if it's used. Each use is a
+    // copy of the directive, and the copies share its expression so that it's evaluated once
+    AST *value = expr->type == AST_RUN ? expr : ast_fold_constant(expr, identifier, module, mem);
+    if (!value) return false;
+
+    map_set(&module->symbols, identifier.str, {
+        .type = SYM_CONSTANT,
+        .constant = { value },
+    });
+
+    return true;
 }
 
-TypeExpr ast_sizecheck(AST *ast, Module *module, AST *proc, i32 topdown_size = 0)
+AST* ast_find_var_load(AST *expr)
+{
+    switch (expr->type) {
+    case AST_VAR_LOAD:
+        return expr;
+    case AST_BINARY_OP:
+        if (AST *var = ast_find_var_load(expr->binary_op.lhs); var) return var;
+        return ast_find_var_load(expr->binary_op.rhs);
+    case AST_RUN:
+        return ast_find_var_load(expr->run.expr);
+    case AST_PROC_CALL:
+        for (AST *arg = expr->proc_call.args; arg; arg = arg->next) {
+            if (AST *var = ast_find_var_load(arg); var) return var;
+        }
+        return nullptr;
+    case AST_VECTOR:
+        for (AST *elem = expr->vector.elems; elem; elem = elem->next) {
+            if (AST *var = ast_find_var_load(elem); var) return var;
+        }
+        return nullptr;
+    case AST_SWIZZLE:
+        return ast_find_var_load(expr->swizzle.expr);
+    case AST_REDUCE:
+        return ast_find_var_load(expr->reduce.expr);
+    case AST_INDEX:
+        if (AST *var = ast_find_var_load(expr->index.expr); var) return var;
+        return ast_find_var_load(expr->index.index);
+    case AST_COUNT:
+        return ast_find_var_load(expr->count.expr);
+    case AST_FIELD:
+        return ast_find_var_load(expr->field.expr);
+    case AST_ADDRESS_OF:
+    case AST_DEREF:
+        return ast_find_var_load(expr->unary.expr);
+    case AST_ATOMIC:
+        for (AST *arg = expr->atomic.args; arg; arg = arg->next) {
+            if (AST *var = ast_find_var_load(arg); var) return var;
+        }
+        return nullptr;
+    case AST_INTRINSIC:
+        for (AST *arg = expr->intrinsic.args; arg; arg = arg->next) {
+            if (AST *var = ast_find_var_load(arg); var) return var;
+        }
+        return nullptr;
+    default:
+        return nullptr;
+    }
+}
+
+// NOTE(jesper): fixed arrays convert to slices of the same element type, everything else has to
+// match exactly
+bool type_assignable(TypeExpr dst, TypeExpr src)
+{
+    if (dst.prim != src.prim || dst.lanes != src.lanes || dst.struct_type != src.struct_type ||
+        dst.pointers != src.pointers)
+    {
+        return false;
+    }
+
+    return dst.elems == src.elems || (dst.elems == TYPE_SLICE && src.elems > 0);
+}
+
+// NOTE(jesper): the parameter type with its type parameter replaced by its type argument, or
+// unknown if it hasn't been given or deduced yet
+TypeExpr type_substitute(TypeExpr type, Array<TypeExpr> type_args)
+{
+    if (type != T_GENERIC) return type;
+
+    TypeExpr arg = type_args[type.size-1];
+    if (!arg) return { T_UNKNOWN };
+
+    arg.elems = type.elems;
+    arg.pointers += type.pointers;
+    return arg;
+}
+
+// NOTE(jesper): the type argument that makes the parameter type match the argument's, which has
+// to have its size known by now, so untyped literals can't be deduced from
+TypeExpr type_deduce(TypeExpr param, TypeExpr arg)
+{
+    if (param.elems != 0) {
+        if (arg.elems == 0 || (param.elems > 0 && param.elems != arg.elems)) return { T_INVALID };
+        arg.elems = 0;
+    }
+
+    if (arg.pointers < param.pointers) return { T_INVALID };
+    arg.pointers -= param.pointers;
+
+    if (!arg || arg == T_INTEGER) return { T_INVALID };
+    return arg;
+}
+
+// NOTE(jesper): instantiations are memoised by their name, so every distinct set of type arguments
+// is only parsed, checked and lowered once
+AST* instantiate_generic_proc(GenericProc *generic, Array<TypeExpr> type_args, Module *module)
+{
+    SArena scratch = tl_scratch_arena();
+
+    String name = stringf(scratch, "%.*s[", STRFMT(generic->decl->proc_decl.identifier.str));
+    for (i32 i = 0; i < type_args.count; i++) {
+        name = stringf(scratch, "%.*s%s%.*s",
+                       STRFMT(name), i > 0 ? "," : "",
+                       STRFMT(string_from_type(type_args[i], scratch)));
+    }
+    name = stringf(generic->mem, "%.*s]", STRFMT(name));
+
+    if (AST **instance = map_find(&module->instances, name); instance) return *instance;
+
+    for (i32 i = 0; i < type_args.count; i++) {
+        array_add(&module->type_bindings, { generic->type_params[i].str, type_args[i] });
+    }
+
+    Lexer lexer = generic->lexer;
+    AST *decl = parse_proc_decl(&lexer, module, generic->mem);
+    module->type_bindings.count = 0;
+    if (!decl) return nullptr;
+
+    decl->proc_decl.identifier.str = name;
+    map_set(&module->instances, name, decl);
+    map_set(&module->symbols, name, {
+        .type = SYM_PROC,
+        .proc = { decl },
+    });
+
+    // NOTE(jesper): procedures are checked in the order they're declared in, which puts the
+    // instantiation after the procedures calling it
+    array_add(&module->procedures, decl);
+
+    AST *tail = module->ast;
+    while (tail->next) tail = tail->next;
+    tail->next = decl;
+
+    LOG_INFO("instantiated %.*s", STRFMT(name));
+    return decl;
+}
+
+void declare_variable(Module *module, String name, TypeExpr type)
+{
+    ScopedSymbol scoped{ .name = name };
+    if (Symbol *sym = map_find(&module->symbols, name); sym) {
+        scoped.shadowed = *sym;
+        scoped.has_shadowed = true;
+    }
+
+    array_add(&module->scope, scoped);
+    map_set(&module->symbols, name, {
+        .type = SYM_VARIABLE,
+        .variable = { type }
+    });
+}
+
+void pop_scope(Module *module, i32 scope)
+{
+    // NOTE(jesper): unwound in reverse, so a variable declared twice in the same scope ends up
+    // with whatever it shadowed before the first declaration
+    for (i32 i = module->scope.count-1; i >= scope; i--) {
+        ScopedSymbol scoped = module->scope[i];
+        if (scoped.has_shadowed) map_set(&module->symbols, scoped.name, scoped.shadowed);
+        else map_remove(&module->symbols, scoped.name);
+    }
+
+    module->scope.count = scope;
+}
+
+TypeExpr ast_typecheck(AST *ast, TypeExpr parent, Module *module, AST *proc)
 {
     switch (ast->type) {
     case AST_VAR_LOAD: {
         Symbol *sym = map_find(&module->symbols, ast->var_load.identifier.str);
         if (!sym) {
-            TERROR(ast->var_load.identifier, "Unknown variable '%.*s'", STRFMT(ast->var_load.identifier.str));
+            TERROR(ast->var_load.identifier,
+                   "unknown variable '%.*s'",
+                   STRFMT(ast->var_load.identifier.str));
             return { T_INVALID };
         }
 
+        // NOTE(jesper): a use of a constant is replaced by a copy of its folded literal, or of
+        // its #run directive, and a use of a constant array by a load of the global it's emitted as
+        if (sym->type == SYM_CONSTANT) {
+            Token identifier = ast->var_load.identifier;
+            AST *next = ast->next;
+
+            *ast = *sym->constant.value;
+            ast->next = next;
+            if (ast->type == AST_LITERAL) ast->literal.token = identifier;
+            return ast_typecheck(ast, parent, module, proc);
+        }
+
+        if (sym->type == SYM_GLOBAL) {
+            Token identifier = ast->var_load.identifier;
+            ast->type = AST_GLOBAL;
+            ast->global.token = identifier;
+            ast->global.index = sym->global.index;
+            return ast->global.type = module->globals[sym->global.index].type;
+        }
+
         if (sym->type != SYM_VARIABLE) {
             TERROR(ast->var_load.identifier,
-                   "symbol '%.*s' is not a variable",
+                   "'%.*s' is not a variable",
                    STRFMT(ast->var_load.identifier.str));
             return { T_INVALID };
         }
 
-        if (sym->variable.type.size == 0) sym->variable.type.size = topdown_size;
         return sym->variable.type;
         } break;
     case AST_VAR_STORE: {
         Symbol *sym = map_find(&module->symbols, ast->var_store.identifier.str);
         if (!sym) {
             TERROR(ast->var_load.identifier,
-                   "unknown variable '%.*s'",
+                   "Unknown variable '%.*s'",
                    STRFMT(ast->var_load.identifier.str));
             return { T_INVALID };
         }
@@ -811,364 +2174,3717 @@ TypeExpr ast_sizecheck(AST *ast, Module *module, AST *proc, i32 topdown_size = 0
             return { T_INVALID };
         }
 
-        TypeExpr rhs = ast_sizecheck(ast->var_store.rhs, module, proc, sym->variable.type.size);
+        TypeExpr lhs = sym->variable.type;
+        if (lhs.elems > 0) {
+            TERROR(ast->var_store.identifier,
+                   "cannot assign to fixed array '%.*s', assign its elements instead",
+                   STRFMT(ast->var_store.identifier.str));
+            return { T_INVALID };
+        }
 
-        if (sym->variable.type.size == 0) sym->variable.type.size = rhs.size;
-        if (rhs.size != 0 && rhs.size != sym->variable.type.size) {
+        TypeExpr rhs = ast_typecheck(ast->var_store.rhs, lhs, module, proc);
+        if (!type_assignable(lhs, rhs)) {
+
+            // TODO(jesper): implicit/explicit conversion rules
             TERROR(ast->var_store.identifier,
-                   "sizing mismtach in variable store, declared as [%s:%d], rhs requires deduced as size %d",
-                   sz_from_enum(sym->variable.type.prim), sym->variable.type.size,
-                   rhs);
+                   "type mismatch, variable declared as [%s:%d], assignment deduced as [%s:%d]",
+                   sz_from_enum(lhs.prim), lhs.size,
+                   sz_from_enum(rhs.prim), rhs.size);
             return { T_INVALID };
         }
 
-        return sym->variable.type;
+        return lhs;
         } break;
-    case AST_INVALID:
-        PANIC_UNREACHABLE();
-        break;
     case AST_VAR_DECL:
         if (ast->var_decl.init) {
-            TypeExpr init_type = ast_sizecheck(ast->var_decl.init, module, proc, ast->var_decl.type.size);
-
-            if (ast->var_decl.type.size == 0) {
-                ast->var_decl.type.size = init_type.size;
-            }
-
-            if (init_type.size != 0 && init_type.size > ast->var_decl.type.size) {
+            TypeExpr init_type = ast_typecheck(ast->var_decl.init, ast->var_decl.type, module, proc);
+            if (ast->var_decl.type == T_UNKNOWN) {
+                ast->var_decl.type = init_type;
+            } else if (!type_assignable(ast->var_decl.type, init_type)) {
+                // TODO(jesper): check if the type is compatible or implicitly convertible
                 TERROR(ast->var_decl.identifier,
-                       "size mismatch in variable declaration, declared as [%s:%d], initialization expression deduced as [%s:%d]",
+                       "type mismatch in declaration and assignment of variable, declared as [%s:%d], assignment deduced as [%s:%d]",
                        sz_from_enum(ast->var_decl.type.prim), ast->var_decl.type.size,
                        sz_from_enum(init_type.prim), init_type.size);
                 return { T_INVALID };
             }
-        } else if (ast->var_decl.type.size == 0) {
-            TERROR(ast->var_decl.identifier, "unable to infer size, variable declaration require either an explicit type, or an assignment expression to automatically deduce type from");
+        }
+
+        if (ast->var_decl.init && ast->var_decl.type.elems > 0) {
+            TERROR(ast->var_decl.identifier,
+                   "fixed array '%.*s' cannot be initialised from another value, it's zero initialised",
+                   STRFMT(ast->var_decl.identifier.str));
             return { T_INVALID };
         }
 
-        return ast->var_decl.type;
-    case AST_LITERAL:
-        if (ast->literal.type.size == 0)
-            ast->literal.type.size = topdown_size;
+        if (ast->var_decl.type == T_INTEGER) {
+            TERROR(ast->var_decl.identifier,
+                   "cannot infer signage of integer variable, '%.*s'",
+                   STRFMT(ast->var_decl.identifier.str));
+            return { T_INVALID };
+        }
 
-        if (ast->literal.type.size == 0 && ast->literal.type == T_SIGNED) {
-            i64 ival = ast->literal.ival;
-            if (ival <= i8_MAX && ival >= i8_MIN) ast->literal.type.size = 1;
-            else if (ival <= i16_MAX && ival >= i16_MIN) ast->literal.type.size = 2;
-            else if (ival <= i32_MAX && ival >= i32_MIN) ast->literal.type.size = 4;
-            else ast->literal.type.size = 8;
+        if (ast->var_decl.type == T_UNKNOWN) {
+            TERROR(ast->var_decl.identifier,
+                   "cannot infer type of '%.*s'",
+                   STRFMT(ast->var_decl.identifier.str));
+            return { T_INVALID };
         }
 
-        if (ast->literal.type.size == 0 && ast->literal.type == T_UNSIGNED) {
-            u64 uval = ast->literal.ival;
-            if (uval <= u8_MAX) ast->literal.type.size = 1;
-            else if (uval <= u16_MAX) ast->literal.type.size = 2;
-            else if (uval <= u32_MAX) ast->literal.type.size = 4;
-            else ast->literal.type.size = 8;
+        if (Symbol *sym = map_find(&module->symbols, ast->var_decl.identifier.str);
+            sym && (sym->type == SYM_CONSTANT || sym->type == SYM_GLOBAL))
+        {
+            TERROR(ast->var_decl.identifier,
+                   "'%.*s' is already declared as a constant",
+                   STRFMT(ast->var_decl.identifier.str));
+            return { T_INVALID };
         }
 
-        if (ast->literal.type.size == 0) {
-            TERROR(ast->literal.token, "cannot infer size of '%.*s'", STRFMT(ast->literal.token.str));
+        declare_variable(module, ast->var_decl.identifier.str, ast->var_decl.type);
+        return ast->var_decl.type;
+    case AST_PROC_DECL:
+        if (ast->proc_decl.params && ast == module->entry) {
+            TERROR(ast->proc_decl.identifier, "main cannot take any parameters");
+            return { T_INVALID };
         }
-        return ast->literal.type;
-    case AST_BINARY_OP: {
-        TypeExpr lhs = ast_sizecheck(ast->binary_op.lhs, module, proc, topdown_size);
-        TypeExpr rhs = ast_sizecheck(ast->binary_op.rhs, module, proc, lhs.size);
 
-        if (lhs.size == 0 && rhs.size != 0) {
-            lhs = ast_sizecheck(ast->binary_op.lhs, module, proc, rhs.size);
+        // NOTE(jesper): fixed arrays are only ever stack allocated locals, they're passed to and
+        // from procedures as slices
+        if (ast->proc_decl.ret_type.elems > 0) {
+            TERROR(ast->proc_decl.identifier, "procedures cannot return fixed arrays, return a slice instead");
+            return { T_INVALID };
         }
 
-        if (lhs.size != rhs.size) {
-            // TODO(jesper): check for implicit conversion
-            TERROR(ast->binary_op.op,
-                   "size mismatch in binary operation, lhs %d, rhs %d",
-                   lhs, rhs);
+        for (AST *param = ast->proc_decl.params; param; param = param->next) {
+            if (param->var_decl.type.elems > 0) {
+                TERROR(param->var_decl.identifier,
+                       "parameter '%.*s' cannot be a fixed array, pass a slice instead",
+                       STRFMT(param->var_decl.identifier.str));
+                return { T_INVALID };
+            }
 
-        }
+            if (param->var_decl.type == T_STRUCT && param->var_decl.type.elems == 0 &&
+                param->var_decl.type.pointers == 0)
+            {
+                TERROR(param->var_decl.identifier,
+                       "parameter '%.*s' cannot be a struct, pass a slice instead",
+                       STRFMT(param->var_decl.identifier.str));
+                return { T_INVALID };
+            }
 
-        return lhs;
-        } break;
+            if (ast_typecheck(param, param->var_decl.type, module, ast) == T_INVALID)
+                return { T_INVALID };
+        }
 
-    case AST_PROC_DECL:
         for (AST *stmt = ast->proc_decl.body; stmt; stmt = stmt->next) {
-            if (ast_sizecheck(stmt, module, ast) == T_INVALID)
+            if (ast_typecheck(stmt, ast->proc_decl.ret_type, module, ast) == T_INVALID)
                 return { T_INVALID };
         }
 
+        pop_scope(module, 0);
+
+        // TODO(jesper): pass and return structs by value, which needs their C ABI lowering for
+        // exported and foreign procedures
+        if (ast->proc_decl.ret_type == T_STRUCT && ast->proc_decl.ret_type.elems == 0 &&
+            ast->proc_decl.ret_type.pointers == 0)
+        {
+            TERROR(ast->proc_decl.identifier, "procedures cannot return structs");
+            return { T_INVALID };
+        }
+
+        if (ast == module->entry && ast->proc_decl.ret_type.pointers != 0) {
+            TERROR(ast->proc_decl.identifier, "main cannot return a pointer");
+            return { T_INVALID };
+        }
+
+        // TODO(jesper): proc type expr?
         return ast->proc_decl.ret_type;
 
     case AST_PROC_CALL: {
         Symbol *sym = map_find(&module->symbols, ast->proc_call.identifier.str);
+        if (sym && sym->type == SYM_GENERIC) return ast_typecheck_generic_call(ast, sym->generic.proc, module, proc);
+
         if (!sym || sym->type != SYM_PROC) {
             TERROR(ast->proc_call.identifier, "procedure not found: '%.*s'", STRFMT(ast->proc_call.identifier.str));
             return { T_INVALID };
         }
 
-        return sym->proc.ast->proc_decl.ret_type;
+        AST *decl = sym->proc.ast;
+        AST *param = decl->proc_decl.params;
+        AST *arg = ast->proc_call.args;
+        for (; param && arg; param = param->next, arg = arg->next) {
+            TypeExpr type = ast_typecheck(arg, param->var_decl.type, module, proc);
+            if (type == T_INVALID) return type;
+
+            if (!type_assignable(param->var_decl.type, type)) {
+                // TODO(jesper): implicit/explicit conversion rules
+                TERROR(ast->proc_call.identifier,
+                       "type mismatch in argument '%.*s', parameter declared as [%s:%d], argument deduced as [%s:%d]",
+                       STRFMT(param->var_decl.identifier.str),
+                       sz_from_enum(param->var_decl.type.prim), param->var_decl.type.size,
+                       sz_from_enum(type.prim), type.size);
+                return { T_INVALID };
+            }
+        }
+
+        if (param || arg) {
+            i32 param_count = 0, arg_count = 0;
+            for (AST *it = decl->proc_decl.params; it; it = it->next) param_count++;
+            for (AST *it = ast->proc_call.args; it; it = it->next) arg_count++;
+
+            TERROR(ast->proc_call.identifier,
+                   "'%.*s' takes %d arguments, called with %d",
+                   STRFMT(ast->proc_call.identifier.str), param_count, arg_count);
+            return { T_INVALID };
+        }
+
+        return decl->proc_decl.ret_type;
         } break;
 
     case AST_RETURN: {
         PANIC_IF(!proc || proc->type != AST_PROC_DECL, "expected AST_PROC_DECL");
 
-        TypeExpr ret_type = proc->proc_decl.ret_type;
-        if (ast->ret.expr)
-            ret_type = ast_sizecheck(ast->ret.expr, module, proc, ret_type.size);
+        TypeExpr ret_type = { T_VOID };
+        // TODO(jesper): I don't think this is correct, but I need to add more conversion rules and explicit return type syntax before really testing this further
+        if (ast->ret.expr) ret_type = ast_typecheck(ast->ret.expr, { T_SIGNED }, module, proc);
+
+        if (proc->proc_decl.ret_type == T_UNKNOWN)
+            proc->proc_decl.ret_type = ret_type;
+
+        if (!type_assignable(proc->proc_decl.ret_type, ret_type)) {
+            TERROR(ast->ret.token,
+                   "type mismatch in return statement; proc ret type dedeuced to [%s:%d], return expression deduced as [%s:%d]",
+                   sz_from_enum(proc->proc_decl.ret_type.prim), proc->proc_decl.ret_type.size,
+                   sz_from_enum(ret_type.prim), ret_type.size);
+
+            return { T_INVALID };
+        }
+
+        return ret_type;
+        } break;
+    case AST_LITERAL:
+        if (ast->literal.type == T_INTEGER) {
+            if (parent == T_SIGNED || parent == T_UNSIGNED)
+                ast->literal.type.prim = parent.prim;
+            else if (parent == T_UNKNOWN)
+                ast->literal.type.prim = T_SIGNED;
+        }
+
+        return ast->literal.type;
+    case AST_GLOBAL:
+        return ast->global.type;
+    case AST_BINARY_OP: {
+        // NOTE(jesper): integer literals take their type from the other operand, and the
+        // operands of a comparison don't get their type from the context it's used in
+        bool comparison = is_comparison_op(ast->binary_op.op);
+        TypeExpr operand_parent = comparison ? TypeExpr{ T_INTEGER } : parent;
+
+        TypeExpr lhs = ast_typecheck(ast->binary_op.lhs, operand_parent, module, proc);
+        TypeExpr rhs_parent = lhs == T_INTEGER || lhs == T_UNKNOWN ? operand_parent : lhs;
+        TypeExpr rhs = ast_typecheck(ast->binary_op.rhs, rhs_parent, module, proc);
+
+        if (lhs == T_INTEGER && rhs != T_INTEGER) {
+            lhs = ast_typecheck(ast->binary_op.lhs, rhs, module, proc);
+        } else if (lhs == T_INTEGER) {
+            lhs = ast_typecheck(ast->binary_op.lhs, { T_SIGNED }, module, proc);
+            rhs = ast_typecheck(ast->binary_op.rhs, { T_SIGNED }, module, proc);
+        }
+
+        if (lhs.prim != rhs.prim) {
+            TERROR(ast->binary_op.op,
+                   "type mismatch in binary operation [%s:%d] %.*s [%s:%d]",
+                   sz_from_enum(lhs.prim), lhs.size,
+                   STRFMT(ast->binary_op.op.str),
+                   sz_from_enum(rhs.prim), rhs.size);
+        }
+
+        if (lhs.elems != 0 || rhs.elems != 0) {
+            TERROR(ast->binary_op.op, "binary operation on arrays is not supported");
+            return { T_INVALID };
+        }
+
+        // TODO(jesper): pointer arithmetic and comparison, index the pointer instead for now
+        if (lhs.pointers != 0 || rhs.pointers != 0) {
+            TERROR(ast->binary_op.op, "binary operation on pointers is not supported");
+            return { T_INVALID };
+        }
+
+        if (lhs == T_STRUCT || rhs == T_STRUCT) {
+            TERROR(ast->binary_op.op, "binary operation on structs is not supported");
+            return { T_INVALID };
+        }
+
+        // TODO(jesper): implicitly splat scalar operands of vector operations?
+        if (lhs.lanes != rhs.lanes) {
+            TERROR(ast->binary_op.op,
+                   "lane count mismatch in binary operation, %d %.*s %d; scalars have to be splat explicitly, e.g. i32x4(2)",
+                   lhs.lanes, STRFMT(ast->binary_op.op.str), rhs.lanes);
+            return { T_INVALID };
+        }
+
+        if (comparison && lhs.lanes > 0) {
+            TERROR(ast->binary_op.op, "comparison of SIMD vectors is not supported");
+            return { T_INVALID };
+        }
+
+        if (comparison) return { T_BOOL, 1 };
+        return lhs;
+    } break;
+    case AST_LOOP: {
+        // NOTE(jesper): the loop's init and body are a scope of their own, so the variables they
+        // declare shadow the ones outside it for the duration of the loop
+        i32 scope = module->scope.count;
+        if (ast->loop.init && ast_typecheck(ast->loop.init, parent, module, proc) == T_INVALID)
+            return { T_INVALID };
+
+        TypeExpr cond = ast_typecheck(ast->loop.cond, { T_BOOL, 1 }, module, proc);
+        if (cond == T_INVALID) return cond;
+
+        if (cond != T_BOOL || cond.pointers != 0) {
+            TERROR(ast->loop.token,
+                   "loop condition has to be a bool, deduced as [%s:%d]",
+                   sz_from_enum(cond.prim), cond.size);
+            return { T_INVALID };
+        }
+
+        if (ast->loop.step && ast_typecheck(ast->loop.step, parent, module, proc) == T_INVALID)
+            return { T_INVALID };
+
+        for (AST *stmt = ast->loop.body; stmt; stmt = stmt->next) {
+            if (ast_typecheck(stmt, parent, module, proc) == T_INVALID)
+                return { T_INVALID };
+        }
+
+        pop_scope(module, scope);
+        return { T_VOID };
+        } break;
+    case AST_SWITCH: {
+        TypeExpr type = ast_typecheck(ast->switch_stmt.expr, { T_UNKNOWN }, module, proc);
+        if (type == T_INVALID) return type;
+        if (type == T_INTEGER) type = ast_typecheck(ast->switch_stmt.expr, { T_SIGNED }, module, proc);
+
+        if ((type != T_SIGNED && type != T_UNSIGNED) || type.lanes != 0 || type.elems != 0 ||
+            type.pointers != 0)
+        {
+            TERROR(ast->switch_stmt.token,
+                   "switch value has to be an integer, deduced as [%s:%d]",
+                   sz_from_enum(type.prim), type.size);
+            return { T_INVALID };
+        }
+
+        ast->switch_stmt.type = type;
+
+        SArena scratch = tl_scratch_arena();
+
+        i32 value_count = 0;
+        for (AST *it = ast->switch_stmt.cases; it; it = it->next) {
+            for (AST *value = it->switch_case.values; value; value = value->next) value_count++;
+        }
+
+        Array<i64> values = array_create<i64>(value_count, scratch);
+        Array<i32> order = array_create<i32>(value_count, scratch);
+        Array<AST*> value_asts = array_create<AST*>(value_count, scratch);
+
+        value_count = 0;
+        AST *else_case = nullptr;
+        for (AST *it = ast->switch_stmt.cases; it; it = it->next) {
+            if (!it->switch_case.values) {
+                if (else_case) {
+                    TERROR(it->switch_case.token, "switch already has a case without values");
+                    return { T_INVALID };
+                }
+
+                else_case = it;
+            }
+
+            for (AST *value = it->switch_case.values; value; value = value->next) {
+                // NOTE(jesper): replaces a constant with its literal, which stays untyped unless
+                // it's negative
+                if (value->type == AST_VAR_LOAD && ast_typecheck(value, { T_INTEGER }, module, proc) == T_INVALID)
+                    return { T_INVALID };
+
+                if (value->type != AST_LITERAL ||
+                    (value->literal.type != T_INTEGER && value->literal.type != T_SIGNED))
+                {
+                    TERROR(it->switch_case.token, "case values have to be integer literals or constants");
+                    return { T_INVALID };
+                }
+
+                ast_typecheck(value, type, module, proc);
+
+                values[value_count] = value->literal.ival;
+                order[value_count] = value_count;
+                value_asts[value_count] = value;
+                value_count++;
+            }
+
+            i32 scope = module->scope.count;
+            for (AST *stmt = it->switch_case.body; stmt; stmt = stmt->next) {
+                if (ast_typecheck(stmt, parent, module, proc) == T_INVALID)
+                    return { T_INVALID };
+            }
+            pop_scope(module, scope);
+        }
+
+        // NOTE(jesper): duplicates end up next to each other once sorted, and the one that comes
+        // later in the source is reported
+        quick_sort_asc(values, order, value_asts);
+        for (i32 i = 1; i < values.count; i++) {
+            if (values[i] != values[i-1]) continue;
+
+            AST *duplicate = order[i] > order[i-1] ? value_asts[i] : value_asts[i-1];
+            TERROR(duplicate->literal.token, "duplicate case value %lld", duplicate->literal.ival);
+            return { T_INVALID };
+        }
+
+        return { T_VOID };
+        } break;
+    case AST_SWITCH_CASE:
+        PANIC_UNREACHABLE();
+        break;
+    case AST_RUN: {
+        TypeExpr type = ast_typecheck(ast->run.expr, parent, module, proc);
+        if (type == T_INVALID) return type;
+
+        // NOTE(jesper): the expression is evaluated before the procedure it's in has ever run,
+        // so it can only call procedures and use literals and constants. It's checked after the
+        // typecheck has replaced the uses of constants
+        if (AST *var = ast_find_var_load(ast->run.expr); var) {
+            TERROR(var->var_load.identifier,
+                   "'%.*s' cannot be used in #run, the expression is evaluated at compile time",
+                   STRFMT(var->var_load.identifier.str));
+            return { T_INVALID };
+        }
+
+        if (type == T_VOID) {
+            TERROR(ast->run.token, "#run expression doesn't produce a value");
+            return { T_INVALID };
+        }
+
+        if (type.lanes > 0 || type.elems != 0 || type == T_STRUCT || type.pointers != 0) {
+            TERROR(ast->run.token, "#run expression cannot produce a SIMD vector, array, struct or pointer");
+            return { T_INVALID };
+        }
+
+        // TODO(jesper): procedures are typechecked in declaration order, so the return type of
+        // one declared further down without an explicit return type isn't known yet
+        if (type == T_UNKNOWN) {
+            TERROR(ast->run.token, "cannot infer the type of #run expression, declare the return type of the procedures it calls");
+            return { T_INVALID };
+        }
+
+        return ast->run.type = type;
+        } break;
+    case AST_VECTOR: {
+        TypeExpr lane_type = ast->vector.type;
+        lane_type.lanes = 0;
+
+        i32 count = 0;
+        for (AST *elem = ast->vector.elems; elem; elem = elem->next, count++) {
+            TypeExpr type = ast_typecheck(elem, lane_type, module, proc);
+            if (type == T_INVALID) return type;
+
+            if (type.prim != lane_type.prim || type.lanes != 0 || type.elems != 0 || type.pointers != 0) {
+                TERROR(ast->vector.token,
+                       "type mismatch in element %d of '%.*s', deduced as [%s:%d]",
+                       count, STRFMT(ast->vector.token.str),
+                       sz_from_enum(type.prim), type.size);
+                return { T_INVALID };
+            }
+        }
+
+        if (count != 1 && count != ast->vector.type.lanes) {
+            TERROR(ast->vector.token,
+                   "'%.*s' takes 1 or %d elements, called with %d",
+                   STRFMT(ast->vector.token.str), ast->vector.type.lanes, count);
+            return { T_INVALID };
+        }
+
+        return ast->vector.type;
+        } break;
+    case AST_SWIZZLE: {
+        TypeExpr type = ast_typecheck(ast->swizzle.expr, { T_UNKNOWN }, module, proc);
+        if (type == T_INVALID) return type;
+
+        if (type.lanes == 0 || type.elems != 0 || type.pointers != 0) {
+            TERROR(ast->swizzle.token,
+                   "cannot select lanes of [%s:%d], it's not a SIMD vector",
+                   sz_from_enum(type.prim), type.size);
+            return { T_INVALID };
+        }
+
+        for (i32 i = 0; i < ast->swizzle.count; i++) {
+            if (ast->swizzle.lanes[i] >= type.lanes) {
+                TERROR(ast->swizzle.token,
+                       "lane %d out of range of vector with %d lanes",
+                       ast->swizzle.lanes[i], type.lanes);
+                return { T_INVALID };
+            }
+        }
+
+        type.lanes = ast->swizzle.count > 1 ? ast->swizzle.count : 0;
+        return ast->swizzle.type = type;
+        } break;
+    case AST_REDUCE: {
+        TypeExpr type = ast_typecheck(ast->reduce.expr, parent, module, proc);
+        if (type == T_INVALID) return type;
+
+        if (type.lanes == 0 || type.elems != 0 || type.pointers != 0) {
+            TERROR(ast->reduce.token,
+                   "'%.*s' expects a SIMD vector, deduced as [%s:%d]",
+                   STRFMT(ast->reduce.token.str),
+                   sz_from_enum(type.prim), type.size);
+            return { T_INVALID };
+        }
+
+        type.lanes = 0;
+        return ast->reduce.type = type;
+        } break;
+    case AST_INDEX: {
+        TypeExpr type = ast_typecheck(ast->index.expr, { T_UNKNOWN }, module, proc);
+        if (type == T_INVALID) return type;
+
+        if (type.elems == 0 && type.pointers == 0 && type.lanes > 0) {
+            AST *index = ast->index.index;
+            if (index->type != AST_LITERAL || index->literal.type != T_INTEGER ||
+                index->literal.ival < 0 || index->literal.ival > 15)
+            {
+                TERROR(ast->index.token, "SIMD vector lanes can only be selected by constant index in [0, 15]");
+                return { T_INVALID };
+            }
+
+            AST *expr = ast->index.expr;
+            Token token = ast->index.token;
+
+            ast->type = AST_SWIZZLE;
+            ast->swizzle.token = token;
+            ast->swizzle.type = {};
+            ast->swizzle.expr = expr;
+            ast->swizzle.count = 1;
+            ast->swizzle.lanes[0] = (u8)index->literal.ival;
+            return ast_typecheck(ast, parent, module, proc);
+        }
+
+        if (type.elems == 0 && type.pointers == 0) {
+            TERROR(ast->index.token,
+                   "cannot index [%s:%d], it's not an array or pointer",
+                   sz_from_enum(type.prim), type.size);
+            return { T_INVALID };
+        }
+
+        TypeExpr index = ast_typecheck(ast->index.index, { T_SIGNED }, module, proc);
+        if (index == T_INVALID) return index;
+
+        if ((index != T_SIGNED && index != T_UNSIGNED) || index.lanes != 0 || index.elems != 0 ||
+            index.pointers != 0)
+        {
+            TERROR(ast->index.token,
+                   "array index has to be an integer, deduced as [%s:%d]",
+                   sz_from_enum(index.prim), index.size);
+            return { T_INVALID };
+        }
+
+        if (AST *literal = ast->index.index; literal->type == AST_LITERAL && type.elems > 0 &&
+            (literal->literal.ival < 0 || literal->literal.ival >= type.elems))
+        {
+            TERROR(ast->index.token,
+                   "index %lld out of bounds of array with %d elements",
+                   (long long)literal->literal.ival, type.elems);
+            return { T_INVALID };
+        }
+
+        // NOTE(jesper): pointers are indexed like a slice of unknown count, which can't be
+        // bounds checked
+        if (type.elems == 0) {
+            type.pointers--;
+            return ast->index.type = type;
+        }
+
+        // NOTE(jesper): the fields of #soa struct elements aren't next to each other in memory
+        if (type == T_STRUCT && type.struct_type->soa && !ast->index.field_access) {
+            TERROR(ast->index.token,
+                   "elements of #soa struct '%.*s' can only be accessed through their fields, e.g. a[i].x",
+                   STRFMT(type.struct_type->identifier.str));
+            return { T_INVALID };
+        }
+
+        type.elems = 0;
+        return ast->index.type = type;
+        } break;
+    case AST_INDEX_STORE: {
+        TypeExpr lhs = ast_typecheck(ast->index_store.lhs, parent, module, proc);
+        if (lhs == T_INVALID) return lhs;
+
+        if (ast->index_store.lhs->type != AST_INDEX) {
+            TERROR(ast->index_store.token, "cannot assign to SIMD vector lanes");
+            return { T_INVALID };
+        }
+
+        if (AST *array = ast->index_store.lhs->index.expr; array->type == AST_GLOBAL) {
+            TERROR(ast->index_store.token,
+                   "cannot assign to elements of constant array '%.*s'",
+                   STRFMT(array->global.token.str));
+            return { T_INVALID };
+        }
+
+        TypeExpr rhs = ast_typecheck(ast->index_store.rhs, lhs, module, proc);
+        if (rhs == T_INVALID) return rhs;
+
+        if (!type_assignable(lhs, rhs)) {
+            TERROR(ast->index_store.token,
+                   "type mismatch, array element is [%s:%d], assignment deduced as [%s:%d]",
+                   sz_from_enum(lhs.prim), lhs.size,
+                   sz_from_enum(rhs.prim), rhs.size);
+            return { T_INVALID };
+        }
+
+        return { T_VOID };
+        } break;
+    case AST_COUNT: {
+        TypeExpr type = ast_typecheck(ast->count.expr, { T_UNKNOWN }, module, proc);
+        if (type == T_INVALID) return type;
+
+        if (type.elems == 0) {
+            TERROR(ast->count.token,
+                   "[%s:%d] has no count, it's not an array",
+                   sz_from_enum(type.prim), type.size);
+            return { T_INVALID };
+        }
+
+        return { T_SIGNED, 8 };
+        } break;
+    case AST_FIELD: {
+        TypeExpr type = ast_typecheck(ast->field.expr, { T_UNKNOWN }, module, proc);
+        if (type == T_INVALID) return type;
+
+        Token token = ast->field.token;
+        AST *expr = ast->field.expr;
+
+        if (type.elems != 0 && token == "count") {
+            ast->type = AST_COUNT;
+            ast->count.token = token;
+            ast->count.expr = expr;
+            return ast_typecheck(ast, parent, module, proc);
+        }
+
+        if (type.elems == 0 && type.pointers == 0 && type.lanes > 0) {
+            String str = token.str;
+            if (str.length != 1 && str.length != 2 && str.length != 4) {
+                TERROR(token, "invalid swizzle '%.*s', expected 1, 2 or 4 lanes", STRFMT(str));
+                return { T_INVALID };
+            }
+
+            u8 lanes[4];
+            for (i32 i = 0; i < str.length; i++) {
+                switch (str[i]) {
+                case 'x': lanes[i] = 0; break;
+                case 'y': lanes[i] = 1; break;
+                case 'z': lanes[i] = 2; break;
+                case 'w': lanes[i] = 3; break;
+                default:
+                    TERROR(token, "invalid swizzle '%.*s', expected xyzw", STRFMT(str));
+                    return { T_INVALID };
+                }
+            }
+
+            ast->type = AST_SWIZZLE;
+            ast->swizzle.token = token;
+            ast->swizzle.type = {};
+            ast->swizzle.expr = expr;
+            ast->swizzle.count = str.length;
+            memcpy(ast->swizzle.lanes, lanes, sizeof lanes);
+            return ast_typecheck(ast, parent, module, proc);
+        }
+
+        if (type.elems == 0 && type.pointers == 0 && type == T_STRUCT) {
+            StructType *st = type.struct_type;
+            for (i32 i = 0; i < st->fields.count; i++) {
+                if (st->fields[i].identifier == token.str) {
+                    ast->field.index = i;
+                    return ast->field.type = st->fields[i].type;
+                }
+            }
+
+            TERROR(token, "'%.*s' has no field '%.*s'", STRFMT(st->identifier.str), STRFMT(token.str));
+            return { T_INVALID };
+        }
+
+        TERROR(token,
+               "[%s:%d] has no field '%.*s'",
+               sz_from_enum(type.prim), type.size, STRFMT(token.str));
+        return { T_INVALID };
+        } break;
+    case AST_FIELD_STORE: {
+        TypeExpr lhs = ast_typecheck(ast->field_store.lhs, parent, module, proc);
+        if (lhs == T_INVALID) return lhs;
+
+        AST *field = ast->field_store.lhs;
+        if (field->type != AST_FIELD) {
+            TERROR(ast->field_store.token, "cannot assign to SIMD vector lanes or the count of an array");
+            return { T_INVALID };
+        }
+
+        if (field->field.expr->type != AST_VAR_LOAD && field->field.expr->type != AST_INDEX) {
+            TERROR(ast->field_store.token, "can only assign to fields of struct variables and array elements");
+            return { T_INVALID };
+        }
+
+        TypeExpr rhs = ast_typecheck(ast->field_store.rhs, lhs, module, proc);
+        if (rhs == T_INVALID) return rhs;
+
+        if (!type_assignable(lhs, rhs)) {
+            TERROR(ast->field_store.token,
+                   "type mismatch, field is [%s:%d], assignment deduced as [%s:%d]",
+                   sz_from_enum(lhs.prim), lhs.size,
+                   sz_from_enum(rhs.prim), rhs.size);
+            return { T_INVALID };
+        }
+
+        return { T_VOID };
+        } break;
+    case AST_ADDRESS_OF: {
+        AST *expr = ast->unary.expr;
+        TypeExpr type = ast_typecheck(expr, { T_UNKNOWN }, module, proc);
+        if (type == T_INVALID) return type;
+
+        // NOTE(jesper): typechecking turns constant indices of SIMD vectors into swizzles, which
+        // aren't addressable
+        if (expr->type != AST_VAR_LOAD && expr->type != AST_INDEX && expr->type != AST_FIELD) {
+            TERROR(ast->unary.token, "can only take the address of variables, array elements and struct fields");
+            return { T_INVALID };
+        }
+
+        if (expr->type == AST_INDEX && expr->index.expr->type == AST_GLOBAL) {
+            TERROR(ast->unary.token,
+                   "cannot take the address of elements of constant array '%.*s', it's read-only",
+                   STRFMT(expr->index.expr->global.token.str));
+            return { T_INVALID };
+        }
+
+        if (expr->type == AST_FIELD) {
+            AST *base = expr->field.expr;
+            if (base->type != AST_VAR_LOAD && base->type != AST_INDEX) {
+                TERROR(ast->unary.token, "can only take the address of fields of struct variables and array elements");
+                return { T_INVALID };
+            }
+
+            // NOTE(jesper): loads and stores through pointers, atomic ones in particular, assume
+            // they're aligned to the size of what they point to, which fields of #packed structs
+            // might not be
+            StructType *st = ast_typecheck(base, { T_UNKNOWN }, module, proc).struct_type;
+            StructField &field = st->fields[expr->field.index];
+            if (i32 size = type_size(field.type); field.offset % size != 0 || st->alignment < size) {
+                TERROR(ast->unary.token,
+                       "cannot take the address of field '%.*s' of '%.*s', it's not aligned to its size of %d bytes; align the struct with #align or reorder its fields",
+                       STRFMT(field.identifier.str), STRFMT(st->identifier.str), size);
+                return { T_INVALID };
+            }
+        }
+
+        if (type.elems != 0) {
+            TERROR(ast->unary.token, "cannot take the address of an array, take the address of its first element instead");
+            return { T_INVALID };
+        }
+
+        type.pointers++;
+        return ast->unary.type = type;
+        } break;
+    case AST_DEREF: {
+        TypeExpr type = ast_typecheck(ast->unary.expr, { T_UNKNOWN }, module, proc);
+        if (type == T_INVALID) return type;
+
+        if (type.pointers == 0 || type.elems != 0) {
+            TERROR(ast->unary.token,
+                   "cannot dereference [%s:%d], it's not a pointer",
+                   sz_from_enum(type.prim), type.size);
+            return { T_INVALID };
+        }
+
+        type.pointers--;
+        return ast->unary.type = type;
+        } break;
+    case AST_DEREF_STORE: {
+        TypeExpr lhs = ast_typecheck(ast->deref_store.lhs, parent, module, proc);
+        if (lhs == T_INVALID) return lhs;
+
+        TypeExpr rhs = ast_typecheck(ast->deref_store.rhs, lhs, module, proc);
+        if (rhs == T_INVALID) return rhs;
+
+        if (!type_assignable(lhs, rhs)) {
+            TERROR(ast->deref_store.token,
+                   "type mismatch, pointer is to [%s:%d], assignment deduced as [%s:%d]",
+                   sz_from_enum(lhs.prim), lhs.size,
+                   sz_from_enum(rhs.prim), rhs.size);
+            return { T_INVALID };
+        }
+
+        return { T_VOID };
+        } break;
+    case AST_ATOMIC: {
+        AtomicOp op = ast->atomic.op;
+        AtomicOrder order = ast->atomic.order;
+        Token token = ast->atomic.token;
+
+        // NOTE(jesper): the same rules as C11, loads can't release, stores can't acquire, and a
+        // relaxed fence doesn't order anything
+        if ((op == ATOMIC_LOAD && (order == ORDER_RELEASE || order == ORDER_ACQ_REL)) ||
+            (op == ATOMIC_STORE && (order == ORDER_ACQUIRE || order == ORDER_ACQ_REL)) ||
+            (op == ATOMIC_FENCE && order == ORDER_RELAXED))
+        {
+            TERROR(token, "invalid memory order for '%.*s', %s", STRFMT(token.str), sz_from_enum(order));
+            return { T_INVALID };
+        }
+
+        if (op == ATOMIC_FENCE) return { T_VOID };
+
+        AST *ptr = ast->atomic.args;
+        TypeExpr ptr_type = ast_typecheck(ptr, { T_UNKNOWN }, module, proc);
+        if (ptr_type == T_INVALID) return ptr_type;
+
+        // NOTE(jesper): bitwise ops, min, max and compare-and-swap are only defined for integers
+        TypeExpr type = ptr_type;
+        type.pointers--;
+
+        bool integer_only = (op >= ATOMIC_AND && op <= ATOMIC_MAX) || op == ATOMIC_CAS;
+        if (ptr_type.pointers == 0 || ptr_type.elems != 0 || type.pointers != 0 || type.lanes != 0 ||
+            (type != T_SIGNED && type != T_UNSIGNED && (type != T_FLOAT || integer_only)))
+        {
+            TERROR(token,
+                   "'%.*s' expects a pointer to %s, deduced as [%s:%d] with %d levels of indirection",
+                   STRFMT(token.str), integer_only ? "an integer" : "an integer or float",
+                   sz_from_enum(ptr_type.prim), ptr_type.size, ptr_type.pointers);
+            return { T_INVALID };
+        }
+
+        for (AST *arg = ptr->next; arg; arg = arg->next) {
+            TypeExpr arg_type = ast_typecheck(arg, type, module, proc);
+            if (arg_type == T_INVALID) return arg_type;
+
+            if (!type_assignable(type, arg_type)) {
+                TERROR(token,
+                       "type mismatch in '%.*s', pointer is to [%s:%d], operand deduced as [%s:%d]",
+                       STRFMT(token.str),
+                       sz_from_enum(type.prim), type.size,
+                       sz_from_enum(arg_type.prim), arg_type.size);
+                return { T_INVALID };
+            }
+        }
+
+        ast->atomic.type = type;
+        return op == ATOMIC_STORE ? TypeExpr{ T_VOID } : type;
+        } break;
+    case AST_INTRINSIC: {
+        IntrinsicOp op = ast->intrinsic.op;
+        Token token = ast->intrinsic.token;
+        AST *arg = ast->intrinsic.args;
+
+        if (op == INTRINSIC_LIKELY || op == INTRINSIC_UNLIKELY) {
+            TypeExpr cond = ast_typecheck(arg, { T_BOOL, 1 }, module, proc);
+            if (cond == T_INVALID) return cond;
+
+            if (cond != T_BOOL || cond.lanes != 0 || cond.elems != 0 || cond.pointers != 0) {
+                TERROR(token,
+                       "'#%.*s' expects a bool, deduced as [%s:%d]",
+                       STRFMT(token.str), sz_from_enum(cond.prim), cond.size);
+                return { T_INVALID };
+            }
+
+            return ast->intrinsic.type = cond;
+        }
+
+        if (op == INTRINSIC_PREFETCH) {
+            TypeExpr ptr = ast_typecheck(arg, { T_UNKNOWN }, module, proc);
+            if (ptr == T_INVALID) return ptr;
+
+            if (ptr.pointers == 0 || ptr.elems != 0) {
+                TERROR(token,
+                       "'%.*s' expects a pointer, deduced as [%s:%d]",
+                       STRFMT(token.str), sz_from_enum(ptr.prim), ptr.size);
+                return { T_INVALID };
+            }
+
+            ast->intrinsic.type = ptr;
+            return { T_VOID };
+        }
+
+        // NOTE(jesper): the bit operations are only defined for scalar integers, and produce
+        // the same type as their operand
+        TypeExpr type = ast_typecheck(arg, { T_UNKNOWN }, module, proc);
+        if (type == T_INVALID) return type;
+        if (type == T_INTEGER) type = ast_typecheck(arg, { T_SIGNED }, module, proc);
+
+        if ((type != T_SIGNED && type != T_UNSIGNED) || type.lanes != 0 || type.elems != 0 ||
+            type.pointers != 0)
+        {
+            TERROR(token,
+                   "'%.*s' expects an integer, deduced as [%s:%d]",
+                   STRFMT(token.str), sz_from_enum(type.prim), type.size);
+            return { T_INVALID };
+        }
+
+        if (AST *amount = arg->next; amount) {
+            TypeExpr amount_type = ast_typecheck(amount, type, module, proc);
+            if (amount_type == T_INVALID) return amount_type;
+
+            if (!type_assignable(type, amount_type)) {
+                TERROR(token,
+                       "type mismatch in '%.*s', operand is [%s:%d], amount deduced as [%s:%d]",
+                       STRFMT(token.str),
+                       sz_from_enum(type.prim), type.size,
+                       sz_from_enum(amount_type.prim), amount_type.size);
+                return { T_INVALID };
+            }
+        }
+
+        return ast->intrinsic.type = type;
+        } break;
+    case AST_INVALID:
+        PANIC_UNREACHABLE();
+        break;
+    }
+
+    return { T_UNKNOWN };
+}
+
+// NOTE(jesper): the type arguments of a call to a generic procedure are either all given as its
+// first arguments, or all deduced from the types of the others. The call is then made to the
+// instantiation with those type arguments, without them
+TypeExpr ast_typecheck_generic_call(AST *ast, GenericProc *generic, Module *module, AST *proc) INTERNAL
+{
+    SArena scratch = tl_scratch_arena();
+    Token identifier = ast->proc_call.identifier;
+
+    i32 param_count = 0, arg_count = 0;
+    for (AST *it = generic->decl->proc_decl.params; it; it = it->next) param_count++;
+    for (AST *it = ast->proc_call.args; it; it = it->next) arg_count++;
+
+    Array<TypeExpr> type_args = array_create<TypeExpr>(generic->type_params.count, scratch);
+    for (TypeExpr &type : type_args) type = { T_UNKNOWN };
+
+    AST *args = ast->proc_call.args;
+    if (arg_count == type_args.count + param_count) {
+        for (i32 i = 0; i < type_args.count; i++, args = args->next) {
+            if (args->type == AST_VAR_LOAD) type_args[i] = type_from_name(args->var_load.identifier.str, module);
+            if (type_args[i] == T_INVALID || type_args[i] == T_UNKNOWN || type_args[i] == T_VOID) {
+                TERROR(identifier,
+                       "expected a type for type parameter '%.*s' of '%.*s'",
+                       STRFMT(generic->type_params[i].str), STRFMT(identifier.str));
+                return { T_INVALID };
+            }
+        }
+    } else if (arg_count != param_count) {
+        TERROR(identifier,
+               "'%.*s' takes %d arguments, or %d with its type arguments, called with %d",
+               STRFMT(identifier.str), param_count, type_args.count + param_count, arg_count);
+        return { T_INVALID };
+    }
+
+    Array<TypeExpr> arg_types = array_create<TypeExpr>(param_count, scratch);
+
+    AST *param = generic->decl->proc_decl.params;
+    AST *arg = args;
+    for (i32 i = 0; arg; arg = arg->next, param = param->next, i++) {
+        TypeExpr param_type = param->var_decl.type;
+
+        arg_types[i] = ast_typecheck(arg, type_substitute(param_type, type_args), module, proc);
+        if (arg_types[i] == T_INVALID) return { T_INVALID };
+        if (param_type != T_GENERIC) continue;
+
+        // NOTE(jesper): untyped literals get their size from the type argument once it's known
+        TypeExpr *type_arg = &type_args[param_type.size-1];
+        if (*type_arg != T_UNKNOWN && arg_types[i].size == 0) continue;
+
+        Token type_param = generic->type_params[param_type.size-1];
+        TypeExpr deduced = type_deduce(param_type, arg_types[i]);
+        if (deduced == T_INVALID) {
+            TERROR(identifier,
+                   "cannot deduce type parameter '%.*s' of '%.*s' from argument '%.*s', deduced as [%s:%d]",
+                   STRFMT(type_param.str), STRFMT(identifier.str),
+                   STRFMT(param->var_decl.identifier.str),
+                   sz_from_enum(arg_types[i].prim), arg_types[i].size);
+            return { T_INVALID };
+        }
+
+        if (*type_arg != T_UNKNOWN && *type_arg != deduced) {
+            TERROR(identifier,
+                   "type parameter '%.*s' of '%.*s' is both %.*s and %.*s",
+                   STRFMT(type_param.str), STRFMT(identifier.str),
+                   STRFMT(string_from_type(*type_arg, scratch)),
+                   STRFMT(string_from_type(deduced, scratch)));
+            return { T_INVALID };
+        }
+
+        *type_arg = deduced;
+    }
+
+    for (i32 i = 0; i < type_args.count; i++) {
+        if (type_args[i] == T_UNKNOWN) {
+            TERROR(identifier,
+                   "cannot deduce type parameter '%.*s' of '%.*s', pass the type arguments explicitly",
+                   STRFMT(generic->type_params[i].str), STRFMT(identifier.str));
+            return { T_INVALID };
+        }
+    }
+
+    AST *decl = instantiate_generic_proc(generic, type_args, module);
+    if (!decl) {
+        TERROR(identifier, "failed to instantiate '%.*s'", STRFMT(identifier.str));
+        return { T_INVALID };
+    }
+
+    param = decl->proc_decl.params;
+    for (i32 i = 0; i < arg_types.count; i++, param = param->next) {
+        if (!type_assignable(param->var_decl.type, arg_types[i])) {
+            TERROR(identifier,
+                   "type mismatch in argument '%.*s', parameter declared as [%s:%d], argument deduced as [%s:%d]",
+                   STRFMT(param->var_decl.identifier.str),
+                   sz_from_enum(param->var_decl.type.prim), param->var_decl.type.size,
+                   sz_from_enum(arg_types[i].prim), arg_types[i].size);
+            return { T_INVALID };
+        }
+    }
+
+    ast->proc_call.identifier.str = decl->proc_decl.identifier.str;
+    ast->proc_call.args = args;
+    return decl->proc_decl.ret_type;
+}
+
+TypeExpr ast_sizecheck(AST *ast, Module *module, AST *proc, i32 topdown_size = 0)
+{
+    switch (ast->type) {
+    case AST_VAR_LOAD: {
+        Symbol *sym = map_find(&module->symbols, ast->var_load.identifier.str);
+        if (!sym) {
+            TERROR(ast->var_load.identifier, "Unknown variable '%.*s'", STRFMT(ast->var_load.identifier.str));
+            return { T_INVALID };
+        }
+
+        if (sym->type != SYM_VARIABLE) {
+            TERROR(ast->var_load.identifier,
+                   "symbol '%.*s' is not a variable",
+                   STRFMT(ast->var_load.identifier.str));
+            return { T_INVALID };
+        }
+
+        if (sym->variable.type.size == 0) sym->variable.type.size = topdown_size;
+        return sym->variable.type;
+        } break;
+    case AST_VAR_STORE: {
+        Symbol *sym = map_find(&module->symbols, ast->var_store.identifier.str);
+        if (!sym) {
+            TERROR(ast->var_load.identifier,
+                   "unknown variable '%.*s'",
+                   STRFMT(ast->var_load.identifier.str));
+            return { T_INVALID };
+        }
+
+        if (sym->type != SYM_VARIABLE) {
+            TERROR(ast->var_load.identifier,
+                   "symbol '%.*s' is not a variable",
+                   STRFMT(ast->var_load.identifier.str));
+            return { T_INVALID };
+        }
+
+        TypeExpr rhs = ast_sizecheck(ast->var_store.rhs, module, proc, sym->variable.type.size);
+        if (rhs == T_INVALID) return rhs;
+
+        if (sym->variable.type.size == 0) sym->variable.type.size = rhs.size;
+        if (rhs.size != 0 && rhs.size != sym->variable.type.size) {
+            TERROR(ast->var_store.identifier,
+                   "sizing mismtach in variable store, declared as [%s:%d], rhs requires deduced as size %d",
+                   sz_from_enum(sym->variable.type.prim), sym->variable.type.size,
+                   rhs);
+            return { T_INVALID };
+        }
+
+        return sym->variable.type;
+        } break;
+    case AST_INVALID:
+    case AST_SWITCH_CASE:
+        PANIC_UNREACHABLE();
+        break;
+    case AST_VAR_DECL:
+        if (ast->var_decl.init) {
+            TypeExpr init_type = ast_sizecheck(ast->var_decl.init, module, proc, ast->var_decl.type.size);
+            if (init_type == T_INVALID) return init_type;
+
+            if (ast->var_decl.type.size == 0) {
+                ast->var_decl.type.size = init_type.size;
+            }
+
+            // NOTE(jesper): slices refer to the elements of the array they're initialised from,
+            // which can't be converted
+            if (init_type.size != 0 &&
+                (init_type.size > ast->var_decl.type.size ||
+                 (init_type.elems != 0 && init_type.size != ast->var_decl.type.size)))
+            {
+                TERROR(ast->var_decl.identifier,
+                       "size mismatch in variable declaration, declared as [%s:%d], initialization expression deduced as [%s:%d]",
+                       sz_from_enum(ast->var_decl.type.prim), ast->var_decl.type.size,
+                       sz_from_enum(init_type.prim), init_type.size);
+                return { T_INVALID };
+            }
+        } else if (ast->var_decl.type.size == 0) {
+            TERROR(ast->var_decl.identifier, "unable to infer size, variable declaration require either an explicit type, or an assignment expression to automatically deduce type from");
+            return { T_INVALID };
+        }
+
+        // NOTE(jesper): declared again, with the size it was just given, in the same scopes as
+        // the typecheck declared it in
+        declare_variable(module, ast->var_decl.identifier.str, ast->var_decl.type);
+
+        return ast->var_decl.type;
+    case AST_LITERAL:
+        if (ast->literal.type.size == 0)
+            ast->literal.type.size = topdown_size;
+
+        if (ast->literal.type.size == 0 && ast->literal.type == T_SIGNED) {
+            i64 ival = ast->literal.ival;
+            if (ival <= i8_MAX && ival >= i8_MIN) ast->literal.type.size = 1;
+            else if (ival <= i16_MAX && ival >= i16_MIN) ast->literal.type.size = 2;
+            else if (ival <= i32_MAX && ival >= i32_MIN) ast->literal.type.size = 4;
+            else ast->literal.type.size = 8;
+        }
+
+        if (ast->literal.type.size == 0 && ast->literal.type == T_UNSIGNED) {
+            u64 uval = ast->literal.ival;
+            if (uval <= u8_MAX) ast->literal.type.size = 1;
+            else if (uval <= u16_MAX) ast->literal.type.size = 2;
+            else if (uval <= u32_MAX) ast->literal.type.size = 4;
+            else ast->literal.type.size = 8;
+        }
+
+        if (ast->literal.type.size == 0) {
+            TERROR(ast->literal.token, "cannot infer size of '%.*s'", STRFMT(ast->literal.token.str));
+        }
+        return ast->literal.type;
+    case AST_GLOBAL:
+        return ast->global.type;
+    case AST_BINARY_OP: {
+        bool comparison = is_comparison_op(ast->binary_op.op);
+        i32 operand_size = comparison ? 0 : topdown_size;
+
+        // NOTE(jesper): a literal lhs takes the size of the rhs, the same as a literal rhs takes
+        // the size of the lhs, instead of the size from the context or the smallest one that
+        // fits its value
+        TypeExpr lhs, rhs;
+        if (ast->binary_op.lhs->type == AST_LITERAL) {
+            rhs = ast_sizecheck(ast->binary_op.rhs, module, proc, operand_size);
+            lhs = ast_sizecheck(ast->binary_op.lhs, module, proc, rhs.size);
+        } else {
+            lhs = ast_sizecheck(ast->binary_op.lhs, module, proc, operand_size);
+            rhs = ast_sizecheck(ast->binary_op.rhs, module, proc, lhs.size);
+        }
+
+        if (lhs.size == 0 && rhs.size != 0) {
+            lhs = ast_sizecheck(ast->binary_op.lhs, module, proc, rhs.size);
+        }
+
+        if (lhs == T_INVALID || rhs == T_INVALID) return { T_INVALID };
+
+        // NOTE(jesper): array counts are i64, and the narrower integer compared against or
+        // combined with one is widened to it when lowered
+        // TODO(jesper): check for other implicit conversions
+        bool count = ast->binary_op.lhs->type == AST_COUNT || ast->binary_op.rhs->type == AST_COUNT;
+        bool integers = (lhs == T_SIGNED || lhs == T_UNSIGNED) && (rhs == T_SIGNED || rhs == T_UNSIGNED) &&
+            lhs.lanes == 0 && rhs.lanes == 0 && lhs.elems == 0 && rhs.elems == 0 &&
+            lhs.pointers == 0 && rhs.pointers == 0;
+
+        if (lhs.size != rhs.size && !(count && integers)) {
+            TERROR(ast->binary_op.op,
+                   "size mismatch in binary operation, lhs [%s:%d], rhs [%s:%d]",
+                   sz_from_enum(lhs.prim), lhs.size, sz_from_enum(rhs.prim), rhs.size);
+            return { T_INVALID };
+        }
+
+        if (comparison) return { T_BOOL, 1 };
+        return lhs.size >= rhs.size ? lhs : rhs;
+        } break;
+    case AST_LOOP: {
+        i32 scope = module->scope.count;
+        if (ast->loop.init && ast_sizecheck(ast->loop.init, module, proc) == T_INVALID)
+            return { T_INVALID };
+
+        if (ast_sizecheck(ast->loop.cond, module, proc) == T_INVALID)
+            return { T_INVALID };
+
+        if (ast->loop.step && ast_sizecheck(ast->loop.step, module, proc) == T_INVALID)
+            return { T_INVALID };
+
+        for (AST *stmt = ast->loop.body; stmt; stmt = stmt->next) {
+            if (ast_sizecheck(stmt, module, proc) == T_INVALID)
+                return { T_INVALID };
+        }
+
+        pop_scope(module, scope);
+        return { T_VOID };
+        } break;
+
+    case AST_SWITCH: {
+        TypeExpr type = ast_sizecheck(ast->switch_stmt.expr, module, proc);
+        if (type == T_INVALID) return type;
+
+        ast->switch_stmt.type.size = type.size;
+
+        for (AST *it = ast->switch_stmt.cases; it; it = it->next) {
+            for (AST *value = it->switch_case.values; value; value = value->next) {
+                if (ast_sizecheck(value, module, proc, type.size) == T_INVALID) return { T_INVALID };
+
+                i64 ival = value->literal.ival;
+                if (!literal_fits_type(ival, type)) {
+                    TERROR(value->literal.token,
+                           "case value %lld is out of range of [%s:%d]",
+                           ival, sz_from_enum(type.prim), type.size);
+                    return { T_INVALID };
+                }
+            }
+
+            i32 scope = module->scope.count;
+            for (AST *stmt = it->switch_case.body; stmt; stmt = stmt->next) {
+                if (ast_sizecheck(stmt, module, proc) == T_INVALID)
+                    return { T_INVALID };
+            }
+            pop_scope(module, scope);
+        }
+
+        return { T_VOID };
+        } break;
+
+    case AST_PROC_DECL:
+        // NOTE(jesper): the typecheck popped the procedure's scope when it was done with it, so
+        // the parameters are declared again
+        for (AST *param = ast->proc_decl.params; param; param = param->next) {
+            declare_variable(module, param->var_decl.identifier.str, param->var_decl.type);
+        }
+
+        for (AST *stmt = ast->proc_decl.body; stmt; stmt = stmt->next) {
+            if (ast_sizecheck(stmt, module, ast) == T_INVALID)
+                return { T_INVALID };
+        }
+
+        pop_scope(module, 0);
+
+        return ast->proc_decl.ret_type;
+
+    case AST_PROC_CALL: {
+        Symbol *sym = map_find(&module->symbols, ast->proc_call.identifier.str);
+        if (!sym || sym->type != SYM_PROC) {
+            TERROR(ast->proc_call.identifier, "procedure not found: '%.*s'", STRFMT(ast->proc_call.identifier.str));
+            return { T_INVALID };
+        }
+
+        AST *param = sym->proc.ast->proc_decl.params;
+        for (AST *arg = ast->proc_call.args; arg; arg = arg->next, param = param->next) {
+            TypeExpr type = ast_sizecheck(arg, module, proc, param->var_decl.type.size);
+            if (type == T_INVALID) return type;
+
+            if (type.size != param->var_decl.type.size) {
+                TERROR(ast->proc_call.identifier,
+                       "size mismatch in argument '%.*s', parameter declared as [%s:%d], argument deduced as [%s:%d]",
+                       STRFMT(param->var_decl.identifier.str),
+                       sz_from_enum(param->var_decl.type.prim), param->var_decl.type.size,
+                       sz_from_enum(type.prim), type.size);
+                return { T_INVALID };
+            }
+        }
+
+        return sym->proc.ast->proc_decl.ret_type;
+        } break;
+
+    case AST_RETURN: {
+        PANIC_IF(!proc || proc->type != AST_PROC_DECL, "expected AST_PROC_DECL");
+
+        TypeExpr ret_type = proc->proc_decl.ret_type;
+        if (ast->ret.expr) {
+            ret_type = ast_sizecheck(ast->ret.expr, module, proc, ret_type.size);
+            if (ret_type == T_INVALID) return ret_type;
+        }
+
+        if (proc->proc_decl.ret_type.size == 0 &&
+            proc->proc_decl.ret_type != T_VOID)
+        {
+            proc->proc_decl.ret_type.size = ret_type.size;
+        }
+
+        if (ret_type.size != proc->proc_decl.ret_type.size) {
+            TERROR(ast->ret.token, "size mismatch in return statement");
+        }
+
+        return ret_type;
+        } break;
+
+    case AST_RUN:
+        return ast->run.type = ast_sizecheck(ast->run.expr, module, proc, topdown_size);
+
+    case AST_VECTOR:
+        for (AST *elem = ast->vector.elems; elem; elem = elem->next) {
+            TypeExpr type = ast_sizecheck(elem, module, proc, ast->vector.type.size);
+            if (type == T_INVALID) return type;
+
+            if (type.size != ast->vector.type.size) {
+                TERROR(ast->vector.token,
+                       "size mismatch in element of '%.*s', deduced as [%s:%d]",
+                       STRFMT(ast->vector.token.str),
+                       sz_from_enum(type.prim), type.size);
+                return { T_INVALID };
+            }
+        }
+
+        return ast->vector.type;
+
+    case AST_SWIZZLE: {
+        TypeExpr type = ast_sizecheck(ast->swizzle.expr, module, proc);
+        if (type == T_INVALID) return type;
+
+        ast->swizzle.type.size = type.size;
+        return ast->swizzle.type;
+        } break;
+
+    case AST_REDUCE: {
+        TypeExpr type = ast_sizecheck(ast->reduce.expr, module, proc);
+        if (type == T_INVALID) return type;
+
+        ast->reduce.type.size = type.size;
+        return ast->reduce.type;
+        } break;
+
+    case AST_INDEX: {
+        TypeExpr type = ast_sizecheck(ast->index.expr, module, proc);
+        if (type == T_INVALID) return type;
+
+        // NOTE(jesper): the index is sized by its non-literal operands, and widened to 64 bit,
+        // the width of the array count, when lowered. Literal indices are sized as 64 bit
+        if (ast_sizecheck(ast->index.index, module, proc, 8) == T_INVALID) return { T_INVALID };
+
+        ast->index.type.size = type.size;
+        return ast->index.type;
+        } break;
+
+    case AST_INDEX_STORE: {
+        TypeExpr lhs = ast_sizecheck(ast->index_store.lhs, module, proc);
+        if (lhs == T_INVALID) return lhs;
+
+        TypeExpr rhs = ast_sizecheck(ast->index_store.rhs, module, proc, lhs.size);
+        if (rhs == T_INVALID) return rhs;
+
+        if (rhs.size != lhs.size) {
+            TERROR(ast->index_store.token,
+                   "size mismatch in array store, element is [%s:%d], assignment deduced as [%s:%d]",
+                   sz_from_enum(lhs.prim), lhs.size,
+                   sz_from_enum(rhs.prim), rhs.size);
+            return { T_INVALID };
+        }
+
+        return { T_VOID };
+        } break;
+
+    case AST_COUNT:
+        if (ast_sizecheck(ast->count.expr, module, proc) == T_INVALID) return { T_INVALID };
+        return { T_SIGNED, 8 };
+
+    case AST_FIELD:
+        if (ast_sizecheck(ast->field.expr, module, proc) == T_INVALID) return { T_INVALID };
+        return ast->field.type;
+
+    case AST_FIELD_STORE: {
+        TypeExpr lhs = ast_sizecheck(ast->field_store.lhs, module, proc);
+        if (lhs == T_INVALID) return lhs;
+
+        TypeExpr rhs = ast_sizecheck(ast->field_store.rhs, module, proc, lhs.size);
+        if (rhs == T_INVALID) return rhs;
+
+        if (rhs.size != lhs.size) {
+            TERROR(ast->field_store.token,
+                   "size mismatch in field store, field is [%s:%d], assignment deduced as [%s:%d]",
+                   sz_from_enum(lhs.prim), lhs.size,
+                   sz_from_enum(rhs.prim), rhs.size);
+            return { T_INVALID };
+        }
+
+        return { T_VOID };
+        } break;
+
+    case AST_ADDRESS_OF:
+    case AST_DEREF: {
+        TypeExpr type = ast_sizecheck(ast->unary.expr, module, proc);
+        if (type == T_INVALID) return type;
+
+        ast->unary.type.size = type.size;
+        return ast->unary.type;
+        } break;
+
+    case AST_DEREF_STORE: {
+        TypeExpr lhs = ast_sizecheck(ast->deref_store.lhs, module, proc);
+        if (lhs == T_INVALID) return lhs;
+
+        TypeExpr rhs = ast_sizecheck(ast->deref_store.rhs, module, proc, lhs.size);
+        if (rhs == T_INVALID) return rhs;
+
+        if (rhs.size != lhs.size) {
+            TERROR(ast->deref_store.token,
+                   "size mismatch in store through pointer, pointer is to [%s:%d], assignment deduced as [%s:%d]",
+                   sz_from_enum(lhs.prim), lhs.size,
+                   sz_from_enum(rhs.prim), rhs.size);
+            return { T_INVALID };
+        }
+
+        return { T_VOID };
+        } break;
+
+    case AST_ATOMIC: {
+        if (ast->atomic.op == ATOMIC_FENCE) return { T_VOID };
+
+        TypeExpr ptr = ast_sizecheck(ast->atomic.args, module, proc);
+        if (ptr == T_INVALID) return ptr;
+
+        ast->atomic.type.size = ptr.size;
+        for (AST *arg = ast->atomic.args->next; arg; arg = arg->next) {
+            TypeExpr type = ast_sizecheck(arg, module, proc, ptr.size);
+            if (type == T_INVALID) return type;
+
+            if (type.size != ptr.size) {
+                TERROR(ast->atomic.token,
+                       "size mismatch in '%.*s', pointer is to [%s:%d], operand deduced as [%s:%d]",
+                       STRFMT(ast->atomic.token.str),
+                       sz_from_enum(ptr.prim), ptr.size,
+                       sz_from_enum(type.prim), type.size);
+                return { T_INVALID };
+            }
+        }
+
+        return ast->atomic.op == ATOMIC_STORE ? TypeExpr{ T_VOID } : ast->atomic.type;
+        } break;
+
+    case AST_INTRINSIC: {
+        IntrinsicOp op = ast->intrinsic.op;
+        TypeExpr type = ast_sizecheck(ast->intrinsic.args, module, proc);
+        if (type == T_INVALID) return type;
+
+        if (op == INTRINSIC_LIKELY || op == INTRINSIC_UNLIKELY) return ast->intrinsic.type;
+        if (op == INTRINSIC_PREFETCH) return { T_VOID };
+
+        ast->intrinsic.type.size = type.size;
+        if (op == INTRINSIC_BSWAP && type.size < 2) {
+            TERROR(ast->intrinsic.token,
+                   "'%.*s' of [%s:%d], it needs at least 2 bytes to swap",
+                   STRFMT(ast->intrinsic.token.str), sz_from_enum(type.prim), type.size);
+            return { T_INVALID };
+        }
+
+        if (AST *amount = ast->intrinsic.args->next; amount) {
+            TypeExpr amount_type = ast_sizecheck(amount, module, proc, type.size);
+            if (amount_type == T_INVALID) return amount_type;
+
+            if (amount_type.size != type.size) {
+                TERROR(ast->intrinsic.token,
+                       "size mismatch in '%.*s', operand is [%s:%d], amount deduced as [%s:%d]",
+                       STRFMT(ast->intrinsic.token.str),
+                       sz_from_enum(type.prim), type.size,
+                       sz_from_enum(amount_type.prim), amount_type.size);
+                return { T_INVALID };
+            }
+        }
+
+        return ast->intrinsic.type;
+        } break;
+    }
+
+    return { T_UNKNOWN };
+}
+
+void llvm_set_target_attributes(LLVMIR *llvm, LLVMValueRef func)
+{
+    // NOTE(jesper): the target machine's cpu and features only act as the default, the
+    // function attributes are what the backend actually looks at when selecting instructions
+    if (llvm->target_cpu && llvm->target_cpu[0]) {
+        LLVMAttributeRef attr = LLVMCreateStringAttribute(
+            llvm->context,
+            "target-cpu", strlen("target-cpu"),
+            llvm->target_cpu, strlen(llvm->target_cpu));
+        LLVMAddAttributeAtIndex(func, LLVMAttributeFunctionIndex, attr);
+    }
+
+    if (llvm->target_features && llvm->target_features[0]) {
+        LLVMAttributeRef attr = LLVMCreateStringAttribute(
+            llvm->context,
+            "target-features", strlen("target-features"),
+            llvm->target_features, strlen(llvm->target_features));
+        LLVMAddAttributeAtIndex(func, LLVMAttributeFunctionIndex, attr);
+    }
+
+    // TODO(jesper): the LLVM-C API we build against can't set fast-math flags on individual
+    // instructions, so the relaxations are applied to the whole function through its
+    // attributes instead. The backend honours them, but the IR level optimisations only look
+    // at instruction flags. Switch to LLVMSetFastMathFlags once we move to LLVM 18
+    struct { u32 flag; const char *attr; } fp_attributes[] = {
+        { FP_UNSAFE_MATH,     "unsafe-fp-math" },
+        { FP_UNSAFE_MATH,     "less-precise-fpmad" },
+        { FP_NO_NANS,         "no-nans-fp-math" },
+        { FP_NO_INFS,         "no-infs-fp-math" },
+        { FP_NO_SIGNED_ZEROS, "no-signed-zeros-fp-math" },
+        { FP_APPROX_FUNC,     "approx-func-fp-math" },
+    };
+
+    for (auto &it : fp_attributes) {
+        if (!(llvm->fp_math & it.flag)) continue;
+
+        LLVMAttributeRef attr = LLVMCreateStringAttribute(
+            llvm->context,
+            it.attr, strlen(it.attr),
+            "true", strlen("true"));
+        LLVMAddAttributeAtIndex(func, LLVMAttributeFunctionIndex, attr);
+    }
+}
+
+void llvm_codegen_proc_decl(LLVMIR *llvm, i32 index)
+{
+    SArena scratch = tl_scratch_arena();
+
+    IrProc *proc = &llvm->source->procs[index];
+    LLVMProc *dst = &llvm->procedures[index];
+
+    LLVMTypeRef ret_type = llvm_type_from_type_expr(llvm->context, proc->ret_type);
+    if (!ret_type) ret_type = LLVMVoidTypeInContext(llvm->context);
+
+    Array<LLVMTypeRef> params = array_create<LLVMTypeRef>(proc->params.count, scratch);
+    for (i32 i = 0; i < params.count; i++) params[i] = llvm_type_from_type_expr(llvm->context, proc->params[i]);
+
+    dst->func_t = LLVMFunctionType(ret_type, params.data, params.count, false);
+    dst->func = LLVMAddFunction(llvm->module, sz_string(proc->name, scratch), dst->func_t);
+    LLVMSetLinkage(dst->func, LLVMExternalLinkage);
+
+    // NOTE(jesper): the calling convention has to match in every unit that calls the procedure,
+    // internal linkage is only given to the definition
+    ProcLinkage linkage = llvm->linkage.count > 0 ? llvm->linkage[index] : LINKAGE_EXTERNAL;
+    if (linkage != LINKAGE_EXTERNAL) LLVMSetFunctionCallConv(dst->func, LLVMFastCallConv);
+    if (linkage == LINKAGE_HIDDEN) LLVMSetVisibility(dst->func, LLVMHiddenVisibility);
+
+    // NOTE(jesper): #restrict slices are a struct of pointer and count, which can't carry the
+    // attribute; they're covered by the alias scopes of llvm_codegen_proc instead
+    u32 noalias_kind = LLVMGetEnumAttributeKindForName("noalias", strlen("noalias"));
+    for (i32 i = 0; i < proc->params.count; i++) {
+        if (!proc->noalias[i] || proc->params[i].elems != 0) continue;
+        LLVMAddAttributeAtIndex(dst->func, i+1, LLVMCreateEnumAttribute(llvm->context, noalias_kind, 0));
+    }
+
+    // NOTE(jesper): the attributes are set on the declarations as well, it's what makes the
+    // branch probabilities of the callers treat paths calling a #cold procedure as unlikely.
+    // Procedures the profile never saw entered are treated the same, and the ones it found hot
+    // are hinted to the inliner
+    u64 entry_count = proc->profile.count > 0 ? proc->profile[0] : 0;
+    bool profile_cold = proc->profile.count > 0 && entry_count == 0;
+    bool profile_hot = llvm->profile_hot_count > 0 && entry_count >= llvm->profile_hot_count;
+
+    const char *attributes[2] = {};
+    if (proc->hot) attributes[0] = "hot";
+    else if (proc->cold || profile_cold) attributes[0] = "cold", attributes[1] = "optsize";
+    else if (profile_hot) attributes[0] = "hot", attributes[1] = "inlinehint";
+
+    for (const char *attr : attributes) {
+        if (!attr) continue;
+        u32 kind = LLVMGetEnumAttributeKindForName(attr, strlen(attr));
+        LLVMAddAttributeAtIndex(dst->func, LLVMAttributeFunctionIndex, LLVMCreateEnumAttribute(llvm->context, kind, 0));
+    }
+}
+
+LLVMValueRef llvm_codegen_const(LLVMIR *llvm, TypeExpr type, IrInst *inst)
+{
+    // NOTE(jesper): the only array constant is the empty slice, and structs and pointers are only
+    // ever zero initialised
+    if (type.elems != 0 || type.pointers != 0 || type == T_STRUCT) return LLVMConstNull(llvm_type_from_type_expr(llvm->context, type));
+
+    if (type.lanes > 0) {
+        TypeExpr lane_type = type;
+        lane_type.lanes = 0;
+
+        LLVMValueRef lanes[16];
+        for (i32 i = 0; i < type.lanes; i++) lanes[i] = llvm_codegen_const(llvm, lane_type, inst);
+        return LLVMConstVector(lanes, type.lanes);
+    }
+
+    LLVMTypeRef llvm_type = llvm_type_from_type_expr(llvm->context, type);
+
+    switch (type.prim) {
+    case T_SIGNED:   return LLVMConstInt(llvm_type, inst->ival, true);
+    case T_UNSIGNED: return LLVMConstInt(llvm_type, inst->ival, false);
+    case T_BOOL:     return LLVMConstInt(llvm_type, inst->ival, false);
+    case T_FLOAT:    return LLVMConstReal(llvm_type, inst->fval);
+    default:
+        PANIC("invalid constant type [%s:%d]", sz_from_enum(type.prim), type.size);
+        return nullptr;
+    }
+}
+
+// NOTE(jesper): every unit gets its own private copy of the constant arrays it might use, with
+// unnamed_addr so that LLVM and the linker are free to merge identical ones and put them in
+// mergeable read-only sections. Unused copies are dropped by the optimiser
+void llvm_codegen_global(LLVMIR *llvm, i32 index)
+{
+    SArena scratch = tl_scratch_arena();
+
+    IrGlobal *global = &llvm->source->globals[index];
+    TypeExpr elem_t = global->type;
+    elem_t.elems = 0;
+
+    Array<LLVMValueRef> elems = array_create<LLVMValueRef>(global->values.count, scratch);
+    for (i32 i = 0; i < elems.count; i++) {
+        IrInst inst{ .op = IR_CONST, .dst = IR_NONE, .a = IR_NONE, .b = IR_NONE };
+        if (elem_t == T_FLOAT) inst.fval = global->values[i].fval;
+        else inst.ival = global->values[i].ival;
+        elems[i] = llvm_codegen_const(llvm, elem_t, &inst);
+    }
+
+    LLVMTypeRef elem_type = llvm_type_from_type_expr(llvm->context, elem_t);
+    LLVMValueRef init = LLVMConstArray(elem_type, elems.data, elems.count);
+
+    LLVMValueRef value = LLVMAddGlobal(llvm->module, LLVMTypeOf(init), sz_string(global->name, scratch));
+    LLVMSetInitializer(value, init);
+    LLVMSetGlobalConstant(value, true);
+    LLVMSetLinkage(value, LLVMPrivateLinkage);
+    LLVMSetUnnamedAddress(value, LLVMGlobalUnnamedAddr);
+    LLVMSetAlignment(value, LLVMABIAlignmentOfType(llvm->data_layout, elem_type));
+
+    llvm->globals[index] = value;
+}
+
+LLVMValueRef llvm_codegen_arith(LLVMIR *llvm, IrOp op, TypeExpr type, LLVMValueRef lhs, LLVMValueRef rhs)
+{
+    if (type == T_FLOAT) {
+        switch (op) {
+        case IR_ADD: return LLVMBuildFAdd(llvm->ir, lhs, rhs, "");
+        case IR_SUB: return LLVMBuildFSub(llvm->ir, lhs, rhs, "");
+        case IR_MUL: return LLVMBuildFMul(llvm->ir, lhs, rhs, "");
+        case IR_DIV: return LLVMBuildFDiv(llvm->ir, lhs, rhs, "");
+        default: break;
+        }
+    } else {
+        switch (op) {
+        case IR_ADD: return LLVMBuildAdd(llvm->ir, lhs, rhs, "");
+        case IR_SUB: return LLVMBuildSub(llvm->ir, lhs, rhs, "");
+        case IR_MUL: return LLVMBuildMul(llvm->ir, lhs, rhs, "");
+        case IR_DIV:
+            if (type == T_SIGNED) return LLVMBuildSDiv(llvm->ir, lhs, rhs, "");
+            return LLVMBuildUDiv(llvm->ir, lhs, rhs, "");
+        default: break;
+        }
+    }
+
+    PANIC("invalid arithmetic op '%s' for type [%s:%d]", sz_from_enum(op), sz_from_enum(type.prim), type.size);
+    return nullptr;
+}
+
+LLVMValueRef llvm_codegen_compare(LLVMIR *llvm, IrOp op, TypeExpr type, LLVMValueRef lhs, LLVMValueRef rhs)
+{
+    // NOTE(jesper): indexed by EQ, NE, LT, LE, GT, GE. Float comparisons are ordered, except
+    // for not equal which is true for NaN operands, like in C
+    static const LLVMRealPredicate f_preds[] = { LLVMRealOEQ, LLVMRealUNE, LLVMRealOLT, LLVMRealOLE, LLVMRealOGT, LLVMRealOGE };
+    static const LLVMIntPredicate s_preds[] = { LLVMIntEQ, LLVMIntNE, LLVMIntSLT, LLVMIntSLE, LLVMIntSGT, LLVMIntSGE };
+    static const LLVMIntPredicate u_preds[] = { LLVMIntEQ, LLVMIntNE, LLVMIntULT, LLVMIntULE, LLVMIntUGT, LLVMIntUGE };
+
+    if (type == T_FLOAT) return LLVMBuildFCmp(llvm->ir, f_preds[op - IR_EQ], lhs, rhs, "");
+    return LLVMBuildICmp(llvm->ir, (type == T_SIGNED ? s_preds : u_preds)[op - IR_EQ], lhs, rhs, "");
+}
+
+LLVMValueRef llvm_codegen_vector(LLVMIR *llvm, TypeExpr type, LLVMValueRef *elems, i32 count)
+{
+    LLVMTypeRef i32_t = LLVMInt32TypeInContext(llvm->context);
+    LLVMValueRef poison = LLVMGetPoison(llvm_type_from_type_expr(llvm->context, type));
+
+    // NOTE(jesper): a single element is inserted in the first lane and broadcast with a zero
+    // shuffle mask, which is the pattern the backends recognise as a splat
+    if (count == 1) {
+        LLVMValueRef vector = LLVMBuildInsertElement(llvm->ir, poison, elems[0], LLVMConstInt(i32_t, 0, false), "");
+        LLVMValueRef mask = LLVMConstNull(LLVMVectorType(i32_t, type.lanes));
+        return LLVMBuildShuffleVector(llvm->ir, vector, poison, mask, "");
+    }
+
+    LLVMValueRef vector = poison;
+    for (i32 i = 0; i < count; i++) {
+        vector = LLVMBuildInsertElement(llvm->ir, vector, elems[i], LLVMConstInt(i32_t, i, false), "");
+    }
+    return vector;
+}
+
+LLVMValueRef llvm_codegen_shuffle(LLVMIR *llvm, TypeExpr type, LLVMValueRef src, u8 *lanes)
+{
+    LLVMTypeRef i32_t = LLVMInt32TypeInContext(llvm->context);
+
+    LLVMValueRef mask[4];
+    for (i32 i = 0; i < type.lanes; i++) mask[i] = LLVMConstInt(i32_t, lanes[i], false);
+
+    LLVMValueRef poison = LLVMGetPoison(LLVMTypeOf(src));
+    return LLVMBuildShuffleVector(llvm->ir, src, poison, LLVMConstVector(mask, type.lanes), "");
+}
+
+// NOTE(jesper): horizontal reductions map to the llvm.vector.reduce intrinsics, overloaded on
+// the type of the vector
+LLVMValueRef llvm_codegen_reduce(LLVMIR *llvm, IrOp op, TypeExpr type, LLVMValueRef src)
+{
+    const char *name = nullptr;
+    if (type == T_FLOAT) {
+        switch (op) {
+        case IR_REDUCE_ADD: name = "llvm.vector.reduce.fadd"; break;
+        case IR_REDUCE_MUL: name = "llvm.vector.reduce.fmul"; break;
+        case IR_REDUCE_MIN: name = "llvm.vector.reduce.fmin"; break;
+        case IR_REDUCE_MAX: name = "llvm.vector.reduce.fmax"; break;
+        default: break;
+        }
+    } else {
+        bool is_signed = type == T_SIGNED;
+        switch (op) {
+        case IR_REDUCE_ADD: name = "llvm.vector.reduce.add"; break;
+        case IR_REDUCE_MUL: name = "llvm.vector.reduce.mul"; break;
+        case IR_REDUCE_MIN: name = is_signed ? "llvm.vector.reduce.smin" : "llvm.vector.reduce.umin"; break;
+        case IR_REDUCE_MAX: name = is_signed ? "llvm.vector.reduce.smax" : "llvm.vector.reduce.umax"; break;
+        default: break;
+        }
+    }
+
+    PANIC_IF(!name, "invalid reduction op '%s' for type [%s:%d]", sz_from_enum(op), sz_from_enum(type.prim), type.size);
+
+    LLVMTypeRef vector_t = LLVMTypeOf(src);
+    u32 id = LLVMLookupIntrinsicID(name, strlen(name));
+    LLVMValueRef func = LLVMGetIntrinsicDeclaration(llvm->module, id, &vector_t, 1);
+    LLVMTypeRef func_t = LLVMIntrinsicGetType(llvm->context, id, &vector_t, 1);
+
+    // NOTE(jesper): the float add and mul reductions take a start value, and are performed in
+    // lane order unless the call has the reassoc flag.
+    // TODO(jesper): set reassoc under -ffast-math once we have LLVMSetFastMathFlags in LLVM 18
+    if (type == T_FLOAT && (op == IR_REDUCE_ADD || op == IR_REDUCE_MUL)) {
+        LLVMTypeRef lane_t = LLVMGetElementType(vector_t);
+        LLVMValueRef args[] = { LLVMConstReal(lane_t, op == IR_REDUCE_ADD ? -0.0 : 1.0), src };
+        return LLVMBuildCall2(llvm->ir, func_t, func, args, ARRAY_COUNT(args), "");
+    }
+
+    return LLVMBuildCall2(llvm->ir, func_t, func, &src, 1, "");
+}
+
+// NOTE(jesper): the intrinsics are overloaded on the type of their first operand, except for
+// llvm.expect, whose expected value is an operand of the same type, and llvm.prefetch, which
+// takes the read/write, locality and cache type as constants
+LLVMValueRef llvm_codegen_intrinsic(LLVMIR *llvm, IrInst *inst, LLVMValueRef a, LLVMValueRef b)
+{
+    const char *name = nullptr;
+    switch (inst->op) {
+    case IR_EXPECT:   name = "llvm.expect"; break;
+    case IR_PREFETCH: name = "llvm.prefetch"; break;
+    case IR_POPCOUNT: name = "llvm.ctpop"; break;
+    case IR_CLZ:      name = "llvm.ctlz"; break;
+    case IR_CTZ:      name = "llvm.cttz"; break;
+    case IR_BSWAP:    name = "llvm.bswap"; break;
+    case IR_ROTL:     name = "llvm.fshl"; break;
+    case IR_ROTR:     name = "llvm.fshr"; break;
+    default: break;
+    }
+
+    PANIC_IF(!name, "invalid intrinsic op '%s'", sz_from_enum(inst->op));
+
+    LLVMTypeRef type = LLVMTypeOf(a);
+    u32 id = LLVMLookupIntrinsicID(name, strlen(name));
+    LLVMValueRef func = LLVMGetIntrinsicDeclaration(llvm->module, id, &type, 1);
+    LLVMTypeRef func_t = LLVMIntrinsicGetType(llvm->context, id, &type, 1);
+
+    LLVMTypeRef i1_t = LLVMInt1TypeInContext(llvm->context);
+    LLVMTypeRef i32_t = LLVMInt32TypeInContext(llvm->context);
+
+    LLVMValueRef args[4] = { a };
+    i32 arg_count = 1;
+    switch (inst->op) {
+    case IR_EXPECT:
+        args[arg_count++] = LLVMConstInt(type, inst->ival, false);
+        break;
+    case IR_PREFETCH:
+        args[arg_count++] = LLVMConstInt(i32_t, 0, false); // read
+        args[arg_count++] = LLVMConstInt(i32_t, 3, false); // keep in all levels of cache
+        args[arg_count++] = LLVMConstInt(i32_t, 1, false); // data cache
+        break;
+    case IR_CLZ:
+    case IR_CTZ:
+        // NOTE(jesper): defined as the bit width for zero, rather than poison
+        args[arg_count++] = LLVMConstInt(i1_t, 0, false);
+        break;
+    case IR_ROTL:
+    case IR_ROTR:
+        // NOTE(jesper): a funnel shift of a value with itself is a rotate, with the amount
+        // taken modulo the bit width
+        args[arg_count++] = a;
+        args[arg_count++] = b;
+        break;
+    default:
+        break;
+    }
+
+    return LLVMBuildCall2(llvm->ir, func_t, func, args, arg_count, "");
+}
+
+// NOTE(jesper): indices are extended to 64 bits according to the signedness of their type
+LLVMValueRef llvm_codegen_index64(LLVMIR *llvm, TypeExpr type, LLVMValueRef index)
+{
+    LLVMTypeRef i64_t = LLVMInt64TypeInContext(llvm->context);
+    if (type == T_SIGNED) return LLVMBuildSExtOrBitCast(llvm->ir, index, i64_t, "");
+    return LLVMBuildZExtOrBitCast(llvm->ir, index, i64_t, "");
+}
+
+// NOTE(jesper): the address of element index of a slice, or of a field of the element
+LLVMValueRef llvm_codegen_element_ptr(
+    LLVMIR *llvm,
+    TypeExpr slice_type, LLVMValueRef slice,
+    TypeExpr index_type, LLVMValueRef index,
+    i32 field)
+{
+    LLVMContextRef ctx = llvm->context;
+
+    // NOTE(jesper): pointers are indexed like the pointer of a slice, and the elements they point
+    // to are never #soa
+    TypeExpr elem_type = slice_type;
+    if (slice_type.elems == 0) elem_type.pointers--;
+    elem_type.elems = 0;
+
+    LLVMValueRef index64 = llvm_codegen_index64(llvm, index_type, index);
+    LLVMValueRef ptr = slice_type.elems == 0 ? slice : LLVMBuildExtractValue(llvm->ir, slice, 0, "");
+    if (field == IR_NONE) return LLVMBuildInBoundsGEP2(llvm->ir, llvm_type_from_type_expr(ctx, elem_type), ptr, &index64, 1, "");
+
+    // NOTE(jesper): the array of a #soa field starts after the arrays of the fields before it,
+    // which is only known from the count of the slice
+    StructField &f = elem_type.struct_type->fields[field];
+    if (elem_type.struct_type->soa && slice_type.elems == TYPE_SLICE) {
+        LLVMValueRef stride = LLVMConstInt(LLVMInt64TypeInContext(ctx), f.soa_offset, false);
+        LLVMValueRef offset = LLVMBuildNUWMul(llvm->ir, LLVMBuildExtractValue(llvm->ir, slice, 1, ""), stride, "");
+        LLVMValueRef base = LLVMBuildInBoundsGEP2(llvm->ir, LLVMInt8TypeInContext(ctx), ptr, &offset, 1, "");
+        return LLVMBuildInBoundsGEP2(llvm->ir, llvm_type_from_type_expr(ctx, f.type), base, &index64, 1, "");
+    }
+
+    LLVMValueRef indices[] = { index64, LLVMConstInt(LLVMInt32TypeInContext(ctx), field, false) };
+    return LLVMBuildInBoundsGEP2(llvm->ir, llvm_type_from_type_expr(ctx, elem_type), ptr, indices, ARRAY_COUNT(indices), "");
+}
+
+// NOTE(jesper): an index outside of the slice traps. The comparison is unsigned so that negative
+// indices are caught by the same check. All failing checks in a procedure branch to the same
+// trap block, created the first time it's needed
+void llvm_codegen_bounds_check(
+    LLVMIR *llvm,
+    LLVMValueRef func,
+    LLVMBasicBlockRef *trap_block,
+    TypeExpr index_type,
+    LLVMValueRef index,
+    LLVMValueRef slice)
+{
+    LLVMBasicBlockRef current = LLVMGetInsertBlock(llvm->ir);
+
+    if (!*trap_block) {
+        *trap_block = LLVMAppendBasicBlockInContext(llvm->context, func, "bounds_trap");
+        LLVMPositionBuilderAtEnd(llvm->ir, *trap_block);
+
+        u32 id = LLVMLookupIntrinsicID("llvm.trap", 9);
+        LLVMValueRef trap = LLVMGetIntrinsicDeclaration(llvm->module, id, nullptr, 0);
+        LLVMBuildCall2(llvm->ir, LLVMIntrinsicGetType(llvm->context, id, nullptr, 0), trap, nullptr, 0, "");
+        LLVMBuildUnreachable(llvm->ir);
+
+        LLVMPositionBuilderAtEnd(llvm->ir, current);
+    }
+
+    LLVMValueRef index64 = llvm_codegen_index64(llvm, index_type, index);
+    LLVMValueRef count = LLVMBuildExtractValue(llvm->ir, slice, 1, "");
+    LLVMValueRef in_bounds = LLVMBuildICmp(llvm->ir, LLVMIntULT, index64, count, "");
+
+    LLVMBasicBlockRef cont = LLVMInsertBasicBlockInContext(llvm->context, *trap_block, "");
+    LLVMMoveBasicBlockAfter(cont, current);
+    LLVMBuildCondBr(llvm->ir, in_bounds, cont, *trap_block);
+    LLVMPositionBuilderAtEnd(llvm->ir, cont);
+}
+
+// NOTE(jesper): the llvm.loop metadata attached to a loop's backedge. The node's first operand
+// refers to the node itself so that it's distinct for every loop, which has to be built by
+// replacing a temporary node. Returns nullptr if the loop has no hints
+LLVMMetadataRef llvm_loop_metadata(LLVMIR *llvm, LoopHints hints)
+{
+    LLVMContextRef ctx = llvm->context;
+
+    auto md_string = [ctx](const char *str) { return LLVMMDStringInContext2(ctx, str, strlen(str)); };
+    auto md_i32 = [ctx](i32 value) { return LLVMValueAsMetadata(LLVMConstInt(LLVMInt32TypeInContext(ctx), value, false)); };
+    auto md_bool = [ctx](bool value) { return LLVMValueAsMetadata(LLVMConstInt(LLVMInt1TypeInContext(ctx), value, false)); };
+
+    LLVMMetadataRef ops[5];
+    i32 count = 1;
+
+    if (hints.no_vectorize) {
+        LLVMMetadataRef prop[] = { md_string("llvm.loop.vectorize.enable"), md_bool(false) };
+        ops[count++] = LLVMMDNodeInContext2(ctx, prop, ARRAY_COUNT(prop));
+    } else if (hints.vectorize_width) {
+        LLVMMetadataRef width[] = { md_string("llvm.loop.vectorize.width"), md_i32(hints.vectorize_width) };
+        LLVMMetadataRef enable[] = { md_string("llvm.loop.vectorize.enable"), md_bool(true) };
+        ops[count++] = LLVMMDNodeInContext2(ctx, width, ARRAY_COUNT(width));
+        ops[count++] = LLVMMDNodeInContext2(ctx, enable, ARRAY_COUNT(enable));
+    }
+
+    if (hints.no_unroll) {
+        LLVMMetadataRef prop[] = { md_string("llvm.loop.unroll.disable") };
+        ops[count++] = LLVMMDNodeInContext2(ctx, prop, ARRAY_COUNT(prop));
+    } else if (hints.unroll_count) {
+        LLVMMetadataRef prop[] = { md_string("llvm.loop.unroll.count"), md_i32(hints.unroll_count) };
+        ops[count++] = LLVMMDNodeInContext2(ctx, prop, ARRAY_COUNT(prop));
+    }
+
+    if (count == 1) return nullptr;
+
+    ops[0] = LLVMTemporaryMDNode(ctx, nullptr, 0);
+    LLVMMetadataRef loop = LLVMMDNodeInContext2(ctx, ops, count);
+    LLVMMetadataReplaceAllUsesWith(ops[0], loop);
+    return loop;
+}
+
+// NOTE(jesper): the ProfileSummary module flag describing the -fprofile-use profile as a whole,
+// which is what LLVM's profile summary analysis reads to tell hot and cold code apart for its
+// inlining and block placement decisions. The detailed summary has the smallest count of the
+// hottest counters making up each cutoff, in millionths, of the total count. The cutoffs are the
+// same as LLVM's own profiles, and counts within the 99% cutoff are hot
+void llvm_profile_summary(LLVMIR *llvm)
+{
+    SArena scratch = tl_scratch_arena();
+    LLVMContextRef ctx = llvm->context;
+
+    i32 count = 0, functions = 0;
+    for (IrProc &proc : llvm->source->procs) {
+        count += proc.profile.count;
+        if (proc.profile.count > 0) functions++;
+    }
+    if (count == 0) return;
+
+    Array<u64> counts = array_create<u64>(count, scratch);
+    u64 total = 0, max_function = 0, max_internal = 0;
+
+    i32 n = 0;
+    for (IrProc &proc : llvm->source->procs) {
+        for (i32 i = 0; i < proc.profile.count; i++) {
+            counts[n++] = proc.profile[i];
+            total += proc.profile[i];
+            if (i == 0) max_function = MAX(max_function, proc.profile[i]);
+            else max_internal = MAX(max_internal, proc.profile[i]);
+        }
+    }
+    if (total == 0) return;
+
+    quick_sort_desc(counts);
+
+    auto md_string = [ctx](const char *str) { return LLVMMDStringInContext2(ctx, str, strlen(str)); };
+    auto md_i32 = [ctx](u64 value) { return LLVMValueAsMetadata(LLVMConstInt(LLVMInt32TypeInContext(ctx), value, false)); };
+    auto md_i64 = [ctx](u64 value) { return LLVMValueAsMetadata(LLVMConstInt(LLVMInt64TypeInContext(ctx), value, false)); };
+    auto md_field = [&](const char *name, u64 value)
+    {
+        LLVMMetadataRef field[] = { md_string(name), md_i64(value) };
+        return LLVMMDNodeInContext2(ctx, field, ARRAY_COUNT(field));
+    };
+
+    const u32 cutoffs[] = { 10000, 100000, 200000, 300000, 400000, 500000, 600000, 700000, 800000, 900000, 950000, 990000, 999000, 999900, 999990, 999999 };
+    const u32 hot_cutoff = 990000;
+
+    LLVMMetadataRef detailed[ARRAY_COUNT(cutoffs)];
+    i32 i = 0;
+    u64 sum = 0;
+    for (i32 c = 0; c < ARRAY_COUNT(cutoffs); c++) {
+        u64 desired = total / 1000000 * cutoffs[c] + total % 1000000 * cutoffs[c] / 1000000;
+        while (i < counts.count && (sum < desired || i == 0)) sum += counts[i++];
+
+        LLVMMetadataRef entry[] = { md_i32(cutoffs[c]), md_i64(counts[i-1]), md_i32(i) };
+        detailed[c] = LLVMMDNodeInContext2(ctx, entry, ARRAY_COUNT(entry));
+
+        if (cutoffs[c] == hot_cutoff) llvm->profile_hot_count = counts[i-1];
+    }
+
+    LLVMMetadataRef format[] = { md_string("ProfileFormat"), md_string("InstrProf") };
+    LLVMMetadataRef detailed_summary[] = { md_string("DetailedSummary"), LLVMMDNodeInContext2(ctx, detailed, ARRAY_COUNT(detailed)) };
+
+    LLVMMetadataRef summary[] = {
+        LLVMMDNodeInContext2(ctx, format, ARRAY_COUNT(format)),
+        md_field("TotalCount", total),
+        md_field("MaxCount", counts[0]),
+        md_field("MaxInternalCount", max_internal),
+        md_field("MaxFunctionCount", max_function),
+        md_field("NumCounts", (u64)count),
+        md_field("NumFunctions", (u64)functions),
+        LLVMMDNodeInContext2(ctx, detailed_summary, ARRAY_COUNT(detailed_summary)),
+    };
+
+    LLVMAddModuleFlag(
+        llvm->module, LLVMModuleFlagBehaviorError,
+        "ProfileSummary", strlen("ProfileSummary"),
+        LLVMMDNodeInContext2(ctx, summary, ARRAY_COUNT(summary)));
+}
+
+// NOTE(jesper): the branch_weights of a branch or switch from the counts of its successors,
+// in the order of the instruction's targets. The weights are 32 bits, so the counts are
+// scaled down to fit, and one is added to each so that a successor the profile never saw taken
+// is unlikely rather than impossible
+LLVMMetadataRef llvm_branch_weights(LLVMIR *llvm, u64 *counts, i32 count)
+{
+    SArena scratch = tl_scratch_arena();
+    LLVMContextRef ctx = llvm->context;
+
+    u64 max = 0;
+    for (i32 i = 0; i < count; i++) max = MAX(max, counts[i]);
+    u64 scale = max / 0xffffffff + 1;
+
+    Array<LLVMMetadataRef> ops = array_create<LLVMMetadataRef>(count+1, scratch);
+    ops[0] = LLVMMDStringInContext2(ctx, "branch_weights", strlen("branch_weights"));
+    for (i32 i = 0; i < count; i++) {
+        u64 weight = MIN(counts[i] / scale + 1, 0xffffffff);
+        ops[i+1] = LLVMValueAsMetadata(LLVMConstInt(LLVMInt32TypeInContext(ctx), weight, false));
+    }
+
+    return LLVMMDNodeInContext2(ctx, ops.data, ops.count);
+}
+
+// NOTE(jesper): the counters are incremented atomically, procedures can run on several threads
+// at once through parallel loops
+void llvm_codegen_profile_increment(LLVMIR *llvm, i32 proc, LLVMValueRef index)
+{
+    LLVMTypeRef i64_t = LLVMInt64TypeInContext(llvm->context);
+    LLVMValueRef counter = LLVMBuildInBoundsGEP2(llvm->ir, i64_t, llvm->profile_counters[proc], &index, 1, "");
+    LLVMBuildAtomicRMW(llvm->ir, LLVMAtomicRMWBinOpAdd, counter, LLVMConstInt(i64_t, 1, false), LLVMAtomicOrderingMonotonic, false);
+}
+
+LLVMAtomicOrdering llvm_atomic_ordering(AtomicOrder order)
+{
+    switch (order) {
+    case ORDER_RELAXED: return LLVMAtomicOrderingMonotonic;
+    case ORDER_ACQUIRE: return LLVMAtomicOrderingAcquire;
+    case ORDER_RELEASE: return LLVMAtomicOrderingRelease;
+    case ORDER_ACQ_REL: return LLVMAtomicOrderingAcquireRelease;
+    case ORDER_SEQ_CST: return LLVMAtomicOrderingSequentiallyConsistent;
+    }
+
+    PANIC("invalid atomic order: %d", order);
+    return LLVMAtomicOrderingSequentiallyConsistent;
+}
+
+LLVMAtomicRMWBinOp llvm_atomic_rmw_op(AtomicOp op, TypeExpr type)
+{
+    switch (op) {
+    case ATOMIC_XCHG: return LLVMAtomicRMWBinOpXchg;
+    case ATOMIC_ADD:  return type == T_FLOAT ? LLVMAtomicRMWBinOpFAdd : LLVMAtomicRMWBinOpAdd;
+    case ATOMIC_SUB:  return type == T_FLOAT ? LLVMAtomicRMWBinOpFSub : LLVMAtomicRMWBinOpSub;
+    case ATOMIC_AND:  return LLVMAtomicRMWBinOpAnd;
+    case ATOMIC_OR:   return LLVMAtomicRMWBinOpOr;
+    case ATOMIC_XOR:  return LLVMAtomicRMWBinOpXor;
+    case ATOMIC_MIN:  return type == T_SIGNED ? LLVMAtomicRMWBinOpMin : LLVMAtomicRMWBinOpUMin;
+    case ATOMIC_MAX:  return type == T_SIGNED ? LLVMAtomicRMWBinOpMax : LLVMAtomicRMWBinOpUMax;
+    default: break;
+    }
+
+    PANIC("invalid atomic read-modify-write op: %s", sz_from_enum(op));
+    return LLVMAtomicRMWBinOpXchg;
+}
+
+// NOTE(jesper): the #restrict parameter each register's pointer or slice is derived from, or
+// IR_NONE. Locals only carry it when every store to them does and their address isn't taken, and
+// loads see it regardless of which store they're reached from
+Array<i32> llvm_restrict_provenance(IrProc *proc, Allocator mem)
+{
+    enum { UNSEEN = -2, CONFLICT = -3 };
+
+    Array<i32> reg_param = array_create<i32>(proc->regs.count, mem);
+    Array<i32> local_param = array_create<i32>(proc->locals.count, mem);
+    for (i32 &it : reg_param) it = IR_NONE;
+    for (i32 &it : local_param) it = UNSEEN;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (IrBlock &block : proc->blocks) {
+            for (IrInst &inst : block.insts) {
+                switch (inst.op) {
+                case IR_PARAM:
+                    if (proc->noalias[inst.param]) reg_param[inst.dst] = inst.param;
+                    break;
+                case IR_COPY:
+                case IR_INDEX_ADDR:
+                    reg_param[inst.dst] = reg_param[inst.a];
+                    break;
+                case IR_LOAD:
+                    reg_param[inst.dst] = MAX(local_param[inst.local], IR_NONE);
+                    break;
+                case IR_STORE:
+                case IR_ADDR: {
+                    i32 &state = local_param[inst.local];
+                    i32 param = inst.op == IR_STORE ? reg_param[inst.a] : IR_NONE;
+
+                    i32 merged = state == UNSEEN && param != IR_NONE ? param
+                        : state == param ? state
+                        : CONFLICT;
+                    changed |= merged != state;
+                    state = merged;
+                    } break;
+                default:
+                    break;
+                }
+            }
+        }
+    }
+
+    return reg_param;
+}
+
+// NOTE(jesper): every #restrict parameter gets an alias scope in a domain of the procedure's
+// own, and the accesses derived from one are marked as not aliasing the others. The scopes are
+// declared on entry, so that they stay distinct for each copy when the procedure is inlined or
+// unrolled into a loop
+void llvm_alias_scopes(
+    LLVMIR *llvm,
+    IrProc *proc,
+    Array<LLVMValueRef> *alias_scope,
+    Array<LLVMValueRef> *noalias,
+    Allocator mem)
+{
+    LLVMContextRef ctx = llvm->context;
+    SArena scratch = tl_scratch_arena(mem);
+
+    *alias_scope = array_create<LLVMValueRef>(proc->params.count, mem);
+    *noalias = array_create<LLVMValueRef>(proc->params.count, mem);
+    for (LLVMValueRef &it : *alias_scope) it = nullptr;
+    for (LLVMValueRef &it : *noalias) it = nullptr;
+
+    auto md_string = [ctx](const char *str) { return LLVMMDStringInContext2(ctx, str, strlen(str)); };
+    auto md_distinct = [ctx](LLVMMetadataRef *ops, i32 count) {
+        ops[0] = LLVMTemporaryMDNode(ctx, nullptr, 0);
+        LLVMMetadataRef node = LLVMMDNodeInContext2(ctx, ops, count);
+        LLVMMetadataReplaceAllUsesWith(ops[0], node);
+        return node;
+    };
+
+    char *name = sz_string(proc->name, scratch);
+    LLVMMetadataRef domain_ops[] = { nullptr, md_string(name) };
+    LLVMMetadataRef domain = md_distinct(domain_ops, ARRAY_COUNT(domain_ops));
+
+    Array<LLVMMetadataRef> scopes = array_create<LLVMMetadataRef>(proc->params.count, scratch);
+    for (i32 i = 0; i < scopes.count; i++) {
+        scopes[i] = nullptr;
+        if (!proc->noalias[i]) continue;
+
+        LLVMMetadataRef ops[] = { nullptr, domain, md_string(sztringf(scratch, "%s.%d", name, i)) };
+        scopes[i] = md_distinct(ops, ARRAY_COUNT(ops));
+    }
+
+    u32 id = LLVMLookupIntrinsicID("llvm.experimental.noalias.scope.decl", strlen("llvm.experimental.noalias.scope.decl"));
+    LLVMValueRef decl = LLVMGetIntrinsicDeclaration(llvm->module, id, nullptr, 0);
+    LLVMTypeRef decl_t = LLVMIntrinsicGetType(ctx, id, nullptr, 0);
+
+    DynamicArray<LLVMMetadataRef> others{ .alloc = scratch };
+    for (i32 i = 0; i < scopes.count; i++) {
+        if (!scopes[i]) continue;
+
+        others.count = 0;
+        for (i32 j = 0; j < scopes.count; j++) {
+            if (j != i && scopes[j]) array_add(&others, scopes[j]);
+        }
+
+        (*alias_scope)[i] = LLVMMetadataAsValue(ctx, LLVMMDNodeInContext2(ctx, &scopes[i], 1));
+        (*noalias)[i] = LLVMMetadataAsValue(ctx, LLVMMDNodeInContext2(ctx, others.data, others.count));
+
+        LLVMValueRef arg = (*alias_scope)[i];
+        LLVMBuildCall2(llvm->ir, decl_t, decl, &arg, 1, "");
+    }
+}
+
+// NOTE(jesper): the captured variables are stored to a context on the stack, which the task the
+// runtime calls loads them back from before calling the outlined body with the range it's given
+void llvm_codegen_parallel_for(
+    LLVMIR *llvm,
+    IrInst *inst,
+    LLVMValueRef start, LLVMValueRef end,
+    Array<LLVMValueRef> args,
+    LLVMBasicBlockRef entry)
+{
+    SArena scratch = tl_scratch_arena();
+    LLVMContextRef ctx = llvm->context;
+
+    IrProc *body = &llvm->source->procs[inst->proc];
+    LLVMProc *callee = &llvm->procedures[inst->proc];
+
+    LLVMTypeRef ptr_t = LLVMPointerTypeInContext(ctx, 0);
+    LLVMTypeRef i64_t = LLVMInt64TypeInContext(ctx);
+    LLVMTypeRef void_t = LLVMVoidTypeInContext(ctx);
+
+    Array<LLVMTypeRef> capture_types = array_create<LLVMTypeRef>(args.count, scratch);
+    for (i32 i = 0; i < args.count; i++) capture_types[i] = llvm_type_from_type_expr(ctx, body->params[i]);
+    LLVMTypeRef context_t = LLVMStructTypeInContext(ctx, capture_types.data, capture_types.count, false);
+
+    LLVMBasicBlockRef insert_block = LLVMGetInsertBlock(llvm->ir);
+
+    LLVMTypeRef task_params[] = { ptr_t, i64_t, i64_t };
+    LLVMTypeRef task_t = LLVMFunctionType(void_t, task_params, ARRAY_COUNT(task_params), false);
+    LLVMValueRef task = LLVMAddFunction(llvm->module, sztringf(scratch, "%.*s.task", STRFMT(body->name)), task_t);
+    LLVMSetLinkage(task, LLVMInternalLinkage);
+    llvm_set_target_attributes(llvm, task);
+
+    LLVMPositionBuilderAtEnd(llvm->ir, LLVMAppendBasicBlockInContext(ctx, task, "entry"));
+
+    Array<LLVMValueRef> body_args = array_create<LLVMValueRef>(body->params.count, scratch);
+    for (i32 i = 0; i < args.count; i++) {
+        LLVMValueRef ptr = LLVMBuildStructGEP2(llvm->ir, context_t, LLVMGetParam(task, 0), i, "");
+        body_args[i] = LLVMBuildLoad2(llvm->ir, capture_types[i], ptr, "");
+    }
+    body_args[args.count] = LLVMGetParam(task, 1);
+    body_args[args.count+1] = LLVMGetParam(task, 2);
+
+    LLVMValueRef call = LLVMBuildCall2(llvm->ir, callee->func_t, callee->func, body_args.data, body_args.count, "");
+    LLVMSetInstructionCallConv(call, LLVMGetFunctionCallConv(callee->func));
+    LLVMBuildRetVoid(llvm->ir);
+
+    // NOTE(jesper): the context is allocated in the entry block with the locals, so that a
+    // parallel loop nested in a sequential one doesn't grow the stack every iteration
+    if (LLVMValueRef first = LLVMGetFirstInstruction(entry); first) LLVMPositionBuilderBefore(llvm->ir, first);
+    else LLVMPositionBuilderAtEnd(llvm->ir, entry);
+    LLVMValueRef context = LLVMBuildAlloca(llvm->ir, context_t, "parallel.ctx");
+
+    LLVMPositionBuilderAtEnd(llvm->ir, insert_block);
+    for (i32 i = 0; i < args.count; i++) {
+        LLVMBuildStore(llvm->ir, args[i], LLVMBuildStructGEP2(llvm->ir, context_t, context, i, ""));
+    }
+
+    LLVMTypeRef runtime_params[] = { ptr_t, ptr_t, i64_t, i64_t, i64_t };
+    LLVMTypeRef runtime_t = LLVMFunctionType(void_t, runtime_params, ARRAY_COUNT(runtime_params), false);
+    LLVMValueRef runtime = LLVMGetNamedFunction(llvm->module, "tir_parallel_for");
+    if (!runtime) runtime = LLVMAddFunction(llvm->module, "tir_parallel_for", runtime_t);
+
+    LLVMValueRef runtime_args[] = {
+        task, context,
+        start, end,
+        LLVMConstInt(i64_t, inst->grain_size, false),
+    };
+    LLVMBuildCall2(llvm->ir, runtime_t, runtime, runtime_args, ARRAY_COUNT(runtime_args), "");
+}
+
+bool llvm_codegen_proc(LLVMIR *llvm, i32 index)
+{
+    SArena scratch = tl_scratch_arena();
+
+    IrProc *proc = &llvm->source->procs[index];
+    LLVMProc *dst = &llvm->procedures[index];
+
+    llvm_set_target_attributes(llvm, dst->func);
+    if (llvm->linkage.count > 0 && llvm->linkage[index] == LINKAGE_INTERNAL) {
+        LLVMSetLinkage(dst->func, LLVMInternalLinkage);
+    }
+
+    Array<LLVMBasicBlockRef> blocks = array_create<LLVMBasicBlockRef>(proc->blocks.count, scratch);
+    for (i32 i = 0; i < blocks.count; i++) {
+        blocks[i] = LLVMAppendBasicBlockInContext(llvm->context, dst->func, i == 0 ? "entry" : "");
+    }
+
+    Array<LLVMValueRef> regs = array_create<LLVMValueRef>(proc->regs.count, scratch);
+    for (auto &it : regs) it = nullptr;
+
+    Array<LLVMValueRef> locals = array_create<LLVMValueRef>(proc->locals.count, scratch);
+    Array<LLVMTypeRef> local_types = array_create<LLVMTypeRef>(proc->locals.count, scratch);
+
+    LLVMPositionBuilderAtEnd(llvm->ir, blocks[0]);
+    for (i32 i = 0; i < locals.count; i++) {
+        local_types[i] = llvm_type_from_type_expr(llvm->context, proc->locals[i].type);
+        locals[i] = LLVMBuildAlloca(llvm->ir, local_types[i], sz_string(proc->locals[i].name, scratch));
+
+        // NOTE(jesper): fields are accessed with the offsets the front-end computed, so LLVM's
+        // layout of the struct has to agree with it
+        if (TypeExpr type = proc->locals[i].type; type == T_STRUCT && type.elems >= 0) {
+            StructType *st = type.struct_type;
+
+            u64 size = st->size;
+            if (type.elems > 0 && st->soa) {
+                StructField &last = st->fields[st->fields.count-1];
+                size = (u64)(last.soa_offset + type_size(last.type))*type.elems;
+            } else if (type.elems > 0) {
+                size *= type.elems;
+            }
+
+            PANIC_IF(LLVMABISizeOfType(llvm->data_layout, local_types[i]) != size,
+                     "LLVM layout of '%.*s' doesn't match its declaration, %llu bytes instead of %llu",
+                     STRFMT(st->identifier.str),
+                     LLVMABISizeOfType(llvm->data_layout, local_types[i]), size);
+            LLVMSetAlignment(locals[i], st->alignment);
+        }
+    }
+
+    // NOTE(jesper): see ir_profile_counters for the layout of the counters, the ones of the
+    // instrumented procedures are private to the unit and handed to the runtime by the unit's
+    // constructor, see llvm_codegen_profile_register
+    u32 prof_kind = LLVMGetMDKindIDInContext(llvm->context, "prof", strlen("prof"));
+    LLVMTypeRef i32_t = LLVMInt32TypeInContext(llvm->context);
+
+    i32 counter_count = 0;
+    Array<i32> first_counter{};
+    if (llvm->profile_path || proc->profile.count > 0) first_counter = ir_profile_counters(proc, scratch, &counter_count);
+
+    if (llvm->profile_path) {
+        LLVMTypeRef counters_t = LLVMArrayType(LLVMInt64TypeInContext(llvm->context), counter_count);
+        LLVMValueRef counters = LLVMAddGlobal(llvm->module, counters_t, sztringf(scratch, "__tir_profile.%.*s", STRFMT(proc->name)));
+        LLVMSetInitializer(counters, LLVMConstNull(counters_t));
+        LLVMSetLinkage(counters, LLVMPrivateLinkage);
+        LLVMSetAlignment(counters, 8);
+
+        llvm->profile_counters[index] = counters;
+        llvm_codegen_profile_increment(llvm, index, LLVMConstInt(i32_t, 0, false));
+    }
+
+    if (proc->profile.count > 0) {
+        LLVMMetadataRef entry_count[] = {
+            LLVMMDStringInContext2(llvm->context, "function_entry_count", strlen("function_entry_count")),
+            LLVMValueAsMetadata(LLVMConstInt(LLVMInt64TypeInContext(llvm->context), proc->profile[0], false)),
+        };
+        LLVMGlobalSetMetadata(dst->func, prof_kind, LLVMMDNodeInContext2(llvm->context, entry_count, ARRAY_COUNT(entry_count)));
+    }
+
+    Array<i32> restrict_param{};
+    Array<LLVMValueRef> alias_scope, noalias;
+    for (bool it : proc->noalias) {
+        if (!it) continue;
+
+        restrict_param = llvm_restrict_provenance(proc, scratch);
+        llvm_alias_scopes(llvm, proc, &alias_scope, &noalias, scratch);
+        break;
+    }
+
+    u32 alias_scope_kind = LLVMGetMDKindIDInContext(llvm->context, "alias.scope", strlen("alias.scope"));
+    u32 noalias_kind = LLVMGetMDKindIDInContext(llvm->context, "noalias", strlen("noalias"));
+    auto set_alias_metadata = [&](LLVMValueRef access, i32 ptr_reg)
+    {
+        if (restrict_param.count == 0 || restrict_param[ptr_reg] == IR_NONE) return;
+        LLVMSetMetadata(access, alias_scope_kind, alias_scope[restrict_param[ptr_reg]]);
+        LLVMSetMetadata(access, noalias_kind, noalias[restrict_param[ptr_reg]]);
+    };
+
+    // NOTE(jesper): values are used directly in the blocks they dominate, so the blocks are
+    // generated in reverse postorder to have every value generated before its uses. The incoming
+    // values of phis can come from anywhere and are added once every block has been generated,
+    // from the block each predecessor ends up ending in after bounds checks have split it
+    Array<i32> order = ir_reverse_postorder(proc, scratch);
+    Array<LLVMBasicBlockRef> block_ends = array_create<LLVMBasicBlockRef>(proc->blocks.count, scratch);
+    DynamicArray<IrInst*> phis{ .alloc = scratch };
+
+    LLVMBasicBlockRef trap_block = nullptr;
+    for (i32 bi : order) {
+        LLVMPositionBuilderAtEnd(llvm->ir, blocks[bi]);
+
+        for (IrInst &inst : proc->blocks[bi].insts) {
+            if (ir_is_terminator(inst.op)) block_ends[bi] = LLVMGetInsertBlock(llvm->ir);
+
+            switch (inst.op) {
+            case IR_NOP:
+                break;
+            case IR_PHI:
+                regs[inst.dst] = LLVMBuildPhi(llvm->ir, llvm_type_from_type_expr(llvm->context, proc->regs[inst.dst]), "");
+                array_add(&phis, &inst);
+                break;
+            case IR_CONST:
+                regs[inst.dst] = llvm_codegen_const(llvm, proc->regs[inst.dst], &inst);
+                break;
+            case IR_COPY:
+                regs[inst.dst] = regs[inst.a];
+                break;
+            case IR_EXTEND: {
+                LLVMTypeRef type = llvm_type_from_type_expr(llvm->context, proc->regs[inst.dst]);
+                regs[inst.dst] = proc->regs[inst.a] == T_SIGNED
+                    ? LLVMBuildSExt(llvm->ir, regs[inst.a], type, "")
+                    : LLVMBuildZExt(llvm->ir, regs[inst.a], type, "");
+                } break;
+            case IR_PARAM:
+                regs[inst.dst] = LLVMGetParam(dst->func, inst.param);
+                break;
+
+            case IR_ADD:
+            case IR_SUB:
+            case IR_MUL:
+            case IR_DIV:
+                regs[inst.dst] = llvm_codegen_arith(llvm, inst.op, proc->regs[inst.dst], regs[inst.a], regs[inst.b]);
+                break;
+            case IR_EQ:
+            case IR_NE:
+            case IR_LT:
+            case IR_LE:
+            case IR_GT:
+            case IR_GE:
+                regs[inst.dst] = llvm_codegen_compare(llvm, inst.op, proc->regs[inst.a], regs[inst.a], regs[inst.b]);
+                break;
+
+            case IR_LOAD: {
+                char *name = sz_string(proc->locals[inst.local].name, scratch);
+                regs[inst.dst] = LLVMBuildLoad2(llvm->ir, local_types[inst.local], locals[inst.local], name);
+                } break;
+            case IR_STORE:
+                LLVMBuildStore(llvm->ir, regs[inst.a], locals[inst.local]);
+                break;
+            case IR_CALL: {
+                LLVMProc *callee = &llvm->procedures[inst.proc];
+
+                Array<LLVMValueRef> args = array_create<LLVMValueRef>(inst.arg_count, scratch);
+                for (i32 i = 0; i < args.count; i++) args[i] = regs[proc->args[inst.args + i]];
+
+                LLVMValueRef ret = LLVMBuildCall2(llvm->ir, callee->func_t, callee->func, args.data, args.count, "");
+                LLVMSetInstructionCallConv(ret, LLVMGetFunctionCallConv(callee->func));
+                if (inst.dst != IR_NONE) regs[inst.dst] = ret;
+                } break;
+            case IR_RET:
+                if (inst.a != IR_NONE) LLVMBuildRet(llvm->ir, regs[inst.a]);
+                else LLVMBuildRetVoid(llvm->ir);
+                break;
+            case IR_JUMP: {
+                LLVMValueRef br = LLVMBuildBr(llvm->ir, blocks[inst.target]);
+
+                for (IrLoop &loop : proc->loops) {
+                    if (loop.latch != bi || loop.header != inst.target) continue;
+                    if (LLVMMetadataRef md = llvm_loop_metadata(llvm, loop.hints); md) {
+                        LLVMSetMetadata(br, LLVMGetMDKindIDInContext(llvm->context, "llvm.loop", 9), LLVMMetadataAsValue(llvm->context, md));
+                    }
+                }
+                } break;
+            case IR_BRANCH: {
+                i32 first = first_counter.count > 0 ? first_counter[bi] : IR_NONE;
+                if (llvm->profile_path) {
+                    LLVMValueRef counter = LLVMBuildSelect(
+                        llvm->ir, regs[inst.a],
+                        LLVMConstInt(i32_t, first, false), LLVMConstInt(i32_t, first+1, false), "");
+                    llvm_codegen_profile_increment(llvm, index, counter);
+                }
+
+                LLVMValueRef br = LLVMBuildCondBr(llvm->ir, regs[inst.a], blocks[inst.target], blocks[inst.target_else]);
+                if (proc->profile.count > 0) {
+                    LLVMSetMetadata(br, prof_kind, LLVMMetadataAsValue(llvm->context, llvm_branch_weights(llvm, &proc->profile[first], 2)));
+                }
+                } break;
+            case IR_SWITCH: {
+                LLVMTypeRef type = LLVMTypeOf(regs[inst.a]);
+                i32 first = first_counter.count > 0 ? first_counter[bi] : IR_NONE;
+
+                // NOTE(jesper): the counter of the case taken is selected by comparing against
+                // each of them, instrumented builds are allowed to be slow
+                if (llvm->profile_path) {
+                    LLVMValueRef counter = LLVMConstInt(i32_t, first + inst.case_count, false);
+                    for (i32 i = 0; i < inst.case_count; i++) {
+                        IrSwitchCase &it = proc->switch_cases[inst.cases + i];
+                        LLVMValueRef is_case = LLVMBuildICmp(
+                            llvm->ir, LLVMIntEQ,
+                            regs[inst.a], LLVMConstInt(type, (u64)it.value, proc->regs[inst.a] == T_SIGNED), "");
+                        counter = LLVMBuildSelect(llvm->ir, is_case, LLVMConstInt(i32_t, first + i, false), counter, "");
+                    }
+                    llvm_codegen_profile_increment(llvm, index, counter);
+                }
+
+                LLVMValueRef sw = LLVMBuildSwitch(llvm->ir, regs[inst.a], blocks[inst.target_else], inst.case_count);
+                for (i32 i = 0; i < inst.case_count; i++) {
+                    IrSwitchCase &it = proc->switch_cases[inst.cases + i];
+                    LLVMAddCase(sw, LLVMConstInt(type, (u64)it.value, proc->regs[inst.a] == T_SIGNED), blocks[it.target]);
+                }
+
+                // NOTE(jesper): the default comes first in the weights of a switch, it's last
+                // in the counters
+                if (proc->profile.count > 0) {
+                    Array<u64> counts = array_create<u64>(inst.case_count+1, scratch);
+                    counts[0] = proc->profile[first + inst.case_count];
+                    for (i32 i = 0; i < inst.case_count; i++) counts[i+1] = proc->profile[first + i];
+                    LLVMSetMetadata(sw, prof_kind, LLVMMetadataAsValue(llvm->context, llvm_branch_weights(llvm, counts.data, counts.count)));
+                }
+                } break;
+
+            case IR_VECTOR: {
+                Array<LLVMValueRef> elems = array_create<LLVMValueRef>(inst.arg_count, scratch);
+                for (i32 i = 0; i < elems.count; i++) elems[i] = regs[proc->args[inst.args + i]];
+                regs[inst.dst] = llvm_codegen_vector(llvm, proc->regs[inst.dst], elems.data, elems.count);
+                } break;
+            case IR_EXTRACT: {
+                LLVMValueRef lane = LLVMConstInt(LLVMInt32TypeInContext(llvm->context), inst.lane, false);
+                regs[inst.dst] = LLVMBuildExtractElement(llvm->ir, regs[inst.a], lane, "");
+                } break;
+            case IR_SHUFFLE:
+                regs[inst.dst] = llvm_codegen_shuffle(llvm, proc->regs[inst.dst], regs[inst.a], inst.mask);
+                break;
+            case IR_REDUCE_ADD:
+            case IR_REDUCE_MUL:
+            case IR_REDUCE_MIN:
+            case IR_REDUCE_MAX:
+                regs[inst.dst] = llvm_codegen_reduce(llvm, inst.op, proc->regs[inst.a], regs[inst.a]);
+                break;
+
+            case IR_SLICE: {
+                LLVMTypeRef slice_t = llvm_type_from_type_expr(llvm->context, proc->regs[inst.dst]);
+                LLVMValueRef count = LLVMConstInt(LLVMInt64TypeInContext(llvm->context), proc->locals[inst.local].type.elems, false);
+
+                LLVMValueRef slice = LLVMBuildInsertValue(llvm->ir, LLVMGetUndef(slice_t), locals[inst.local], 0, "");
+                regs[inst.dst] = LLVMBuildInsertValue(llvm->ir, slice, count, 1, "");
+                } break;
+            case IR_GLOBAL: {
+                LLVMTypeRef slice_t = llvm_type_from_type_expr(llvm->context, proc->regs[inst.dst]);
+                LLVMValueRef count = LLVMConstInt(LLVMInt64TypeInContext(llvm->context), llvm->source->globals[inst.global].type.elems, false);
+
+                LLVMValueRef slice = LLVMBuildInsertValue(llvm->ir, LLVMGetUndef(slice_t), llvm->globals[inst.global], 0, "");
+                regs[inst.dst] = LLVMBuildInsertValue(llvm->ir, slice, count, 1, "");
+                } break;
+            case IR_COUNT:
+                regs[inst.dst] = LLVMBuildExtractValue(llvm->ir, regs[inst.a], 1, "");
+                break;
+            case IR_INDEX: {
+                LLVMValueRef ptr = llvm_codegen_element_ptr(llvm, proc->regs[inst.a], regs[inst.a], proc->regs[inst.b], regs[inst.b], inst.field);
+                regs[inst.dst] = LLVMBuildLoad2(llvm->ir, llvm_type_from_type_expr(llvm->context, proc->regs[inst.dst]), ptr, "");
+                set_alias_metadata(regs[inst.dst], inst.a);
+                } break;
+            case IR_INDEX_STORE: {
+                LLVMValueRef ptr = llvm_codegen_element_ptr(llvm, proc->regs[inst.a], regs[inst.a], proc->regs[inst.b], regs[inst.b], inst.field);
+                set_alias_metadata(LLVMBuildStore(llvm->ir, regs[inst.value], ptr), inst.a);
+                } break;
+            case IR_FIELD:
+                regs[inst.dst] = LLVMBuildExtractValue(llvm->ir, regs[inst.a], inst.field, "");
+                break;
+            case IR_INSERT_FIELD:
+                regs[inst.dst] = LLVMBuildInsertValue(llvm->ir, regs[inst.a], regs[inst.b], inst.field, "");
+                break;
+            case IR_BOUNDS_CHECK:
+                llvm_codegen_bounds_check(llvm, dst->func, &trap_block, proc->regs[inst.a], regs[inst.a], regs[inst.b]);
+                break;
+
+            case IR_ADDR:
+                regs[inst.dst] = locals[inst.local];
+                break;
+            case IR_INDEX_ADDR:
+                regs[inst.dst] = llvm_codegen_element_ptr(llvm, proc->regs[inst.a], regs[inst.a], proc->regs[inst.b], regs[inst.b], inst.field);
+                break;
+            case IR_PTR_LOAD:
+                regs[inst.dst] = LLVMBuildLoad2(llvm->ir, llvm_type_from_type_expr(llvm->context, proc->regs[inst.dst]), regs[inst.a], "");
+                set_alias_metadata(regs[inst.dst], inst.a);
+                break;
+            case IR_PTR_STORE:
+                set_alias_metadata(LLVMBuildStore(llvm->ir, regs[inst.b], regs[inst.a]), inst.a);
+                break;
+
+            // NOTE(jesper): the loads and stores are aligned to the ABI alignment of their type,
+            // which is their size for every type atomics are allowed on
+            case IR_ATOMIC_LOAD: {
+                LLVMTypeRef type = llvm_type_from_type_expr(llvm->context, proc->regs[inst.dst]);
+                regs[inst.dst] = LLVMBuildLoad2(llvm->ir, type, regs[inst.a], "");
+                LLVMSetOrdering(regs[inst.dst], llvm_atomic_ordering(inst.order));
+                set_alias_metadata(regs[inst.dst], inst.a);
+                } break;
+            case IR_ATOMIC_STORE: {
+                LLVMValueRef store = LLVMBuildStore(llvm->ir, regs[inst.b], regs[inst.a]);
+                LLVMSetOrdering(store, llvm_atomic_ordering(inst.order));
+                set_alias_metadata(store, inst.a);
+                } break;
+            case IR_ATOMIC_RMW:
+                regs[inst.dst] = LLVMBuildAtomicRMW(
+                    llvm->ir,
+                    llvm_atomic_rmw_op(inst.atomic_op, proc->regs[inst.dst]),
+                    regs[inst.a], regs[inst.b],
+                    llvm_atomic_ordering(inst.order), false);
+                set_alias_metadata(regs[inst.dst], inst.a);
+                break;
+            case IR_ATOMIC_CAS: {
+                // NOTE(jesper): the failure order can't release, it's the strongest one
+                // without doing so
+                LLVMAtomicOrdering failure = llvm_atomic_ordering(
+                    inst.order == ORDER_RELEASE ? ORDER_RELAXED :
+                    inst.order == ORDER_ACQ_REL ? ORDER_ACQUIRE :
+                    inst.order);
+
+                LLVMValueRef cas = LLVMBuildAtomicCmpXchg(
+                    llvm->ir,
+                    regs[inst.a], regs[inst.b], regs[inst.desired],
+                    llvm_atomic_ordering(inst.order), failure, false);
+                set_alias_metadata(cas, inst.a);
+                regs[inst.dst] = LLVMBuildExtractValue(llvm->ir, cas, 0, "");
+                } break;
+            case IR_FENCE:
+                LLVMBuildFence(llvm->ir, llvm_atomic_ordering(inst.order), false, "");
+                break;
+
+            case IR_PREFETCH:
+                llvm_codegen_intrinsic(llvm, &inst, regs[inst.a], nullptr);
+                break;
+            case IR_EXPECT:
+                // NOTE(jesper): the branch weights measured by a profile take precedence over
+                // #likely and #unlikely, lowering the expect would replace them
+                if (proc->profile.count > 0) regs[inst.dst] = regs[inst.a];
+                else regs[inst.dst] = llvm_codegen_intrinsic(llvm, &inst, regs[inst.a], nullptr);
+                break;
+            case IR_POPCOUNT:
+            case IR_CLZ:
+            case IR_CTZ:
+            case IR_BSWAP:
+            case IR_ROTL:
+            case IR_ROTR:
+                regs[inst.dst] = llvm_codegen_intrinsic(llvm, &inst, regs[inst.a], inst.b != IR_NONE ? regs[inst.b] : nullptr);
+                break;
+
+            case IR_PARALLEL_FOR: {
+                Array<LLVMValueRef> args = array_create<LLVMValueRef>(inst.arg_count, scratch);
+                for (i32 i = 0; i < args.count; i++) args[i] = regs[proc->args[inst.args + i]];
+                llvm_codegen_parallel_for(llvm, &inst, regs[inst.a], regs[inst.b], args, blocks[0]);
+                } break;
+            }
+        }
+    }
+
+    for (IrInst *phi : phis) {
+        for (i32 i = 0; i < phi->incoming_count; i++) {
+            IrPhiIncoming &it = proc->phi_incoming[phi->incoming + i];
+            LLVMAddIncoming(regs[phi->dst], &regs[it.value], &block_ends[it.block], 1);
+        }
+    }
+
+    return true;
+}
+
+LLVMValueRef llvm_codegen_cstring(LLVMIR *llvm, const char *str)
+{
+    LLVMValueRef init = LLVMConstStringInContext(llvm->context, str, strlen(str), false);
+    LLVMValueRef value = LLVMAddGlobal(llvm->module, LLVMTypeOf(init), "");
+    LLVMSetInitializer(value, init);
+    LLVMSetGlobalConstant(value, true);
+    LLVMSetLinkage(value, LLVMPrivateLinkage);
+    LLVMSetUnnamedAddress(value, LLVMGlobalUnnamedAddr);
+    return value;
+}
+
+// NOTE(jesper): the constructor of an instrumented unit, which registers the counters of the
+// procedures it defines with the runtime. Linked programs run it through llvm.global_ctors, and
+// in run mode jit_run calls it by name, nothing runs the constructors of objects loaded into the
+// JIT
+void llvm_codegen_profile_register(LLVMIR *llvm, i32 unit)
+{
+    SArena scratch = tl_scratch_arena();
+    LLVMContextRef ctx = llvm->context;
+
+    LLVMTypeRef ptr_t = LLVMPointerTypeInContext(ctx, 0);
+    LLVMTypeRef i32_t = LLVMInt32TypeInContext(ctx);
+    LLVMTypeRef i64_t = LLVMInt64TypeInContext(ctx);
+    LLVMTypeRef void_t = LLVMVoidTypeInContext(ctx);
+
+    // NOTE(jesper): TirProfileProc
+    LLVMTypeRef fields[] = { ptr_t, ptr_t, i64_t, i32_t };
+    LLVMTypeRef proc_t = LLVMStructTypeInContext(ctx, fields, ARRAY_COUNT(fields), false);
+
+    DynamicArray<LLVMValueRef> procs{ .alloc = scratch };
+    for (i32 i = 0; i < llvm->profile_counters.count; i++) {
+        LLVMValueRef counters = llvm->profile_counters[i];
+        if (!counters) continue;
+
+        IrProc *proc = &llvm->source->procs[i];
+        LLVMValueRef values[] = {
+            llvm_codegen_cstring(llvm, sz_string(proc->name, scratch)),
+            counters,
+            LLVMConstInt(i64_t, LLVMGetArrayLength(LLVMGlobalGetValueType(counters)), false),
+            LLVMConstInt(i32_t, ir_profile_checksum(proc), false),
+        };
+        array_add(&procs, LLVMConstStructInContext(ctx, values, ARRAY_COUNT(values), false));
+    }
+
+    LLVMValueRef table_init = LLVMConstArray(proc_t, procs.data, procs.count);
+    LLVMValueRef table = LLVMAddGlobal(llvm->module, LLVMTypeOf(table_init), "__tir_profile_procs");
+    LLVMSetInitializer(table, table_init);
+    LLVMSetGlobalConstant(table, true);
+    LLVMSetLinkage(table, LLVMPrivateLinkage);
+
+    LLVMTypeRef init_t = LLVMFunctionType(void_t, nullptr, 0, false);
+    LLVMValueRef init = LLVMAddFunction(llvm->module, sztringf(scratch, "__tir_profile_init.%d", unit), init_t);
+    LLVMSetVisibility(init, LLVMHiddenVisibility);
+    llvm_set_target_attributes(llvm, init);
+
+    LLVMTypeRef register_params[] = { ptr_t, ptr_t, i64_t };
+    LLVMTypeRef register_t = LLVMFunctionType(void_t, register_params, ARRAY_COUNT(register_params), false);
+    LLVMValueRef runtime = LLVMAddFunction(llvm->module, "tir_profile_register", register_t);
+
+    LLVMPositionBuilderAtEnd(llvm->ir, LLVMAppendBasicBlockInContext(ctx, init, "entry"));
+    LLVMValueRef args[] = {
+        llvm_codegen_cstring(llvm, llvm->profile_path),
+        table,
+        LLVMConstInt(i64_t, procs.count, false),
+    };
+    LLVMBuildCall2(llvm->ir, register_t, runtime, args, ARRAY_COUNT(args), "");
+    LLVMBuildRetVoid(llvm->ir);
+
+    LLVMTypeRef ctor_fields[] = { i32_t, ptr_t, ptr_t };
+    LLVMValueRef ctor_values[] = { LLVMConstInt(i32_t, 65535, false), init, LLVMConstNull(ptr_t) };
+    LLVMValueRef ctor = LLVMConstStructInContext(ctx, ctor_values, ARRAY_COUNT(ctor_values), false);
+    LLVMValueRef ctors_init = LLVMConstArray(LLVMStructTypeInContext(ctx, ctor_fields, ARRAY_COUNT(ctor_fields), false), &ctor, 1);
+
+    LLVMValueRef ctors = LLVMAddGlobal(llvm->module, LLVMTypeOf(ctors_init), "llvm.global_ctors");
+    LLVMSetInitializer(ctors, ctors_init);
+    LLVMSetLinkage(ctors, LLVMAppendingLinkage);
+}
+
+enum OutputType : i32 {
+    OUTPUT_EXECUTABLE,
+    OUTPUT_OBJECT,
+
+    // NOTE(jesper): nothing is written to disk, the objects are loaded into an in-process
+    // JIT and main is called directly
+    OUTPUT_RUN,
+};
+
+enum Linker : i32 {
+    LINKER_BUILTIN,
+    LINKER_CLANG,
+};
+
+enum Backend : i32 {
+    // NOTE(jesper): the fast backend at -O0 when targeting x86-64 ELF, LLVM otherwise
+    BACKEND_AUTO,
+    BACKEND_LLVM,
+    BACKEND_FAST,
+
+    // NOTE(jesper): run mode only, the IR is interpreted without initialising LLVM
+    BACKEND_BYTECODE,
+
+    // NOTE(jesper): run mode only, the IR is interpreted and procedures that get hot are
+    // compiled at -O2 on a background thread, replacing the interpreted versions once done
+    BACKEND_TIERED,
+};
+
+struct {
+    OutputType out_type;
+    Linker linker;
+    Backend backend;
+    i32 opt_level;
+    i32 codegen_units = 1;
+
+    char *target_cpu = (char*)"generic";
+    char *target_features = (char*)"";
+    u32 fp_math;
+    bool bounds_checks = true;
+
+    // NOTE(jesper): the file instrumented programs write their profile to, and the profile the
+    // program is optimised with. nullptr when not given
+    char *profile_generate;
+    char *profile_use;
+
+    DynamicArray<char*> libraries;
+
+    bool use_cache = true;
+    bool print_cache_stats;
+    u64 cache_size = 512*MiB;
+
+    u32 tier_threshold = 1000;
+} opts;
+
+struct CodegenUnit {
+    i32 index;
+    IrModule *ir;
+
+    DynamicArray<i32> procedures;
+    i32 cost;
+    i32 opt_level;
+
+    // NOTE(jesper): shared by the units of a partition, empty for units whose procedures have
+    // to be callable by name and with the C calling convention, like the tiered backend's
+    Array<ProcLinkage> linkage;
+
+    LLVMTargetRef target;
+    const char *target_triple;
+
+    LLVMMemoryBufferRef object;
+};
+
+bool llvm_check_error(LLVMErrorRef err, const char *what)
+{
+    if (!err) return true;
+
+    char *msg = LLVMGetErrorMessage(err);
+    LOG_ERROR("%s: %s", what, msg);
+    LLVMDisposeErrorMessage(msg);
+    return false;
+}
+
+LLVMCodeGenOptLevel llvm_codegen_opt_level(i32 opt_level)
+{
+    switch (opt_level) {
+    case 0:  return LLVMCodeGenLevelNone;
+    case 1:  return LLVMCodeGenLevelLess;
+    case 2:  return LLVMCodeGenLevelDefault;
+    default: return LLVMCodeGenLevelAggressive;
+    }
+}
+
+Array<CodegenUnit> partition_codegen_units(IrModule *ir, i32 max_units, Allocator mem)
+{
+    SArena scratch = tl_scratch_arena(mem);
+
+    DynamicArray<i32> procs{ .alloc = scratch };
+    DynamicArray<i32> costs{ .alloc = scratch };
+
+    for (i32 i = 0; i < ir->procs.count; i++) {
+        if (!ir->procs[i].defined) continue;
+        array_add(&procs, i);
+        array_add(&costs, 1 + ir_inst_count(&ir->procs[i]));
+    }
+
+    i32 count = CLAMP(max_units, 1, MAX(procs.count, 1));
+    Array<CodegenUnit> units = array_create<CodegenUnit>(count, mem);
+    for (i32 i = 0; i < count; i++) units[i] = { .index = i, .ir = ir, .opt_level = opts.opt_level };
+
+    // NOTE(jesper): longest processing time first; the most expensive procedures are assigned
+    // first, each to the unit with the least amount of work so far
+    quick_sort_desc(costs, procs);
+
+    Array<i32> proc_units = array_create<i32>(ir->procs.count, scratch);
+    for (i32 i = 0; i < procs.count; i++) {
+        CodegenUnit *unit = &units[0];
+        for (auto &it : units) if (it.cost < unit->cost) unit = &it;
+
+        array_add(&unit->procedures, procs[i]);
+        unit->cost += costs[i];
+        proc_units[procs[i]] = unit->index;
+    }
+
+    Array<ProcLinkage> linkage = array_create<ProcLinkage>(ir->procs.count, mem);
+    for (i32 i = 0; i < ir->procs.count; i++) {
+        IrProc *proc = &ir->procs[i];
+        linkage[i] = proc->defined && !proc->exported ? LINKAGE_INTERNAL : LINKAGE_EXTERNAL;
+    }
+
+    for (i32 i : procs) {
+        for (IrBlock &block : ir->procs[i].blocks) {
+            for (IrInst &inst : block.insts) {
+                if (inst.op != IR_CALL && inst.op != IR_PARALLEL_FOR) continue;
+                if (linkage[inst.proc] != LINKAGE_INTERNAL) continue;
+                if (proc_units[inst.proc] != proc_units[i]) linkage[inst.proc] = LINKAGE_HIDDEN;
+            }
+        }
+    }
+
+    for (auto &it : units) it.linkage = linkage;
+    return units;
+}
+
+LLVMMemoryBufferRef llvm_codegen_unit(CodegenUnit *unit)
+{
+    SArena scratch = tl_scratch_arena();
+
+    LLVMIR llvm{};
+    llvm.context = LLVMContextCreate();
+    llvm.module = LLVMModuleCreateWithNameInContext(sztringf(scratch, "tir.%d", unit->index), llvm.context);
+    llvm.ir = LLVMCreateBuilderInContext(llvm.context);
+    llvm.target_cpu = opts.target_cpu;
+    llvm.target_features = opts.target_features;
+    llvm.fp_math = opts.fp_math;
+    llvm.profile_path = opts.profile_generate;
+
+    defer {
+        LLVMDisposeBuilder(llvm.ir);
+        LLVMDisposeModule(llvm.module);
+        LLVMContextDispose(llvm.context);
+    };
+
+    // NOTE(jesper): the data layout is set up front so that codegen can query the size of types
+    LLVMTargetMachineRef target_machine = LLVMCreateTargetMachine(
+        unit->target,
+        unit->target_triple, opts.target_cpu, opts.target_features,
+        llvm_codegen_opt_level(unit->opt_level),
+        LLVMRelocPIC,
+        LLVMCodeModelDefault);
+    defer { LLVMDisposeTargetMachine(target_machine); };
+
+    LLVMSetTarget(llvm.module, unit->target_triple);
+
+    llvm.data_layout = LLVMCreateTargetDataLayout(target_machine);
+    defer { LLVMDisposeTargetData(llvm.data_layout); };
+    LLVMSetModuleDataLayout(llvm.module, llvm.data_layout);
+
+    // NOTE(jesper): the summary decides which procedures are hot before they're declared
+    llvm.source = unit->ir;
+    llvm_profile_summary(&llvm);
+
+    // NOTE(jesper): every procedure is declared in every unit, calls to procedures defined in
+    // other units are resolved when the unit objects are linked together
+    llvm.linkage = unit->linkage;
+    llvm.procedures = array_create<LLVMProc>(unit->ir->procs.count, scratch);
+    for (i32 i = 0; i < unit->ir->procs.count; i++) llvm_codegen_proc_decl(&llvm, i);
+
+    llvm.globals = array_create<LLVMValueRef>(unit->ir->globals.count, scratch);
+    for (i32 i = 0; i < unit->ir->globals.count; i++) llvm_codegen_global(&llvm, i);
+
+    if (llvm.profile_path) {
+        llvm.profile_counters = array_create<LLVMValueRef>(unit->ir->procs.count, scratch);
+        for (auto &it : llvm.profile_counters) it = nullptr;
+    }
+
+    for (i32 i : unit->procedures) {
+        if (!llvm_codegen_proc(&llvm, i)) return nullptr;
+    }
+
+    if (llvm.profile_path) llvm_codegen_profile_register(&llvm, unit->index);
+
+    // NOTE(jesper): record the target in the object's .comment section, so that it's
+    // possible to tell which cpu and features an object was generated for
+    char *ident = sztringf(scratch, "tir (target-cpu=%s target-features=%s)", opts.target_cpu, opts.target_features);
+    LLVMMetadataRef ident_md = LLVMMDStringInContext2(llvm.context, ident, strlen(ident));
+    LLVMAddNamedMetadataOperand(
+        llvm.module, "llvm.ident",
+        LLVMMetadataAsValue(llvm.context, LLVMMDNodeInContext2(llvm.context, &ident_md, 1)));
+
+    if (char *mod = LLVMPrintModuleToString(llvm.module); mod) {
+        LOG_INFO("Generated LLVM IR, unit %d:\n%s", unit->index, mod);
+        LLVMDisposeMessage(mod);
+    }
+
+    if (unit->opt_level > 0) {
+        LLVMPassBuilderOptionsRef pass_opts = LLVMCreatePassBuilderOptions();
+        defer { LLVMDisposePassBuilderOptions(pass_opts); };
+
+        char *passes = sztringf(scratch, "default<O%d>", unit->opt_level);
+        if (!llvm_check_error(LLVMRunPasses(llvm.module, passes, target_machine, pass_opts), "Failed to run optimisation passes"))
+            return nullptr;
+    }
+
+    char *sz_error = nullptr;
+    LLVMMemoryBufferRef buffer;
+    if (LLVMTargetMachineEmitToMemoryBuffer(
+            target_machine, llvm.module,
+            LLVMObjectFile,
+            &sz_error, &buffer) != 0)
+    {
+        LOG_ERROR("Failed to emit object file: %s", sz_error);
+        LLVMDisposeMessage(sz_error);
+        return nullptr;
+    }
+
+    return buffer;
+}
+
+i32 codegen_unit_thread_proc(void *user_data)
+{
+    CodegenUnit *unit = (CodegenUnit*)user_data;
+    unit->object = llvm_codegen_unit(unit);
+    return unit->object ? 0 : -1;
+}
+
+#if defined(__linux__)
+// NOTE(jesper): the first library of a GNU ld script's GROUP or INPUT command, leaving out the
+// ones it only links AS_NEEDED, or nullptr if the script isn't one
+char* ld_script_library(String script, Allocator mem)
+{
+    auto is_separator = [](char c) { return is_whitespace(c) || c == ',' || c == '(' || c == ')'; };
+
+    for (i32 i = 0; i < script.length; i++) {
+        String rest = slice(script, i);
+        if (!starts_with(rest, "GROUP") && !starts_with(rest, "INPUT")) continue;
+
+        i32 depth = 0;
+        i += 5;
+        while (i < script.length) {
+            char c = script[i];
+            if (c == '(') depth++;
+            if (c == ')' && --depth == 0) break;
+            if (is_separator(c)) {
+                i++;
+                continue;
+            }
+
+            if (depth == 0) break;
+
+            i32 start = i;
+            while (i < script.length && !is_separator(script[i])) i++;
+
+            String name = slice(script, start, i);
+            if (name == "AS_NEEDED") {
+                while (i < script.length && script[i] != ')') i++;
+                i++;
+            } else if (!starts_with(name, "-l")) {
+                return sz_string(name, mem);
+            }
+        }
+    }
+
+    return nullptr;
+}
+#endif
+
+char* shared_library_path(char *library, Allocator mem)
+{
+    if (strchr(library, '/') || strchr(library, '.')) return library;
+
+#if defined(_WIN32)
+    return sztringf(mem, "%s.dll", library);
+#elif defined(__linux__)
+    char *name = sztringf(mem, "lib%s.so", library);
+
+    // NOTE(jesper): lib<name>.so is the library the linker uses, which isn't always one the
+    // dynamic loader can load. glibc installs some of them, like libm.so, as ld scripts that
+    // refer to the versioned library, and that's loaded instead. The directories are searched
+    // in roughly the same order as the loader does
+    SArena scratch = tl_scratch_arena(mem);
+    DynamicArray<String> dirs{ .alloc = scratch };
+    if (char *env = getenv("LD_LIBRARY_PATH"); env) {
+        String paths = string(env);
+        for (i32 start = 0, end; start < paths.length; start = end+1) {
+            for (end = start; end < paths.length && paths[end] != ':'; end++);
+            if (end > start) array_add(&dirs, slice(paths, start, end));
+        }
+    }
+
+    for (const char *dir : { "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu", "/lib64", "/usr/lib64", "/lib", "/usr/lib" }) {
+        array_add(&dirs, string(dir));
+    }
+
+    for (String dir : dirs) {
+        char *path = join_path(sz_string(dir, scratch), name, scratch);
+        if (!file_exists_sz(path)) continue;
+
+        FileInfo f = read_file(string(path), scratch);
+        if (f.size >= 4 && memcmp(f.data, "\x7f" "ELF", 4) == 0) return name;
+
+        if (char *target = ld_script_library({ (char*)f.data, f.size }, mem); target) {
+            LOG_INFO("%s is an ld script, loading %s instead", path, target);
+            return target;
+        }
+
+        return name;
+    }
+
+    return name;
+#endif
+}
+
+bool llvm_init_target(LLVMTargetRef *target, char **target_triple)
+{
+    LLVMInitializeX86TargetInfo();
+    LLVMInitializeX86Target();
+    LLVMInitializeX86TargetMC();
+    LLVMInitializeX86AsmParser();
+    LLVMInitializeX86AsmPrinter();
+
+    char *sz_error = nullptr;
+    *target_triple = LLVMGetDefaultTargetTriple();
+
+    if (LLVMGetTargetFromTriple(*target_triple, target, &sz_error) != 0) {
+        LOG_ERROR("Failed to get target from triple '%s': %s", *target_triple, sz_error);
+        LLVMDisposeMessage(sz_error);
+        return false;
+    }
+
+    return true;
+}
+
+LLVMOrcLLJITRef jit_create()
+{
+    SArena scratch = tl_scratch_arena();
+
+    LLVMOrcLLJITRef jit;
+    if (!llvm_check_error(LLVMOrcCreateLLJIT(&jit, nullptr), "Failed to create JIT"))
+        return nullptr;
+
+    LLVMOrcJITDylibRef dylib = LLVMOrcLLJITGetMainJITDylib(jit);
+    char global_prefix = LLVMOrcLLJITGetGlobalPrefix(jit);
+
+    // NOTE(jesper): #foreign procedures are resolved from the listed libraries first, in the
+    // order they were given, and then from the symbols already loaded into the host process
+    for (char *library : opts.libraries) {
+        char *path = shared_library_path(library, scratch);
+
+        LLVMOrcDefinitionGeneratorRef generator;
+        LLVMErrorRef err = LLVMOrcCreateDynamicLibrarySearchGeneratorForPath(&generator, path, global_prefix, nullptr, nullptr);
+        if (!llvm_check_error(err, sztringf(scratch, "Failed to load library '%s'", path))) {
+            LLVMConsumeError(LLVMOrcDisposeLLJIT(jit));
+            return nullptr;
+        }
+
+        LLVMOrcJITDylibAddGenerator(dylib, generator);
+    }
+
+    LLVMOrcDefinitionGeneratorRef process_generator;
+    LLVMErrorRef err = LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(&process_generator, global_prefix, nullptr, nullptr);
+    if (!llvm_check_error(err, "Failed to create process symbol generator")) {
+        LLVMConsumeError(LLVMOrcDisposeLLJIT(jit));
+        return nullptr;
+    }
+
+    LLVMOrcJITDylibAddGenerator(dylib, process_generator);
+
+    // NOTE(jesper): the runtime library is linked into the compiler, so the programs are resolved
+    // against that instead of needing the library to be given
+    LLVMOrcCSymbolMapPair runtime_symbols[] = {
+        {
+            LLVMOrcLLJITMangleAndIntern(jit, "tir_parallel_for"),
+            { (LLVMOrcExecutorAddress)&tir_parallel_for, { LLVMJITSymbolGenericFlagsExported | LLVMJITSymbolGenericFlagsCallable, 0 } },
+        },
+        {
+            LLVMOrcLLJITMangleAndIntern(jit, "tir_profile_register"),
+            { (LLVMOrcExecutorAddress)&tir_profile_register, { LLVMJITSymbolGenericFlagsExported | LLVMJITSymbolGenericFlagsCallable, 0 } },
+        },
+    };
+
+    LLVMOrcMaterializationUnitRef runtime = LLVMOrcAbsoluteSymbols(runtime_symbols, ARRAY_COUNT(runtime_symbols));
+    if (!llvm_check_error(LLVMOrcJITDylibDefine(dylib, runtime), "Failed to define runtime symbols")) {
+        LLVMOrcDisposeMaterializationUnit(runtime);
+        LLVMConsumeError(LLVMOrcDisposeLLJIT(jit));
+        return nullptr;
+    }
+
+    return jit;
+}
+
+i32 jit_run(TypeExpr *main_ret, Array<LLVMMemoryBufferRef> objects)
+{
+    if (!main_ret) {
+        LOG_ERROR("No main procedure to run");
+        return -1;
+    }
+
+    LLVMOrcLLJITRef jit = jit_create();
+    if (!jit) return -1;
+    defer { LLVMConsumeError(LLVMOrcDisposeLLJIT(jit)); };
+
+    LLVMOrcJITDylibRef dylib = LLVMOrcLLJITGetMainJITDylib(jit);
+    for (LLVMMemoryBufferRef object : objects) {
+        LLVMErrorRef err = LLVMOrcLLJITAddObjectFile(jit, dylib, object);
+        if (!llvm_check_error(err, "Failed to add object to JIT"))
+            return -1;
+    }
+
+    LLVMOrcExecutorAddress main_addr;
+    if (!llvm_check_error(LLVMOrcLLJITLookup(jit, &main_addr, "main"), "Failed to look up main"))
+        return -1;
+
+    // NOTE(jesper): the constructors of the objects aren't run by the JIT, so the instrumented
+    // units are registered here, and the profile is written before the objects are unloaded
+    // rather than at exit
+    if (opts.profile_generate) {
+        SArena scratch = tl_scratch_arena();
+        for (i32 i = 0; i < objects.count; i++) {
+            LLVMOrcExecutorAddress init_addr;
+            LLVMErrorRef err = LLVMOrcLLJITLookup(jit, &init_addr, sztringf(scratch, "__tir_profile_init.%d", i));
+            if (!llvm_check_error(err, "Failed to look up profile constructor")) return -1;
+            ((void(*)())init_addr)();
+        }
+    }
+    defer { if (opts.profile_generate) tir_profile_dump(); };
+
+    TypeExpr ret_type = *main_ret;
+    if (ret_type == T_FLOAT) {
+        if (ret_type.size == 4) return (i32)((f32(*)())main_addr)();
+        return (i32)((f64(*)())main_addr)();
+    }
+
+    switch (ret_type.size) {
+    case 0: ((void(*)())main_addr)(); return 0;
+    case 1: return ((i8(*)())main_addr)();
+    case 2: return ((i16(*)())main_addr)();
+    case 4: return ((i32(*)())main_addr)();
+    case 8: return (i32)((i64(*)())main_addr)();
+    }
+
+    PANIC("unhandled main return type [%s:%d]", sz_from_enum(ret_type.prim), ret_type.size);
+    return -1;
+}
+
+struct TieredCompiler {
+    VmProgram *program;
+    IrModule *ir;
+
+    Mutex *mutex;
+    Semaphore *signal;
+
+    // NOTE(jesper): guarded by mutex. A procedure only gets hot once, so the queue never holds
+    // more than one entry per procedure
+    Array<i32> queue;
+    i32 queue_head;
+    i32 queue_tail;
+    bool quit;
+
+    // NOTE(jesper): only touched by the compile thread. LLVM is initialised lazily when the
+    // first procedure gets hot, so programs that never get there don't pay for it
+    LLVMOrcLLJITRef jit;
+    LLVMTargetRef target;
+    char *target_triple;
+    bool init_failed;
+
+    Array<bool> compiled;
+    i32 unit_count;
+    i32 promoted_count;
+};
+
+void tiered_on_hot(VmProgram *program, i32 proc, void *user_data)
+{
+    TieredCompiler *tier = (TieredCompiler*)user_data;
+
+    GUARD_MUTEX(tier->mutex) tier->queue[tier->queue_tail++] = proc;
+    signal_semaphore(tier->signal);
+}
+
+void tiered_compile(TieredCompiler *tier, i32 root)
+{
+    SArena scratch = tl_scratch_arena();
+
+    // NOTE(jesper): already compiled as a callee of a procedure that got hot before it
+    if (tier->compiled[root]) return;
+
+    if (!tier->jit) {
+        if (tier->init_failed) return;
+        if (!llvm_init_target(&tier->target, &tier->target_triple) || !(tier->jit = jit_create())) {
+            LOG_ERROR("tier: failed to initialise the JIT, continuing in the interpreter");
+            tier->init_failed = true;
+            return;
+        }
+    }
+
+    u64 start = wall_timestamp();
+
+    // NOTE(jesper): the hot procedure is compiled together with every procedure it can reach
+    // that isn't compiled yet, so that LLVM can inline across them and the native code never
+    // has to call back into the interpreter
+    CodegenUnit unit{
+        .index = tier->unit_count++,
+        .ir = tier->ir,
+        .procedures = { .alloc = scratch },
+        .opt_level = 2,
+        .target = tier->target,
+        .target_triple = tier->target_triple,
+    };
+
+    tier->compiled[root] = true;
+    array_add(&unit.procedures, root);
+
+    for (i32 i = 0; i < unit.procedures.count; i++) {
+        IrProc *proc = &tier->ir->procs[unit.procedures[i]];
+        for (IrBlock &block : proc->blocks) {
+            for (IrInst &inst : block.insts) {
+                if (inst.op != IR_CALL) continue;
+                if (!tier->ir->procs[inst.proc].defined || tier->compiled[inst.proc]) continue;
+
+                tier->compiled[inst.proc] = true;
+                array_add(&unit.procedures, inst.proc);
+            }
+        }
+    }
+
+    String name = tier->ir->procs[root].name;
+
+    LLVMMemoryBufferRef object = llvm_codegen_unit(&unit);
+    if (!object) {
+        LOG_ERROR("tier: failed to compile '%.*s', it stays interpreted", STRFMT(name));
+        return;
+    }
+
+    LLVMOrcJITDylibRef dylib = LLVMOrcLLJITGetMainJITDylib(tier->jit);
+    if (!llvm_check_error(LLVMOrcLLJITAddObjectFile(tier->jit, dylib, object), "tier: failed to add object to JIT"))
+        return;
+
+    // NOTE(jesper): the first lookup materializes the whole object, after which each entry is
+    // published on its own. The interpreter picks it up on its next call of the procedure
+    for (i32 index : unit.procedures) {
+        char *sz_name = sz_string(tier->ir->procs[index].name, scratch);
+
+        LLVMOrcExecutorAddress addr;
+        if (!llvm_check_error(LLVMOrcLLJITLookup(tier->jit, &addr, sz_name), "tier: failed to look up compiled procedure"))
+            return;
+
+        atomic_store(&tier->program->native[index], (void*)addr);
+        tier->promoted_count++;
+    }
+
+    LOG_INFO("tier: compiled '%.*s' and %d callees at -O2 in %.3fs",
+             STRFMT(name), unit.procedures.count-1, wall_duration_s(start, wall_timestamp()));
+}
+
+i32 tiered_compile_thread_proc(void *user_data)
+{
+    TieredCompiler *tier = (TieredCompiler*)user_data;
 
-        if (proc->proc_decl.ret_type.size == 0 &&
-            proc->proc_decl.ret_type != T_VOID)
-        {
-            proc->proc_decl.ret_type.size = ret_type.size;
-        }
+    while (true) {
+        wait_semaphore(tier->signal);
 
-        if (ret_type.size != proc->proc_decl.ret_type.size) {
-            TERROR(ast->ret.token, "size mismatch in return statement");
+        bool quit;
+        i32 proc = -1;
+        GUARD_MUTEX(tier->mutex) {
+            quit = tier->quit;
+            if (!quit && tier->queue_head < tier->queue_tail) proc = tier->queue[tier->queue_head++];
         }
 
-        return ret_type;
-        } break;
+        if (quit) break;
+        if (proc != -1) tiered_compile(tier, proc);
     }
 
-    return { T_UNKNOWN };
+    return 0;
 }
 
-LLVMValueRef llvm_create_scoped_var(
-    LLVMIR *llvm,
-    Scope *scope,
-    LLVMTypeRef type,
-    String name)
+i32 bytecode_run(TypeExpr *main_ret, IrModule *ir, bool tiered)
 {
     SArena scratch = tl_scratch_arena();
 
-    LLVMValueRef var = LLVMBuildAlloca(llvm->ir, type, sz_string(name, scratch));
-    map_set(&scope->variables, name, var);
+    if (!main_ret) {
+        LOG_ERROR("No main procedure to run");
+        return -1;
+    }
+
+    u64 compile_start = wall_timestamp();
+
+    VmProgram program;
+    if (!vm_compile(&program, ir, scratch)) return -1;
+
+    Array<char*> libraries = array_create<char*>(opts.libraries.count, scratch);
+    for (i32 i = 0; i < libraries.count; i++) libraries[i] = shared_library_path(opts.libraries[i], scratch);
+    if (!vm_resolve_foreign(&program, libraries)) return -1;
+
+    u64 compile_end = wall_timestamp();
+    LOG_INFO("vm: compiled %d instructions in %.3fs", program.code.count, wall_duration_s(compile_start, compile_end));
+
+    TieredCompiler tier{};
+    Thread *compile_thread = nullptr;
+    if (tiered) {
+        tier = {
+            .program = &program,
+            .ir = ir,
+            .mutex = create_mutex(),
+            .signal = create_semaphore(),
+            .queue = array_create<i32>(ir->procs.count, scratch),
+            .compiled = array_create<bool>(ir->procs.count, scratch),
+        };
+        for (bool &it : tier.compiled) it = false;
+
+        vm_enable_tiering(&program, opts.tier_threshold, tiered_on_hot, &tier, scratch);
+        compile_thread = create_thread(tiered_compile_thread_proc, &tier);
+    }
+
+    u64 result;
+    bool ok = vm_run(&program, vm_find_proc(&program, "main"), &result);
+
+    u64 run_end = wall_timestamp();
+    LOG_INFO("vm: executed in %.3fs", wall_duration_s(compile_end, run_end));
+
+    if (compile_thread) {
+        // NOTE(jesper): a compile that's in flight is finished before the JIT is torn down,
+        // the native code may still be referenced by it until then
+        GUARD_MUTEX(tier.mutex) tier.quit = true;
+        signal_semaphore(tier.signal);
+        wait_for_thread(compile_thread);
+
+        LOG_INFO("tier: %d procedures promoted to native code", tier.promoted_count);
+        if (tier.jit) LLVMConsumeError(LLVMOrcDisposeLLJIT(tier.jit));
+    }
+
+    if (!ok) return -1;
 
-    return var;
+    TypeExpr ret_type = *main_ret;
+    if (ret_type == T_FLOAT) {
+        f32 f32_result; f64 f64_result;
+        memcpy(&f32_result, &result, sizeof f32_result);
+        memcpy(&f64_result, &result, sizeof f64_result);
+        return ret_type.size == 4 ? (i32)f32_result : (i32)f64_result;
+    }
+
+    return (i32)result;
 }
 
-LLVMValueRef llvm_codegen_expr(LLVMIR *llvm, AST *ast)
+void ast_collect_run_directives(AST *ast, DynamicArray<AST*> *runs)
 {
-    SArena scratch = tl_scratch_arena();
-
     switch (ast->type) {
-    case AST_VAR_DECL: {
-        LLVMValueRef var = llvm_create_scoped_var(
-            llvm, &llvm->scope,
-            llvm_type_from_type_expr(llvm->context, ast->var_decl.type),
-            ast->var_decl.identifier.str);
-
-        if (ast->var_decl.init) {
-            LLVMValueRef init = llvm_codegen_expr(llvm, ast->var_decl.init);
-            return LLVMBuildStore(llvm->ir, init, var);
-        } else {
-            // TODO(jesper): default init value
+    case AST_RUN:
+        // NOTE(jesper): nested directives are evaluated as part of the outermost one
+        array_add(runs, ast);
+        break;
+    case AST_PROC_DECL:
+        for (AST *stmt = ast->proc_decl.body; stmt; stmt = stmt->next) ast_collect_run_directives(stmt, runs);
+        break;
+    case AST_VAR_DECL:
+        if (ast->var_decl.init) ast_collect_run_directives(ast->var_decl.init, runs);
+        break;
+    case AST_VAR_STORE:
+        ast_collect_run_directives(ast->var_store.rhs, runs);
+        break;
+    case AST_RETURN:
+        if (ast->ret.expr) ast_collect_run_directives(ast->ret.expr, runs);
+        break;
+    case AST_BINARY_OP:
+        ast_collect_run_directives(ast->binary_op.lhs, runs);
+        ast_collect_run_directives(ast->binary_op.rhs, runs);
+        break;
+    case AST_PROC_CALL:
+        for (AST *arg = ast->proc_call.args; arg; arg = arg->next) ast_collect_run_directives(arg, runs);
+        break;
+    case AST_LOOP:
+        if (ast->loop.init) ast_collect_run_directives(ast->loop.init, runs);
+        ast_collect_run_directives(ast->loop.cond, runs);
+        if (ast->loop.step) ast_collect_run_directives(ast->loop.step, runs);
+        for (AST *stmt = ast->loop.body; stmt; stmt = stmt->next) ast_collect_run_directives(stmt, runs);
+        break;
+    case AST_SWITCH:
+        ast_collect_run_directives(ast->switch_stmt.expr, runs);
+        for (AST *it = ast->switch_stmt.cases; it; it = it->next) {
+            for (AST *stmt = it->switch_case.body; stmt; stmt = stmt->next) ast_collect_run_directives(stmt, runs);
         }
-        } break;
+        break;
+    case AST_VECTOR:
+        for (AST *elem = ast->vector.elems; elem; elem = elem->next) ast_collect_run_directives(elem, runs);
+        break;
+    case AST_SWIZZLE:
+        ast_collect_run_directives(ast->swizzle.expr, runs);
+        break;
+    case AST_REDUCE:
+        ast_collect_run_directives(ast->reduce.expr, runs);
+        break;
+    case AST_INTRINSIC:
+        for (AST *arg = ast->intrinsic.args; arg; arg = arg->next) ast_collect_run_directives(arg, runs);
+        break;
+    case AST_INDEX:
+        ast_collect_run_directives(ast->index.expr, runs);
+        ast_collect_run_directives(ast->index.index, runs);
+        break;
+    case AST_INDEX_STORE:
+        ast_collect_run_directives(ast->index_store.lhs, runs);
+        ast_collect_run_directives(ast->index_store.rhs, runs);
+        break;
+    case AST_COUNT:
+        ast_collect_run_directives(ast->count.expr, runs);
+        break;
+    case AST_FIELD:
+        ast_collect_run_directives(ast->field.expr, runs);
+        break;
+    case AST_FIELD_STORE:
+        ast_collect_run_directives(ast->field_store.lhs, runs);
+        ast_collect_run_directives(ast->field_store.rhs, runs);
+        break;
+    default:
+        break;
+    }
+}
 
-    case AST_VAR_STORE: {
-        LLVMValueRef *it = map_find(
-            &llvm->scope.variables,
-            ast->var_store.identifier.str);
+bool eval_run_directives(Module *module)
+{
+    SArena scratch = tl_scratch_arena();
 
-        if (!it) {
-            TERROR(ast->var_load.identifier, "unknown variable");
-            return nullptr;
+    DynamicArray<AST*> runs{ .alloc = scratch };
+    for (AST *ast = module->ast; ast; ast = ast->next) ast_collect_run_directives(ast, &runs);
+    for (GlobalConstant &global : module->globals) {
+        for (AST *elem = global.elems; elem; elem = elem->next) ast_collect_run_directives(elem, &runs);
+    }
+    if (runs.count == 0) return true;
+
+    // NOTE(jesper): the uses of a constant initialised by #run are copies of the same directive,
+    // which share its expression and are evaluated once, by the first of them
+    DynamicArray<AST*> evaluated{ .alloc = scratch };
+    Array<i32> evaluated_by = array_create<i32>(runs.count, scratch);
+    for (i32 i = 0; i < runs.count; i++) {
+        evaluated_by[i] = -1;
+        for (i32 j = 0; j < evaluated.count && evaluated_by[i] == -1; j++) {
+            if (evaluated[j]->run.expr == runs[i]->run.expr) evaluated_by[i] = j;
         }
 
-        LLVMValueRef rhs = llvm_codegen_expr(llvm, ast->var_store.rhs);
-        return LLVMBuildStore(llvm->ir, rhs, *it);
-        } break;
-
-    case AST_VAR_LOAD: {
-        LLVMValueRef *it = map_find(
-            &llvm->scope.variables,
-            ast->var_load.identifier.str);
+        if (evaluated_by[i] == -1) evaluated_by[i] = array_add(&evaluated, runs[i]);
+    }
+    i32 proc_count = evaluated.count;
+
+    u64 start = wall_timestamp();
+
+    // NOTE(jesper): every directive becomes a procedure returning its expression, which is
+    // lowered together with the rest of the module so that it can call any procedure in it and
+    // evaluated in the bytecode interpreter, without needing LLVM or the target to match the
+    // host. The procedures are only linked into the AST while the module is being lowered
+    AST *tail = module->ast;
+    while (tail->next) tail = tail->next;
+
+    AST **ptr = &tail->next;
+    for (i32 i = 0; i < runs.count; i++) {
+        AST *run = runs[i];
+        if (evaluated[evaluated_by[i]] != run) continue;
+
+        Token name = run->run.token;
+        name.str = stringf(scratch, "#run.%d", evaluated_by[i]);
+
+        *ptr = ALLOC_T(*scratch, AST) {
+            .type = AST_PROC_DECL,
+            .proc_decl.identifier = name,
+            .proc_decl.ret_type = run->run.type,
+            .proc_decl.body = ALLOC_T(*scratch, AST) {
+                .type = AST_RETURN,
+                .ret.token = run->run.token,
+                .ret.expr = run->run.expr,
+            },
+        };
+        ptr = &(*ptr)->next;
+    }
 
-        if (!it) {
-            TERROR(ast->var_load.identifier, "unknown variable");
-            return nullptr;
-        }
+    IrModule ir;
+    bool lowered = ir_lower_module(&ir, module, scratch, opts.bounds_checks);
+    tail->next = nullptr;
+    if (!lowered) return false;
 
-        LLVMTypeRef type = LLVMGetAllocatedType(*it);
-        size_t length; const char *name = LLVMGetValueName2(*it, &length);
+    ir_optimize(&ir);
 
-        return LLVMBuildLoad2(llvm->ir, type, *it, name);
-        } break;
+    VmProgram program;
+    if (!vm_compile(&program, &ir, scratch)) return false;
 
-    case AST_PROC_CALL: {
-        LLVMProc *proc = map_find(&llvm->procedures, ast->proc_call.identifier.str);
-        if (!proc) {
-            TERROR(ast->proc_call.identifier, "unknown procedure '%.*s'", STRFMT(ast->proc_call.identifier.str));
-            return nullptr;
-        }
+    Array<i32> roots = array_create<i32>(proc_count, scratch);
+    for (i32 i = 0; i < proc_count; i++) {
+        roots[i] = *map_find(&ir.proc_indices, stringf(scratch, "#run.%d", i));
+    }
 
-        if (!proc->func || !proc->func_t) {
-            TERROR(ast->proc_call.identifier, "procedure has not yet been generated: '%.*s'", STRFMT(ast->proc_call.identifier.str));
-            return nullptr;
+    // NOTE(jesper): #foreign procedures called at compile time are resolved the same way as in
+    // run mode, which means the libraries they're in have to be loadable by the compiler
+    Array<char*> libraries = array_create<char*>(opts.libraries.count, scratch);
+    for (i32 i = 0; i < libraries.count; i++) libraries[i] = shared_library_path(opts.libraries[i], scratch);
+    if (!vm_resolve_foreign(&program, libraries, roots)) return false;
+
+    Array<u64> results = array_create<u64>(proc_count, scratch);
+    for (i32 i = 0; i < runs.count; i++) {
+        AST *run = runs[i];
+
+        u64 result;
+        if (evaluated[evaluated_by[i]] != run) {
+            result = results[evaluated_by[i]];
+        } else if (!vm_run(&program, roots[evaluated_by[i]], &result)) {
+            TERROR(run->run.token, "failed to evaluate #run expression");
+            return false;
         }
+        results[evaluated_by[i]] = result;
 
-        return LLVMBuildCall2(llvm->ir, proc->func_t, proc->func, nullptr, 0, "");
-        } break;
+        // NOTE(jesper): the directive is replaced by a literal in place, the interpreter keeps
+        // integers extended to 64 bits and floats as their bit pattern
+        TypeExpr type = run->run.type;
+        *run = {
+            .next = run->next,
+            .type = AST_LITERAL,
+            .literal.token = run->run.token,
+            .literal.type = type,
+        };
 
-    case AST_LITERAL: {
-        switch (ast->literal.type.prim) {
-        case T_INTEGER:
-            PANIC("undeterminate signage of integer");
-            break;
-        case T_SIGNED:
-            switch (ast->literal.type.size) {
-            case 1: return LLVMConstInt(LLVMInt8Type(), ast->literal.ival, true);
-            case 2: return LLVMConstInt(LLVMInt16Type(), ast->literal.ival, true);
-            case 4: return LLVMConstInt(LLVMInt32Type(), ast->literal.ival, true);
-            case 8: return LLVMConstInt(LLVMInt64Type(), ast->literal.ival, true);
-            default: PANIC("Invalid integer size %d", ast->literal.type.size);
-            }
-            break;
-        case T_UNSIGNED:
-            switch (ast->literal.type.size) {
-            case 1: return LLVMConstInt(LLVMInt8Type(), ast->literal.ival, false);
-            case 2: return LLVMConstInt(LLVMInt16Type(), ast->literal.ival, false);
-            case 4: return LLVMConstInt(LLVMInt32Type(), ast->literal.ival, false);
-            case 8: return LLVMConstInt(LLVMInt64Type(), ast->literal.ival, false);
-            default: PANIC("Invalid integer size %d", ast->literal.type.size);
-            }
-            break;
+        switch (type.prim) {
         case T_FLOAT:
-            switch (ast->literal.type.size) {
-            case 4: return LLVMConstReal(LLVMFloatType(), ast->literal.fval);
-            case 8: return LLVMConstReal(LLVMDoubleType(), ast->literal.fval);
-            default:
-                PANIC("invalid float size: %d", ast->literal.type.size);
-                return nullptr;
+            if (type.size == 4) {
+                u32 bits = (u32)result;
+                memcpy(&run->literal.fval, &bits, sizeof bits);
+            } else {
+                memcpy(&run->literal.dval, &result, sizeof result);
             }
             break;
         case T_BOOL:
-            switch (ast->literal.type.size) {
-            case 1: return LLVMConstInt(LLVMInt1Type(), ast->literal.bval, false);
-            default:
-                PANIC("invalid boolean size: %d", ast->literal.type.size);
-                return nullptr;
-            }
-            break;
-        case T_INVALID:
-        case T_UNKNOWN:
-        case T_VOID:
-            PANIC("invalid literal type");
+            run->literal.bval = result != 0;
             break;
-        }
-        } break;
-
-    case AST_BINARY_OP: {
-        LLVMValueRef lhs = llvm_codegen_expr(llvm, ast->binary_op.lhs);
-        LLVMValueRef rhs = llvm_codegen_expr(llvm, ast->binary_op.rhs);
-
-        // TODO(jesper): need to grab the type to know which instruction to emit
-        // TypeExpr lhs_type = ast_typecheck(ast->binary_op.lhs, T_UNKNOWN, nullptr, nullptr);
-        // TypeExpr rhs_type = ast_typecheck(ast->binary_op.lhs, T_UNKNOWN, nullptr, nullptr);
-
-        switch (ast->binary_op.op.type) {
-        case '+': return LLVMBuildAdd(llvm->ir, lhs, rhs, "");
-        case '-': return LLVMBuildSub(llvm->ir, lhs, rhs, "");
-        case '*': return LLVMBuildMul(llvm->ir, lhs, rhs, "");
-        case '/': return LLVMBuildSDiv(llvm->ir, lhs, rhs, "");
         default:
-            LOG_ERROR("Invalid binary op '%.*s'",
-                      STRFMT(ast->binary_op.op.str));
+            run->literal.ival = (i64)result;
             break;
         }
-        break;
     }
 
-    default:
-        LOG_ERROR("Invalid AST node type '%s'", sz_from_enum(ast->type));
-        break;
-    }
-    return nullptr;
+    LOG_INFO("run: evaluated %d directives in %.3fs", proc_count, wall_duration_s(start, wall_timestamp()));
+    return true;
 }
 
-
-void* llvm_codegen_proc(LLVMIR *llvm, AST *ast)
+// NOTE(jesper): profile is the contents of the -fprofile-use profile, or empty when there isn't one
+bool parse_module(Module *module, String file, FileInfo f, String profile, IrModule *ir)
 {
-    PANIC_IF(ast->type != AST_PROC_DECL, "expected AST_PROC_DECL");
+    constexpr i32 MAX_AST_MEM = 10*MiB;
+    constexpr i32 MAX_IR_MEM = 64*MiB;
 
-    LLVMProc *proc = map_find_emplace(&llvm->procedures, ast->proc_decl.identifier.str);
+    {
+        Allocator mem = tl_linear_allocator(MAX_AST_MEM);
+        Lexer lexer{ f.data, f.size, file };
 
-    if (!proc->func) {
-        SArena scratch = tl_scratch_arena();
+        AST **ptr = &module->ast;
+        while (next_token(&lexer)) {
+            if (lexer.t.type == TOKEN_IDENTIFIER && peek_nth_token(&lexer, 3) == "struct") {
+                if (!parse_struct_decl(&lexer, module, mem)) return false;
+            } else if (lexer.t.type == TOKEN_IDENTIFIER &&
+                       // NOTE(jesper): a constant expression can't start with '(', that's a procedure
+                       peek_nth_token(&lexer, 1) == ':' && peek_nth_token(&lexer, 2) == ':' &&
+                       peek_nth_token(&lexer, 3) != '(')
+            {
+                if (!parse_constant_decl(&lexer, module, mem)) return false;
+            } else if (AST *proc = parse_proc_decl(&lexer, module, mem); proc) {
+                // NOTE(jesper): generic procedures are only added once they're instantiated
+                if (proc->proc_decl.flags.generic) continue;
+
+                array_add(&module->procedures, proc);
+                (*ptr) = proc;
+                ptr = &proc->next;
 
-        LLVMTypeRef ret_type = llvm_type_from_type_expr(
-            llvm->context,
-            ast->proc_decl.ret_type);
+                if (proc->proc_decl.identifier == "main") module->entry = proc;
+            } else {
+                PARSE_ERROR(&lexer, "unknown declaration in global scope");
+                return false;
+            }
+        }
+    }
 
-        if (!ret_type) ret_type = LLVMVoidType();
+    for (AST *ast = module->ast; ast; ast = ast->next) {
+        if (ast_typecheck(ast, { T_INVALID }, module, nullptr) == T_INVALID)
+            return false;
+    }
 
-        proc->func_t = LLVMFunctionType(ret_type, nullptr, 0, false);
-        proc->func = LLVMAddFunction(llvm->module, sz_string(ast->proc_decl.identifier.str, scratch), proc->func_t);
+    for (AST *ast = module->ast; ast; ast = ast->next) {
+        if (ast_sizecheck(ast, module, nullptr) == T_INVALID)
+            return false;
+    }
 
-        if (ast->proc_decl.flags.foreign) {
-            LLVMSetLinkage(proc->func, LLVMExternalLinkage);
-        } else {
-            proc->entry = LLVMCreateBasicBlockInContext(llvm->context, "entry");
-            LLVMAppendExistingBasicBlock(proc->func, proc->entry);
+    // NOTE(jesper): the #run elements of constant arrays have to produce exactly the element
+    // type, their results are written to the global as they are
+    for (GlobalConstant &global : module->globals) {
+        TypeExpr elem_t = global.type;
+        elem_t.elems = 0;
+
+        i32 index = 0;
+        for (AST *elem = global.elems; elem; elem = elem->next, index++) {
+            if (elem->type != AST_RUN) continue;
+
+            TypeExpr type = ast_typecheck(elem, elem_t, module, nullptr);
+            if (type != T_INVALID) type = ast_sizecheck(elem, module, nullptr, elem_t.size);
+            if (type == T_INVALID) return false;
+
+            if (type.prim != elem_t.prim || type.size != elem_t.size) {
+                TERROR(elem->run.token,
+                       "element %d of constant array '%.*s' is not a valid [%s:%d], #run produces [%s:%d]",
+                       index, STRFMT(global.identifier.str),
+                       sz_from_enum(elem_t.prim), elem_t.size, sz_from_enum(type.prim), type.size);
+                return false;
+            }
         }
     }
 
-    if (ast->proc_decl.identifier == "main") {
-        llvm->scope.entry = proc->entry;
+    if (!eval_run_directives(module)) return false;
+
+    debug_print_ast(module->ast);
+
+    // NOTE(jesper): the IR is only read once it's been lowered and optimised, so the codegen
+    // units can share it between threads
+    u64 lower_start = wall_timestamp();
+    if (!ir_lower_module(ir, module, tl_linear_allocator(MAX_IR_MEM), opts.bounds_checks)) return false;
+    u64 lower_end = wall_timestamp();
+    ir_optimize(ir);
+    u64 optimize_end = wall_timestamp();
+
+    LOG_INFO("ir: lowered in %.3fs, optimised in %.3fs",
+             wall_duration_s(lower_start, lower_end),
+             wall_duration_s(lower_end, optimize_end));
+
+    // NOTE(jesper): the counters are laid out by the optimised IR, which is the same for every
+    // build of the same program
+    if (profile.length > 0 && !ir_apply_profile(ir, profile)) {
+        LOG_ERROR("Failed to read profile '%s'", opts.profile_use);
+        return false;
     }
 
-    if (ast->proc_decl.body) {
-        map_destroy(&llvm->scope.variables);
+    ir_print(ir);
 
-        LLVMPositionBuilderAtEnd(llvm->ir, proc->entry);
-        for (auto *stmt = ast->proc_decl.body; stmt; stmt = stmt->next) {
-            switch (stmt->type) {
-            case AST_PROC_CALL:
-            case AST_VAR_DECL:
-                llvm_codegen_expr(llvm, stmt);
-                break;
-            case AST_RETURN:
-                if (stmt->ret.expr) {
-                    LLVMValueRef val = llvm_codegen_expr(llvm, stmt->ret.expr);
-                    LLVMBuildRet(llvm->ir, val);
-                } else {
-                    LLVMBuildRetVoid(llvm->ir);
-                }
-                break;
-            default:
-                LOG_ERROR("Invalid statement type '%s'", sz_from_enum(stmt->type));
-                break;
-            }
+    return true;
+}
+
+bool compile_module(
+    IrModule *ir,
+    i32 max_units,
+    LLVMTargetRef target, const char *target_triple,
+    DynamicArray<LLVMMemoryBufferRef> *objects)
+{
+    if (opts.backend == BACKEND_FAST) {
+        DynamicArray<u8> object{ .alloc = mem_dynamic };
+        defer { array_destroy(&object); };
+
+        u64 fast_start = wall_timestamp();
+        bool emitted = x64_emit_object(ir, &object);
+        u64 fast_end = wall_timestamp();
+
+        if (emitted) {
+            LOG_INFO("backend: fast x86-64 backend in %.3fs", wall_duration_s(fast_start, fast_end));
+            array_add(objects, LLVMCreateMemoryBufferWithMemoryRangeCopy((char*)object.data, object.count, "tir"));
+            return true;
         }
+
+        LOG_INFO("fast backend can't compile this program, falling back to LLVM");
+    }
+
+    Array<CodegenUnit> units = partition_codegen_units(ir, max_units, mem_dynamic);
+    for (auto &unit : units) {
+        unit.target = target;
+        unit.target_triple = target_triple;
+    }
+
+    u64 backend_start = wall_timestamp();
+    {
+        SArena scratch = tl_scratch_arena();
+        Array<Thread*> threads = array_create<Thread*>(units.count, scratch);
+
+        // NOTE(jesper): the first unit is generated on the main thread while the rest are
+        // generated, optimised and emitted on worker threads
+        for (i32 i = 1; i < units.count; i++) threads[i] = create_thread(codegen_unit_thread_proc, &units[i]);
+        codegen_unit_thread_proc(&units[0]);
+        for (i32 i = 1; i < units.count; i++) wait_for_thread(threads[i]);
+    }
+    u64 backend_end = wall_timestamp();
+
+    LOG_INFO("backend: %d codegen units in %.3fs", units.count, wall_duration_s(backend_start, backend_end));
+
+    for (auto &unit : units) {
+        if (!unit.object) return false;
     }
 
-    return proc->func;
+    for (auto &unit : units) array_add(objects, unit.object);
+    return true;
 }
 
-enum OutputType : i32 {
-    OUTPUT_EXECUTABLE,
-    OUTPUT_OBJECT,
-};
+CacheKey object_cache_key(FileInfo f, FileInfo profile, i32 max_units, const char *target_triple)
+{
+    SArena scratch = tl_scratch_arena();
 
-struct {
-    OutputType out_type;
-} opts;
+    // NOTE(jesper): everything that affects the generated objects has to be part of the key.
+    // The compiler is identified by the code of tir's executable and the libraries it's loaded
+    // with, so that rebuilding any part of tir or upgrading LLVM invalidates the objects it produced
+    unsigned llvm_major, llvm_minor, llvm_patch;
+    LLVMGetVersion(&llvm_major, &llvm_minor, &llvm_patch);
+
+    llvm_blake3_hasher hasher;
+    cache_key_begin(&hasher);
+    cache_key_add(&hasher, String{ (char*)f.data, f.size });
+    cache_key_add(&hasher, TIR_VERSION);
+    cache_key_add(&hasher, stringf(scratch, "LLVM %u.%u.%u", llvm_major, llvm_minor, llvm_patch));
+    cache_key_add_compiler(&hasher);
+    cache_key_add(&hasher, stringf(scratch, "-O%d -j%d --backend=%d -ffp=%x -fbounds=%d", opts.opt_level, max_units, opts.backend, opts.fp_math, opts.bounds_checks));
+    cache_key_add(&hasher, string(target_triple));
+    cache_key_add(&hasher, string(opts.target_cpu));
+    cache_key_add(&hasher, string(opts.target_features));
+    cache_key_add(&hasher, string(opts.profile_generate ? opts.profile_generate : ""));
+    cache_key_add(&hasher, String{ (char*)profile.data, profile.size });
+    return cache_key_end(&hasher);
+}
 
 void print_usage()
 {
     printf("Usage: tir <file> [options]\n");
+    printf("       tir run <file> [options]\n");
     printf("Options:\n");
-    printf("  -h, --help  Print this message\n");
-    printf("  -o <file>   Output file\n");
-    printf("  -c          Output object file\n");
+    printf("  -h, --help         Print this message\n");
+    printf("  -o <file>          Output file\n");
+    printf("  -c                 Output object file\n");
+    printf("  -l <library>       Link against library, or load it to resolve #foreign procedures in run mode\n");
+    printf("  -O<level>          Optimisation level, 0-3\n");
+    printf("  -j <n>             Number of parallel codegen units, 0 uses one per hardware thread\n");
+    printf("  -march=<cpu>       Target cpu, 'native' selects the host cpu and its features\n");
+    printf("  -mcpu=<cpu>        Target cpu without implying any features\n");
+    printf("  -mattr=<features>  Comma separated target features, e.g. +avx2,-bmi\n");
+    printf("  -ffast-math        Allow float operations to be optimised without strict IEEE-754 semantics,\n");
+    printf("                     the same as all of the below\n");
+    printf("  -funsafe-math-optimizations  Allow reassociation, reciprocals and contraction into fma\n");
+    printf("  -ffinite-math-only Assume float operations never produce or take NaN or infinity\n");
+    printf("  -fno-signed-zeros  Ignore the sign of zero in float operations\n");
+    printf("  -fapprox-func      Allow approximate versions of math functions\n");
+    printf("  -fno-bounds-check  Don't check array indices at runtime. Checks that can be proven to pass at\n");
+    printf("                     compile time are always removed\n");
+    printf("  -fprofile-generate[=<file>]  Count how often procedures are entered and which way their\n");
+    printf("                     branches go, and write the counts to file when the program exits,\n");
+    printf("                     default.tirprof by default, or $TIR_PROFILE_FILE if set\n");
+    printf("  -fprofile-use=<file>  Optimise with the branch weights and procedure entry counts of a\n");
+    printf("                     profile written by a program built with -fprofile-generate\n");
+    printf("  --backend=<name>   'fast' generates x86-64 code directly without optimisations, 'llvm' always\n");
+    printf("                     uses LLVM, 'auto' uses the fast backend at -O0 (default). In run mode\n");
+    printf("                     'bytecode' interprets the program without initialising LLVM, and 'tiered'\n");
+    printf("                     interprets it while compiling hot procedures at -O2 in the background\n");
+    printf("  --tier-threshold=<n> Number of calls before a procedure is compiled by the tiered backend, 1000\n");
+    printf("                     by default\n");
+    printf("  --linker=<linker>  'builtin' links self-contained programs in-process and falls back to\n");
+    printf("                     'clang' for anything else, 'clang' always links with clang\n");
+    printf("  --no-cache         Don't use the object cache\n");
+    printf("  --cache-size=<MiB> Size limit of the object cache, least recently used objects are evicted\n");
+    printf("  --cache-stats      Print object cache statistics\n");
+    printf("\n");
+    printf("The object cache is stored in $TIR_CACHE_DIR if set, or the user's cache directory otherwise\n");
     printf("\n");
 }
 
 int main(int argc, char *argv[])
 {
     for (auto &c : indent) c = ' ';
-    constexpr i32 MAX_AST_MEM = 10*MiB;
 
     init_default_allocators();
 
@@ -1179,7 +5895,15 @@ int main(int argc, char *argv[])
     char *out_name    = nullptr;
     char *out_dir     = nullptr;
 
-    for (i32 i = 1; i < argc; i++) {
+    char *mattr       = nullptr;
+
+    i32 first_arg = 1;
+    if (argc > 1 && strcmp(argv[1], "run") == 0) {
+        opts.out_type = OUTPUT_RUN;
+        first_arg = 2;
+    }
+
+    for (i32 i = first_arg; i < argc; i++) {
         if (argv[i][0] == '-') {
             if (argv[i][1] == 'h' || strcmp(&argv[i][1], "-help") == 0) {
                 print_usage();
@@ -1192,7 +5916,104 @@ int main(int argc, char *argv[])
 
                 out = argv[++i];
             } else if (argv[i][1] == 'c') {
+                if (opts.out_type == OUTPUT_RUN) {
+                    LOG_ERROR("'-c' is not supported in run mode");
+                    return -1;
+                }
+
                 opts.out_type = OUTPUT_OBJECT;
+            } else if (argv[i][1] == 'l') {
+                char *library = argv[i][2] != '\0' ? &argv[i][2] : i+1 < argc ? argv[++i] : nullptr;
+                if (!library) {
+                    LOG_ERROR("Expected library after '-l'");
+                    return -1;
+                }
+
+                array_add(&opts.libraries, library);
+            } else if (argv[i][1] == 'O') {
+                if (argv[i][2] == '\0') opts.opt_level = 2;
+                else if (!i32_from_string(string(&argv[i][2]), &opts.opt_level) ||
+                         opts.opt_level < 0 || opts.opt_level > 3)
+                {
+                    LOG_ERROR("Invalid optimisation level '%s'", argv[i]);
+                    return -1;
+                }
+            } else if (argv[i][1] == 'j') {
+                char *n = argv[i][2] != '\0' ? &argv[i][2] : i+1 < argc ? argv[++i] : nullptr;
+                if (!n || !i32_from_string(string(n), &opts.codegen_units) || opts.codegen_units < 0) {
+                    LOG_ERROR("Expected number of codegen units after '-j'");
+                    return -1;
+                }
+            } else if (starts_with(string(argv[i]), "--linker=")) {
+                char *linker = argv[i] + strlen("--linker=");
+                if (strcmp(linker, "builtin") == 0) opts.linker = LINKER_BUILTIN;
+                else if (strcmp(linker, "clang") == 0) opts.linker = LINKER_CLANG;
+                else {
+                    LOG_ERROR("Unknown linker '%s'", linker);
+                    return -1;
+                }
+            } else if (starts_with(string(argv[i]), "--backend=")) {
+                char *backend = argv[i] + strlen("--backend=");
+                if (strcmp(backend, "auto") == 0) opts.backend = BACKEND_AUTO;
+                else if (strcmp(backend, "llvm") == 0) opts.backend = BACKEND_LLVM;
+                else if (strcmp(backend, "fast") == 0) opts.backend = BACKEND_FAST;
+                else if (strcmp(backend, "bytecode") == 0) opts.backend = BACKEND_BYTECODE;
+                else if (strcmp(backend, "tiered") == 0) opts.backend = BACKEND_TIERED;
+                else {
+                    LOG_ERROR("Unknown backend '%s'", backend);
+                    return -1;
+                }
+            } else if (starts_with(string(argv[i]), "--tier-threshold=")) {
+                i32 threshold;
+                if (!i32_from_string(string(argv[i] + strlen("--tier-threshold=")), &threshold) || threshold <= 0) {
+                    LOG_ERROR("Invalid tier threshold '%s'", argv[i]);
+                    return -1;
+                }
+
+                opts.tier_threshold = (u32)threshold;
+            } else if (strcmp(argv[i], "-ffast-math") == 0) {
+                opts.fp_math |= FP_FAST_MATH;
+            } else if (strcmp(argv[i], "-funsafe-math-optimizations") == 0) {
+                opts.fp_math |= FP_UNSAFE_MATH;
+            } else if (strcmp(argv[i], "-ffinite-math-only") == 0) {
+                opts.fp_math |= FP_NO_NANS | FP_NO_INFS;
+            } else if (strcmp(argv[i], "-fno-signed-zeros") == 0) {
+                opts.fp_math |= FP_NO_SIGNED_ZEROS;
+            } else if (strcmp(argv[i], "-fapprox-func") == 0) {
+                opts.fp_math |= FP_APPROX_FUNC;
+            } else if (strcmp(argv[i], "-fno-bounds-check") == 0) {
+                opts.bounds_checks = false;
+            } else if (strcmp(argv[i], "-fprofile-generate") == 0) {
+                opts.profile_generate = (char*)"default.tirprof";
+            } else if (starts_with(string(argv[i]), "-fprofile-generate=")) {
+                opts.profile_generate = argv[i] + strlen("-fprofile-generate=");
+            } else if (starts_with(string(argv[i]), "-fprofile-use=")) {
+                opts.profile_use = argv[i] + strlen("-fprofile-use=");
+            } else if (strcmp(argv[i], "--no-cache") == 0) {
+                opts.use_cache = false;
+            } else if (strcmp(argv[i], "--cache-stats") == 0) {
+                opts.print_cache_stats = true;
+            } else if (starts_with(string(argv[i]), "--cache-size=")) {
+                i32 size;
+                if (!i32_from_string(string(argv[i] + strlen("--cache-size=")), &size) || size < 0) {
+                    LOG_ERROR("Invalid cache size '%s'", argv[i]);
+                    return -1;
+                }
+
+                opts.cache_size = (u64)size*MiB;
+            } else if (starts_with(string(argv[i]), "-march=")) {
+                char *arch = argv[i] + strlen("-march=");
+                if (strcmp(arch, "native") == 0) {
+                    opts.target_cpu = LLVMGetHostCPUName();
+                    opts.target_features = LLVMGetHostCPUFeatures();
+                } else {
+                    opts.target_cpu = arch;
+                }
+            } else if (starts_with(string(argv[i]), "-mcpu=")) {
+                char *cpu = argv[i] + strlen("-mcpu=");
+                opts.target_cpu = strcmp(cpu, "native") == 0 ? LLVMGetHostCPUName() : cpu;
+            } else if (starts_with(string(argv[i]), "-mattr=")) {
+                mattr = argv[i] + strlen("-mattr=");
             } else {
                 LOG_ERROR("Unknown option '%s'", argv[i]);
                 return -1;
@@ -1202,12 +6023,33 @@ int main(int argc, char *argv[])
         }
     }
 
+    ObjectCache cache{};
+    if (opts.use_cache || opts.print_cache_stats) {
+        if (!init_object_cache(&cache, default_cache_dir(mem_dynamic), opts.cache_size)) {
+            LOG_ERROR("Failed to initialise object cache, continuing without it");
+        }
+    }
+
+    if (opts.print_cache_stats && cache.dir.length) {
+        print_cache_stats(&cache);
+        if (!src) return 0;
+    }
+
+    if (!opts.use_cache) cache = {};
+
     if (!src) {
         LOG_ERROR("No input file");
         print_usage();
         return -1;
     }
 
+    if (mattr) {
+        // NOTE(jesper): explicit features are appended so that they take precedence over
+        // the ones implied by -march=native
+        if (opts.target_features[0]) opts.target_features = sztringf(mem_dynamic, "%s,%s", opts.target_features, mattr);
+        else opts.target_features = mattr;
+    }
+
     src_name = strdup(src);
     if (char *p = strrchr(src_name, '/'); p) src_name = p+1;
     if (char *p = strrchr(src_name, '.'); p) *p = '\0';
@@ -1226,96 +6068,168 @@ int main(int argc, char *argv[])
     out_dir = strdup(out);
     if (char *p = strrchr(out_dir, '/'); p) *p = '\0';
 
-    Module module{};
-    {
-        SArena scratch = tl_scratch_arena();
+    String file = string(src);
 
-        String file = string(src);
-        FileInfo f = read_file(file, scratch);
-        if (!f.data) {
-            LOG_ERROR("Failed to read file '%.*s'", STRFMT(file));
+    // NOTE(jesper): the tokens, and in turn the AST, reference the file contents directly
+    // so it has to outlive the compilation
+    FileInfo f = read_file(file, mem_dynamic);
+    if (!f.data) {
+        LOG_ERROR("Failed to read file '%.*s'", STRFMT(file));
+        return -1;
+    }
+
+    FileInfo profile{};
+    if (opts.profile_use) {
+        profile = read_file(string(opts.profile_use), mem_dynamic);
+        if (!profile.data) {
+            LOG_ERROR("Failed to read profile '%s'", opts.profile_use);
             return -1;
         }
+    }
 
-        Allocator mem = tl_linear_allocator(MAX_AST_MEM);
-        Lexer lexer{ f.data, f.size, file };
-
-        AST **ptr = &module.ast;
-        while (next_token(&lexer)) {
-            if (AST *proc = parse_proc_decl(&lexer, &module, mem); proc) {
-                array_add(&module.procedures, proc);
-                (*ptr) = proc;
-                ptr = &proc->next;
+    if (opts.backend == BACKEND_BYTECODE || opts.backend == BACKEND_TIERED) {
+        const char *backend = opts.backend == BACKEND_TIERED ? "tiered" : "bytecode";
+        if (opts.out_type != OUTPUT_RUN) {
+            LOG_ERROR("The %s backend is only supported in run mode", backend);
+            return -1;
+        }
 
-                if (proc->proc_decl.identifier == "main") module.entry = proc;
-            } else {
-                PARSE_ERROR(&lexer, "unknown declaration in global scope");
-                return -1;
-            }
+        if (opts.profile_generate) {
+            LOG_ERROR("The %s backend doesn't support -fprofile-generate", backend);
+            return -1;
         }
+
+        if (opts.profile_use) LOG_INFO("The %s backend doesn't use profiles, ignoring -fprofile-use", backend);
+
+        Module module{};
+        IrModule ir;
+        if (!parse_module(&module, file, f, {}, &ir)) return -1;
+
+        TypeExpr main_ret = module.entry ? module.entry->proc_decl.ret_type : TypeExpr{};
+        return bytecode_run(module.entry ? &main_ret : nullptr, &ir, opts.backend == BACKEND_TIERED);
     }
 
-    for (AST *ast = module.ast; ast; ast = ast->next) {
-        if (ast_typecheck(ast, { T_INVALID }, &module, nullptr) == T_INVALID)
+    char *target_triple;
+    LLVMTargetRef target;
+    if (!llvm_init_target(&target, &target_triple)) return -1;
+
+    // NOTE(jesper): the fast backend only emits x86-64 ELF objects and doesn't optimise, so
+    // it's only picked automatically for -O0 builds targeting linux
+    bool fast_target = strncmp(target_triple, "x86_64", 6) == 0 && strstr(target_triple, "linux");
+    // NOTE(jesper): profiles are only generated and used by LLVM, which is picked for them
+    // regardless of the optimisation level
+    bool profile_guided = opts.profile_generate || opts.profile_use;
+    if (opts.backend == BACKEND_AUTO) {
+        opts.backend = opts.opt_level == 0 && fast_target && !profile_guided ? BACKEND_FAST : BACKEND_LLVM;
+    } else if (opts.backend == BACKEND_FAST) {
+        if (!fast_target) {
+            LOG_ERROR("The fast backend doesn't support target '%s'", target_triple);
             return -1;
-    }
+        }
 
-    for (AST *ast = module.ast; ast; ast = ast->next) {
-        if (ast_sizecheck(ast, &module, nullptr) == T_INVALID)
+        if (opts.profile_generate) {
+            LOG_ERROR("The fast backend doesn't support -fprofile-generate");
             return -1;
+        }
+
+        if (opts.opt_level > 0) LOG_INFO("The fast backend doesn't optimise, ignoring -O%d", opts.opt_level);
+        if (opts.profile_use) LOG_INFO("The fast backend doesn't optimise, ignoring -fprofile-use");
     }
 
-    debug_print_ast(module.ast);
+    i32 max_units = opts.codegen_units > 0 ? opts.codegen_units : get_hardware_thread_count();
 
-    LLVMIR llvm{};
-    llvm.context = LLVMGetGlobalContext();
-    llvm.module = LLVMModuleCreateWithNameInContext("tir", llvm.context);
-    llvm.ir = LLVMCreateBuilderInContext(llvm.context);
+    // NOTE(jesper): object output is a single file, merging the units into one would need a
+    // relocatable link step
+    if (opts.out_type == OUTPUT_OBJECT) max_units = 1;
 
-    {
-        SArena scratch = tl_scratch_arena();
+    CacheKey cache_key{};
+    CacheEntry cached{};
+    bool cache_hit = false;
 
-        for (AST *it = module.ast; it; it = it->next) {
-            if (it->type == AST_PROC_DECL) {
-                llvm_codegen_proc(&llvm, it);
-            }
+    if (cache.dir.length) {
+        cache_key = object_cache_key(f, profile, max_units, target_triple);
+        cache_hit = cache_lookup(&cache, cache_key, &cached, mem_dynamic);
+        LOG_INFO("object cache %s", cache_hit ? "hit" : "miss");
+    }
+
+    DynamicArray<LLVMMemoryBufferRef> objects{};
+    TypeExpr main_ret{};
+    bool has_main = false;
+    bool uses_runtime = false;
+
+    if (cache_hit) {
+        for (String obj : cached.objects) {
+            array_add(&objects, LLVMCreateMemoryBufferWithMemoryRange(obj.data, obj.length, "tir", false));
         }
 
-        if (char *mod = LLVMPrintModuleToString(llvm.module); mod) {
-            LOG_INFO("Generated LLVM IR:\n%s", mod);
-            LLVMDisposeMessage(mod);
+        has_main = cached.has_main;
+        main_ret = { (PrimitiveType)cached.main_prim, cached.main_size };
+        uses_runtime = cached.uses_runtime;
+    } else {
+        Module module{};
+        IrModule ir;
+        if (!parse_module(&module, file, f, String{ (char*)profile.data, profile.size }, &ir)) return -1;
+
+        // NOTE(jesper): the runtime writes out the counters of instrumented programs
+        if (opts.profile_generate) ir.uses_runtime = true;
+        if (!compile_module(&ir, max_units, target, target_triple, &objects)) return -1;
+
+        has_main = module.entry != nullptr;
+        if (has_main) main_ret = module.entry->proc_decl.ret_type;
+        uses_runtime = ir.uses_runtime;
+
+        if (cache.dir.length) {
+            CacheEntry entry{
+                .has_main = has_main,
+                .main_prim = main_ret.prim,
+                .main_size = main_ret.size,
+                .uses_runtime = uses_runtime,
+            };
+            for (LLVMMemoryBufferRef obj : objects) {
+                array_add(&entry.objects, String{ (char*)LLVMGetBufferStart(obj), (i32)LLVMGetBufferSize(obj) });
+            }
+
+            cache_store(&cache, cache_key, &entry);
         }
     }
 
+    if (opts.out_type == OUTPUT_RUN) return jit_run(has_main ? &main_ret : nullptr, objects);
 
-    DynamicArray<String> object_files{};
-    {
+    String exe_name;
+    if (opts.out_type == OUTPUT_EXECUTABLE) {
+#if defined(_WIN32)
+        exe_name = stringf(mem_dynamic, "%s/%s.exe", out_dir, out_name);
+#elif defined(__linux__)
+        exe_name = stringf(mem_dynamic, "%s/%s", out_dir, out_name);
+#endif
+    }
+
+#if defined(__linux__)
+    // NOTE(jesper): the builtin linker doesn't do shared or archive libraries, so programs needing
+    // the runtime library go straight to clang
+    if (opts.out_type == OUTPUT_EXECUTABLE && opts.linker == LINKER_BUILTIN && !uses_runtime) {
         SArena scratch = tl_scratch_arena();
 
-        LLVMInitializeX86TargetInfo();
-        LLVMInitializeX86Target();
-        LLVMInitializeX86TargetMC();
-        LLVMInitializeX86AsmParser();
-        LLVMInitializeX86AsmPrinter();
+        Array<String> object_data = array_create<String>(objects.count, scratch);
+        for (i32 i = 0; i < objects.count; i++) {
+            object_data[i] = { (char*)LLVMGetBufferStart(objects[i]), (i32)LLVMGetBufferSize(objects[i]) };
+        }
 
-        char *sz_error = nullptr;
-        char *target_triple = LLVMGetDefaultTargetTriple();
+        u64 link_start = wall_timestamp();
+        bool linked = link_static_executable(exe_name, object_data, "main");
+        u64 link_end = wall_timestamp();
 
-        LLVMTargetRef target;
-        if (LLVMGetTargetFromTriple(target_triple, &target, &sz_error) != 0) {
-            LOG_ERROR("Failed to get target from triple '%s': %s", target_triple, sz_error);
-            return -1;
+        if (linked) {
+            LOG_INFO("link: builtin linker in %.3fs", wall_duration_s(link_start, link_end));
+            return 0;
         }
 
-        LLVMTargetMachineRef target_machine = LLVMCreateTargetMachine(
-            target,
-            target_triple, "generic", "",
-            LLVMCodeGenLevelDefault,
-            LLVMRelocPIC,
-            LLVMCodeModelDefault);
-
-        LLVMSetTarget(llvm.module, target_triple);
+        LOG_INFO("builtin linker can't link this program, falling back to clang");
+    }
+#endif
 
+    DynamicArray<String> object_files{};
+    for (LLVMMemoryBufferRef object : objects) {
         FileHandle fd;
         String path;
 
@@ -1329,24 +6243,11 @@ int main(int argc, char *argv[])
 
         defer { if(fd) close_file(fd); };
 
-        LLVMPassManagerRef pass_manager = LLVMCreatePassManager();
-        LLVMAddAnalysisPasses(target_machine, pass_manager);
-        LLVMRunPassManager(pass_manager, llvm.module);
-
-        LLVMMemoryBufferRef buffer;
-        if (LLVMTargetMachineEmitToMemoryBuffer(
-                target_machine, llvm.module,
-                LLVMObjectFile,
-                &sz_error, &buffer) != 0)
-        {
-            LOG_ERROR("Failed to emit object file: %s", sz_error);
-            return -1;
-        }
-
-        const char *data = LLVMGetBufferStart(buffer);
-        size_t size = LLVMGetBufferSize(buffer);
+        const char *data = LLVMGetBufferStart(object);
+        size_t size = LLVMGetBufferSize(object);
         write_file(fd, data, size);
 
+        LLVMDisposeMemoryBuffer(object);
         array_add(&object_files, path);
     }
 
@@ -1354,18 +6255,21 @@ int main(int argc, char *argv[])
         SArena scratch = tl_scratch_arena();
         DynamicArray<String> args{ .alloc = scratch };
 
-#if defined(_WIN32)
-        String exe_name = stringf(scratch, "%s/%s.exe", out_dir, out_name);
-#elif defined(__linux__)
-        String exe_name = stringf(scratch, "%s/%s", out_dir, out_name);
-#endif
-
         array_add(&args, object_files);
         array_add(&args, { String{ "-o" }, exe_name });
         array_add(&args, { String{ "-L" }, string(out_dir) });
         array_add(&args, String{ "-lextern" });
+        if (uses_runtime) array_add(&args, { String{ "-l" TIR_RUNTIME_LIBRARY }, String{ "-lpthread" } });
+        for (char *library : opts.libraries) {
+            if (strchr(library, '/')) array_add(&args, string(library));
+            else array_add(&args, stringf(scratch, "-l%s", library));
+        }
 
+        u64 link_start = wall_timestamp();
         run_process("clang", args);
+        u64 link_end = wall_timestamp();
+
+        LOG_INFO("link: clang in %.3fs", wall_duration_s(link_start, link_end));
     }
 
     return 0;
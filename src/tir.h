@@ -0,0 +1,558 @@
+#ifndef TIR_H
+#define TIR_H
+
+#include "core.h"
+#include "lexer.h"
+#include "array.h"
+#include "hash_table.h"
+
+enum ASTType : i32 {
+    AST_INVALID = 0,
+
+    AST_VAR_DECL,
+    AST_VAR_LOAD,
+    AST_VAR_STORE,
+
+    AST_PROC_DECL,
+    AST_PROC_CALL,
+
+    AST_RETURN,
+    AST_LITERAL,
+    AST_BINARY_OP,
+
+    AST_RUN,
+    AST_LOOP,
+    AST_SWITCH,
+    AST_SWITCH_CASE,
+
+    AST_VECTOR,
+    AST_SWIZZLE,
+    AST_REDUCE,
+
+    AST_INDEX,
+    AST_INDEX_STORE,
+    AST_COUNT,
+
+    AST_FIELD,
+    AST_FIELD_STORE,
+
+    AST_ADDRESS_OF,
+    AST_DEREF,
+    AST_DEREF_STORE,
+
+    AST_ATOMIC,
+    AST_INTRINSIC,
+
+    AST_GLOBAL,
+};
+
+inline const char* sz_from_enum(ASTType type)
+{
+    switch (type) {
+    case AST_INVALID:   return "invalid";
+    case AST_VAR_LOAD:  return "var_load";
+    case AST_VAR_DECL:  return "var_decl";
+    case AST_VAR_STORE: return "var_store";
+    case AST_PROC_DECL: return "proc_decl";
+    case AST_PROC_CALL: return "proc_call";
+    case AST_RETURN:    return "return";
+    case AST_LITERAL:   return "literal";
+    case AST_BINARY_OP: return "binary_op";
+    case AST_RUN:       return "run";
+    case AST_LOOP:      return "loop";
+    case AST_SWITCH:    return "switch";
+    case AST_SWITCH_CASE: return "switch_case";
+    case AST_VECTOR:    return "vector";
+    case AST_SWIZZLE:   return "swizzle";
+    case AST_REDUCE:    return "reduce";
+    case AST_INDEX:     return "index";
+    case AST_INDEX_STORE: return "index_store";
+    case AST_COUNT:     return "count";
+    case AST_FIELD:     return "field";
+    case AST_FIELD_STORE: return "field_store";
+    case AST_ADDRESS_OF: return "address_of";
+    case AST_DEREF:     return "deref";
+    case AST_DEREF_STORE: return "deref_store";
+    case AST_ATOMIC:    return "atomic";
+    case AST_INTRINSIC: return "intrinsic";
+    case AST_GLOBAL:    return "global";
+    }
+
+    return "invalid";
+}
+
+enum UnaryOp : i8 {
+    UOP_INVALID = 0,
+
+    // UOP_NEG,
+};
+
+inline const char* sz_from_enum(UnaryOp op)
+{
+    switch (op) {
+    case UOP_INVALID: return "invalid";
+    }
+}
+
+enum PrimitiveType : i32 {
+    T_INVALID = -1,
+    T_UNKNOWN = 0,
+    T_VOID,
+    T_INTEGER,
+    T_UNSIGNED,
+    T_SIGNED,
+    T_FLOAT,
+    T_BOOL,
+    T_STRUCT,
+    T_GENERIC,
+};
+
+inline const char* sz_from_enum(PrimitiveType type)
+{
+    switch (type) {
+    case T_UNKNOWN:  return "unknown";
+    case T_VOID:     return "void";
+    case T_INTEGER:  return "INT";
+    case T_SIGNED:   return "SINT";
+    case T_UNSIGNED: return "UINT";
+    case T_FLOAT:    return "FLOAT";
+    case T_BOOL:     return "BOOL";
+    case T_STRUCT:   return "STRUCT";
+    case T_GENERIC:  return "GENERIC";
+    case T_INVALID:  break;
+    }
+
+    return "invalid";
+}
+
+#define TYPE_SLICE -1
+
+struct StructType;
+
+// NOTE(jesper): SIMD vectors have the prim and size of their lanes, scalars have 0 lanes.
+// Arrays have the type of their elements, with elems being the count of a fixed [N]T array or
+// TYPE_SLICE for a []T slice. Structs have the size of the whole struct and refer to its
+// declaration, which is what distinguishes two struct types. Pointers have the type they point
+// to, with pointers being the levels of indirection; for arrays it applies to the elements.
+// The type parameters of generic procedures are T_GENERIC, with size being the 1-based index of
+// the parameter, and only exist in the declaration their instantiations are deduced from
+struct TypeExpr {
+    PrimitiveType prim;
+    i32           size;
+    i32           lanes;
+    i32           elems;
+    StructType    *struct_type;
+    i32           pointers;
+
+    explicit operator bool() { return prim != T_UNKNOWN && size != 0; }
+    bool operator==(const TypeExpr &rhs) const = default;
+    bool operator==(const PrimitiveType &rhs) const { return prim == rhs; }
+};
+
+// NOTE(jesper): the size in bytes of a value of the type, arrays excluded
+inline i32 type_size(TypeExpr type)
+{
+    return type.lanes > 0 ? type.size*type.lanes : type.size;
+}
+
+struct StructField {
+    Token identifier;
+    TypeExpr type;
+    i32 offset;
+
+    // NOTE(jesper): byte offset of the field's array in an array of #soa structs, for each
+    // element in the array
+    i32 soa_offset;
+};
+
+// NOTE(jesper): the fields are stored in layout order, which is their declaration order for
+// #packed and #ordered structs and sorted by decreasing alignment otherwise, which leaves no
+// padding between them. Fixed arrays and slices of #soa structs store each field in an array of
+// its own, one after the other
+struct StructType {
+    Token identifier;
+    Array<StructField> fields;
+    i32 size;
+    i32 alignment;
+
+    bool packed;
+    bool ordered;
+    bool soa;
+};
+
+// NOTE(jesper): optimisation hints given by #vectorize(width), #unroll(n), #no_vectorize and
+// #no_unroll directives in front of a loop. Zero means it's left up to the optimiser. The
+// #grain(n) of a parallel loop is the fewest iterations the runtime hands to a thread at once,
+// zero means it's left up to the runtime
+struct LoopHints {
+    i32 vectorize_width;
+    i32 unroll_count;
+    i32 grain_size;
+    bool no_vectorize;
+    bool no_unroll;
+};
+
+enum ReduceOp : i32 {
+    REDUCE_ADD,
+    REDUCE_MUL,
+    REDUCE_MIN,
+    REDUCE_MAX,
+};
+
+// NOTE(jesper): the atomic builtins, atomic_load(p, order), atomic_store(p, v, order), the
+// read-modify-write ops like atomic_add(p, v, order) returning the previous value,
+// atomic_cas(p, expected, desired, order) returning the previous value, and atomic_fence(order)
+enum AtomicOp : u8 {
+    ATOMIC_LOAD,
+    ATOMIC_STORE,
+    ATOMIC_XCHG,
+    ATOMIC_ADD,
+    ATOMIC_SUB,
+    ATOMIC_AND,
+    ATOMIC_OR,
+    ATOMIC_XOR,
+    ATOMIC_MIN,
+    ATOMIC_MAX,
+    ATOMIC_CAS,
+    ATOMIC_FENCE,
+};
+
+inline const char* sz_from_enum(AtomicOp op)
+{
+    switch (op) {
+    case ATOMIC_LOAD:  return "load";
+    case ATOMIC_STORE: return "store";
+    case ATOMIC_XCHG:  return "xchg";
+    case ATOMIC_ADD:   return "add";
+    case ATOMIC_SUB:   return "sub";
+    case ATOMIC_AND:   return "and";
+    case ATOMIC_OR:    return "or";
+    case ATOMIC_XOR:   return "xor";
+    case ATOMIC_MIN:   return "min";
+    case ATOMIC_MAX:   return "max";
+    case ATOMIC_CAS:   return "cas";
+    case ATOMIC_FENCE: return "fence";
+    }
+
+    return "invalid";
+}
+
+// NOTE(jesper): the `#likely <cond>` and `#unlikely <cond>` branch hints, and the prefetch(p),
+// popcount(x), clz(x), ctz(x), bswap(x), rotl(x, n) and rotr(x, n) builtins. The bit operations
+// work on integers and integer SIMD vectors, lane-wise, and count or rotate within the size of
+// their type
+enum IntrinsicOp : u8 {
+    INTRINSIC_LIKELY,
+    INTRINSIC_UNLIKELY,
+    INTRINSIC_PREFETCH,
+    INTRINSIC_POPCOUNT,
+    INTRINSIC_CLZ,
+    INTRINSIC_CTZ,
+    INTRINSIC_BSWAP,
+    INTRINSIC_ROTL,
+    INTRINSIC_ROTR,
+};
+
+inline const char* sz_from_enum(IntrinsicOp op)
+{
+    switch (op) {
+    case INTRINSIC_LIKELY:   return "likely";
+    case INTRINSIC_UNLIKELY: return "unlikely";
+    case INTRINSIC_PREFETCH: return "prefetch";
+    case INTRINSIC_POPCOUNT: return "popcount";
+    case INTRINSIC_CLZ:      return "clz";
+    case INTRINSIC_CTZ:      return "ctz";
+    case INTRINSIC_BSWAP:    return "bswap";
+    case INTRINSIC_ROTL:     return "rotl";
+    case INTRINSIC_ROTR:     return "rotr";
+    }
+
+    return "invalid";
+}
+
+enum AtomicOrder : u8 {
+    ORDER_RELAXED,
+    ORDER_ACQUIRE,
+    ORDER_RELEASE,
+    ORDER_ACQ_REL,
+    ORDER_SEQ_CST,
+};
+
+inline const char* sz_from_enum(AtomicOrder order)
+{
+    switch (order) {
+    case ORDER_RELAXED: return "relaxed";
+    case ORDER_ACQUIRE: return "acquire";
+    case ORDER_RELEASE: return "release";
+    case ORDER_ACQ_REL: return "acq_rel";
+    case ORDER_SEQ_CST: return "seq_cst";
+    }
+
+    return "invalid";
+}
+
+struct AST {
+    AST *next;
+
+    ASTType type;
+    union {
+        struct {
+            Token identifier;
+            TypeExpr ret_type;
+            struct {
+                u32 foreign : 1;
+                u32 exported : 1;
+                u32 generic : 1;
+                u32 cold : 1;
+                u32 hot : 1;
+                u32 unused  : 27;
+            } flags;
+            AST *params;    // AST_VAR_DECL without initialisers
+            AST *body;
+        } proc_decl;
+        struct {
+            Token identifier;
+            AST *args;
+        } proc_call;
+        struct {
+            Token identifier;
+            TypeExpr type;
+            AST *init;
+            bool noalias;   // #restrict parameter
+        } var_decl;
+        struct {
+            Token identifier;
+            AST *rhs;
+        } var_store;
+        struct {
+            Token identifier;
+        } var_load;
+        struct {
+            Token op;
+            AST *lhs;
+            AST *rhs;
+        } binary_op;
+        struct {
+            Token token;
+            TypeExpr type;
+            union {
+                i64 ival;
+                f32 fval;
+                f64 dval;   // NOTE(jesper): only produced by #run, for [FLOAT:8] results
+                bool bval;
+            };
+        } literal;
+        struct {
+            Token token;
+            AST *expr;
+        } ret;
+        struct {
+            Token token;
+            TypeExpr type;
+            AST *expr;
+        } run;
+        struct {
+            // NOTE(jesper): while loops only have a condition and a body, for loops also have
+            // an init and step statement. Parallel loops are parsed into the for loop of their
+            // range, with the upper bound as the rhs of the condition
+            Token token;
+            AST *init;
+            AST *cond;
+            AST *step;
+            AST *body;
+            LoopHints hints;
+            bool parallel;
+        } loop;
+        struct {
+            // NOTE(jesper): the cases are AST_SWITCH_CASE nodes, in source order. The else case
+            // has no values, and there's at most one of them
+            Token token;
+            TypeExpr type;
+            AST *expr;
+            AST *cases;
+        } switch_stmt;
+        struct {
+            // NOTE(jesper): the body runs when the switch value is equal to any of the values,
+            // integer literals, and cases don't fall through to the next one
+            Token token;
+            AST *values;
+            AST *body;
+        } switch_case;
+        struct {
+            // NOTE(jesper): a single element is splat to every lane
+            Token token;
+            TypeExpr type;
+            AST *elems;
+        } vector;
+        struct {
+            // NOTE(jesper): `v[i]` with a constant index and `v.xyzw` both select lanes, a
+            // single lane results in a scalar
+            Token token;
+            TypeExpr type;
+            AST *expr;
+            i32 count;
+            u8 lanes[4];
+        } swizzle;
+        struct {
+            Token token;
+            TypeExpr type;
+            ReduceOp op;
+            AST *expr;
+        } reduce;
+        struct {
+            // NOTE(jesper): indexing a SIMD vector with a constant is turned into a swizzle by
+            // the typechecker
+            Token token;
+            TypeExpr type;
+            AST *expr;
+            AST *index;
+            bool field_access;  // only a field of the element is accessed, `a[i].x`
+        } index;
+        struct {
+            Token token;
+            AST *lhs;   // AST_INDEX
+            AST *rhs;
+        } index_store;
+        struct {
+            Token token;
+            AST *expr;
+        } count;
+        struct {
+            // NOTE(jesper): `.count` of arrays and `.xyzw` of SIMD vectors are parsed as fields
+            // too, the typechecker turns them into AST_COUNT and AST_SWIZZLE
+            Token token;
+            TypeExpr type;
+            AST *expr;
+            i32 index;  // into StructType::fields
+        } field;
+        struct {
+            Token token;
+            AST *lhs;   // AST_FIELD
+            AST *rhs;
+        } field_store;
+        struct {
+            // NOTE(jesper): AST_ADDRESS_OF of a variable or array element, and AST_DEREF of a
+            // pointer
+            Token token;
+            TypeExpr type;
+            AST *expr;
+        } unary;
+        struct {
+            Token token;
+            AST *lhs;   // AST_DEREF
+            AST *rhs;
+        } deref_store;
+        struct {
+            // NOTE(jesper): args is the pointer followed by the operands of the op, the type is
+            // what the pointer points to
+            Token token;
+            TypeExpr type;
+            AtomicOp op;
+            AtomicOrder order;
+            AST *args;
+        } atomic;
+        struct {
+            Token token;
+            TypeExpr type;
+            IntrinsicOp op;
+            AST *args;
+        } intrinsic;
+        struct {
+            // NOTE(jesper): a load of a constant array, index into Module::globals
+            Token token;
+            TypeExpr type;
+            i32 index;
+        } global;
+    };
+};
+
+enum SymbolType {
+    SYM_VARIABLE,
+    SYM_PROC,
+    SYM_STRUCT,
+    SYM_GENERIC,
+    SYM_CONSTANT,
+    SYM_GLOBAL,
+};
+
+// NOTE(jesper): generic procedures, declared with `$T : type` parameters, are parsed again from
+// their declaration for every distinct set of type arguments they're called with, with the type
+// parameters bound to them. The declaration itself only has the value parameters, and is what
+// the type arguments are deduced from
+struct GenericProc {
+    AST *decl;
+    Array<Token> type_params;
+
+    Lexer lexer;    // at the start of the declaration
+    Allocator mem;
+};
+
+struct TypeBinding {
+    String name;
+    TypeExpr type;
+};
+
+struct Symbol {
+    SymbolType type;
+    union {
+        struct {
+            TypeExpr type;
+        } variable;
+        struct {
+            AST *ast;
+        } proc;
+        struct {
+            StructType *type;
+        } struct_decl;
+        struct {
+            GenericProc *proc;
+        } generic;
+        struct {
+            AST *value;     // the folded AST_LITERAL, or the AST_RUN it's initialised by
+        } constant;
+        struct {
+            i32 index;      // into Module::globals
+        } global;
+    };
+};
+
+// NOTE(jesper): top-level constant arrays, `NAME :: [N]T(e0, e1, ...);`, with every element
+// folded to an AST_LITERAL of the element type. An element that is a #run directive is an
+// AST_RUN until the directives are evaluated. They're emitted as read-only globals rather
+// than being built on the stack of every procedure that uses them
+struct GlobalConstant {
+    Token identifier;
+    TypeExpr type;
+    AST *elems;
+};
+
+// NOTE(jesper): a variable declared in the current scope, with the symbol it shadows so the
+// symbol can be restored when the scope ends
+struct ScopedSymbol {
+    String name;
+    Symbol shadowed;
+    bool has_shadowed;
+};
+
+struct Module {
+    AST *ast;
+    AST *entry;
+
+    DynamicArray<AST*> procedures;
+    HashTable<String, Symbol> symbols;
+    DynamicArray<GlobalConstant> globals;
+
+    // NOTE(jesper): the instantiations of generic procedures by their name, which is the
+    // procedure's with its type arguments, like `sum[i32]`. They're added to the end of the
+    // module's AST as they're first called, and checked and lowered like any other procedure
+    HashTable<String, AST*> instances;
+
+    // NOTE(jesper): the type parameters in scope of the generic procedure being parsed
+    DynamicArray<TypeBinding> type_bindings;
+
+    // NOTE(jesper): the variables declared by the procedure, loop or switch case being checked,
+    // in declaration order. A scope is the count at its start, and is popped back down to it
+    DynamicArray<ScopedSymbol> scope;
+};
+
+#endif // TIR_H
@@ -0,0 +1,600 @@
+#include "vm.h"
+#include "ir.h"
+#include "process.h"
+#include "thread.h"
+
+#include <string.h>
+
+constexpr i32 VM_STACK_SIZE = 1024*1024;
+constexpr i32 VM_MAX_FRAMES = 64*1024;
+
+constexpr i32 VM_NATIVE_INT_ARGS = 6;
+constexpr i32 VM_NATIVE_FLOAT_ARGS = 8;
+
+static f32 f32_from_bits(u64 bits) { f32 f; u32 b = (u32)bits; memcpy(&f, &b, sizeof f); return f; }
+static f64 f64_from_bits(u64 bits) { f64 f; memcpy(&f, &bits, sizeof f); return f; }
+static u64 bits_from_f32(f32 f) { u32 b; memcpy(&b, &f, sizeof b); return b; }
+static u64 bits_from_f64(f64 f) { u64 b; memcpy(&b, &f, sizeof b); return b; }
+
+static void vm_emit(VmProgram *program, VmOp op, i32 dst, i32 a = 0, i32 b = 0)
+{
+    array_add(&program->code, VmInst{ .op = op, .dst = dst, .a = a, .b = b });
+}
+
+static void vm_emit_extend(VmProgram *program, TypeExpr type, i32 reg)
+{
+    if (type == T_SIGNED) {
+        switch (type.size) {
+        case 1: vm_emit(program, VM_SEXT8, reg); break;
+        case 2: vm_emit(program, VM_SEXT16, reg); break;
+        case 4: vm_emit(program, VM_SEXT32, reg); break;
+        }
+    } else if (type == T_UNSIGNED) {
+        switch (type.size) {
+        case 1: vm_emit(program, VM_ZEXT8, reg); break;
+        case 2: vm_emit(program, VM_ZEXT16, reg); break;
+        case 4: vm_emit(program, VM_ZEXT32, reg); break;
+        }
+    }
+}
+
+static bool vm_supported_type(TypeExpr type)
+{
+    return type.lanes == 0 && type.elems == 0 && type.pointers == 0 && type != T_STRUCT;
+}
+
+static bool vm_compile_proc(VmProgram *program, IrModule *ir, i32 index)
+{
+    SArena scratch = tl_scratch_arena(program->code.alloc);
+
+    IrProc *proc = &ir->procs[index];
+    VmProc *dst = &program->procs[index];
+
+    dst->code_offset = program->code.count;
+    dst->reg_count = proc->regs.count + proc->locals.count + proc->params.count;
+
+    // NOTE(jesper): registers are 64 bits, so SIMD vectors, arrays and structs are left to the
+    // native backends. The procedure is compiled to an error when it's called rather than
+    // failing the whole program, so that the rest of the module can still be interpreted
+    bool unsupported = !vm_supported_type(proc->ret_type);
+    for (TypeExpr &type : proc->params) unsupported = unsupported || !vm_supported_type(type);
+    for (TypeExpr &type : proc->regs) unsupported = unsupported || !vm_supported_type(type);
+    for (IrLocal &local : proc->locals) unsupported = unsupported || !vm_supported_type(local.type);
+    if (unsupported) {
+        vm_emit(program, VM_UNSUPPORTED, IR_NONE);
+        return true;
+    }
+
+    // NOTE(jesper): locals are allocated registers after the IR's own, followed by the
+    // parameters which the caller writes to
+    auto local_reg = [proc](i32 local) { return proc->regs.count + local; };
+    auto param_reg = [proc](i32 param) { return proc->regs.count + proc->locals.count + param; };
+
+    // NOTE(jesper): jump targets are emitted as block indices and patched to code offsets once
+    // every block has been emitted
+    Array<i32> block_offsets = array_create<i32>(proc->blocks.count, scratch);
+    DynamicArray<i32> fixups{ .alloc = scratch };
+
+    auto phi_copy = [program](i32 shadow, i32 value)
+    {
+        vm_emit(program, VM_MOV, shadow, value);
+    };
+
+    for (i32 bi = 0; bi < proc->blocks.count; bi++) {
+        block_offsets[bi] = program->code.count;
+
+        for (IrInst &inst : proc->blocks[bi].insts) {
+            if (ir_is_terminator(inst.op)) ir_for_each_phi_copy(proc, bi, phi_copy);
+
+            switch (inst.op) {
+            case IR_NOP:
+                break;
+            case IR_PHI:
+                vm_emit(program, VM_MOV, inst.dst, inst.shadow);
+                break;
+            case IR_CONST: {
+                TypeExpr type = proc->regs[inst.dst];
+
+                u64 value;
+                if (type == T_FLOAT) value = type.size == 4 ? bits_from_f32((f32)inst.fval) : bits_from_f64(inst.fval);
+                else value = inst.ival;
+
+                if (type != T_FLOAT && inst.ival >= i32_MIN && inst.ival <= i32_MAX) {
+                    vm_emit(program, VM_CONST_I32, inst.dst, (i32)inst.ival);
+                } else {
+                    vm_emit(program, VM_CONST, inst.dst, array_add(&program->constants, value));
+                }
+                } break;
+            case IR_COPY:
+            case IR_EXPECT:
+            case IR_EXTEND: // registers already hold integers extended by their own type
+                vm_emit(program, VM_MOV, inst.dst, inst.a);
+                break;
+            case IR_PARAM:
+                vm_emit(program, VM_MOV, inst.dst, param_reg(inst.param));
+                break;
+            case IR_ADD:
+            case IR_SUB:
+            case IR_MUL:
+            case IR_DIV: {
+                TypeExpr type = proc->regs[inst.dst];
+
+                VmOp op;
+                if (type == T_FLOAT) {
+                    static const VmOp f32_ops[] = { VM_FADD32, VM_FSUB32, VM_FMUL32, VM_FDIV32 };
+                    static const VmOp f64_ops[] = { VM_FADD64, VM_FSUB64, VM_FMUL64, VM_FDIV64 };
+                    op = (type.size == 4 ? f32_ops : f64_ops)[inst.op - IR_ADD];
+                } else {
+                    switch (inst.op) {
+                    case IR_ADD: op = VM_ADD; break;
+                    case IR_SUB: op = VM_SUB; break;
+                    case IR_MUL: op = VM_MUL; break;
+                    default:     op = type == T_SIGNED ? VM_SDIV : VM_UDIV; break;
+                    }
+                }
+
+                vm_emit(program, op, inst.dst, inst.a, inst.b);
+                vm_emit_extend(program, type, inst.dst);
+                } break;
+            case IR_EQ:
+            case IR_NE:
+            case IR_LT:
+            case IR_LE:
+            case IR_GT:
+            case IR_GE: {
+                TypeExpr type = proc->regs[inst.a];
+
+                // NOTE(jesper): indexed by EQ, NE, LT, LE
+                static const VmOp s_ops[]   = { VM_EQ, VM_NE, VM_SLT, VM_SLE };
+                static const VmOp u_ops[]   = { VM_EQ, VM_NE, VM_ULT, VM_ULE };
+                static const VmOp f32_ops[] = { VM_FEQ32, VM_FNE32, VM_FLT32, VM_FLE32 };
+                static const VmOp f64_ops[] = { VM_FEQ64, VM_FNE64, VM_FLT64, VM_FLE64 };
+
+                const VmOp *ops = u_ops;
+                if (type == T_FLOAT) ops = type.size == 4 ? f32_ops : f64_ops;
+                else if (type == T_SIGNED) ops = s_ops;
+
+                i32 a = inst.a, b = inst.b;
+                IrOp op = inst.op;
+                if (op == IR_GT || op == IR_GE) {
+                    SWAP(a, b);
+                    op = op == IR_GT ? IR_LT : IR_LE;
+                }
+
+                vm_emit(program, ops[op - IR_EQ], inst.dst, a, b);
+                } break;
+            case IR_LOAD:
+                vm_emit(program, VM_MOV, inst.dst, local_reg(inst.local));
+                break;
+            case IR_STORE:
+                vm_emit(program, VM_MOV, local_reg(inst.local), inst.a);
+                break;
+            case IR_CALL: {
+                VmProc *callee = &program->procs[inst.proc];
+                if (!callee->defined && !callee->native_abi) {
+                    LOG_ERROR("vm: too many arguments to call foreign procedure '%.*s'", STRFMT(callee->name));
+                    return false;
+                }
+
+                i32 args = program->args.count;
+                array_add(&program->args, proc->args.data + inst.args, inst.arg_count);
+                vm_emit(program, callee->defined ? VM_CALL : VM_CALL_FOREIGN, inst.dst, inst.proc, args);
+                } break;
+            case IR_RET:
+                if (inst.a != IR_NONE) vm_emit(program, VM_RET, IR_NONE, inst.a);
+                else vm_emit(program, VM_RET_VOID, IR_NONE);
+                break;
+            case IR_JUMP:
+                array_add(&fixups, program->code.count);
+                vm_emit(program, inst.target <= bi ? VM_LOOP : VM_JMP, IR_NONE, inst.target);
+                break;
+            case IR_BRANCH:
+                array_add(&fixups, program->code.count);
+                vm_emit(program, VM_BRANCH, inst.target, inst.a, inst.target_else);
+                break;
+            case IR_SWITCH: {
+                // NOTE(jesper): the IR only has switches over dense sets of cases, the gaps
+                // between them go to the else target
+                IrSwitchCase *cases = &proc->switch_cases[inst.cases];
+                i64 lo = cases[0].value;
+                i64 count = cases[inst.case_count-1].value - lo + 1;
+
+                i32 table = array_add(&program->jump_tables, lo);
+                array_add(&program->jump_tables, count);
+                for (i64 i = 0; i < count; i++) array_add(&program->jump_tables, (i64)inst.target_else);
+                for (i32 i = 0; i < inst.case_count; i++) {
+                    program->jump_tables[table + 2 + (i32)(cases[i].value - lo)] = cases[i].target;
+                }
+
+                array_add(&fixups, program->code.count);
+                vm_emit(program, VM_SWITCH, inst.target_else, inst.a, table);
+                } break;
+            default:
+                LOG_ERROR("vm: unsupported IR instruction '%s'", sz_from_enum(inst.op));
+                return false;
+            }
+        }
+    }
+
+    for (i32 offset : fixups) {
+        VmInst &inst = program->code[offset];
+        if (inst.op == VM_BRANCH) {
+            inst.dst = block_offsets[inst.dst];
+            inst.b = block_offsets[inst.b];
+        } else if (inst.op == VM_SWITCH) {
+            inst.dst = block_offsets[inst.dst];
+            i64 *entries = &program->jump_tables[inst.b + 2];
+            for (i64 i = 0; i < program->jump_tables[inst.b + 1]; i++) entries[i] = block_offsets[(i32)entries[i]];
+        } else {
+            inst.a = block_offsets[inst.a];
+        }
+    }
+
+    return true;
+}
+
+bool vm_compile(VmProgram *program, IrModule *ir, Allocator mem)
+{
+    *program = {
+        .code = { .alloc = mem },
+        .constants = { .alloc = mem },
+        .procs = { .alloc = mem },
+        .args = { .alloc = mem },
+        .jump_tables = { .alloc = mem },
+    };
+
+    for (IrProc &proc : ir->procs) {
+        i32 int_count = 0, float_count = 0;
+        bool unsupported = !vm_supported_type(proc.ret_type);
+        Array<TypeExpr> params = array_create<TypeExpr>(proc.params.count, mem);
+        for (i32 i = 0; i < params.count; i++) {
+            params[i] = proc.params[i];
+            if (params[i] == T_FLOAT) float_count++;
+            else int_count++;
+            unsupported = unsupported || !vm_supported_type(params[i]);
+        }
+
+        array_add(&program->procs, VmProc{
+            .name = proc.name,
+            .ret_type = proc.ret_type,
+            .params = params,
+            .native_abi = !unsupported && int_count <= VM_NATIVE_INT_ARGS && float_count <= VM_NATIVE_FLOAT_ARGS,
+            .defined = proc.defined,
+        });
+    }
+
+    for (i32 i = 0; i < ir->procs.count; i++) {
+        if (ir->procs[i].defined && !vm_compile_proc(program, ir, i)) return false;
+        program->procs[i].code_count = program->code.count - program->procs[i].code_offset;
+    }
+
+    return true;
+}
+
+bool vm_resolve_foreign(VmProgram *program, Array<char*> libraries, Array<i32> roots)
+{
+    SArena scratch = tl_scratch_arena();
+
+    Array<bool> called = array_create<bool>(program->procs.count, scratch);
+    for (bool &it : called) it = false;
+
+    if (roots.count == 0) {
+        for (VmInst &inst : program->code) {
+            if (inst.op == VM_CALL_FOREIGN) called[inst.a] = true;
+        }
+    } else {
+        Array<bool> reached = array_create<bool>(program->procs.count, scratch);
+        for (bool &it : reached) it = false;
+
+        DynamicArray<i32> worklist{ .alloc = scratch };
+        for (i32 root : roots) {
+            if (!reached[root]) array_add(&worklist, root);
+            reached[root] = true;
+        }
+
+        while (worklist.count > 0) {
+            VmProc *proc = &program->procs[array_pop(&worklist)];
+            for (i32 i = 0; i < proc->code_count; i++) {
+                VmInst &inst = program->code[proc->code_offset + i];
+                if (inst.op == VM_CALL_FOREIGN) called[inst.a] = true;
+                else if (inst.op == VM_CALL && !reached[inst.a]) {
+                    reached[inst.a] = true;
+                    array_add(&worklist, inst.a);
+                }
+            }
+        }
+    }
+
+    bool any_called = false;
+    for (i32 i = 0; i < called.count; i++) any_called |= called[i] && !program->procs[i].foreign;
+    if (!any_called) return true;
+
+    Array<void*> handles = array_create<void*>(libraries.count, scratch);
+    for (i32 i = 0; i < libraries.count; i++) {
+        if (!(handles[i] = load_library(libraries[i]))) return false;
+    }
+
+    for (i32 i = 0; i < program->procs.count; i++) {
+        VmProc *proc = &program->procs[i];
+        if (!called[i] || proc->foreign) continue;
+
+        char *name = sz_string(proc->name, scratch);
+        for (void *handle : handles) {
+            if ((proc->foreign = find_library_symbol(handle, name))) break;
+        }
+
+        if (!proc->foreign) proc->foreign = find_library_symbol(nullptr, name);
+        if (!proc->foreign) {
+            LOG_ERROR("vm: unresolved foreign procedure '%s'", name);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+i32 vm_find_proc(VmProgram *program, String name)
+{
+    for (i32 i = 0; i < program->procs.count; i++) {
+        if (program->procs[i].name == name && program->procs[i].defined) return i;
+    }
+
+    return -1;
+}
+
+void vm_enable_tiering(VmProgram *program, u32 threshold, VmHotProc on_hot, void *user_data, Allocator mem)
+{
+    program->native = ALLOC_ARR(mem, void*, program->procs.count);
+    for (i32 i = 0; i < program->procs.count; i++) program->native[i] = nullptr;
+
+    program->hot_threshold = threshold;
+    program->on_hot = on_hot;
+    program->hot_user_data = user_data;
+}
+
+// NOTE(jesper): the trampoline calls native code, foreign or compiled by a higher tier, through
+// a function pointer of the matching return type, and converts the result to the VM's register
+// representation. Integer and float arguments are assigned registers independently of each
+// other in the SysV calling convention, so every call passes the maximum number of both and
+// the callee ignores the ones it doesn't take.
+// TODO(jesper): the win64 calling convention assigns registers by argument position, mixing
+// integer and float parameters doesn't work there
+static u64 vm_call_native(void *fp, VmProc *callee, const u64 *regs, const i32 *arg_regs)
+{
+    u64 i[VM_NATIVE_INT_ARGS] = {};
+    f64 f[VM_NATIVE_FLOAT_ARGS] = {};
+
+    i32 int_count = 0, float_count = 0;
+    for (i32 arg = 0; arg < callee->params.count; arg++) {
+        u64 value = regs[arg_regs[arg]];
+        if (callee->params[arg] == T_FLOAT) {
+            // NOTE(jesper): an f32 is passed in the low bits of the register
+            memcpy(&f[float_count++], &value, sizeof value);
+        } else {
+            i[int_count++] = value;
+        }
+    }
+
+#define NATIVE_ARGS i[0], i[1], i[2], i[3], i[4], i[5], f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7]
+#define NATIVE_FN(ret) ((ret(*)(u64, u64, u64, u64, u64, u64, f64, f64, f64, f64, f64, f64, f64, f64))fp)
+
+    TypeExpr type = callee->ret_type;
+    switch (type.prim) {
+    case T_VOID:
+        NATIVE_FN(void)(NATIVE_ARGS);
+        return 0;
+    case T_FLOAT:
+        if (type.size == 4) return bits_from_f32(NATIVE_FN(f32)(NATIVE_ARGS));
+        return bits_from_f64(NATIVE_FN(f64)(NATIVE_ARGS));
+    case T_SIGNED:
+        switch (type.size) {
+        case 1: return (u64)(i64)NATIVE_FN(i8)(NATIVE_ARGS);
+        case 2: return (u64)(i64)NATIVE_FN(i16)(NATIVE_ARGS);
+        case 4: return (u64)(i64)NATIVE_FN(i32)(NATIVE_ARGS);
+        }
+        return (u64)NATIVE_FN(i64)(NATIVE_ARGS);
+    case T_BOOL:
+        return NATIVE_FN(bool)(NATIVE_ARGS);
+    default:
+        switch (type.size) {
+        case 1: return NATIVE_FN(u8)(NATIVE_ARGS);
+        case 2: return NATIVE_FN(u16)(NATIVE_ARGS);
+        case 4: return NATIVE_FN(u32)(NATIVE_ARGS);
+        }
+        return NATIVE_FN(u64)(NATIVE_ARGS);
+    }
+
+#undef NATIVE_FN
+#undef NATIVE_ARGS
+}
+
+bool vm_run(VmProgram *program, i32 entry, u64 *result)
+{
+    struct VmFrame {
+        const VmInst *ip;
+        u64 *regs;
+        VmProc *proc;
+    };
+
+    u64 *stack = ALLOC_ARR(mem_dynamic, u64, VM_STACK_SIZE);
+    VmFrame *frames = ALLOC_ARR(mem_dynamic, VmFrame, VM_MAX_FRAMES);
+    defer {
+        FREE(mem_dynamic, stack);
+        FREE(mem_dynamic, frames);
+    };
+
+    const VmInst *code = program->code.data;
+    const u64 *constants = program->constants.data;
+    const i32 *args = program->args.data;
+    const i64 *jump_tables = program->jump_tables.data;
+
+    VmProc *proc = &program->procs[entry];
+    const VmInst *ip = code + proc->code_offset;
+    u64 *regs = stack;
+    i32 depth = 0;
+
+    if (proc->reg_count > VM_STACK_SIZE) {
+        LOG_ERROR("vm: stack overflow");
+        return false;
+    }
+
+    // NOTE(jesper): the dispatch table has to list the handlers in the same order as VmOp
+    static const void *dispatch[] = {
+        &&op_const, &&op_const_i32, &&op_mov,
+        &&op_add, &&op_sub, &&op_mul, &&op_sdiv, &&op_udiv,
+        &&op_fadd32, &&op_fsub32, &&op_fmul32, &&op_fdiv32,
+        &&op_fadd64, &&op_fsub64, &&op_fmul64, &&op_fdiv64,
+        &&op_eq, &&op_ne, &&op_slt, &&op_sle, &&op_ult, &&op_ule,
+        &&op_feq32, &&op_fne32, &&op_flt32, &&op_fle32,
+        &&op_feq64, &&op_fne64, &&op_flt64, &&op_fle64,
+        &&op_sext8, &&op_sext16, &&op_sext32, &&op_zext8, &&op_zext16, &&op_zext32,
+        &&op_call, &&op_call_foreign,
+        &&op_ret, &&op_ret_void,
+        &&op_jmp, &&op_loop, &&op_branch, &&op_switch,
+        &&op_unsupported,
+    };
+    static_assert(ARRAY_COUNT(dispatch) == VM_OP_COUNT, "dispatch table out of sync with VmOp");
+
+#define DISPATCH() goto *dispatch[ip->op]
+#define NEXT() do { ip++; DISPATCH(); } while (0)
+
+    u64 value;
+    DISPATCH();
+
+op_const:     regs[ip->dst] = constants[ip->a]; NEXT();
+op_const_i32: regs[ip->dst] = (u64)(i64)ip->a; NEXT();
+op_mov:       regs[ip->dst] = regs[ip->a]; NEXT();
+
+op_add: regs[ip->dst] = regs[ip->a] + regs[ip->b]; NEXT();
+op_sub: regs[ip->dst] = regs[ip->a] - regs[ip->b]; NEXT();
+op_mul: regs[ip->dst] = regs[ip->a] * regs[ip->b]; NEXT();
+op_sdiv:
+    if (regs[ip->b] == 0) goto division_by_zero;
+    // NOTE(jesper): INT64_MIN / -1 traps on x86-64, the result wraps around instead
+    if ((i64)regs[ip->b] == -1) regs[ip->dst] = 0 - regs[ip->a];
+    else regs[ip->dst] = (u64)((i64)regs[ip->a] / (i64)regs[ip->b]);
+    NEXT();
+op_udiv:
+    if (regs[ip->b] == 0) goto division_by_zero;
+    regs[ip->dst] = regs[ip->a] / regs[ip->b];
+    NEXT();
+
+op_fadd32: regs[ip->dst] = bits_from_f32(f32_from_bits(regs[ip->a]) + f32_from_bits(regs[ip->b])); NEXT();
+op_fsub32: regs[ip->dst] = bits_from_f32(f32_from_bits(regs[ip->a]) - f32_from_bits(regs[ip->b])); NEXT();
+op_fmul32: regs[ip->dst] = bits_from_f32(f32_from_bits(regs[ip->a]) * f32_from_bits(regs[ip->b])); NEXT();
+op_fdiv32: regs[ip->dst] = bits_from_f32(f32_from_bits(regs[ip->a]) / f32_from_bits(regs[ip->b])); NEXT();
+
+op_fadd64: regs[ip->dst] = bits_from_f64(f64_from_bits(regs[ip->a]) + f64_from_bits(regs[ip->b])); NEXT();
+op_fsub64: regs[ip->dst] = bits_from_f64(f64_from_bits(regs[ip->a]) - f64_from_bits(regs[ip->b])); NEXT();
+op_fmul64: regs[ip->dst] = bits_from_f64(f64_from_bits(regs[ip->a]) * f64_from_bits(regs[ip->b])); NEXT();
+op_fdiv64: regs[ip->dst] = bits_from_f64(f64_from_bits(regs[ip->a]) / f64_from_bits(regs[ip->b])); NEXT();
+
+op_eq:  regs[ip->dst] = regs[ip->a] == regs[ip->b]; NEXT();
+op_ne:  regs[ip->dst] = regs[ip->a] != regs[ip->b]; NEXT();
+op_slt: regs[ip->dst] = (i64)regs[ip->a] < (i64)regs[ip->b]; NEXT();
+op_sle: regs[ip->dst] = (i64)regs[ip->a] <= (i64)regs[ip->b]; NEXT();
+op_ult: regs[ip->dst] = regs[ip->a] < regs[ip->b]; NEXT();
+op_ule: regs[ip->dst] = regs[ip->a] <= regs[ip->b]; NEXT();
+
+op_feq32: regs[ip->dst] = f32_from_bits(regs[ip->a]) == f32_from_bits(regs[ip->b]); NEXT();
+op_fne32: regs[ip->dst] = f32_from_bits(regs[ip->a]) != f32_from_bits(regs[ip->b]); NEXT();
+op_flt32: regs[ip->dst] = f32_from_bits(regs[ip->a]) < f32_from_bits(regs[ip->b]); NEXT();
+op_fle32: regs[ip->dst] = f32_from_bits(regs[ip->a]) <= f32_from_bits(regs[ip->b]); NEXT();
+
+op_feq64: regs[ip->dst] = f64_from_bits(regs[ip->a]) == f64_from_bits(regs[ip->b]); NEXT();
+op_fne64: regs[ip->dst] = f64_from_bits(regs[ip->a]) != f64_from_bits(regs[ip->b]); NEXT();
+op_flt64: regs[ip->dst] = f64_from_bits(regs[ip->a]) < f64_from_bits(regs[ip->b]); NEXT();
+op_fle64: regs[ip->dst] = f64_from_bits(regs[ip->a]) <= f64_from_bits(regs[ip->b]); NEXT();
+
+op_sext8:  regs[ip->dst] = (u64)(i64)(i8)regs[ip->dst]; NEXT();
+op_sext16: regs[ip->dst] = (u64)(i64)(i16)regs[ip->dst]; NEXT();
+op_sext32: regs[ip->dst] = (u64)(i64)(i32)regs[ip->dst]; NEXT();
+op_zext8:  regs[ip->dst] = (u8)regs[ip->dst]; NEXT();
+op_zext16: regs[ip->dst] = (u16)regs[ip->dst]; NEXT();
+op_zext32: regs[ip->dst] = (u32)regs[ip->dst]; NEXT();
+
+op_call: {
+        VmProc *callee = &program->procs[ip->a];
+        if (program->native && callee->native_abi) {
+            if (void *fp = atomic_load(&program->native[ip->a]); fp) {
+                value = vm_call_native(fp, callee, regs, args + ip->b);
+                if (ip->dst != IR_NONE) regs[ip->dst] = value;
+                NEXT();
+            }
+
+            if (++callee->call_count == program->hot_threshold) {
+                program->on_hot(program, ip->a, program->hot_user_data);
+            }
+        }
+
+        if (depth+1 >= VM_MAX_FRAMES || regs + proc->reg_count + callee->reg_count > stack + VM_STACK_SIZE) {
+            LOG_ERROR("vm: stack overflow calling '%.*s'", STRFMT(callee->name));
+            return false;
+        }
+
+        u64 *callee_regs = regs + proc->reg_count;
+        u64 *params = callee_regs + callee->reg_count - callee->params.count;
+        for (i32 i = 0; i < callee->params.count; i++) params[i] = regs[args[ip->b + i]];
+
+        frames[depth++] = { ip, regs, proc };
+        regs = callee_regs;
+        proc = callee;
+        ip = code + callee->code_offset;
+    }
+    DISPATCH();
+
+op_call_foreign:
+    value = vm_call_native(program->procs[ip->a].foreign, &program->procs[ip->a], regs, args + ip->b);
+    if (ip->dst != IR_NONE) regs[ip->dst] = value;
+    NEXT();
+
+op_ret:
+    value = regs[ip->a];
+    goto ret;
+op_ret_void:
+    value = 0;
+ret:
+    if (depth == 0) {
+        *result = value;
+        return true;
+    }
+
+    {
+        VmFrame &frame = frames[--depth];
+        ip = frame.ip;
+        regs = frame.regs;
+        proc = frame.proc;
+    }
+
+    if (ip->dst != IR_NONE) regs[ip->dst] = value;
+    NEXT();
+
+op_loop:
+    // NOTE(jesper): loop iterations count towards making the procedure hot, so that one that's
+    // only called once but spends its time in a loop is compiled for the next time it's called
+    if (program->native && proc->native_abi && ++proc->call_count == program->hot_threshold) {
+        program->on_hot(program, (i32)(proc - program->procs.data), program->hot_user_data);
+    }
+op_jmp:
+    ip = code + ip->a;
+    DISPATCH();
+op_branch:
+    ip = code + (regs[ip->a] ? ip->dst : ip->b);
+    DISPATCH();
+op_switch:
+    // NOTE(jesper): values below the lowest case wrap around to the top of the range
+    value = regs[ip->a] - (u64)jump_tables[ip->b];
+    ip = code + (value < (u64)jump_tables[ip->b + 1] ? jump_tables[ip->b + 2 + value] : ip->dst);
+    DISPATCH();
+
+op_unsupported:
+    LOG_ERROR("vm: '%.*s' uses SIMD vector, array, struct or pointer types, which the interpreter doesn't support", STRFMT(proc->name));
+    return false;
+
+division_by_zero:
+    LOG_ERROR("vm: division by zero in '%.*s'", STRFMT(proc->name));
+    return false;
+
+#undef NEXT
+#undef DISPATCH
+}
@@ -0,0 +1,145 @@
+#ifndef VM_H
+#define VM_H
+
+#include "array.h"
+#include "tir.h"
+
+struct IrModule;
+
+// NOTE(jesper): register based bytecode interpreter, compiled from the IR in a single pass.
+// Every IR register and local maps to a 64 bit VM register, integers are kept sign or zero
+// extended from their type's size and floats are stored as their bit pattern. It exists so
+// that code can be executed without initialising or running LLVM at all
+enum VmOp : u8 {
+    VM_CONST,           // r[dst] = constants[a]
+    VM_CONST_I32,       // r[dst] = (i64)a
+    VM_MOV,             // r[dst] = r[a]
+
+    VM_ADD,             // r[dst] = r[a] op r[b]
+    VM_SUB,
+    VM_MUL,
+    VM_SDIV,
+    VM_UDIV,
+
+    VM_FADD32,
+    VM_FSUB32,
+    VM_FMUL32,
+    VM_FDIV32,
+
+    VM_FADD64,
+    VM_FSUB64,
+    VM_FMUL64,
+    VM_FDIV64,
+
+    VM_EQ,              // r[dst] = r[a] cmp r[b], greater than is emitted with the operands swapped
+    VM_NE,
+    VM_SLT,
+    VM_SLE,
+    VM_ULT,
+    VM_ULE,
+
+    VM_FEQ32,
+    VM_FNE32,
+    VM_FLT32,
+    VM_FLE32,
+
+    VM_FEQ64,
+    VM_FNE64,
+    VM_FLT64,
+    VM_FLE64,
+
+    VM_SEXT8,           // r[dst] = extend(r[dst])
+    VM_SEXT16,
+    VM_SEXT32,
+    VM_ZEXT8,
+    VM_ZEXT16,
+    VM_ZEXT32,
+
+    VM_CALL,            // r[dst] = procs[a](r[args[b]], ...), dst is IR_NONE for void calls
+    VM_CALL_FOREIGN,
+
+    VM_RET,             // return r[a]
+    VM_RET_VOID,
+
+    VM_JMP,             // goto code[a]
+    VM_LOOP,            // goto code[a], a loop's backedge
+    VM_BRANCH,          // goto r[a] ? code[dst] : code[b]
+    VM_SWITCH,          // goto code[jump_tables[b + 2 + r[a] - lo]], or code[dst] if it's out of range
+    VM_UNSUPPORTED,     // abort, the procedure can't be run by the interpreter
+
+    VM_OP_COUNT,
+};
+
+struct VmInst {
+    VmOp op;
+    i32 dst;
+    i32 a;
+    i32 b;
+};
+
+struct VmProc {
+    String name;
+    TypeExpr ret_type;
+
+    // NOTE(jesper): the parameters are passed in the last registers of the callee's frame
+    Array<TypeExpr> params;
+
+    // NOTE(jesper): whether the arguments fit in the registers the trampoline passes to native
+    // code, 6 integers and 8 floats and no SIMD vectors. Other procedures can't be called natively from the
+    // interpreter
+    bool native_abi;
+
+    bool defined;
+    i32 code_offset;
+    i32 code_count;
+    i32 reg_count;
+
+    // NOTE(jesper): resolved address of #foreign procedures
+    void *foreign;
+
+    // NOTE(jesper): number of times the procedure has been called from the interpreter, plus the
+    // number of loop iterations it has run. Only counted while tiering is enabled
+    u32 call_count;
+};
+
+struct VmProgram;
+typedef void (*VmHotProc)(VmProgram *program, i32 proc, void *user_data);
+
+struct VmProgram {
+    DynamicArray<VmInst> code;
+    DynamicArray<u64> constants;
+    DynamicArray<VmProc> procs;
+    DynamicArray<i32> args;
+
+    // NOTE(jesper): a jump table of VM_SWITCH is its lowest case value and number of entries,
+    // followed by the code offset of each entry
+    DynamicArray<i64> jump_tables;
+
+    // NOTE(jesper): tiered execution. When native is set, it's an indirection table with an
+    // entry per procedure that another thread may fill in with the address of a compiled
+    // version at any time, which calls from the interpreter switch to from then on. on_hot is
+    // called once for a procedure, on the interpreter's thread, when its call count reaches
+    // hot_threshold. A long running loop makes its procedure hot as well, but the invocation
+    // that's already running stays in the interpreter
+    void **native;
+    u32 hot_threshold;
+    VmHotProc on_hot;
+    void *hot_user_data;
+};
+
+bool vm_compile(VmProgram *program, IrModule *ir, Allocator mem);
+
+// NOTE(jesper): resolves the #foreign procedures that are called from the listed libraries
+// first, in the order they're given, and then from the symbols loaded into the process. With
+// roots, only the procedures that can be reached from them are resolved, and the libraries are
+// only loaded if any of those call a #foreign procedure
+bool vm_resolve_foreign(VmProgram *program, Array<char*> libraries, Array<i32> roots = {});
+
+// NOTE(jesper): enables tiered execution, allocating the indirection table with mem. The
+// program must be compiled first
+void vm_enable_tiering(VmProgram *program, u32 threshold, VmHotProc on_hot, void *user_data, Allocator mem);
+
+i32 vm_find_proc(VmProgram *program, String name);
+bool vm_run(VmProgram *program, i32 proc, u64 *result);
+
+#endif // VM_H
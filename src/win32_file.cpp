@@ -455,6 +455,74 @@ u64 file_modified_timestamp(String path)
     return -1;
 }
 
+u64 file_size(String path)
+{
+    SArena scratch = tl_scratch_arena();
+    char *sz_path = sz_string(path, scratch);
+
+    HANDLE file = win32_open_file(sz_path, OPEN_EXISTING, GENERIC_READ);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        LOG_ERROR("unable to open file to get size: '%.*s' - (%d) '%s'", STRFMT(path), WIN32_ERR_STR);
+        return 0;
+    }
+
+    defer { CloseHandle(file); };
+
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size)) return size.QuadPart;
+    return 0;
+}
+
+void touch_file(String path)
+{
+    SArena scratch = tl_scratch_arena();
+    char *sz_path = sz_string(path, scratch);
+
+    HANDLE file = win32_open_file(sz_path, OPEN_EXISTING, GENERIC_WRITE);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        LOG_ERROR("unable to open file to update timestamp: '%.*s' - (%d) '%s'", STRFMT(path), WIN32_ERR_STR);
+        return;
+    }
+
+    defer { CloseHandle(file); };
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(file, nullptr, &now, &now);
+}
+
+bool set_file_executable(String /*path*/)
+{
+    // NOTE(jesper): executability is determined by the file extension on windows
+    return true;
+}
+
+bool create_directory(String path)
+{
+    SArena scratch = tl_scratch_arena();
+    char *sz_path = sz_string(path, scratch);
+
+    // NOTE(jesper): create each missing parent directory in turn, skipping the drive letter
+    for (char *p = sz_path+1; *p; p++) {
+        if (*p != '/' && *p != '\\') continue;
+        if (*(p-1) == ':') continue;
+
+        char c = *p;
+        *p = '\0';
+        CreateDirectoryA(sz_path, nullptr);
+        *p = c;
+    }
+
+    if (!CreateDirectoryA(sz_path, nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        LOG_ERROR("failed to create directory: '%s' - (%d) '%s'", sz_path, WIN32_ERR_STR);
+        return false;
+    }
+
+    return true;
+}
+
 void remove_file(String path)
 {
     SArena scratch = tl_scratch_arena();
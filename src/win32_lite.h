@@ -393,6 +393,7 @@ typedef long long LONGLONG;
 typedef float FLOAT;
 
 typedef DWORD *LPDWORD;
+typedef LONG *LPLONG;
 typedef UINT *PUINT;
 
 typedef WORD ATOM;
@@ -701,6 +702,17 @@ extern "C" {
 
     BOOL ReleaseMutex(HANDLE hMutex);
 
+    HANDLE CreateSemaphoreA(
+        LPSECURITY_ATTRIBUTES lpSemaphoreAttributes,
+        LONG                  lInitialCount,
+        LONG                  lMaximumCount,
+        LPCSTR                lpName);
+
+    BOOL ReleaseSemaphore(
+        HANDLE hSemaphore,
+        LONG   lReleaseCount,
+        LPLONG lpPreviousCount);
+
     void Sleep(DWORD dwMilliseconds);
 
     DWORD GetLastError();
@@ -816,6 +828,12 @@ extern "C" {
         LPFILETIME lpLastAccessTime,
         LPFILETIME lpLastWriteTime);
 
+    BOOL SetFileTime(
+        HANDLE         hFile,
+        const FILETIME *lpCreationTime,
+        const FILETIME *lpLastAccessTime,
+        const FILETIME *lpLastWriteTime);
+
     void GetSystemTimeAsFileTime(LPFILETIME lpSystemTimeAsFileTime);
 
     HMODULE GetModuleHandleA(LPCSTR lpModuleName);
@@ -122,3 +122,16 @@ bool get_exit_code(Process *process, i32 *exit_code)
 
     return false;
 }
+
+void* load_library(const char *path)
+{
+    HMODULE library = LoadLibraryA(path);
+    if (!library) LOG_ERROR("failed to load library '%s': (%d) %s", path, WIN32_ERR_STR);
+    return library;
+}
+
+void* find_library_symbol(void *library, const char *name)
+{
+    HMODULE module = library ? (HMODULE)library : GetModuleHandleA(nullptr);
+    return (void*)GetProcAddress(module, name);
+}
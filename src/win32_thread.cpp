@@ -27,6 +27,24 @@ void unlock_mutex(Mutex *m)
     ReleaseMutex(h);
 }
 
+Semaphore* create_semaphore(i32 initial_count)
+{
+    HANDLE h = CreateSemaphoreA(NULL, initial_count, i32_MAX, NULL);
+    return (Semaphore*)h;
+}
+
+void signal_semaphore(Semaphore *s)
+{
+    HANDLE h = (HANDLE)s;
+    ReleaseSemaphore(h, 1, NULL);
+}
+
+void wait_semaphore(Semaphore *s)
+{
+    HANDLE h = (HANDLE)s;
+    WaitForSingleObject(h, WIN32_INFINITE);
+}
+
 Thread* create_thread(ThreadProc proc, void *user_data)
 {
     extern Allocator mem_sys;
@@ -47,3 +65,20 @@ Thread* create_thread(ThreadProc proc, void *user_data)
 
     return t;
 }
+
+void wait_for_thread(Thread *t)
+{
+    extern Allocator mem_sys;
+
+    WaitForSingleObject(t->handle, WIN32_INFINITE);
+    CloseHandle(t->handle);
+
+    FREE(mem_sys, t);
+}
+
+i32 get_hardware_thread_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (i32)info.dwNumberOfProcessors : 1;
+}
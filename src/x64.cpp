@@ -0,0 +1,555 @@
+#include "x64.h"
+#include "ir.h"
+#include "elf.h"
+
+#include <string.h>
+
+struct X64Symbol {
+    i32 proc;
+    u64 offset;
+    u64 size;
+};
+
+// NOTE(jesper): a rel32 jump displacement at offset in the text, to the start of block
+struct X64Fixup {
+    i32 offset;
+    i32 block;
+};
+
+struct X64Emitter {
+    IrModule *ir;
+    IrProc *proc;
+
+    DynamicArray<i32> block_offsets;
+    DynamicArray<X64Fixup> fixups;
+
+    DynamicArray<u8> text;
+    DynamicArray<ElfRela> relocations;
+
+    // NOTE(jesper): the ELF symbol index of a symbol is its index in this array + 1, index 0
+    // is the reserved null symbol. Procedures only get a symbol once they're defined or called
+    DynamicArray<X64Symbol> symbols;
+    Array<i32> proc_symbols;
+};
+
+static void emit(X64Emitter *e, std::initializer_list<u8> bytes)
+{
+    array_add(&e->text, bytes);
+}
+
+static void emit_u32(X64Emitter *e, u32 value)
+{
+    array_add(&e->text, (u8*)&value, sizeof value);
+}
+
+static void emit_u64(X64Emitter *e, u64 value)
+{
+    array_add(&e->text, (u8*)&value, sizeof value);
+}
+
+static void emit_block_rel32(X64Emitter *e, i32 block)
+{
+    array_add(&e->fixups, X64Fixup{ .offset = e->text.count, .block = block });
+    emit_u32(e, 0);
+}
+
+static i32 x64_symbol(X64Emitter *e, i32 proc)
+{
+    if (e->proc_symbols[proc] == 0) {
+        e->proc_symbols[proc] = array_add(&e->symbols, X64Symbol{ .proc = proc }) + 1;
+    }
+
+    return e->proc_symbols[proc];
+}
+
+static bool x64_unsupported(const char *what)
+{
+    LOG_INFO("fast backend: unsupported %s", what);
+    return false;
+}
+
+static bool x64_supported_type(TypeExpr type)
+{
+    if (type.lanes > 0 || type.elems != 0 || type.pointers != 0) return false;
+
+    switch (type.prim) {
+    case T_SIGNED:
+    case T_UNSIGNED:
+        return type.size == 1 || type.size == 2 || type.size == 4 || type.size == 8;
+    case T_BOOL:
+        return type.size == 1;
+    default:
+        return false;
+    }
+}
+
+// NOTE(jesper): every register and local gets an 8 byte stack slot. Registers always hold
+// their value sign or zero extended from their type's size to 64 bits, so that the 64 bit
+// arithmetic and division instructions produce the right result
+static i32 reg_offset(X64Emitter *e, i32 reg)
+{
+    return -8*(reg + 1);
+}
+
+static i32 local_offset(X64Emitter *e, i32 local)
+{
+    return -8*(e->proc->regs.count + local + 1);
+}
+
+// NOTE(jesper): the parameters are spilled from their registers in the prologue to the slots
+// following the locals
+static i32 param_offset(X64Emitter *e, i32 param)
+{
+    return -8*(e->proc->regs.count + e->proc->locals.count + param + 1);
+}
+
+// NOTE(jesper): SysV integer argument registers, rdi, rsi, rdx, rcx, r8 and r9, as the rex
+// prefix and modrm byte of a `mov reg, [rbp+disp32]` or `mov [rbp+disp32], reg`
+struct X64ArgReg {
+    u8 rex;
+    u8 modrm;
+};
+
+static const X64ArgReg x64_arg_regs[] = {
+    { 0x48, 0xbd }, { 0x48, 0xb5 }, { 0x48, 0x95 }, { 0x48, 0x8d }, { 0x4c, 0x85 }, { 0x4c, 0x8d },
+};
+
+static void emit_load_reg(X64Emitter *e, u8 modrm, i32 reg)
+{
+    emit(e, { 0x48, 0x8b, modrm });                         // mov r64, qword [rbp+disp32]
+    emit_u32(e, reg_offset(e, reg));
+}
+
+static void emit_store_reg(X64Emitter *e, i32 reg)
+{
+    emit(e, { 0x48, 0x89, 0x85 });                          // mov qword [rbp+disp32], rax
+    emit_u32(e, reg_offset(e, reg));
+}
+
+static void emit_extend_rax(X64Emitter *e, TypeExpr type)
+{
+    if (type == T_SIGNED) {
+        switch (type.size) {
+        case 1: emit(e, { 0x48, 0x0f, 0xbe, 0xc0 }); break; // movsx rax, al
+        case 2: emit(e, { 0x48, 0x0f, 0xbf, 0xc0 }); break; // movsx rax, ax
+        case 4: emit(e, { 0x48, 0x63, 0xc0 }); break;       // movsxd rax, eax
+        }
+    } else {
+        switch (type.size) {
+        case 1: emit(e, { 0x0f, 0xb6, 0xc0 }); break;       // movzx eax, al
+        case 2: emit(e, { 0x0f, 0xb7, 0xc0 }); break;       // movzx eax, ax
+        case 4: emit(e, { 0x89, 0xc0 }); break;             // mov eax, eax
+        }
+    }
+}
+
+static void emit_load_local(X64Emitter *e, i32 local)
+{
+    TypeExpr type = e->proc->locals[local].type;
+    if (type == T_SIGNED) {
+        switch (type.size) {
+        case 1: emit(e, { 0x48, 0x0f, 0xbe, 0x85 }); break; // movsx rax, byte [rbp+disp32]
+        case 2: emit(e, { 0x48, 0x0f, 0xbf, 0x85 }); break; // movsx rax, word [rbp+disp32]
+        case 4: emit(e, { 0x48, 0x63, 0x85 }); break;       // movsxd rax, dword [rbp+disp32]
+        case 8: emit(e, { 0x48, 0x8b, 0x85 }); break;       // mov rax, qword [rbp+disp32]
+        }
+    } else {
+        switch (type.size) {
+        case 1: emit(e, { 0x0f, 0xb6, 0x85 }); break;       // movzx eax, byte [rbp+disp32]
+        case 2: emit(e, { 0x0f, 0xb7, 0x85 }); break;       // movzx eax, word [rbp+disp32]
+        case 4: emit(e, { 0x8b, 0x85 }); break;             // mov eax, dword [rbp+disp32]
+        case 8: emit(e, { 0x48, 0x8b, 0x85 }); break;       // mov rax, qword [rbp+disp32]
+        }
+    }
+
+    emit_u32(e, local_offset(e, local));
+}
+
+static void emit_store_local(X64Emitter *e, i32 local)
+{
+    switch (e->proc->locals[local].type.size) {
+    case 1: emit(e, { 0x88, 0x85 }); break;                 // mov byte [rbp+disp32], al
+    case 2: emit(e, { 0x66, 0x89, 0x85 }); break;           // mov word [rbp+disp32], ax
+    case 4: emit(e, { 0x89, 0x85 }); break;                 // mov dword [rbp+disp32], eax
+    case 8: emit(e, { 0x48, 0x89, 0x85 }); break;           // mov qword [rbp+disp32], rax
+    }
+
+    emit_u32(e, local_offset(e, local));
+}
+
+static void emit_epilogue(X64Emitter *e)
+{
+    emit(e, { 0x48, 0x89, 0xec }); // mov rsp, rbp
+    emit(e, { 0x5d });             // pop rbp
+    emit(e, { 0xc3 });             // ret
+}
+
+static bool x64_emit_inst(X64Emitter *e, IrInst *inst)
+{
+    IrProc *proc = e->proc;
+
+    switch (inst->op) {
+    case IR_NOP:
+        break;
+    case IR_CONST:
+        if (inst->ival >= i32_MIN && inst->ival <= i32_MAX) {
+            emit(e, { 0x48, 0xc7, 0xc0 });                  // mov rax, imm32
+            emit_u32(e, (u32)inst->ival);
+        } else {
+            emit(e, { 0x48, 0xb8 });                        // mov rax, imm64
+            emit_u64(e, inst->ival);
+        }
+        emit_store_reg(e, inst->dst);
+        break;
+    case IR_COPY:
+    case IR_EXPECT:
+    case IR_EXTEND: // every result is stored extended to 64 bits by its type
+        emit_load_reg(e, 0x85, inst->a);
+        emit_store_reg(e, inst->dst);
+        break;
+    case IR_PHI:
+        emit_load_reg(e, 0x85, inst->shadow);
+        emit_store_reg(e, inst->dst);
+        break;
+    case IR_PARAM:
+        // NOTE(jesper): the upper bits of an argument register are undefined for types smaller
+        // than 64 bits, so the value is extended like any other result
+        emit(e, { 0x48, 0x8b, 0x85 });                      // mov rax, qword [rbp+disp32]
+        emit_u32(e, param_offset(e, inst->param));
+        emit_extend_rax(e, proc->regs[inst->dst]);
+        emit_store_reg(e, inst->dst);
+        break;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV: {
+        TypeExpr type = proc->regs[inst->dst];
+
+        emit_load_reg(e, 0x85, inst->a);                    // rax = a
+        emit_load_reg(e, 0x8d, inst->b);                    // rcx = b
+
+        switch (inst->op) {
+        case IR_ADD: emit(e, { 0x48, 0x01, 0xc8 }); break;       // add rax, rcx
+        case IR_SUB: emit(e, { 0x48, 0x29, 0xc8 }); break;       // sub rax, rcx
+        case IR_MUL: emit(e, { 0x48, 0x0f, 0xaf, 0xc1 }); break; // imul rax, rcx
+        default:
+            if (type == T_SIGNED) {
+                emit(e, { 0x48, 0x99 });                    // cqo
+                emit(e, { 0x48, 0xf7, 0xf9 });              // idiv rcx
+            } else {
+                emit(e, { 0x31, 0xd2 });                    // xor edx, edx
+                emit(e, { 0x48, 0xf7, 0xf1 });              // div rcx
+            }
+            break;
+        }
+
+        emit_extend_rax(e, type);
+        emit_store_reg(e, inst->dst);
+        } break;
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE: {
+        // NOTE(jesper): setcc condition codes, indexed by EQ, NE, LT, LE, GT, GE
+        static const u8 s_cc[] = { 0x94, 0x95, 0x9c, 0x9e, 0x9f, 0x9d };
+        static const u8 u_cc[] = { 0x94, 0x95, 0x92, 0x96, 0x97, 0x93 };
+        const u8 *cc = proc->regs[inst->a] == T_SIGNED ? s_cc : u_cc;
+
+        emit_load_reg(e, 0x85, inst->a);                    // rax = a
+        emit_load_reg(e, 0x8d, inst->b);                    // rcx = b
+        emit(e, { 0x48, 0x39, 0xc8 });                      // cmp rax, rcx
+        emit(e, { 0x0f, cc[inst->op - IR_EQ], 0xc0 });      // setcc al
+        emit(e, { 0x0f, 0xb6, 0xc0 });                      // movzx eax, al
+        emit_store_reg(e, inst->dst);
+        } break;
+    case IR_LOAD:
+        emit_load_local(e, inst->local);
+        emit_store_reg(e, inst->dst);
+        break;
+    case IR_STORE:
+        emit_load_reg(e, 0x85, inst->a);
+        emit_store_local(e, inst->local);
+        break;
+    case IR_CALL:
+        if (inst->arg_count > ARRAY_COUNT(x64_arg_regs)) return x64_unsupported("number of arguments");
+
+        for (i32 i = 0; i < inst->arg_count; i++) {
+            emit(e, { x64_arg_regs[i].rex, 0x8b, x64_arg_regs[i].modrm }); // mov reg, qword [rbp+disp32]
+            emit_u32(e, reg_offset(e, proc->args[inst->args + i]));
+        }
+
+        // NOTE(jesper): every call goes through a relocation, whether the procedure is defined
+        // in this object or not, and the linker resolves it. The frame size is a multiple of
+        // 16 so the stack is already aligned
+        emit(e, { 0xe8 });                                  // call rel32
+        array_add(&e->relocations, ElfRela{
+            .offset = (u64)e->text.count,
+            .info = elf_rela_info(x64_symbol(e, inst->proc), ELF_R_X86_64_PLT32),
+            .addend = -4,
+        });
+        emit_u32(e, 0);
+
+        if (inst->dst != IR_NONE) {
+            emit_extend_rax(e, proc->regs[inst->dst]);
+            emit_store_reg(e, inst->dst);
+        }
+        break;
+    case IR_RET:
+        if (inst->a != IR_NONE) emit_load_reg(e, 0x85, inst->a);
+        emit_epilogue(e);
+        break;
+    case IR_JUMP:
+        emit(e, { 0xe9 });                                  // jmp rel32
+        emit_block_rel32(e, inst->target);
+        break;
+    case IR_BRANCH:
+        emit_load_reg(e, 0x85, inst->a);
+        emit(e, { 0x84, 0xc0 });                            // test al, al
+        emit(e, { 0x0f, 0x85 });                            // jne rel32
+        emit_block_rel32(e, inst->target);
+        emit(e, { 0xe9 });                                  // jmp rel32
+        emit_block_rel32(e, inst->target_else);
+        break;
+    case IR_SWITCH:
+        // NOTE(jesper): the cases are compared one by one. A jump table would need a section of
+        // its own in the object, with relocations for every entry
+        emit_load_reg(e, 0x85, inst->a);
+        for (i32 i = 0; i < inst->case_count; i++) {
+            IrSwitchCase &it = proc->switch_cases[inst->cases + i];
+            if (it.value < i32_MIN || it.value > i32_MAX) return x64_unsupported("switch case value");
+
+            emit(e, { 0x48, 0x3d });                        // cmp rax, imm32
+            emit_u32(e, (u32)it.value);
+            emit(e, { 0x0f, 0x84 });                        // je rel32
+            emit_block_rel32(e, it.target);
+        }
+        emit(e, { 0xe9 });                                  // jmp rel32
+        emit_block_rel32(e, inst->target_else);
+        break;
+    case IR_FENCE:
+        // NOTE(jesper): x86 only reorders stores after later loads, which only a sequentially
+        // consistent fence has to prevent
+        if (inst->order == ORDER_SEQ_CST) emit(e, { 0x0f, 0xae, 0xf0 });   // mfence
+        break;
+    default:
+        return x64_unsupported(sz_from_enum(inst->op));
+    }
+
+    return true;
+}
+
+static bool x64_emit_proc(X64Emitter *e, i32 index)
+{
+    IrProc *proc = e->proc = &e->ir->procs[index];
+
+    if (proc->ret_type != T_VOID && !x64_supported_type(proc->ret_type)) return x64_unsupported("return type");
+    if (proc->params.count > ARRAY_COUNT(x64_arg_regs)) return x64_unsupported("number of parameters");
+    for (TypeExpr &type : proc->params) {
+        if (!x64_supported_type(type)) return x64_unsupported("parameter type");
+    }
+    for (TypeExpr &type : proc->regs) {
+        if (!x64_supported_type(type)) return x64_unsupported("register type");
+    }
+    for (IrLocal &local : proc->locals) {
+        if (!x64_supported_type(local.type)) return x64_unsupported("local type");
+    }
+
+    // NOTE(jesper): pad procedure entries to 16 bytes with int3
+    while (e->text.count % 16 != 0) emit(e, { 0xcc });
+
+    X64Symbol *sym = &e->symbols[x64_symbol(e, index)-1];
+    sym->offset = e->text.count;
+
+    u32 frame_size = (8*(proc->regs.count + proc->locals.count + proc->params.count) + 15) & ~15;
+
+    emit(e, { 0x55 });                   // push rbp
+    emit(e, { 0x48, 0x89, 0xe5 });       // mov rbp, rsp
+    emit(e, { 0x48, 0x81, 0xec });       // sub rsp, imm32
+    emit_u32(e, frame_size);
+
+    for (i32 i = 0; i < proc->params.count; i++) {
+        emit(e, { x64_arg_regs[i].rex, 0x89, x64_arg_regs[i].modrm }); // mov qword [rbp+disp32], reg
+        emit_u32(e, param_offset(e, i));
+    }
+
+    e->block_offsets.count = 0;
+    e->fixups.count = 0;
+
+    auto phi_copy = [e](i32 shadow, i32 value)
+    {
+        emit_load_reg(e, 0x85, value);
+        emit_store_reg(e, shadow);
+    };
+
+    for (i32 bi = 0; bi < proc->blocks.count; bi++) {
+        array_add(&e->block_offsets, e->text.count);
+
+        for (IrInst &inst : proc->blocks[bi].insts) {
+            if (ir_is_terminator(inst.op)) ir_for_each_phi_copy(proc, bi, phi_copy);
+
+            if (!x64_emit_inst(e, &inst)) return false;
+        }
+    }
+
+    for (X64Fixup &fixup : e->fixups) {
+        u32 rel = (u32)(e->block_offsets[fixup.block] - (fixup.offset + 4));
+        memcpy(&e->text[fixup.offset], &rel, sizeof rel);
+    }
+
+    // NOTE(jesper): the symbol array may have grown while emitting the body
+    sym = &e->symbols[x64_symbol(e, index)-1];
+    sym->size = e->text.count - sym->offset;
+    return true;
+}
+
+static u64 append_aligned(DynamicArray<u8> *out, void *data, i32 size, i32 alignment)
+{
+    while (out->count % alignment != 0) array_add(out, (u8)0);
+
+    u64 offset = out->count;
+    array_add(out, (u8*)data, size);
+    return offset;
+}
+
+bool x64_emit_object(IrModule *ir, DynamicArray<u8> *object)
+{
+    SArena scratch = tl_scratch_arena();
+
+    X64Emitter e{
+        .ir = ir,
+        .block_offsets = { .alloc = scratch },
+        .fixups = { .alloc = scratch },
+        .text = { .alloc = scratch },
+        .relocations = { .alloc = scratch },
+        .symbols = { .alloc = scratch },
+        .proc_symbols = array_create<i32>(ir->procs.count, scratch),
+    };
+    for (i32 &it : e.proc_symbols) it = 0;
+
+    for (i32 i = 0; i < ir->procs.count; i++) {
+        if (ir->procs[i].defined && !x64_emit_proc(&e, i)) return false;
+    }
+
+    DynamicArray<char> strtab{ .alloc = scratch };
+    array_add(&strtab, '\0');
+
+    DynamicArray<ElfSymbol> symtab{ .alloc = scratch };
+    array_add(&symtab, ElfSymbol{});
+
+    for (X64Symbol &sym : e.symbols) {
+        IrProc *proc = &ir->procs[sym.proc];
+
+        u32 name = strtab.count;
+        array_add(&strtab, proc->name.data, proc->name.length);
+        array_add(&strtab, '\0');
+
+        array_add(&symtab, ElfSymbol{
+            .name = name,
+            .info = elf_symbol_info(ELF_STB_GLOBAL, proc->defined ? ELF_STT_FUNC : ELF_STT_NOTYPE),
+            .shndx = (u16)(proc->defined ? 1 : ELF_SHN_UNDEF),
+            .value = sym.offset,
+            .size = sym.size,
+        });
+    }
+
+    enum {
+        SECTION_NULL,
+        SECTION_TEXT,
+        SECTION_RELA_TEXT,
+        SECTION_SYMTAB,
+        SECTION_STRTAB,
+        SECTION_SHSTRTAB,
+        SECTION_NOTE_GNU_STACK,
+        SECTION_COUNT,
+    };
+
+    static const char shstrtab[] = "\0.text\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+    auto shstrtab_name = [](const char *name) -> u32
+    {
+        for (u32 i = 1; i < sizeof shstrtab; i += strlen(&shstrtab[i]) + 1) {
+            if (strcmp(&shstrtab[i], name) == 0) return i;
+        }
+        return 0;
+    };
+
+    object->count = 0;
+
+    ElfHeader header{};
+    append_aligned(object, &header, sizeof header, 1);
+
+    u64 text_offset = append_aligned(object, e.text.data, e.text.count, 16);
+    u64 rela_offset = append_aligned(object, e.relocations.data, e.relocations.count*sizeof(ElfRela), 8);
+    u64 symtab_offset = append_aligned(object, symtab.data, symtab.count*sizeof(ElfSymbol), 8);
+    u64 strtab_offset = append_aligned(object, strtab.data, strtab.count, 1);
+    u64 shstrtab_offset = append_aligned(object, (void*)shstrtab, sizeof shstrtab, 1);
+
+    ElfSectionHeader shdrs[SECTION_COUNT]{};
+    shdrs[SECTION_TEXT] = {
+        .name = shstrtab_name(".text"),
+        .type = ELF_SHT_PROGBITS,
+        .flags = ELF_SHF_ALLOC | ELF_SHF_EXECINSTR,
+        .offset = text_offset,
+        .size = (u64)e.text.count,
+        .addralign = 16,
+    };
+    shdrs[SECTION_RELA_TEXT] = {
+        .name = shstrtab_name(".rela.text"),
+        .type = ELF_SHT_RELA,
+        .flags = ELF_SHF_INFO_LINK,
+        .offset = rela_offset,
+        .size = e.relocations.count*sizeof(ElfRela),
+        .link = SECTION_SYMTAB,
+        .info = SECTION_TEXT,
+        .addralign = 8,
+        .entsize = sizeof(ElfRela),
+    };
+    shdrs[SECTION_SYMTAB] = {
+        .name = shstrtab_name(".symtab"),
+        .type = ELF_SHT_SYMTAB,
+        .offset = symtab_offset,
+        .size = symtab.count*sizeof(ElfSymbol),
+        .link = SECTION_STRTAB,
+        .info = 1, // index of the first non-local symbol
+        .addralign = 8,
+        .entsize = sizeof(ElfSymbol),
+    };
+    shdrs[SECTION_STRTAB] = {
+        .name = shstrtab_name(".strtab"),
+        .type = ELF_SHT_STRTAB,
+        .offset = strtab_offset,
+        .size = (u64)strtab.count,
+        .addralign = 1,
+    };
+    shdrs[SECTION_SHSTRTAB] = {
+        .name = shstrtab_name(".shstrtab"),
+        .type = ELF_SHT_STRTAB,
+        .offset = shstrtab_offset,
+        .size = sizeof shstrtab,
+        .addralign = 1,
+    };
+    shdrs[SECTION_NOTE_GNU_STACK] = {
+        .name = shstrtab_name(".note.GNU-stack"),
+        .type = ELF_SHT_PROGBITS,
+        .offset = shstrtab_offset,
+        .addralign = 1,
+    };
+
+    u64 shoff = append_aligned(object, shdrs, sizeof shdrs, 8);
+
+    header = {
+        .endian = ELF_LE,
+        .abi = ELF_ABI_SYSV,
+        .type = ELF_TYPE_REL,
+        .machine = ELF_MACHINE_X86_64,
+        .shoff = shoff,
+        .ehsize = sizeof(ElfHeader),
+        .shentsize = sizeof(ElfSectionHeader),
+        .shnum = SECTION_COUNT,
+        .shstrndx = SECTION_SHSTRTAB,
+    };
+    memcpy(object->data, &header, sizeof header);
+
+    return true;
+}
@@ -0,0 +1,15 @@
+#ifndef X64_H
+#define X64_H
+
+#include "array.h"
+
+struct IrModule;
+
+// NOTE(jesper): the fast backend lowers the IR straight to x86-64 machine code and
+// writes it out as a relocatable ELF object, without going through LLVM. It's meant for -O0
+// builds where compile latency matters more than code quality, and only covers a subset of
+// the language; it returns false for anything it doesn't support so that the caller can
+// fall back to the LLVM backend
+bool x64_emit_object(IrModule *ir, DynamicArray<u8> *object);
+
+#endif // X64_H
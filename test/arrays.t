@@ -0,0 +1,21 @@
+sum :: (s : []i32) -> i32
+{
+    total : i32 = 0;
+    for i : i64 = 0; i < s.count; i = i + 1 {
+        total = total + s[i];
+    }
+
+    return total;
+}
+
+main :: () -> i32
+{
+    a : [8]i32;
+    for j : i32 = 0; j < 8; j = j + 1 {
+        a[j] = j * 2;
+    }
+
+    a[3] = 1;
+    k : i32 = 2;
+    return sum(a) + a[7] + a[1 + k] + a[8 - k];
+}
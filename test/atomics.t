@@ -0,0 +1,35 @@
+Ring :: struct #align(64) {
+    head : i32;
+    tail : i32;
+}
+
+increment :: (counter : *i32) -> i32
+{
+    old : i32 = atomic_load(counter, relaxed);
+    while atomic_cas(counter, old, old + 1, acq_rel) != old {
+        old = atomic_load(counter, relaxed);
+    }
+
+    return old + 1;
+}
+
+main :: () -> i32
+{
+    ring : Ring;
+    atomic_store(&ring.tail, 5, release);
+    atomic_add(&ring.head, 3, seq_cst);
+    prev : i32 = atomic_xchg(&ring.tail, 7, acq_rel);
+    atomic_fence(seq_cst);
+
+    counters : [4]i32;
+    for i : i32 = 0; i < 4; i = i + 1 {
+        atomic_or(&counters[i], 8, relaxed);
+        atomic_max(&counters[i], 10, relaxed);
+    }
+
+    n : i32 = 0;
+    increment(&n);
+    increment(&n);
+
+    return atomic_load(&ring.head, acquire) + prev + atomic_load(&ring.tail, relaxed) + counters[3] + n;
+}
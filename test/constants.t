@@ -0,0 +1,74 @@
+SIZE :: 8;
+HALF :: SIZE / 2;
+SCALE :: 2.5;
+DEBUG :: HALF * 2 != SIZE;
+
+SQUARES :: [8]i32(0, 1, 4, 9, 16, 25, 36, 49);
+WEIGHTS :: [4]f32(0.5, 1.0, SCALE, 4.0);
+MASKS :: [4]u8(1, 2, 4, 128);
+CUBES :: [2]i32(#run cube(2), 27);
+HALVES :: [HALF]i32(1, 2, 3, 4);
+
+cube :: (x : i32) -> i32
+{
+    return x * x * x;
+}
+
+sum :: (s : []i32) -> i32
+{
+    total : i32 = 0;
+    for i : i64 = 0; i < s.count; i = i + 1 {
+        total = total + s[i];
+    }
+
+    return total;
+}
+
+weighted :: (x : f32) -> f32
+{
+    w : f32 = 0.0;
+    for i : i32 = 0; i < WEIGHTS.count; i = i + 1 {
+        w = w + WEIGHTS[i]*x;
+    }
+
+    return w;
+}
+
+main :: () -> i32
+{
+    total : i32 = sum(SQUARES) + SQUARES[HALF];
+    for i : i32 = 0; i < HALF; i = i + 1 {
+        total = total + SQUARES[i];
+    }
+
+    w : f32 = weighted(2.0);
+    while w > 15.0 {
+        w = w - 4.0;
+        total = total + 1;
+    }
+
+    m : u8 = MASKS[3] / MASKS[2];
+    while m > 1 {
+        m = m / 2;
+        total = total + 1;
+    }
+
+    switch total {
+    case SIZE: total = 0;
+    case HALF, 176: total = total + 1;
+    case:
+    }
+
+    debug : bool = DEBUG;
+    while debug {
+        debug = false;
+        total = 0;
+    }
+
+    quarters : [HALF]i32;
+    for i : i32 = 0; i < quarters.count; i = i + 1 {
+        quarters[i] = i;
+    }
+
+    return total + sum(quarters) + HALVES[3] + CUBES[1] / CUBES[0] + #run SIZE * 3;
+}
@@ -0,0 +1,9 @@
+main :: () -> i32
+{
+    n : i32 = 5;
+    while n > 0 { n = n - 1; {} }
+    for i : i32 = 0; i < 3; i = i + 1 {}
+    k : i32 = 0;
+    while k < 4 { k = k + 1; { k = k + 1; n = n + 1; } }
+    return n * 10 + k;
+}
@@ -0,0 +1,54 @@
+Vec2 :: struct {
+    x : i32;
+    y : i32;
+}
+
+sum :: ($T : type, values : []T) -> T
+{
+    total : T = 0;
+    for i : i64 = 0; i < values.count; i = i + 1 {
+        total = total + values[i];
+    }
+
+    return total;
+}
+
+max :: ($T : type, a : T, b : T) -> T
+{
+    result : T = a;
+    while b > result {
+        result = b;
+    }
+
+    return result;
+}
+
+count :: ($T : type, values : []T) -> i64
+{
+    return values.count;
+}
+
+main :: () -> i32
+{
+    a : [4]i32;
+    for i : i32 = 0; i < 4; i = i + 1 {
+        a[i] = i + 1;
+    }
+
+    b : [3]i64;
+    b[0] = 5;
+    b[2] = 7;
+
+    points : [6]Vec2;
+
+    x : i32 = 3;
+    result : i32 = sum(a) + sum(i32, a) + max(x, 6);
+
+    big : i64 = sum(b) - count(points);
+    while big > 0 {
+        result = result + 1;
+        big = big - 1;
+    }
+
+    return result;
+}
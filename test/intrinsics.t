@@ -0,0 +1,37 @@
+#hot sum :: (s : []i32) -> i32
+{
+    total : i32 = 0;
+    for i : i64 = 0; #likely i < s.count; i = i + 1 {
+        prefetch(&s[i]);
+        total = total + s[i];
+    }
+
+    return total;
+}
+
+#cold fail :: (code : i32) -> i32
+{
+    return code;
+}
+
+main :: () -> i32
+{
+    a : [8]i32;
+    for j : i32 = 0; j < 8; j = j + 1 {
+        a[j] = j;
+    }
+
+    x : i32 = 240;
+    y : i32 = 16777216;
+    r : i32 = 1;
+    bits : i32 = popcount(x) + clz(x) + ctz(x) + bswap(y) + rotl(rotr(r, 1), 2);
+
+    u : u32 = 4026531840;
+    n : i32 = 0;
+    while #unlikely ctz(u) < 28 {
+        n = fail(n + 1);
+        u = u + u;
+    }
+
+    return sum(a) + bits + n;
+}
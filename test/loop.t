@@ -0,0 +1,25 @@
+sum :: () -> i32
+{
+    total : i32 = 0;
+
+    #vectorize(4)
+    for i : i32 = 0; i < 10; i = i + 1 {
+        total = total + i;
+    }
+
+    return total;
+}
+
+main :: () -> i32
+{
+    n : i32 = 0;
+    count : i32 = 0;
+
+    #no_unroll
+    while n < 5 {
+        n = n + 1;
+        count = count + 2;
+    }
+
+    return sum() + count;
+}
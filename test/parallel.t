@@ -0,0 +1,26 @@
+fill :: (values : []i64, scale : i64)
+{
+    #grain(16) parallel for i in 0..values.count {
+        values[i] = i * scale;
+    }
+}
+
+main :: () -> i32
+{
+    a : [1000]i64;
+    fill(a, 2);
+
+    visited : i32 = 0;
+    counter : *i32 = &visited;
+    parallel for i in 0..a.count {
+        a[i] = a[i] + 1;
+        atomic_add(counter, 1, relaxed);
+    }
+
+    total : i64 = 0;
+    for i : i64 = 0; i < a.count; i = i + 1 {
+        total = total + a[i];
+    }
+
+    return visited - 1000 + 10;
+}
@@ -0,0 +1,17 @@
+madd :: (a : i32, b : i32, c : i32) -> i32
+{
+    return a * b + c;
+}
+
+#export scale :: (v : i64, by : i64) -> i64
+{
+    v = v * by;
+    return v;
+}
+
+main :: () -> i32
+{
+    x : i32 = madd(3, 4, 5);
+    y : i64 = scale(5, 4);
+    return madd(x, 2, 1) + x;
+}
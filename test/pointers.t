@@ -0,0 +1,47 @@
+Vec2 :: struct {
+    x : i32;
+    y : i32;
+}
+
+axpy :: (#restrict dst : []i32, #restrict src : []i32, a : i32)
+{
+    for i : i64 = 0; i < dst.count; i = i + 1 {
+        dst[i] = dst[i] + a * src[i];
+    }
+}
+
+swap :: (#restrict a : *i32, #restrict b : *i32)
+{
+    t : i32 = *a;
+    *a = *b;
+    *b = t;
+}
+
+bump :: (p : *Vec2)
+{
+    p[0].x = p[0].x + 1;
+}
+
+main :: () -> i32
+{
+    xs : [4]i32;
+    ys : [4]i32;
+    for k : i32 = 0; k < 4; k = k + 1 {
+        xs[k] = k;
+        ys[k] = 2;
+    }
+    axpy(xs, ys, 3);
+
+    x : i32 = 1;
+    y : i32 = 2;
+    swap(&x, &y);
+
+    v : Vec2;
+    bump(&v);
+    bump(&v);
+
+    p : *i32 = &xs[2];
+    *p = *p + p[1];
+
+    return xs[2] + x * 10 + y + v.x;
+}
@@ -0,0 +1,47 @@
+rare :: (x : i64) -> i64
+{
+    return x / 7;
+}
+
+unused :: (x : i64) -> i64
+{
+    return x * 3;
+}
+
+digit :: (x : i64) -> i64
+{
+    switch x - x / 4 * 4 {
+    case 0: return 3;
+    case 1: return 1;
+    case 2: return 4;
+    case:
+    }
+
+    return 1;
+}
+
+step :: (x : i64) -> i64
+{
+    switch x - x / 1000 * 1000 {
+    case 999: return rare(x);
+    case:
+    }
+
+    return x + digit(x);
+}
+
+main :: () -> i64
+{
+    total : i64 = 0;
+    for i : i64 = 0; i < 100000; i = i + 1 {
+        total = total + step(i) - i;
+    }
+
+    n : i64 = 0;
+    while n < 3 {
+        n = n + 1;
+    }
+
+    r : i64 = total + n;
+    return r - r / 256 * 256;
+}
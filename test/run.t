@@ -0,0 +1,14 @@
+square :: () -> i32
+{
+    n : i32 = 12;
+    return n * n;
+}
+
+AREA :: #run square();
+
+main :: ()
+{
+    x : i32 = #run square() - 100;
+    y : i32 = AREA;
+    return x + y / 12 + AREA - 144;
+}
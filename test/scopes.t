@@ -0,0 +1,46 @@
+loop_var :: () -> i32
+{
+    n : i32 = 0;
+    i : i32 = 40;
+
+    for i : i32 = 0; i < 3; i = i + 1 {
+        n = n + 1;
+    }
+
+    for i : i32 = 0; i < 2; i = i + 1 {
+        n = n + i;
+    }
+
+    return i + n;
+}
+
+body_var :: () -> i32
+{
+    x : i32 = 1;
+    c : bool = true;
+
+    while c {
+        x : i32 = 5;
+        c = false;
+    }
+
+    return x;
+}
+
+case_var :: (v : i32) -> i32
+{
+    y : i32 = 7;
+
+    switch v {
+    case 1:
+        y : i32 = 100;
+        y = y + 1;
+    }
+
+    return y;
+}
+
+main :: () -> i32
+{
+    return loop_var() + body_var() + case_var(1);
+}
@@ -0,0 +1,13 @@
+dot :: (a : i32x4, b : i32x4) -> i32
+{
+    return reduce_add(a * b);
+}
+
+main :: () -> i32
+{
+    v : i32x4 = i32x4(1, 2, 3, 4);
+    w : i32x4 = v.wzyx + i32x4(10);
+    lo : i32x2 = w.xy;
+
+    return dot(v, w) - reduce_max(w) + lo[1] + w[3];
+}
@@ -0,0 +1,74 @@
+fib :: (n : i32) -> i32
+{
+    a : i32 = 0;
+    b : i32 = 1;
+    while n > 0 {
+        t : i32 = a;
+        a = b;
+        b = t + b;
+        n = n - 1;
+    }
+
+    return a;
+}
+
+swaps :: (n : i32) -> i32
+{
+    x : i32 = 1;
+    y : i32 = 2;
+    for i : i32 = 0; i < n; i = i + 1 {
+        t : i32 = x;
+        x = y;
+        y = t;
+    }
+
+    return x*10 + y;
+}
+
+collatz :: (n : i64) -> i32
+{
+    steps : i32 = 0;
+    while n != 1 {
+        half : i64 = n / 2;
+        switch n - half*2 {
+        case 0: n = half;
+        case: n = 3*n + 1;
+        }
+        steps = steps + 1;
+    }
+
+    return steps;
+}
+
+average :: (n : i32) -> f32
+{
+    sum : f32 = 0.0;
+    count : f32 = 0.0;
+    done : bool = false;
+    while done == false {
+        sum = sum + 2.5;
+        count = count + 1.0;
+        n = n - 1;
+        done = n == 0;
+    }
+
+    return sum / count;
+}
+
+main :: () -> i32
+{
+    total : i32 = 0;
+    for i : i32 = 0; i < 3; i = i + 1 {
+        for j : i32 = 0; j < 4; j = j + 1 {
+            total = total + i*j;
+        }
+    }
+
+    a : f32 = average(4);
+    while a > 2.0 {
+        a = a - 1.0;
+        total = total + 1;
+    }
+
+    return fib(10) + swaps(3) + collatz(6) + total;
+}
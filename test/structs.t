@@ -0,0 +1,48 @@
+Particle :: struct {
+    alive : bool;
+    x : f32;
+    id : i32;
+    vel : f32x4;
+}
+
+Body :: struct #soa {
+    mass : i32;
+    charge : i64;
+}
+
+Header :: struct #packed #align(8) {
+    tag : u8;
+    len : i32;
+}
+
+total_mass :: (bodies : []Body) -> i32
+{
+    total : i32 = 0;
+    for i : i64 = 0; i < bodies.count; i = i + 1 {
+        total = total + bodies[i].mass;
+    }
+
+    return total;
+}
+
+main :: () -> i32
+{
+    p : Particle;
+    p.id = 5;
+    p.x = 1.5;
+
+    ps : [3]Particle;
+    ps[1].id = 7;
+    q : Particle = ps[1];
+
+    bodies : [4]Body;
+    for k : i32 = 0; k < 4; k = k + 1 {
+        bodies[k].mass = k * 2;
+        bodies[k].charge = 10;
+    }
+
+    h : Header;
+    h.len = 3;
+
+    return p.id + q.id + total_mass(bodies) + h.len;
+}
@@ -0,0 +1,53 @@
+run :: (program : i64) -> i32
+{
+    acc : i32 = 0;
+    while program > 0 {
+        next : i64 = program / 8;
+        op : i64 = program - next * 8;
+        program = next;
+
+        switch op {
+        case 1: acc = acc + 1;
+        case 2: acc = acc + acc;
+        case 3: acc = acc - 3;
+        case 4, 5:
+            acc = acc * 2;
+        case 6: program = 0;
+        case: acc = 0;
+        }
+    }
+
+    return acc;
+}
+
+classify :: (x : u32) -> i32
+{
+    switch x {
+    case 1: return 10;
+    case 100: return 20;
+    case 1000, 10000: return 30;
+    case 65536: return 40;
+    case:
+    }
+
+    return 0;
+}
+
+NEG :: -5;
+
+sign :: (x : i64) -> i32
+{
+    switch x {
+    case -1: return 1;
+    case NEG: return 2;
+    case 0: return 3;
+    case:
+    }
+
+    return 0;
+}
+
+main :: () -> i32
+{
+    return run(30786639) + classify(100) + classify(10000) + classify(7) + classify(65536) + sign(-5) * 10 + sign(-1);
+}
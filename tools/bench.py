@@ -0,0 +1,59 @@
+import sys, os, glob, time, argparse, statistics, subprocess
+
+# Compares the bytecode interpreter and the tiered backend against the JIT in run mode. All are
+# measured end to end, including process startup, so the numbers include LLVM initialisation for
+# the JIT and the cost of parsing for all of them.
+
+root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+parser = argparse.ArgumentParser(description="benchmark 'tir run' with the bytecode interpreter, the tiered backend and the JIT")
+parser.add_argument("files", nargs="*", help="programs to run, defaults to bench/*.t and test/*.t")
+parser.add_argument("--tir", default="tir", help="path to the tir executable")
+parser.add_argument("-n", type=int, default=5, help="number of runs per program and backend")
+parser.add_argument("-O", dest="opt", default="0", help="optimisation level for the JIT")
+parser.add_argument("-l", dest="libs", action="append", default=[], help="library to load for #foreign procedures")
+args = parser.parse_args()
+
+files = args.files or sorted(glob.glob(os.path.join(root, "bench", "*.t"))) + sorted(glob.glob(os.path.join(root, "test", "*.t")))
+
+modes = [
+    ("bytecode", ["--backend=bytecode"]),
+    ("tiered",   ["--backend=tiered"]),
+    ("jit",      ["--backend=llvm", "--no-cache", "-O" + args.opt]),
+]
+
+def run(file, flags):
+    cmd = [args.tir, "run", file] + flags
+    for lib in args.libs: cmd += ["-l", lib]
+
+    start = time.perf_counter()
+    result = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return time.perf_counter() - start, result.returncode
+
+print("%-24s %12s %12s %12s %12s %12s %12s" % ("program", "bytecode min", "bytecode med", "tiered min", "tiered med", "jit min", "jit med"))
+
+failed = False
+for file in files:
+    times = {}
+    codes = {}
+    for name, flags in modes:
+        samples = []
+        for _ in range(args.n):
+            elapsed, code = run(file, flags)
+            samples.append(elapsed)
+            codes.setdefault(name, set()).add(code)
+        times[name] = samples
+
+    columns = []
+    for name, _ in modes:
+        columns += [min(times[name])*1000, statistics.median(times[name])*1000]
+
+    note = ""
+    if len(set(frozenset(c) for c in codes.values())) > 1:
+        note = "  exit code mismatch: " + ", ".join("%s %s" % (name, sorted(codes[name])) for name, _ in modes)
+        failed = True
+
+    print("%-24s %10.1fms %10.1fms %10.1fms %10.1fms %10.1fms %10.1fms%s" % (
+        (os.path.basename(file),) + tuple(columns) + (note,)))
+
+sys.exit(1 if failed else 0)